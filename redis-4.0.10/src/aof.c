@@ -632,8 +632,10 @@ struct client *createFakeClient(void) {
     c->name = NULL;
     c->querybuf = sdsempty();
     c->querybuf_peak = 0;
+    c->qb_pos = 0;
     c->argc = 0;
     c->argv = NULL;
+    memset(c->argv_cache,0,sizeof(c->argv_cache));
     c->bufpos = 0;
     c->flags = 0;
     c->btype = BLOCKED_NONE;
@@ -645,7 +647,7 @@ struct client *createFakeClient(void) {
     c->obuf_soft_limit_reached_time = 0;
     c->watched_keys = listCreate();
     c->peerid = NULL;
-    listSetFreeMethod(c->reply,decrRefCountVoid);
+    listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
     initClientMultiState(c);
     return c;
@@ -661,6 +663,7 @@ void freeFakeClientArgv(struct client *c) {
 
 void freeFakeClient(struct client *c) {
     sdsfree(c->querybuf);
+    freeClientArgvCache(c);
     listRelease(c->reply);
     listRelease(c->watched_keys);
     freeClientMultiState(c);
@@ -926,6 +929,24 @@ int rewriteSetObject(rio *r, robj *key, robj *o) {
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
+    } else if (o->encoding == OBJ_ENCODING_ROARING) {
+        roaringIterator ri;
+        int64_t llval;
+
+        roaringInitIterator(o->ptr,&ri);
+        while(roaringNext(&ri,&llval)) {
+            if (count == 0) {
+                int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
+                    AOF_REWRITE_ITEMS_PER_CMD : items;
+
+                if (rioWriteBulkCount(r,'*',2+cmd_items) == 0) return 0;
+                if (rioWriteBulkString(r,"SADD",4) == 0) return 0;
+                if (rioWriteBulkObject(r,key) == 0) return 0;
+            }
+            if (rioWriteBulkLongLong(r,llval) == 0) return 0;
+            if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
+            items--;
+        }
     } else if (o->encoding == OBJ_ENCODING_HT) {
         dictIterator *di = dictGetIterator(o->ptr);
         dictEntry *de;
@@ -1027,12 +1048,12 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
  *
  * The function returns 0 on error, non-zero on success. */
 static int rioWriteHashIteratorCursor(rio *r, hashTypeIterator *hi, int what) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr)
             return rioWriteBulkString(r, (char*)vstr, vlen);
         else
@@ -1071,6 +1092,25 @@ int rewriteHashObject(rio *r, robj *key, robj *o) {
 
     hashTypeReleaseIterator(hi);
 
+    /* Emit an HPEXPIREAT for every field having a TTL. */
+    if (hashTypeHasFieldExpires(o)) {
+        hi = hashTypeInitIterator(o);
+        while (hashTypeNext(hi) != C_ERR) {
+            sds field = hashTypeCurrentFromHashTable(hi,OBJ_HASH_KEY);
+            long long expire = hashTypeGetFieldExpire(o,field);
+
+            if (expire == -1) continue;
+            if (rioWriteBulkCount(r,'*',6) == 0) return 0;
+            if (rioWriteBulkString(r,"HPEXPIREAT",10) == 0) return 0;
+            if (rioWriteBulkObject(r,key) == 0) return 0;
+            if (rioWriteBulkLongLong(r,expire) == 0) return 0;
+            if (rioWriteBulkString(r,"FIELDS",6) == 0) return 0;
+            if (rioWriteBulkLongLong(r,1) == 0) return 0;
+            if (rioWriteBulkString(r,field,sdslen(field)) == 0) return 0;
+        }
+        hashTypeReleaseIterator(hi);
+    }
+
     return 1;
 }
 
@@ -206,6 +206,15 @@ void setproctitle(const char *fmt, ...);
 #endif
 #endif
 
+/* Define HAVE_X86_SIMD if SSE4.2 and AVX2 code paths can be compiled using
+ * the target function attribute, and selected at runtime using the CPU
+ * detection builtins, without building the whole server with -mavx2. */
+#if defined(__x86_64__) && BYTE_ORDER == LITTLE_ENDIAN && \
+    (defined(__clang__) || \
+     (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define HAVE_X86_SIMD 1
+#endif
+
 /* Make sure we can test for ARM just checking for __arm__, since sometimes
  * __arm is defined but __arm__ is not. */
 #if defined(__arm) && !defined(__arm__)
@@ -74,6 +74,14 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
     }
 }
 
+/* Return 1 if 'val' is a hash whose fields all have an elapsed TTL, but were
+ * not deleted yet. */
+static int hashHasOnlyExpiredFields(robj *val) {
+    return val->type == OBJ_HASH &&
+           hashTypeCountExpiredFields(val,hashTypeFieldExpireNow()) ==
+               hashTypeLength(val);
+}
+
 /* Lookup a key for read operations, or return NULL if the key is not found
  * in the specified DB.
  *
@@ -125,6 +133,21 @@ robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
         }
     }
     val = lookupKey(db,key,flags);
+    /* Hash fields with an elapsed TTL are deleted on access as well. */
+    if (val && val->type == OBJ_HASH && hashTypeExpireIfNeeded(db,key,&val))
+        val = NULL;
+    /* The fields not deleted yet, see hashTypeExpireIfNeeded(), are hidden by
+     * the read commands. Like for expired keys in slaves, a hash having only
+     * such fields is reported as missing to read-only commands. */
+    if (val &&
+        server.current_client &&
+        server.current_client != server.master &&
+        server.current_client->cmd &&
+        server.current_client->cmd->flags & CMD_READONLY &&
+        hashHasOnlyExpiredFields(val))
+    {
+        val = NULL;
+    }
     if (val == NULL)
         server.stat_keyspace_misses++;
     else
@@ -144,8 +167,13 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
  * Returns the linked value object if the key exists or NULL if the key
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
+    robj *val;
+
     expireIfNeeded(db,key);
-    return lookupKey(db,key,LOOKUP_NONE);
+    val = lookupKey(db,key,LOOKUP_NONE);
+    if (val && val->type == OBJ_HASH && hashTypeExpireIfNeeded(db,key,&val))
+        val = NULL;
+    return val;
 }
 
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply) {
@@ -160,6 +188,28 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
     return o;
 }
 
+/* Prefetch the main dictionary and expires entries of the keys with the
+ * specified hashes, so that the lookups done next by a command or by a batch
+ * of commands don't stall on a cache miss for every key. */
+void dbPrefetchHashes(redisDb *db, const uint64_t *hashes, int count) {
+    dictPrefetchHashes(db->dict,hashes,count,1);
+    if (dictSize(db->expires)) dictPrefetchHashes(db->expires,hashes,count,0);
+}
+
+/* Prefetch the first DICT_PREFETCH_BATCH keys of the 'keys' array. Commands
+ * looking up many keys call it again every DICT_PREFETCH_BATCH keys, so that
+ * what was prefetched is still in the cache when the key is looked up. */
+void dbPrefetchKeys(redisDb *db, robj **keys, int count) {
+    uint64_t hashes[DICT_PREFETCH_BATCH];
+    int j;
+
+    if (count > DICT_PREFETCH_BATCH) count = DICT_PREFETCH_BATCH;
+    if (count < 2 || dictSize(db->dict) == 0) return;
+    for (j = 0; j < count; j++)
+        hashes[j] = dictGetHash(db->dict,keys[j]->ptr);
+    dbPrefetchHashes(db,hashes,count);
+}
+
 /* Add the key to the DB. It's up to the caller to increment the reference
  * counter of the value if needed.
  *
@@ -170,6 +220,7 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
 
     serverAssertWithInfo(NULL,key,retval == DICT_OK);
     if (val->type == OBJ_LIST) signalListAsReady(db, key);
+    if (val->type == OBJ_HASH) hashTypeIndexFieldExpires(db,key->ptr,val);
     if (server.cluster_enabled) slotToKeyAdd(key);
  }
 
@@ -177,21 +228,30 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
  * count of the new value is up to the caller.
  * This function does not modify the expire time of the existing key.
  *
+ * If the old value is expensive to release, according to the lazy free
+ * policy (see lazyfreeShouldFreeAsync()), it is reclaimed in the background.
+ *
  * The program is aborted if the key was not already present. */
 void dbOverwrite(redisDb *db, robj *key, robj *val) {
     dictEntry *de = dictFind(db->dict,key->ptr);
 
     serverAssertWithInfo(NULL,key,de != NULL);
-    if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-        robj *old = dictGetVal(de);
-        int saved_lru = old->lru;
+    robj *old = dictGetVal(de);
+    int saved_lru = old->lru;
+    if (lazyfreeShouldFreeAsync(old,LAZYFREE_PATH_OVERWRITE)) {
+        /* Set the new value without calling the value destructor, and
+         * let the lazyfree thread release the old one. */
+        dictSetVal(db->dict,de,val);
+        lazyfreeFreeObjectAsync(old,LAZYFREE_PATH_OVERWRITE);
+    } else {
         dictReplace(db->dict, key->ptr, val);
+    }
+    if (val->type == OBJ_HASH) hashTypeIndexFieldExpires(db,key->ptr,val);
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
         val->lru = saved_lru;
         /* LFU should be not only copied but also updated
          * when a key is overwritten. */
         updateLFU(val);
-    } else {
-        dictReplace(db->dict, key->ptr, val);
     }
 }
 
@@ -249,6 +309,7 @@ int dbSyncDelete(redisDb *db, robj *key) {
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
     if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
+    if (dictSize(db->hexpires) > 0) dictDelete(db->hexpires,key->ptr);
     if (dictDelete(db->dict,key->ptr) == DICT_OK) {
         if (server.cluster_enabled) slotToKeyDel(key);
         return 1;
@@ -260,8 +321,7 @@ int dbSyncDelete(redisDb *db, robj *key) {
 /* This is a wrapper whose behavior depends on the Redis lazy free
  * configuration. Deletes the key synchronously or asynchronously. */
 int dbDelete(redisDb *db, robj *key) {
-    return server.lazyfree_lazy_server_del ? dbAsyncDelete(db,key) :
-                                             dbSyncDelete(db,key);
+    return dbLazyDelete(db,key,LAZYFREE_PATH_SERVER_DEL);
 }
 
 /* Prepare the string object stored at 'key' to be modified destructively
@@ -302,6 +362,35 @@ robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o) {
     return o;
 }
 
+/* Values pinned by modules with RedisModule_PinKey() are read by module
+ * threads without any lock, so the main thread must never modify them in
+ * place. The commands call this function after the lookup of a value they
+ * are going to modify (commands like EXPIRE or RENAME, that don't touch the
+ * value itself, don't): if the value has more than a reference, the value
+ * 'o' stored at 'key' is replaced by a private copy that is returned, while
+ * the pinned value is released when the last pin is dropped. The copy has a
+ * single reference, so a pinned value is copied only by the first write
+ * after it was pinned.
+ *
+ * Strings are not copied here since they are shared for other reasons too
+ * (see dbUnshareStringValue()), nor module values, that can't be copied
+ * without changing the semantics of the module type: modules pinning their
+ * own values must synchronize the accesses themselves. */
+robj *dbUnshareValue(redisDb *db, robj *key, robj *o) {
+    if (o->refcount == 1 || o->type == OBJ_STRING || o->type == OBJ_MODULE)
+        return o;
+    switch(o->type) {
+    case OBJ_LIST: o = listTypeDup(o); break;
+    case OBJ_SET: o = setTypeDup(o); break;
+    case OBJ_ZSET: o = zsetDup(o); break;
+    case OBJ_HASH: o = hashTypeDup(o); break;
+    default: serverPanic("Unknown object type");
+    }
+    dbOverwrite(db,key,o);
+    server.stat_unshared_values++;
+    return o;
+}
+
 /* Remove all keys from all the databases in a Redis server.
  * If callback is given the function is called from time to time to
  * signal that work is in progress.
@@ -333,6 +422,7 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         } else {
             dictEmpty(server.db[j].dict,callback);
             dictEmpty(server.db[j].expires,callback);
+            dictEmpty(server.db[j].hexpires,callback);
         }
     }
     if (server.cluster_enabled) {
@@ -439,6 +529,8 @@ void delGenericCommand(client *c, int lazy) {
     int numdel = 0, j;
 
     for (j = 1; j < c->argc; j++) {
+        if ((j-1) % DICT_PREFETCH_BATCH == 0)
+            dbPrefetchKeys(c->db,c->argv+j,c->argc-j);
         expireIfNeeded(c->db,c->argv[j]);
         int deleted  = lazy ? dbAsyncDelete(c->db,c->argv[j]) :
                               dbSyncDelete(c->db,c->argv[j]);
@@ -468,8 +560,16 @@ void existsCommand(client *c) {
     int j;
 
     for (j = 1; j < c->argc; j++) {
+        if ((j-1) % DICT_PREFETCH_BATCH == 0)
+            dbPrefetchKeys(c->db,c->argv+j,c->argc-j);
         expireIfNeeded(c->db,c->argv[j]);
-        if (dbExists(c->db,c->argv[j])) count++;
+        if (!dbExists(c->db,c->argv[j])) continue;
+        /* Hashes having only fields with an elapsed TTL are missing, see
+         * lookupKeyReadWithFlags(). */
+        if (dictSize(c->db->hexpires) &&
+            hashHasOnlyExpiredFields(lookupKey(c->db,c->argv[j],LOOKUP_NOTOUCH)))
+            continue;
+        count++;
     }
     addReplyLongLong(c,count);
 }
@@ -646,7 +746,11 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
      * representation that is not a hash table, we are sure that it is also
      * composed of a small number of elements. So to avoid taking state we
      * just return everything inside the object in a single call, setting the
-     * cursor to zero to signal the end of the iteration. */
+     * cursor to zero to signal the end of the iteration.
+     *
+     * Roaring bitmaps are the exception: they can be big, but their elements
+     * are sorted, so the cursor is simply the next element to return, with
+     * the sign bit flipped so that it is never zero. */
 
     /* Handle the case of a hash table. */
     ht = NULL;
@@ -681,6 +785,18 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         } while (cursor &&
               maxiterations-- &&
               listLength(keys) < (unsigned long)count);
+    } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_ROARING) {
+        roaringIterator ri;
+        int64_t ll;
+
+        roaringInitIterator(o->ptr,&ri);
+        if (cursor) roaringSeek(&ri,(int64_t)((uint64_t)cursor ^ (1ULL<<63)));
+        while (listLength(keys) < (unsigned long)count && roaringNext(&ri,&ll))
+            listAddNodeTail(keys,createStringObjectFromLongLong(ll));
+        if (roaringNext(&ri,&ll))
+            cursor = (unsigned long)((uint64_t)ll ^ (1ULL<<63));
+        else
+            cursor = 0;
     } else if (o->type == OBJ_SET) {
         int pos = 0;
         int64_t ll;
@@ -688,7 +804,21 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         while(intsetGet(o->ptr,pos++,&ll))
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
-    } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET) {
+    } else if (o->type == OBJ_HASH) {
+        unsigned char *p = lpFirst(o->ptr);
+        unsigned char *vstr;
+        unsigned int vlen;
+        long long vll;
+
+        while(p) {
+            lpGetValue(p,&vstr,&vlen,&vll);
+            listAddNodeTail(keys,
+                (vstr != NULL) ? createStringObject((char*)vstr,vlen) :
+                                 createStringObjectFromLongLong(vll));
+            p = lpNext(o->ptr,p);
+        }
+        cursor = 0;
+    } else if (o->type == OBJ_ZSET) {
         unsigned char *p = ziplistIndex(o->ptr,0);
         unsigned char *vstr;
         unsigned int vlen;
@@ -731,6 +861,12 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         /* Filter element if it is an expired key. */
         if (!filter && o == NULL && expireIfNeeded(c->db, kobj)) filter = 1;
 
+        /* Filter element if it is a hash field with an elapsed TTL. Hashes
+         * with field TTLs are hash tables, the fields are sds encoded. */
+        if (!filter && o && o->type == OBJ_HASH &&
+            hashTypeFieldIsExpired(o,kobj->ptr,hashTypeFieldExpireNow()))
+            filter = 1;
+
         /* Remove the element and its associted value if needed. */
         if (filter) {
             decrRefCount(kobj);
@@ -977,10 +1113,12 @@ int dbSwapDatabases(int id1, int id2) {
      * remain in the same DB they were. */
     db1->dict = db2->dict;
     db1->expires = db2->expires;
+    db1->hexpires = db2->hexpires;
     db1->avg_ttl = db2->avg_ttl;
 
     db2->dict = aux.dict;
     db2->expires = aux.expires;
+    db2->hexpires = aux.hexpires;
     db2->avg_ttl = aux.avg_ttl;
 
     /* Now we need to handle clients blocked on lists: as an effect
@@ -1127,7 +1265,8 @@ int expireIfNeeded(redisDb *db, robj *key) {
      * only the first time it is accessed and not in the middle of the
      * script execution, making propagation to slaves / AOF consistent.
      * See issue #1525 on Github for more information. */
-    now = server.lua_caller ? server.lua_time_start : mstime();
+    now = (server.lua_caller && !server.lua_yielding) ?
+          server.lua_time_start : mstime();
 
     /* If we are running in the context of a slave, return ASAP:
      * the slave key expiration is controlled by the master that will
@@ -1146,8 +1285,7 @@ int expireIfNeeded(redisDb *db, robj *key) {
     propagateExpire(db,key,server.lazyfree_lazy_expire);
     notifyKeyspaceEvent(NOTIFY_EXPIRED,
         "expired",key,db->id);
-    return server.lazyfree_lazy_expire ? dbAsyncDelete(db,key) :
-                                         dbSyncDelete(db,key);
+    return dbLazyDelete(db,key,LAZYFREE_PATH_EXPIRE);
 }
 
 /* -----------------------------------------------------------------------------
@@ -1245,6 +1383,31 @@ int *zunionInterGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *nu
     return keys;
 }
 
+/* Helper function to extract keys from following commands:
+ * ZUNION <num-keys> <key> <key> ... <key> <options>
+ * ZINTER <num-keys> <key> <key> ... <key> <options>
+ * ZDIFF <num-keys> <key> <key> ... <key> <options> */
+int *zunionInterDiffGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int i, num, *keys;
+    UNUSED(cmd);
+
+    num = atoi(argv[1]->ptr);
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with syntax error. */
+    if (num < 1 || num > (argc-2)) {
+        *numkeys = 0;
+        return NULL;
+    }
+
+    keys = zmalloc(sizeof(int)*num);
+    *numkeys = num;
+
+    /* Add all key positions for argv[2...n] to keys[] */
+    for (i = 0; i < num; i++) keys[i] = 2+i;
+
+    return keys;
+}
+
 /* Helper function to extract keys from the following commands:
  * EVAL <script> <num-keys> <key> <key> ... <key> [more stuff]
  * EVALSHA <script> <num-keys> <key> <key> ... <key> [more stuff] */
@@ -1269,6 +1432,29 @@ int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys)
     return keys;
 }
 
+/* Helper function to extract keys from the following commands:
+ * SINTERCARD <num-keys> <key> <key> ... <key> [LIMIT <limit>] */
+int *sintercardGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int i, num, *keys;
+    UNUSED(cmd);
+
+    num = atoi(argv[1]->ptr);
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with syntax error. */
+    if (num < 1 || num > (argc-2)) {
+        *numkeys = 0;
+        return NULL;
+    }
+
+    keys = zmalloc(sizeof(int)*num);
+    *numkeys = num;
+
+    /* Add all key positions for argv[2...n] to keys[] */
+    for (i = 0; i < num; i++) keys[i] = 2+i;
+
+    return keys;
+}
+
 /* Helper function to extract keys from the SORT command.
  *
  * SORT <sort-key> ... STORE <store-key> ...
@@ -236,6 +236,13 @@ void computeDatasetDigest(unsigned char *final) {
                     sdsele = hashTypeCurrentObjectNewSds(hi,OBJ_HASH_VALUE);
                     mixDigest(eledigest,sdsele,sdslen(sdsele));
                     sdsfree(sdsele);
+                    /* If the field has an expire, add it to the mix. */
+                    if (hashTypeHasFieldExpires(o)) {
+                        sdsele = hashTypeCurrentObjectNewSds(hi,OBJ_HASH_KEY);
+                        if (hashTypeGetFieldExpire(o,sdsele) != -1)
+                            mixDigest(eledigest,"!!expire!!",10);
+                        sdsfree(sdsele);
+                    }
                     xorDigest(digest,eledigest,20);
                 }
                 hashTypeReleaseIterator(hi);
@@ -293,6 +300,8 @@ void debugCommand(client *c) {
         blen++; addReplyStatus(c,
         "ziplist <key> -- Show low level info about the ziplist encoding.");
         blen++; addReplyStatus(c,
+        "listpack <key> -- Show low level info about the listpack encoding.");
+        blen++; addReplyStatus(c,
         "populate <count> [prefix] [size] -- Create <count> string keys named key:<num>. If a prefix is specified is used instead of the 'key' prefix.");
         blen++; addReplyStatus(c,
         "digest   -- Outputs an hex signature representing the current DB content.");
@@ -449,6 +458,18 @@ void debugCommand(client *c) {
             ziplistRepr(o->ptr);
             addReplyStatus(c,"Ziplist structure printed on stdout");
         }
+    } else if (!strcasecmp(c->argv[1]->ptr,"listpack") && c->argc == 3) {
+        robj *o;
+
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nokeyerr))
+                == NULL) return;
+
+        if (o->encoding != OBJ_ENCODING_LISTPACK) {
+            addReplyError(c,"Not a listpack encoded object.");
+        } else {
+            lpRepr(o->ptr);
+            addReplyStatus(c,"Listpack structure printed on stdout");
+        }
     } else if (!strcasecmp(c->argv[1]->ptr,"populate") &&
                c->argc >= 3 && c->argc <= 5) {
         long keys, j;
@@ -45,6 +45,61 @@
  * pointers are worthwhile moving and which aren't */
 int je_get_defrag_hint(void* ptr, int *bin_util, int *run_util);
 
+/* Fragmentation map of the allocator small size classes, indexed by the
+ * allocation size in 8 bytes units. A size class is hot when the free
+ * regions in its runs are at least active-defrag-threshold-lower percent of
+ * the used ones. Allocations of the other size classes are skipped without
+ * asking jemalloc for the defrag hint, that takes the bin lock, and without
+ * copying them around. */
+#define DEFRAG_MAP_MAX_SIZE (16*1024)
+static unsigned char defrag_hot_size[DEFRAG_MAP_MAX_SIZE/8+1];
+
+/* Rebuild the fragmentation map from the jemalloc bins stats, and flag the
+ * slabs with enough unused space to be defragged. The stats must be fresh,
+ * see getAllocatorFragmentation(). Returns the number of hot size classes
+ * and slabs: with none of them there is nothing the defragger can fix. */
+static int defragUpdateMap(void) {
+    unsigned nbins, narenas, j;
+    size_t usz = sizeof(unsigned), sz = sizeof(size_t), rsz = sizeof(uint32_t);
+    char name[64];
+    zslab *slab;
+    int hot = 0;
+
+    memset(defrag_hot_size,0,sizeof(defrag_hot_size));
+    je_mallctl("arenas.nbins", &nbins, &usz, NULL, 0);
+    je_mallctl("arenas.narenas", &narenas, &usz, NULL, 0);
+    for (j = 0; j < nbins; j++) {
+        size_t size, curregs, curruns, freeregs;
+        uint32_t nregs;
+
+        snprintf(name, sizeof(name), "arenas.bin.%u.size", j);
+        je_mallctl(name, &size, &sz, NULL, 0);
+        if (size > DEFRAG_MAP_MAX_SIZE) break;
+        snprintf(name, sizeof(name), "arenas.bin.%u.nregs", j);
+        je_mallctl(name, &nregs, &rsz, NULL, 0);
+        /* The stats of all the arenas merged are at index 'narenas'. */
+        snprintf(name, sizeof(name), "stats.arenas.%u.bins.%u.curregs", narenas, j);
+        je_mallctl(name, &curregs, &sz, NULL, 0);
+        snprintf(name, sizeof(name), "stats.arenas.%u.bins.%u.curruns", narenas, j);
+        je_mallctl(name, &curruns, &sz, NULL, 0);
+        freeregs = curruns*nregs - curregs;
+        if (curregs &&
+            freeregs*100 >= curregs*server.active_defrag_threshold_lower)
+        {
+            defrag_hot_size[size>>3] = 1;
+            hot++;
+        }
+    }
+    for (slab = zslab_list(); slab; slab = slab->next) {
+        size_t used = slab->used*slab->size;
+        size_t unused = slab->npages*ZSLAB_PAGE_SIZE - used;
+        slab->defrag = used &&
+            unused*100 >= used*server.active_defrag_threshold_lower;
+        hot += slab->defrag;
+    }
+    return hot;
+}
+
 /* Defrag helper for generic allocations.
  *
  * returns NULL in case the allocatoin wasn't moved.
@@ -54,6 +109,12 @@ void* activeDefragAlloc(void *ptr) {
     int bin_util, run_util;
     size_t size;
     void *newptr;
+    /* skip the size classes that are not fragmented. */
+    size = zmalloc_size(ptr);
+    if (size > DEFRAG_MAP_MAX_SIZE || !defrag_hot_size[size>>3]) {
+        server.stat_active_defrag_skipped++;
+        return NULL;
+    }
     if(!je_get_defrag_hint(ptr, &bin_util, &run_util)) {
         server.stat_active_defrag_misses++;
         return NULL;
@@ -68,13 +129,25 @@ void* activeDefragAlloc(void *ptr) {
     /* move this allocation to a new allocation.
      * make sure not to use the thread cache. so that we don't get back the same
      * pointers we try to free */
-    size = zmalloc_size(ptr);
     newptr = zmalloc_no_tcache(size);
     memcpy(newptr, ptr, size);
     zfree_no_tcache(ptr);
     return newptr;
 }
 
+/* Defrag helper for objects allocated from a slab (dictEntry, robj and
+ * quicklistNode), moved to a fuller page of their slab when their page is
+ * less used than the average.
+ *
+ * returns NULL in case the allocation wasn't moved.
+ * when it returns a non-null value, the old pointer was already released
+ * and should NOT be accessed. */
+void* activeDefragSlabAlloc(void *ptr) {
+    void *newptr = zslab_defrag(ptr);
+    if (!newptr) server.stat_active_defrag_misses++;
+    return newptr;
+}
+
 /*Defrag helper for sds strings
  *
  * returns NULL in case the allocatoin wasn't moved.
@@ -103,7 +176,7 @@ robj *activeDefragStringOb(robj* ob, int *defragged) {
 
     /* try to defrag robj (only if not an EMBSTR type (handled below). */
     if (ob->type!=OBJ_STRING || ob->encoding!=OBJ_ENCODING_EMBSTR) {
-        if ((ret = activeDefragAlloc(ob))) {
+        if ((ret = activeDefragSlabAlloc(ob))) {
             ob = ret;
             (*defragged)++;
         }
@@ -121,7 +194,7 @@ robj *activeDefragStringOb(robj* ob, int *defragged) {
             /* The sds is embedded in the object allocation, calculate the
              * offset and update the pointer in the new allocation. */
             long ofs = (intptr_t)ob->ptr - (intptr_t)ob;
-            if ((ret = activeDefragAlloc(ob))) {
+            if ((ret = activeDefragSlabAlloc(ob))) {
                 ret->ptr = (void*)((intptr_t)ret + ofs);
                 (*defragged)++;
             }
@@ -143,7 +216,7 @@ int dictIterDefragEntry(dictIterator *iter) {
     /* Handle the next entry (if there is one), and update the pointer in the
      * current entry. */
     if (iter->nextEntry) {
-        dictEntry *newde = activeDefragAlloc(iter->nextEntry);
+        dictEntry *newde = activeDefragSlabAlloc(iter->nextEntry);
         if (newde) {
             defragged++;
             iter->nextEntry = newde;
@@ -153,7 +226,7 @@ int dictIterDefragEntry(dictIterator *iter) {
     /* handle the case of the first entry in the hash bucket. */
     ht = &iter->d->ht[iter->table];
     if (ht->table[iter->index] == iter->entry) {
-        dictEntry *newde = activeDefragAlloc(iter->entry);
+        dictEntry *newde = activeDefragSlabAlloc(iter->entry);
         if (newde) {
             iter->entry = newde;
             ht->table[iter->index] = newde;
@@ -205,45 +278,35 @@ void zslUpdateNode(zskiplist *zsl, zskiplistNode *oldnode, zskiplistNode *newnod
 }
 
 /* Defrag helper for sorted set.
- * Update the robj pointer, defrag the skiplist struct and return the new score
- * reference. We may not access oldele pointer (not even the pointer stored in
- * the skiplist), as it was already freed. Newele may be null, in which case we
- * only need to defrag the skiplist, but not update the obj pointer.
- * When return value is non-NULL, it is the score reference that must be updated
- * in the dict record. */
-double *zslDefrag(zskiplist *zsl, double score, sds oldele, sds newele) {
+ * Defrag the skiplist node holding the element 'ele' with the specified
+ * score. The element is embedded in the node, so when the node is moved the
+ * new node is returned, and both the key and the score reference stored in
+ * the dict record must be updated. Otherwise NULL is returned. */
+zskiplistNode *zslDefrag(zskiplist *zsl, double score, sds ele) {
     zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x, *newx;
     int i;
-    sds ele = newele? newele: oldele;
 
-    /* find the skiplist node referring to the object that was moved,
-     * and all pointers that need to be updated if we'll end up moving the skiplist node. */
+    /* find the skiplist node referring to the element, and all pointers
+     * that need to be updated if we'll end up moving the skiplist node. */
     x = zsl->header;
     for (i = zsl->level-1; i >= 0; i--) {
         while (x->level[i].forward &&
-            x->level[i].forward->ele != oldele && /* make sure not to access the
-                                                     ->obj pointer if it matches
-                                                     oldele */
+            zslNodeElement(x->level[i].forward) != ele &&
             (x->level[i].forward->score < score ||
                 (x->level[i].forward->score == score &&
-                sdscmp(x->level[i].forward->ele,ele) < 0)))
+                sdscmp(zslNodeElement(x->level[i].forward),ele) < 0)))
             x = x->level[i].forward;
         update[i] = x;
     }
 
-    /* update the robj pointer inside the skip list record. */
     x = x->level[0].forward;
-    serverAssert(x && score == x->score && x->ele==oldele);
-    if (newele)
-        x->ele = newele;
+    serverAssert(x && score == x->score && zslNodeElement(x)==ele);
 
     /* try to defrag the skiplist record itself */
     newx = activeDefragAlloc(x);
-    if (newx) {
+    if (newx)
         zslUpdateNode(zsl, x, newx, update);
-        return &newx->score;
-    }
-    return NULL;
+    return newx;
 }
 
 /* Utility function that replaces an old key pointer in the dictionary with a
@@ -257,7 +320,7 @@ dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sd
     dictEntry **deref = dictFindEntryRefByPtrAndHash(d, oldkey, hash);
     if (deref) {
         dictEntry *de = *deref;
-        dictEntry *newde = activeDefragAlloc(de);
+        dictEntry *newde = activeDefragSlabAlloc(de);
         if (newde) {
             de = *deref = newde;
             (*defragged)++;
@@ -271,7 +334,7 @@ dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sd
 
 /* for each key we scan in the main dict, this function will attempt to defrag
  * all the various pointers it has. Returns a stat of how many pointers were
- * moved. */
+ * moved, that is also accounted to the type of the value. */
 int defragKey(redisDb *db, dictEntry *de) {
     sds keysds = dictGetKey(de);
     robj *newob, *ob;
@@ -302,6 +365,9 @@ int defragKey(redisDb *db, dictEntry *de) {
 
     if (ob->type == OBJ_STRING) {
         /* Already handled in activeDefragStringOb. */
+    } else if (ob->refcount != 1) {
+        /* Pinned by a module (see RM_PinKey()): module threads may be
+         * reading the value, so its allocations can't move. */
     } else if (ob->type == OBJ_LIST) {
         if (ob->encoding == OBJ_ENCODING_QUICKLIST) {
             quicklist *ql = ob->ptr, *newql;
@@ -309,7 +375,7 @@ int defragKey(redisDb *db, dictEntry *de) {
             if ((newql = activeDefragAlloc(ql)))
                 defragged++, ob->ptr = ql = newql;
             while (node) {
-                if ((newnode = activeDefragAlloc(node))) {
+                if ((newnode = activeDefragSlabAlloc(node))) {
                     if (newnode->prev)
                         newnode->prev->next = newnode;
                     else
@@ -348,6 +414,20 @@ int defragKey(redisDb *db, dictEntry *de) {
             intset *newis = activeDefragAlloc(is);
             if (newis)
                 defragged++, ob->ptr = newis;
+        } else if (ob->encoding == OBJ_ENCODING_ROARING) {
+            roaring *r = ob->ptr, *newr;
+            void *newptr;
+            uint32_t j;
+            if ((newr = activeDefragAlloc(r)))
+                defragged++, ob->ptr = r = newr;
+            if ((newptr = activeDefragAlloc(r->keys)))
+                defragged++, r->keys = newptr;
+            if ((newptr = activeDefragAlloc(r->containers)))
+                defragged++, r->containers = newptr;
+            for (j = 0; j < r->len; j++) {
+                if ((newptr = activeDefragAlloc(r->containers[j])))
+                    defragged++, r->containers[j] = newptr;
+            }
         } else {
             serverPanic("Unknown set encoding");
         }
@@ -369,13 +449,12 @@ int defragKey(redisDb *db, dictEntry *de) {
             d = zs->dict;
             di = dictGetIterator(d);
             while((de = dictNext(di)) != NULL) {
-                double* newscore;
+                zskiplistNode *newnode;
                 sds sdsele = dictGetKey(de);
-                if ((newsds = activeDefragSds(sdsele)))
-                    defragged++, de->key = newsds;
-                newscore = zslDefrag(zs->zsl, *(double*)dictGetVal(de), sdsele, newsds);
-                if (newscore) {
-                    dictSetVal(d, de, newscore);
+                newnode = zslDefrag(zs->zsl, *(double*)dictGetVal(de), sdsele);
+                if (newnode) {
+                    de->key = zslNodeElement(newnode);
+                    dictSetVal(d, de, &newnode->score);
                     defragged++;
                 }
                 defragged += dictIterDefragEntry(di);
@@ -386,7 +465,7 @@ int defragKey(redisDb *db, dictEntry *de) {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (ob->type == OBJ_HASH) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_HT) {
@@ -407,11 +486,13 @@ int defragKey(redisDb *db, dictEntry *de) {
             serverPanic("Unknown hash encoding");
         }
     } else if (ob->type == OBJ_MODULE) {
-        /* Currently defragmenting modules private data types
-         * is not supported. */
+        robj keyobj;
+        initStaticStringObject(keyobj,dictGetKey(de));
+        defragged += moduleDefragValue(&keyobj,ob);
     } else {
         serverPanic("Unknown object type");
     }
+    server.stat_active_defrag_type_hits[ob->type] += defragged;
     return defragged;
 }
 
@@ -431,7 +512,7 @@ void defragDictBucketCallback(void *privdata, dictEntry **bucketref) {
     UNUSED(privdata);
     while(*bucketref) {
         dictEntry *de = *bucketref, *newde;
-        if ((newde = activeDefragAlloc(de))) {
+        if ((newde = activeDefragSlabAlloc(de))) {
             *bucketref = newde;
         }
         bucketref = &(*bucketref)->next;
@@ -457,6 +538,9 @@ float getAllocatorFragmentation(size_t *out_frag_bytes) {
     /* Unlike zmalloc_used_memory, this matches the stats.resident by taking
      * into account all allocations done by this process (not only zmalloc). */
     je_mallctl("stats.allocated", &allocated, &sz, NULL, 0);
+    /* The free slots in the slab pages are fragmentation as well, that the
+     * defrag of slab objects can reclaim. */
+    allocated -= zslab_unused_memory();
     float frag_pct = ((float)active / allocated)*100 - 100;
     size_t frag_bytes = active - allocated;
     float rss_pct = ((float)resident / allocated)*100 - 100;
@@ -472,6 +556,28 @@ float getAllocatorFragmentation(size_t *out_frag_bytes) {
 #define INTERPOLATE(x, x1, x2, y1, y2) ( (y1) + ((x)-(x1)) * ((y2)-(y1)) / ((x2)-(x1)) )
 #define LIMIT(y, min, max) ((y)<(min)? min: ((y)>(max)? max: (y)))
 
+/* Time spent in activeDefragCycle(), to tell it apart from the time spent
+ * serving the clients. */
+static long long defrag_usec = 0;
+
+/* Return the percentage of time the server was busy with anything else
+ * than defrag since the previous call: the event loop time not spent
+ * waiting for events nor defragging. */
+static int defragBusyPercentage(void) {
+    static long long prev_time = 0, prev_sleep = 0, prev_defrag = 0;
+    long long now = ustime(), elapsed = now - prev_time;
+    long long idle = (server.el_sleep_usec - prev_sleep) +
+                     (defrag_usec - prev_defrag);
+    int busy_pct = 0;
+
+    if (prev_time && elapsed > 0)
+        busy_pct = LIMIT(100 - idle*100/elapsed, 0, 100);
+    prev_time = now;
+    prev_sleep = server.el_sleep_usec;
+    prev_defrag = defrag_usec;
+    return busy_pct;
+}
+
 /* Perform incremental defragmentation work from the serverCron.
  * This works in a similar way to activeExpireCycle, in the sense that
  * we do incremental work across calls. */
@@ -488,35 +594,59 @@ void activeDefragCycle(void) {
         return; /* Defragging memory while there's a fork will just do damage. */
 
     /* Once a second, check if we the fragmentation justfies starting a scan
-     * or making it more aggressive. */
+     * and adapt its aggressiveness. */
     run_with_period(1000) {
         size_t frag_bytes;
         float frag_pct = getAllocatorFragmentation(&frag_bytes);
+        int busy_pct = defragBusyPercentage();
+        int hot;
+
         /* If we're not already running, and below the threshold, exit. */
         if (!server.active_defrag_running) {
             if(frag_pct < server.active_defrag_threshold_lower || frag_bytes < server.active_defrag_ignore_bytes)
                 return;
         }
 
-        /* Calculate the adaptive aggressiveness of the defrag */
+        /* Find the size classes and slabs worth defragging. When none is
+         * left the rest of the fragmentation is not in small allocations
+         * the scan could move, so stop it. */
+        hot = defragUpdateMap();
+        if (!hot) {
+            if (server.active_defrag_running) {
+                serverLog(LL_VERBOSE,
+                    "Active defrag stopped, no fragmented size class left, frag=%.0f%%, frag_bytes=%zu",
+                    frag_pct, frag_bytes);
+                current_db = -1;
+                cursor = 0;
+                db = NULL;
+                server.active_defrag_running = 0;
+            }
+            return;
+        }
+
+        /* Calculate the adaptive aggressiveness of the defrag from the
+         * fragmentation, then adapt it to the CPU the clients leave: use at
+         * least half of the idle time to converge sooner, and never more
+         * than the idle time not to add latency to the clients. */
         int cpu_pct = INTERPOLATE(frag_pct,
                 server.active_defrag_threshold_lower,
                 server.active_defrag_threshold_upper,
                 server.active_defrag_cycle_min,
                 server.active_defrag_cycle_max);
+        int spare_pct = 100 - busy_pct;
+        if (cpu_pct < spare_pct/2)
+            cpu_pct = spare_pct/2;
+        else if (cpu_pct > spare_pct)
+            cpu_pct = spare_pct;
         cpu_pct = LIMIT(cpu_pct,
                 server.active_defrag_cycle_min,
                 server.active_defrag_cycle_max);
-         /* We allow increasing the aggressiveness during a scan, but don't
-          * reduce it. */
-        if (!server.active_defrag_running ||
-            cpu_pct > server.active_defrag_running)
-        {
-            server.active_defrag_running = cpu_pct;
+        if (!server.active_defrag_running) {
             serverLog(LL_VERBOSE,
-                "Starting active defrag, frag=%.0f%%, frag_bytes=%zu, cpu=%d%%",
-                frag_pct, frag_bytes, cpu_pct);
+                "Starting active defrag, frag=%.0f%%, frag_bytes=%zu, hot size classes=%d, busy=%d%%, cpu=%d%%",
+                frag_pct, frag_bytes, hot, busy_pct, cpu_pct);
         }
+        server.active_defrag_running = cpu_pct;
     }
     if (!server.active_defrag_running)
         return;
@@ -542,6 +672,7 @@ void activeDefragCycle(void) {
                 cursor = 0;
                 db = NULL;
                 server.active_defrag_running = 0;
+                defrag_usec += now - start;
                 return;
             }
             else if (current_db==0) {
@@ -560,7 +691,9 @@ void activeDefragCycle(void) {
              * (if we have a lot of pointers in one hash bucket), check if we
              * reached the tiem limit. */
             if (cursor && (++iterations > 16 || server.stat_active_defrag_hits - defragged > 1000)) {
-                if ((ustime() - start) > timelimit) {
+                long long elapsed = ustime() - start;
+                if (elapsed > timelimit) {
+                    defrag_usec += elapsed;
                     return;
                 }
                 iterations = 0;
@@ -576,4 +709,15 @@ void activeDefragCycle(void) {
     /* Not implemented yet. */
 }
 
+void *activeDefragAlloc(void *ptr) {
+    UNUSED(ptr);
+    return NULL;
+}
+
+robj *activeDefragStringOb(robj *ob, int *defragged) {
+    UNUSED(ob);
+    UNUSED(defragged);
+    return NULL;
+}
+
 #endif
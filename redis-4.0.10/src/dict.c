@@ -62,6 +62,9 @@
 static int dict_can_resize = 1;
 static unsigned int dict_force_resize_ratio = 5;
 
+/* Entries are allocated from a slab, they are all of the same size. */
+static zslab dict_entry_slab = ZSLAB_INIT("dictEntry",sizeof(dictEntry));
+
 /* -------------------------- private prototypes ---------------------------- */
 
 static int _dictExpandIfNeeded(dict *ht);
@@ -307,7 +310,7 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
      * system it is more likely that recently added entries are accessed
      * more frequently. */
     ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
-    entry = zmalloc(sizeof(*entry));
+    entry = zslab_malloc(&dict_entry_slab);
     entry->next = ht->table[index];
     ht->table[index] = entry;
     ht->used++;
@@ -385,7 +388,7 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
                 if (!nofree) {
                     dictFreeKey(d, he);
                     dictFreeVal(d, he);
-                    zfree(he);
+                    zslab_free(he);
                 }
                 d->ht[table].used--;
                 return he;
@@ -435,7 +438,7 @@ void dictFreeUnlinkedEntry(dict *d, dictEntry *he) {
     if (he == NULL) return;
     dictFreeKey(d, he);
     dictFreeVal(d, he);
-    zfree(he);
+    zslab_free(he);
 }
 
 /* Destroy an entire dictionary */
@@ -453,7 +456,7 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
             nextHe = he->next;
             dictFreeKey(d, he);
             dictFreeVal(d, he);
-            zfree(he);
+            zslab_free(he);
             ht->used--;
             he = nextHe;
         }
@@ -501,6 +504,74 @@ void *dictFetchValue(dict *d, const void *key) {
     return he ? dictGetVal(he) : NULL;
 }
 
+#if defined(__GNUC__)
+#define dictPrefetch(addr) __builtin_prefetch(addr)
+#else
+#define dictPrefetch(addr)
+#endif
+
+/* Prefetch what is needed to lookup 'count' keys with the specified hashes,
+ * so that the lookups done later don't stall on cache misses one after the
+ * other. The work is interleaved across the batch in three stages, each one
+ * touching only the memory prefetched by the previous one: first the buckets
+ * of all the keys, then the first entry of every bucket, finally the key of
+ * every such entry and, if 'vals' is true, the value it points to.
+ *
+ * Batches larger than DICT_PREFETCH_BATCH are split, since there is no point
+ * in having more cache misses in flight than the CPU can track. This is only
+ * a hint: the dictionary is not modified. */
+void dictPrefetchHashes(dict *d, const uint64_t *hashes, int count, int vals) {
+    dictEntry *he;
+    int tables, table, j;
+
+    if (dictSize(d) == 0) return;
+    tables = dictIsRehashing(d) ? 2 : 1;
+
+    while (count > DICT_PREFETCH_BATCH) {
+        dictPrefetchHashes(d,hashes,DICT_PREFETCH_BATCH,vals);
+        hashes += DICT_PREFETCH_BATCH;
+        count -= DICT_PREFETCH_BATCH;
+    }
+
+    for (table = 0; table < tables; table++) {
+        dictht *ht = &d->ht[table];
+        for (j = 0; j < count; j++)
+            dictPrefetch(&ht->table[hashes[j] & ht->sizemask]);
+    }
+    for (table = 0; table < tables; table++) {
+        dictht *ht = &d->ht[table];
+        for (j = 0; j < count; j++) {
+            he = ht->table[hashes[j] & ht->sizemask];
+            if (he) dictPrefetch(he);
+        }
+    }
+    for (table = 0; table < tables; table++) {
+        dictht *ht = &d->ht[table];
+        for (j = 0; j < count; j++) {
+            he = ht->table[hashes[j] & ht->sizemask];
+            if (he == NULL) continue;
+            dictPrefetch(he->key);
+            if (vals) dictPrefetch(he->v.val);
+        }
+    }
+}
+
+/* Like dictPrefetchHashes() but computing the hashes of the specified keys
+ * with the hash function of the dictionary. */
+void dictPrefetchKeys(dict *d, const void **keys, int count, int vals) {
+    uint64_t hashes[DICT_PREFETCH_BATCH];
+    int j, batch;
+
+    if (dictSize(d) == 0) return;
+    while (count > 0) {
+        batch = count > DICT_PREFETCH_BATCH ? DICT_PREFETCH_BATCH : count;
+        for (j = 0; j < batch; j++) hashes[j] = dictHashKey(d,keys[j]);
+        dictPrefetchHashes(d,hashes,batch,vals);
+        keys += batch;
+        count -= batch;
+    }
+}
+
 /* A fingerprint is a 64 bit number that represents the state of the dictionary
  * at a given time, it's just a few dict properties xored together.
  * When an unsafe iterator is initialized, we get the dict fingerprint, and check
@@ -1200,6 +1271,33 @@ int main(int argc, char **argv) {
     }
     end_benchmark("Random access of existing elements");
 
+    /* Batches of random keys looked up one after the other, like the keys
+     * of a MGET or of a pipeline, without and with dictPrefetchKeys(). The
+     * difference grows with the size of the dictionary, try 100000000. */
+    for (int prefetch = 0; prefetch <= 1; prefetch++) {
+        sds keys[DICT_PREFETCH_BATCH];
+        int k;
+
+        srand(1234);
+        start_benchmark();
+        for (j = 0; j < count; j += DICT_PREFETCH_BATCH) {
+            for (k = 0; k < DICT_PREFETCH_BATCH; k++)
+                keys[k] = sdsfromlonglong(rand() % count);
+            if (prefetch)
+                dictPrefetchKeys(dict,(const void**)keys,DICT_PREFETCH_BATCH,1);
+            for (k = 0; k < DICT_PREFETCH_BATCH; k++) {
+                dictEntry *de = dictFind(dict,keys[k]);
+                assert(de != NULL);
+                sdsfree(keys[k]);
+            }
+        }
+        if (prefetch) {
+            end_benchmark("Random access in batches (prefetch)");
+        } else {
+            end_benchmark("Random access in batches");
+        }
+    }
+
     start_benchmark();
     for (j = 0; j < count; j++) {
         sds key = sdsfromlonglong(rand() % count);
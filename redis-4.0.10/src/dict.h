@@ -124,6 +124,9 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     4
 
+/* Max number of keys prefetched together by dictPrefetchHashes() */
+#define DICT_PREFETCH_BATCH      16
+
 /* ------------------------------- Macros ------------------------------------*/
 #define dictFreeVal(d, entry) \
     if ((d)->type->valDestructor) \
@@ -209,6 +212,10 @@ void dictRelease(dict *d);
 dictEntry * dictFind(dict *d, const void *key);
 //获取某个节点值
 void *dictFetchValue(dict *d, const void *key);
+//分阶段预取一批hash值对应的桶、节点和键值
+void dictPrefetchHashes(dict *d, const uint64_t *hashes, int count, int vals);
+//计算一批键的hash值并预取
+void dictPrefetchKeys(dict *d, const void **keys, int count, int vals);
 //调整hash大小
 int dictResize(dict *d);
 //获取迭代器
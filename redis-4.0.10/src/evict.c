@@ -48,8 +48,13 @@
  * instead of the idle time, so that we still evict by larger value (larger
  * inverse frequency means to evict keys with the least frequent accesses).
  *
+ * Since the pool survives across freeMemoryIfNeeded() calls, the score of
+ * an entry may become stale if the key is accessed after being sampled:
+ * the score is checked again before evicting the key (see
+ * evictionPoolPopBestKey()).
+ *
  * Empty entries have the key pointer set to NULL. */
-#define EVPOOL_SIZE 16
+#define EVPOOL_SIZE 64
 #define EVPOOL_CACHED_SDS_SIZE 255
 struct evictionPoolEntry {
     unsigned long long idle;    /* Object idle time (inverse frequency for LFU) */
@@ -128,12 +133,19 @@ unsigned long long estimateObjectIdleTime(robj *o) {
  *
  * After the pool is populated, the best key we have in the pool is expired.
  * However note that we don't remove keys from the pool when they are deleted
- * so the pool may contain keys that no longer exist.
+ * so the pool may contain keys that no longer exist, or keys that were
+ * accessed after being sampled, so that their score is no longer valid.
  *
  * When we try to evict a key, and all the entries in the pool don't exist
  * we populate it again. This time we'll be sure that the pool has at least
  * one key that can be evicted, if there is at least one key that can be
- * evicted in the whole database. */
+ * evicted in the whole database.
+ *
+ * The N samples are not taken from every DB: a budget of samples is split
+ * among the DBs proportionally to their size (see evictionPoolSample()), so
+ * that every key has about the same probability of being sampled regardless
+ * of the size of the DB it lives in, and many small DBs don't multiply the
+ * work needed in order to find a good candidate. */
 
 /* Create a new eviction pool. */
 void evictionPoolAlloc(void) {
@@ -150,56 +162,93 @@ void evictionPoolAlloc(void) {
     EvictionPoolLRU = ep;
 }
 
+/* Number of elements sampled by objectComputeSize() in order to estimate
+ * the size of aggregated values for the GDSF policies. */
+#define EVICTION_SIZE_SAMPLES 3
+
+/* Return the eviction score of a key according to the current policy.
+ * 'de' is the entry of the key in the dictionary we sample from (the
+ * expires dictionary for volatile policies), while 'keydict' is the main
+ * dictionary of the DB, used in order to fetch the value object when
+ * sampling from the expires dictionary. */
+static unsigned long long evictionGetScore(dict *sampledict, dict *keydict,
+                                           dictEntry *de)
+{
+    unsigned long long idle;
+    robj *o;
+
+    /* If the dictionary we are sampling from is not the main
+     * dictionary (but the expires one) we need to lookup the key
+     * again in the key dictionary to obtain the value object. */
+    if (server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
+        if (sampledict != keydict) de = dictFind(keydict, dictGetKey(de));
+        o = dictGetVal(de);
+    }
+
+    /* Calculate the idle time according to the policy. This is called
+     * idle just because the code initially handled LRU, but is in fact
+     * just a score where an higher score means better candidate. */
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_LRU) {
+        idle = estimateObjectIdleTime(o);
+    } else if (server.maxmemory_policy & MAXMEMORY_FLAG_SIZE) {
+        /* GreedyDual-Size-Frequency: the value of keeping a key is its
+         * frequency divided by its size, so we evict first the keys with
+         * the greatest size / frequency ratio. The LFU counter provides
+         * both the frequency and the aging, since it decays over time.
+         * The counter is incremented by one so that never accessed keys
+         * are still ordered by size. */
+        size_t size = sdsZmallocSize(dictGetKey(de)) +
+                      objectComputeSize(o,EVICTION_SIZE_SAMPLES);
+        idle = (unsigned long long)size*256/(LFUDecrAndReturn(o)+1);
+    } else if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+        /* When we use an LRU policy, we sort the keys by idle time
+         * so that we expire keys starting from greater idle time.
+         * However when the policy is an LFU one, we have a frequency
+         * estimation, and we want to evict keys with lower frequency
+         * first. So inside the pool we put objects using the inverted
+         * frequency subtracting the actual frequency to the maximum
+         * frequency of 255. */
+        idle = 255-LFUDecrAndReturn(o);
+    } else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
+        /* In this case the sooner the expire the better. */
+        idle = ULLONG_MAX - (long)dictGetVal(de);
+    } else {
+        serverPanic("Unknown eviction policy in evictionGetScore()");
+    }
+    return idle;
+}
+
 /* This is an helper function for freeMemoryIfNeeded(), it is used in order
  * to populate the evictionPool with a few entries every time we want to
- * expire a key. Keys with idle time smaller than one of the current
- * keys are added. Keys are always added if there are free entries.
+ * expire a key. Up to 'count' keys are sampled. Keys with idle time smaller
+ * than one of the current keys are added. Keys are always added if there
+ * are free entries.
  *
  * We insert keys on place in ascending order, so keys with the smaller
  * idle time are on the left, and keys with the higher idle time on the
  * right. */
 
-void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
-    int j, k, count;
-    dictEntry *samples[server.maxmemory_samples];
+void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool, int count) {
+    int j, k;
+    dictEntry *samples[count];
 
-    count = dictGetSomeKeys(sampledict,samples,server.maxmemory_samples);
+    count = dictGetSomeKeys(sampledict,samples,count);
     for (j = 0; j < count; j++) {
         unsigned long long idle;
         sds key;
-        robj *o;
         dictEntry *de;
 
         de = samples[j];
         key = dictGetKey(de);
+        idle = evictionGetScore(sampledict,keydict,de);
 
-        /* If the dictionary we are sampling from is not the main
-         * dictionary (but the expires one) we need to lookup the key
-         * again in the key dictionary to obtain the value object. */
+        /* Track the average score of the sampled keys: since samples are
+         * random, it estimates the score of the whole population, to be
+         * compared with the score of the evicted keys. The score is
+         * meaningless for volatile-ttl, so it is not tracked. */
         if (server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
-            if (sampledict != keydict) de = dictFind(keydict, key);
-            o = dictGetVal(de);
-        }
-
-        /* Calculate the idle time according to the policy. This is called
-         * idle just because the code initially handled LRU, but is in fact
-         * just a score where an higher score means better candidate. */
-        if (server.maxmemory_policy & MAXMEMORY_FLAG_LRU) {
-            idle = estimateObjectIdleTime(o);
-        } else if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-            /* When we use an LRU policy, we sort the keys by idle time
-             * so that we expire keys starting from greater idle time.
-             * However when the policy is an LFU one, we have a frequency
-             * estimation, and we want to evict keys with lower frequency
-             * first. So inside the pool we put objects using the inverted
-             * frequency subtracting the actual frequency to the maximum
-             * frequency of 255. */
-            idle = 255-LFUDecrAndReturn(o);
-        } else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
-            /* In this case the sooner the expire the better. */
-            idle = ULLONG_MAX - (long)dictGetVal(de);
-        } else {
-            serverPanic("Unknown eviction policy in evictionPoolPopulate()");
+            server.stat_eviction_sampled_score += idle;
+            server.stat_eviction_sampled_keys++;
         }
 
         /* Insert the element inside the pool.
@@ -256,6 +305,103 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
     }
 }
 
+/* Sample keys from all the DBs in order to populate the eviction pool.
+ *
+ * A budget of maxmemory-samples keys for every non empty DB (capped to the
+ * pool size, since the pool survives across calls) is split among the DBs
+ * proportionally to the number of keys they hold. Fractional shares are
+ * rounded randomly, so that small DBs are sampled only from time to time,
+ * but every key has the same probability of being sampled.
+ *
+ * Returns the total number of keys that could be evicted, so that the
+ * caller can stop if there is nothing to evict. */
+unsigned long evictionPoolSample(struct evictionPoolEntry *pool) {
+    unsigned long total_keys = 0, keys;
+    int i, nonempty = 0, budget;
+    dict *dict;
+
+    for (i = 0; i < server.dbnum; i++) {
+        dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
+                server.db[i].dict : server.db[i].expires;
+        if ((keys = dictSize(dict)) != 0) {
+            total_keys += keys;
+            nonempty++;
+        }
+    }
+    if (!total_keys) return 0;
+
+    budget = server.maxmemory_samples*nonempty;
+    if (budget > EVPOOL_SIZE) budget = EVPOOL_SIZE;
+    if (budget < server.maxmemory_samples) budget = server.maxmemory_samples;
+
+    for (i = 0; i < server.dbnum; i++) {
+        redisDb *db = server.db+i;
+        double share;
+        int count;
+
+        dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
+                db->dict : db->expires;
+        if ((keys = dictSize(dict)) == 0) continue;
+
+        share = (double)budget*keys/total_keys;
+        count = (int)share;
+        if ((double)random()/RAND_MAX < share-count) count++;
+        if (count) evictionPoolPopulate(i, dict, db->dict, pool, count);
+    }
+    return total_keys;
+}
+
+/* Return the best key to evict from the pool, removing it from the pool,
+ * or NULL if no entry of the pool is a valid candidate, so that the pool
+ * needs to be populated again. On success '*dbid' is set to the DB of the
+ * key.
+ *
+ * Entries referencing keys that no longer exist are discarded. Entries
+ * whose score is now lower than when the key was sampled, because the key
+ * was accessed in the meantime, are discarded as well: the pool is kept
+ * across calls, so without this check recently used keys could be evicted
+ * because of an old sample. */
+sds evictionPoolPopBestKey(struct evictionPoolEntry *pool, int *dbid) {
+    int k;
+
+    /* Go backward from best to worst element to evict. */
+    for (k = EVPOOL_SIZE-1; k >= 0; k--) {
+        redisDb *db;
+        dict *dict;
+        dictEntry *de;
+        unsigned long long idle;
+
+        if (pool[k].key == NULL) continue;
+        db = server.db+pool[k].dbid;
+        dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
+                db->dict : db->expires;
+        de = dictFind(dict,pool[k].key);
+        idle = pool[k].idle;
+
+        /* Remove the entry from the pool. */
+        if (pool[k].key != pool[k].cached)
+            sdsfree(pool[k].key);
+        pool[k].key = NULL;
+        pool[k].idle = 0;
+
+        /* If the key exists, and its score is still valid, is our pick.
+         * Otherwise it is a ghost or a stale entry and we need to try
+         * the next element. */
+        if (de == NULL) continue;
+        if (evictionGetScore(dict,db->dict,de) < idle) {
+            server.stat_eviction_stale_candidates++;
+            continue;
+        }
+        if (server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
+            server.stat_evicted_score += idle;
+            server.stat_evicted_scored_keys++;
+        }
+        *dbid = db->id;
+        return dictGetKey(de);
+    }
+    return NULL;
+}
+
 /* ----------------------------------------------------------------------------
  * LFU (Least Frequently Used) implementation.
 
@@ -369,10 +515,21 @@ size_t freeMemoryGetNotCountedMemory(void) {
     return overhead;
 }
 
-int freeMemoryIfNeeded(void) {
+/* Evict keys, according to the maxmemory policy, until the used memory
+ * (not counting slaves output buffers and AOF buffers) is at or below
+ * 'limit' bytes.
+ *
+ * If 'timelimit' is zero the function is called synchronously before
+ * executing a command, and will try as hard as possible to reach the limit,
+ * including waiting for the lazyfree thread to release memory. Otherwise
+ * the function is called by the background eviction cycle, and returns
+ * after 'timelimit' microseconds even if the limit was not reached.
+ *
+ * C_OK is returned if the limit was reached, otherwise C_ERR. */
+static int freeMemoryToLimit(size_t limit, long long timelimit) {
     size_t mem_reported, mem_used, mem_tofree, mem_freed;
     mstime_t latency, eviction_latency;
-    long long delta;
+    long long delta, start, evicted = 0;
     int slaves = listLength(server.slaves);
 
     /* When clients are paused the dataset should be static not just from the
@@ -383,7 +540,7 @@ int freeMemoryIfNeeded(void) {
     /* Check if we are over the memory usage limit. If we are not, no need
      * to subtract the slaves output buffers. We can just return ASAP. */
     mem_reported = zmalloc_used_memory();
-    if (mem_reported <= server.maxmemory) return C_OK;
+    if (mem_reported <= limit) return C_OK;
 
     /* Remove the size of slaves output buffers and AOF buffer from the
      * count of used memory. */
@@ -392,18 +549,19 @@ int freeMemoryIfNeeded(void) {
     mem_used = (mem_used > overhead) ? mem_used-overhead : 0;
 
     /* Check if we are still over the memory limit. */
-    if (mem_used <= server.maxmemory) return C_OK;
+    if (mem_used <= limit) return C_OK;
 
     /* Compute how much memory we need to free. */
-    mem_tofree = mem_used - server.maxmemory;
+    mem_tofree = mem_used - limit;
     mem_freed = 0;
+    start = ustime();
 
     if (server.maxmemory_policy == MAXMEMORY_NO_EVICTION)
         goto cant_free; /* We need to free memory, but policy forbids. */
 
     latencyStartMonitor(latency);
     while (mem_freed < mem_tofree) {
-        int j, k, i, keys_freed = 0;
+        int j, i, keys_freed = 0;
         static unsigned int next_db = 0;
         sds bestkey = NULL;
         int bestdbid;
@@ -417,50 +575,11 @@ int freeMemoryIfNeeded(void) {
             struct evictionPoolEntry *pool = EvictionPoolLRU;
 
             while(bestkey == NULL) {
-                unsigned long total_keys = 0, keys;
-
                 /* We don't want to make local-db choices when expiring keys,
                  * so to start populate the eviction pool sampling keys from
                  * every DB. */
-                for (i = 0; i < server.dbnum; i++) {
-                    db = server.db+i;
-                    dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
-                            db->dict : db->expires;
-                    if ((keys = dictSize(dict)) != 0) {
-                        evictionPoolPopulate(i, dict, db->dict, pool);
-                        total_keys += keys;
-                    }
-                }
-                if (!total_keys) break; /* No keys to evict. */
-
-                /* Go backward from best to worst element to evict. */
-                for (k = EVPOOL_SIZE-1; k >= 0; k--) {
-                    if (pool[k].key == NULL) continue;
-                    bestdbid = pool[k].dbid;
-
-                    if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) {
-                        de = dictFind(server.db[pool[k].dbid].dict,
-                            pool[k].key);
-                    } else {
-                        de = dictFind(server.db[pool[k].dbid].expires,
-                            pool[k].key);
-                    }
-
-                    /* Remove the entry from the pool. */
-                    if (pool[k].key != pool[k].cached)
-                        sdsfree(pool[k].key);
-                    pool[k].key = NULL;
-                    pool[k].idle = 0;
-
-                    /* If the key exists, is our pick. Otherwise it is
-                     * a ghost and we need to try the next element. */
-                    if (de) {
-                        bestkey = dictGetKey(de);
-                        break;
-                    } else {
-                        /* Ghost... Iterate again. */
-                    }
-                }
+                if (!evictionPoolSample(pool)) break; /* No keys to evict. */
+                bestkey = evictionPoolPopBestKey(pool,&bestdbid);
             }
         }
 
@@ -500,20 +619,19 @@ int freeMemoryIfNeeded(void) {
              * we only care about memory used by the key space. */
             delta = (long long) zmalloc_used_memory();
             latencyStartMonitor(eviction_latency);
-            if (server.lazyfree_lazy_eviction)
-                dbAsyncDelete(db,keyobj);
-            else
-                dbSyncDelete(db,keyobj);
+            dbLazyDelete(db,keyobj,LAZYFREE_PATH_EVICTION);
             latencyEndMonitor(eviction_latency);
             latencyAddSampleIfNeeded("eviction-del",eviction_latency);
             latencyRemoveNestedEvent(latency,eviction_latency);
             delta -= (long long) zmalloc_used_memory();
             mem_freed += delta;
             server.stat_evictedkeys++;
+            if (timelimit) server.stat_evictedkeys_background++;
             notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
                 keyobj, db->id);
             decrRefCount(keyobj);
             keys_freed++;
+            evicted++;
 
             /* When the memory to free starts to be big enough, we may
              * start spending so much time here that is impossible to
@@ -526,16 +644,26 @@ int freeMemoryIfNeeded(void) {
              * are deleting objects in another thread, it's better to
              * check, from time to time, if we already reached our target
              * memory, since the "mem_freed" amount is computed only
-             * across the dbAsyncDelete() call, while the thread can
+             * across the dbLazyDelete() call, while the thread can
              * release the memory all the time. */
-            if (server.lazyfree_lazy_eviction && !(keys_freed % 16)) {
+            if ((server.lazyfree_lazy_eviction || server.lazyfree_auto_effort)
+                && !(evicted % 16))
+            {
                 overhead = freeMemoryGetNotCountedMemory();
                 mem_used = zmalloc_used_memory();
                 mem_used = (mem_used > overhead) ? mem_used-overhead : 0;
-                if (mem_used <= server.maxmemory) {
+                if (mem_used <= limit) {
                     mem_freed = mem_tofree;
                 }
             }
+
+            /* The background eviction cycle has a time limit: stop if
+             * we reached it, we'll continue at the next cycle. */
+            if (timelimit && !(evicted % 16) && ustime()-start > timelimit) {
+                latencyEndMonitor(latency);
+                latencyAddSampleIfNeeded("eviction-cycle",latency);
+                return C_ERR;
+            }
         }
 
         if (!keys_freed) {
@@ -546,9 +674,17 @@ int freeMemoryIfNeeded(void) {
     }
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("eviction-cycle",latency);
+    if (!timelimit) {
+        server.stat_eviction_sync_calls++;
+        server.stat_eviction_sync_usec += ustime()-start;
+    }
     return C_OK;
 
 cant_free:
+    /* The background eviction cycle never blocks waiting for memory: the
+     * synchronous path will handle it if needed. */
+    if (timelimit) return C_ERR;
+
     /* We are here if we are not able to reclaim memory. There is only one
      * last thing we can try: check if the lazyfree thread has jobs in queue
      * and wait... */
@@ -557,6 +693,47 @@ cant_free:
             break;
         usleep(1000);
     }
+    server.stat_eviction_sync_calls++;
+    server.stat_eviction_sync_usec += ustime()-start;
     return C_ERR;
 }
 
+/* freeMemoryIfNeeded() is called before executing commands: free memory
+ * synchronously in order to stay under the maxmemory limit. If background
+ * eviction is enabled this is just a fallback for when the background
+ * cycle can't keep up with the writes. */
+int freeMemoryIfNeeded(void) {
+    return freeMemoryToLimit(server.maxmemory,0);
+}
+
+/* Background eviction: when maxmemory-eviction-lowwater is set, evict keys
+ * from serverCron() in order to keep the used memory below the low water
+ * mark, a percentage of maxmemory, so that commands rarely need to pay the
+ * eviction cost inline when a burst of writes happens near the limit.
+ *
+ * Every call uses at most BACKGROUND_EVICTION_CYCLE_TIME_PERC percent of
+ * the CPU time between two cron calls. After every cycle the distance from
+ * the low water mark is stored as the eviction lag. */
+#define BACKGROUND_EVICTION_CYCLE_TIME_PERC 25
+void backgroundEvictionCycle(void) {
+    size_t limit, mem_used, overhead;
+    long long timelimit;
+
+    if (!server.maxmemory || !server.maxmemory_eviction_lowwater ||
+        server.maxmemory_policy == MAXMEMORY_NO_EVICTION)
+    {
+        server.stat_eviction_lag = 0;
+        return;
+    }
+
+    limit = (double)server.maxmemory/100*server.maxmemory_eviction_lowwater;
+    timelimit = 1000000*BACKGROUND_EVICTION_CYCLE_TIME_PERC/server.hz/100;
+    if (timelimit <= 0) timelimit = 1;
+    freeMemoryToLimit(limit,timelimit);
+
+    overhead = freeMemoryGetNotCountedMemory();
+    mem_used = zmalloc_used_memory();
+    mem_used = (mem_used > overhead) ? mem_used-overhead : 0;
+    server.stat_eviction_lag = (mem_used > limit) ? mem_used-limit : 0;
+}
+
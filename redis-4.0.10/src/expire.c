@@ -58,10 +58,7 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
         robj *keyobj = createStringObject(key,sdslen(key));
 
         propagateExpire(db,keyobj,server.lazyfree_lazy_expire);
-        if (server.lazyfree_lazy_expire)
-            dbAsyncDelete(db,keyobj);
-        else
-            dbSyncDelete(db,keyobj);
+        dbLazyDelete(db,keyobj,LAZYFREE_PATH_EXPIRE);
         notifyKeyspaceEvent(NOTIFY_EXPIRED,
             "expired",keyobj,db->id);
         decrRefCount(keyobj);
@@ -72,6 +69,33 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
     }
 }
 
+/* Like activeExpireCycleTryExpire() but for the 'db->hexpires' entry 'de',
+ * that references a hash having fields with a TTL: up to
+ * ACTIVE_EXPIRE_CYCLE_FIELDS_PER_LOOKUP expired fields of the hash are
+ * deleted. Entries referencing keys that are no longer hashes with field
+ * TTLs are removed.
+ *
+ * Returns 1 if at least a field was expired, otherwise 0. */
+int activeExpireCycleTryExpireFields(redisDb *db, dictEntry *de, long long now) {
+    long long t = dictGetSignedIntegerVal(de);
+    if (now > t) {
+        sds key = dictGetKey(de);
+        robj *keyobj = createStringObject(key,sdslen(key));
+        robj *o = lookupKey(db,keyobj,LOOKUP_NOTOUCH);
+        long expired = 0;
+
+        if (o == NULL || o->type != OBJ_HASH || !hashTypeHasFieldExpires(o))
+            dictDelete(db->hexpires,key);
+        else
+            expired = hashTypeExpireFields(db,keyobj,o,now,
+                ACTIVE_EXPIRE_CYCLE_FIELDS_PER_LOOKUP);
+        decrRefCount(keyobj);
+        return expired != 0;
+    } else {
+        return 0;
+    }
+}
+
 /* Try to expire a few timed out keys. The algorithm used is adaptive and
  * will use few CPU cycles if there are few expiring keys, otherwise
  * it will get more aggressive to avoid that too much memory is used by
@@ -227,6 +251,35 @@ void activeExpireCycle(int type) {
             /* We don't repeat the cycle if there are less than 25% of keys
              * found expired in the current DB. */
         } while (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4);
+
+        /* Then expire the hash fields with a TTL in the same way, sampling
+         * the hashes indexed in db->hexpires. */
+        while (!timelimit_exit && dictSize(db->hexpires) > 0) {
+            unsigned long num = dictSize(db->hexpires);
+            long long now = mstime();
+            iteration++;
+
+            if (num > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP)
+                num = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
+
+            expired = 0;
+            while (num--) {
+                dictEntry *de;
+
+                if ((de = dictGetRandomKey(db->hexpires)) == NULL) break;
+                if (activeExpireCycleTryExpireFields(db,de,now)) expired++;
+            }
+
+            if ((iteration & 0xf) == 0) { /* check once every 16 iterations. */
+                elapsed = ustime()-start;
+                if (elapsed > timelimit) {
+                    timelimit_exit = 1;
+                    server.stat_expired_time_cap_reached_count++;
+                    break;
+                }
+            }
+            if (expired <= ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4) break;
+        }
     }
 
     elapsed = ustime()-start;
@@ -427,8 +480,7 @@ void expireGenericCommand(client *c, long long basetime, int unit) {
     if (when <= mstime() && !server.loading && !server.masterhost) {
         robj *aux;
 
-        int deleted = server.lazyfree_lazy_expire ? dbAsyncDelete(c->db,key) :
-                                                    dbSyncDelete(c->db,key);
+        int deleted = dbLazyDelete(c->db,key,LAZYFREE_PATH_EXPIRE);
         serverAssertWithInfo(c,key,deleted);
         server.dirty++;
 
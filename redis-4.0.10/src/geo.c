@@ -269,7 +269,7 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
         }
 
         while (ln) {
-            sds ele = ln->ele;
+            sds ele = zslNodeElement(ln);
             /* Abort when the node is no longer in range. */
             if (!zslValueLteMax(ln->score, &range))
                 break;
@@ -651,8 +651,7 @@ void georadiusGeneric(client *c, int flags) {
 
             if (maxelelen < elelen) maxelelen = elelen;
             znode = zslInsert(zs->zsl,score,gp->member);
-            serverAssert(dictAdd(zs->dict,gp->member,&znode->score) == DICT_OK);
-            gp->member = NULL;
+            serverAssert(dictAdd(zs->dict,zslNodeElement(znode),&znode->score) == DICT_OK);
         }
 
         if (returned_items) {
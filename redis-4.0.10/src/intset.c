@@ -35,6 +35,10 @@
 #include "zmalloc.h"
 #include "endianconv.h"
 
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
 /* Note that these encodings are ordered, so:
  * INTSET_ENC_INT16 < INTSET_ENC_INT32 < INTSET_ENC_INT64. */
 #define INTSET_ENC_INT16 (sizeof(int16_t))
@@ -108,6 +112,154 @@ static intset *intsetResize(intset *is, uint32_t len) {
     return is;
 }
 
+/* Create an empty intset with room for 'maxlen' elements, with the encoding
+ * needed by the values in the 'min'..'max' range. It is filled in order with
+ * intsetAppend(), without reallocations, and intsetTrim() then releases the
+ * room that was not used. */
+intset *intsetNewPresized(uint32_t maxlen, int64_t min, int64_t max) {
+    uint8_t enc = _intsetValueEncoding(min);
+    intset *is;
+
+    if (_intsetValueEncoding(max) > enc) enc = _intsetValueEncoding(max);
+    is = zmalloc(sizeof(intset)+(size_t)maxlen*enc);
+    is->encoding = intrev32ifbe(enc);
+    is->length = 0;
+    return is;
+}
+
+/* Append 'value' to an intset created with intsetNewPresized(). The value
+ * must be in the range the intset was created for and greater than its last
+ * element, and the intset must have room for it. */
+void intsetAppend(intset *is, int64_t value) {
+    uint32_t len = intrev32ifbe(is->length);
+
+    _intsetSet(is,len,value);
+    is->length = intrev32ifbe(len+1);
+}
+
+/* Release the room reserved by intsetNewPresized() and not used. */
+intset *intsetTrim(intset *is) {
+    return intsetResize(is,intrev32ifbe(is->length));
+}
+
+/* Search kernels.
+ *
+ * When the CPU supports it, intsetSearch() only uses the binary search to
+ * narrow the range to a window of INTSET_SIMD_WINDOW bytes, and then counts
+ * how many elements of the window are smaller than the searched value using
+ * SIMD compares. Since the elements are sorted, this count is the position
+ * of the value (or where it should be inserted). Scanning a small window
+ * linearly is faster than the last steps of the binary search, that are
+ * dominated by unpredictable branches.
+ *
+ * The kernel is picked at runtime the first time it is needed, so that the
+ * same binary runs on CPUs without AVX2 or SSE4.2, falling back to the plain
+ * binary search. */
+#define INTSET_SIMD_WINDOW 256
+
+#define INTSET_KERNEL_SCALAR 0
+#define INTSET_KERNEL_SSE42 1
+#define INTSET_KERNEL_AVX2 2
+static int intset_kernel = -1;
+
+#ifdef HAVE_X86_SIMD
+/* Return the number of the 'n' elements of encoding 'enc' starting at 'p'
+ * that are smaller than 'value', that must be representable with 'enc'.
+ * The elements must be sorted, so we can stop at the first vector that
+ * contains an element greater or equal to 'value'. */
+__attribute__((target("sse4.2,popcnt")))
+static uint32_t intsetCountLessSSE42(const void *p, uint32_t n, uint8_t enc, int64_t value) {
+    uint32_t i = 0, count = 0;
+    unsigned int mask;
+
+    if (enc == INTSET_ENC_INT16) {
+        const int16_t *a = p;
+        __m128i v = _mm_set1_epi16((int16_t)value);
+        for (; i+8 <= n; i += 8) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(a+i));
+            mask = _mm_movemask_epi8(_mm_cmpgt_epi16(v,x));
+            count += __builtin_popcount(mask) >> 1;
+            if (mask != 0xffff) return count;
+        }
+        for (; i < n && a[i] < value; i++) count++;
+    } else if (enc == INTSET_ENC_INT32) {
+        const int32_t *a = p;
+        __m128i v = _mm_set1_epi32((int32_t)value);
+        for (; i+4 <= n; i += 4) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(a+i));
+            mask = _mm_movemask_epi8(_mm_cmpgt_epi32(v,x));
+            count += __builtin_popcount(mask) >> 2;
+            if (mask != 0xffff) return count;
+        }
+        for (; i < n && a[i] < value; i++) count++;
+    } else {
+        const int64_t *a = p;
+        __m128i v = _mm_set1_epi64x(value);
+        for (; i+2 <= n; i += 2) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(a+i));
+            mask = _mm_movemask_epi8(_mm_cmpgt_epi64(v,x));
+            count += __builtin_popcount(mask) >> 3;
+            if (mask != 0xffff) return count;
+        }
+        for (; i < n && a[i] < value; i++) count++;
+    }
+    return count;
+}
+
+/* Like intsetCountLessSSE42() but comparing 32 bytes at a time. */
+__attribute__((target("avx2,popcnt")))
+static uint32_t intsetCountLessAVX2(const void *p, uint32_t n, uint8_t enc, int64_t value) {
+    uint32_t i = 0, count = 0;
+    unsigned int mask;
+
+    if (enc == INTSET_ENC_INT16) {
+        const int16_t *a = p;
+        __m256i v = _mm256_set1_epi16((int16_t)value);
+        for (; i+16 <= n; i += 16) {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+            mask = _mm256_movemask_epi8(_mm256_cmpgt_epi16(v,x));
+            count += __builtin_popcount(mask) >> 1;
+            if (mask != 0xffffffff) return count;
+        }
+        for (; i < n && a[i] < value; i++) count++;
+    } else if (enc == INTSET_ENC_INT32) {
+        const int32_t *a = p;
+        __m256i v = _mm256_set1_epi32((int32_t)value);
+        for (; i+8 <= n; i += 8) {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+            mask = _mm256_movemask_epi8(_mm256_cmpgt_epi32(v,x));
+            count += __builtin_popcount(mask) >> 2;
+            if (mask != 0xffffffff) return count;
+        }
+        for (; i < n && a[i] < value; i++) count++;
+    } else {
+        const int64_t *a = p;
+        __m256i v = _mm256_set1_epi64x(value);
+        for (; i+4 <= n; i += 4) {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+            mask = _mm256_movemask_epi8(_mm256_cmpgt_epi64(v,x));
+            count += __builtin_popcount(mask) >> 3;
+            if (mask != 0xffffffff) return count;
+        }
+        for (; i < n && a[i] < value; i++) count++;
+    }
+    return count;
+}
+#endif
+
+/* Select the best search kernel supported by this CPU. */
+static void intsetSelectSearchKernel(void) {
+    intset_kernel = INTSET_KERNEL_SCALAR;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        intset_kernel = INTSET_KERNEL_AVX2;
+    else if (__builtin_cpu_supports("sse4.2") &&
+             __builtin_cpu_supports("popcnt"))
+        intset_kernel = INTSET_KERNEL_SSE42;
+#endif
+}
+
 /* Search for the position of "value". Return 1 when the value was found and
  * sets "pos" to the position of the value within the intset. Return 0 when
  * the value is not present in the intset and sets "pos" to the position
@@ -132,6 +284,41 @@ static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
         }
     }
 
+#ifdef HAVE_X86_SIMD
+    if (intset_kernel == -1) intsetSelectSearchKernel();
+    if (intset_kernel != INTSET_KERNEL_SCALAR) {
+        uint8_t enc = intrev32ifbe(is->encoding);
+        int window = INTSET_SIMD_WINDOW/enc;
+        uint32_t count;
+
+        /* Binary search until the range fits the window. */
+        while(max-min+1 > window) {
+            mid = ((unsigned int)min + (unsigned int)max) >> 1;
+            cur = _intsetGet(is,mid);
+            if (value > cur) {
+                min = mid+1;
+            } else if (value < cur) {
+                max = mid-1;
+            } else {
+                if (pos) *pos = mid;
+                return 1;
+            }
+        }
+
+        /* All the elements before 'min' are smaller than 'value', so 'min'
+         * plus the smaller elements inside the window is the position. */
+        if (intset_kernel == INTSET_KERNEL_AVX2)
+            count = intsetCountLessAVX2(is->contents+min*enc,max-min+1,
+                                        enc,value);
+        else
+            count = intsetCountLessSSE42(is->contents+min*enc,max-min+1,
+                                         enc,value);
+        mid = min+count;
+        if (pos) *pos = mid;
+        return mid <= max && _intsetGet(is,mid) == value;
+    }
+#endif
+
     while(max >= min) {
         mid = ((unsigned int)min + (unsigned int)max) >> 1;
         cur = _intsetGet(is,mid);
@@ -256,6 +443,44 @@ uint8_t intsetFind(intset *is, int64_t value) {
     return valenc <= intrev32ifbe(is->encoding) && intsetSearch(is,value,NULL);
 }
 
+/* Return the position of the first element greater than or equal to
+ * 'value', only looking at the elements starting at position 'from'. When
+ * all those elements are smaller the intset length is returned.
+ *
+ * The search gallops forward from 'from' before switching to a binary
+ * search, so probing an intset with increasing values costs O(log(distance))
+ * per call: merging a small sorted sequence against a big intset is
+ * O(N*log(M/N)) instead of O(N*log(M)) with intsetFind(). */
+uint32_t intsetSeek(intset *is, uint32_t from, int64_t value) {
+    uint32_t len = intrev32ifbe(is->length);
+    uint8_t enc = intrev32ifbe(is->encoding);
+    uint64_t lo = from, hi, mid, step = 1;
+
+    if (from >= len || _intsetGetEncoded(is,from,enc) >= value) return from;
+
+    /* Here the element at 'lo' is always smaller than 'value'. */
+    while(1) {
+        hi = lo+step;
+        if (hi >= len) {
+            hi = len;
+            break;
+        }
+        if (_intsetGetEncoded(is,hi,enc) >= value) break;
+        lo = hi;
+        step <<= 1;
+    }
+
+    /* The first element >= value is in the (lo,hi] range. */
+    while(hi-lo > 1) {
+        mid = lo+(hi-lo)/2;
+        if (_intsetGetEncoded(is,mid,enc) < value)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return hi;
+}
+
 /* Return random member */
 int64_t intsetRandom(intset *is) {
     return _intsetGet(is,rand()%intrev32ifbe(is->length));
@@ -348,6 +573,12 @@ static void checkConsistency(intset *is) {
     }
 }
 
+static const char *intset_kernel_name[] = {"scalar","sse4.2","avx2"};
+
+/* The benchmark stores its results here so that they are not optimized
+ * away. */
+static volatile uint32_t benchmark_sink;
+
 #define UNUSED(x) (void)(x)
 int intsetTest(int argc, char **argv) {
     uint8_t success;
@@ -458,6 +689,23 @@ int intsetTest(int argc, char **argv) {
         ok();
     }
 
+    printf("Presized appends: "); {
+        is = intsetNewPresized(100,-5,70000);
+        assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT32);
+        for (i = -5; i < 70000; i += 1000) intsetAppend(is,i);
+        is = intsetTrim(is);
+        assert(intsetLen(is) == 71);
+        assert(intsetBlobLen(is) == sizeof(intset)+71*INTSET_ENC_INT32);
+        assert(intsetFind(is,-5) && intsetFind(is,69995));
+        checkConsistency(is);
+        zfree(is);
+
+        is = intsetTrim(intsetNewPresized(10,0,0));
+        assert(intsetLen(is) == 0);
+        zfree(is);
+        ok();
+    }
+
     printf("Stress lookups: "); {
         long num = 100000, size = 10000;
         int i, bits = 20;
@@ -471,6 +719,104 @@ int intsetTest(int argc, char **argv) {
                num,size,usec()-start);
     }
 
+    printf("Search kernels agree with the binary search: "); {
+        int kernel, j, k, bits[] = {12,28,60}, sizes[] = {1,3,17,64,257,5000};
+
+        intsetSelectSearchKernel();
+        kernel = intset_kernel;
+        for (i = 0; i < 3; i++) {
+            for (j = 0; j < 6; j++) {
+                int64_t mask = ((int64_t)1<<bits[i])-1;
+                is = intsetNew();
+                for (k = 0; k < sizes[j]; k++) {
+                    int64_t v = (((int64_t)rand()<<31)^rand()) & mask;
+                    is = intsetAdd(is,v-mask/2,NULL);
+                }
+                checkConsistency(is);
+                for (k = 0; k < 2000; k++) {
+                    int64_t v;
+                    uint32_t pos1, pos2;
+                    uint8_t found1, found2;
+
+                    /* Search both elements and random values. */
+                    if (k & 1)
+                        intsetGet(is,rand() % intsetLen(is),&v);
+                    else
+                        v = ((((int64_t)rand()<<31)^rand()) & mask)-mask/2;
+                    intset_kernel = INTSET_KERNEL_SCALAR;
+                    found1 = intsetSearch(is,v,&pos1);
+                    intset_kernel = kernel;
+                    found2 = intsetSearch(is,v,&pos2);
+                    assert(found1 == found2 && pos1 == pos2);
+                }
+                zfree(is);
+            }
+        }
+        printf("OK (%s)\n", intset_kernel_name[kernel]);
+    }
+
+    printf("Benchmark intsetSearch kernels:\n"); {
+        int kernel, maxkernel, j, k, num = 1000000;
+        int bits[] = {14,30,62}, sizes[] = {16,128,512,4096};
+        int64_t *values = zmalloc(sizeof(int64_t)*num);
+        long long start, elapsed;
+
+        intsetSelectSearchKernel();
+        maxkernel = intset_kernel;
+        for (i = 0; i < 3; i++) {
+            for (j = 0; j < 4; j++) {
+                int64_t mask = ((int64_t)1<<bits[i])-1;
+                is = intsetNew();
+                while (intsetLen(is) < (uint32_t)sizes[j]) {
+                    int64_t v = (((int64_t)rand()<<31)^rand()) & mask;
+                    is = intsetAdd(is,v,NULL);
+                }
+                for (k = 0; k < num; k++)
+                    values[k] = (((int64_t)rand()<<31)^rand()) & mask;
+                printf("  int%d, %5d elements:", bits[i]+2, sizes[j]);
+                for (kernel = 0; kernel <= maxkernel; kernel++) {
+                    uint32_t found = 0;
+                    intset_kernel = kernel;
+                    start = usec();
+                    for (k = 0; k < num; k++)
+                        found += intsetSearch(is,values[k],NULL);
+                    elapsed = usec()-start;
+                    printf(" %s %.1f ns", intset_kernel_name[kernel],
+                        (double)elapsed*1000/num);
+                    benchmark_sink = found;
+                }
+                printf("\n");
+                zfree(is);
+            }
+        }
+        intset_kernel = maxkernel;
+        zfree(values);
+    }
+
+    printf("intsetSeek agrees with intsetSearch: "); {
+        int i, j;
+        uint32_t pos, from;
+        int64_t v;
+
+        for (i = 0; i < 3; i++) {
+            is = createSet(i == 0 ? 16 : (i == 1 ? 32 : 64),2000);
+            for (j = 0; j < 20000; j++) {
+                /* Search both elements and random values. */
+                if (rand() % 2)
+                    v = _intsetGet(is,rand()%intrev32ifbe(is->length));
+                else
+                    v = (i == 0) ? rand() % 32768 : rand();
+                intsetSearch(is,v,&pos);
+                from = rand() % (pos+1);
+                assert(intsetSeek(is,from,v) == pos);
+                assert(intsetSeek(is,pos+1,v) == pos+1);
+            }
+            assert(intsetSeek(is,0,INT64_MAX) == intrev32ifbe(is->length));
+            zfree(is);
+        }
+        ok();
+    }
+
     printf("Stress add+delete: "); {
         int i, v1, v2;
         is = intsetNew();
@@ -39,9 +39,13 @@ typedef struct intset {
 } intset;
 
 intset *intsetNew(void);
+intset *intsetNewPresized(uint32_t maxlen, int64_t min, int64_t max);
+void intsetAppend(intset *is, int64_t value);
+intset *intsetTrim(intset *is);
 intset *intsetAdd(intset *is, int64_t value, uint8_t *success);
 intset *intsetRemove(intset *is, int64_t value, int *success);
 uint8_t intsetFind(intset *is, int64_t value);
+uint32_t intsetSeek(intset *is, uint32_t from, int64_t value);
 int64_t intsetRandom(intset *is);
 uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value);
 uint32_t intsetLen(const intset *is);
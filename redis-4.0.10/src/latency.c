@@ -59,20 +59,36 @@ dictType latencyTimeSeriesDictType = {
 /* ------------------------- Utility functions ------------------------------ */
 
 #ifdef __linux__
-/* Returns 1 if Transparent Huge Pages support is enabled in the kernel.
- * Otherwise (or if we are unable to check) 0 is returned. */
-int THPIsEnabled(void) {
-    char buf[1024];
-
+/* Read the Transparent Huge Pages mode, like "always [madvise] never", into
+ * 'buf'. Returns 0 if we are unable to read it. */
+static int THPReadMode(char *buf, size_t len) {
     FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled","r");
     if (!fp) return 0;
-    if (fgets(buf,sizeof(buf),fp) == NULL) {
+    if (fgets(buf,len,fp) == NULL) {
         fclose(fp);
         return 0;
     }
     fclose(fp);
+    return 1;
+}
+
+/* Returns 1 if Transparent Huge Pages support is enabled in the kernel.
+ * Otherwise (or if we are unable to check) 0 is returned. */
+int THPIsEnabled(void) {
+    char buf[1024];
+
+    if (!THPReadMode(buf,sizeof(buf))) return 0;
     return (strstr(buf,"[never]") == NULL) ? 1 : 0;
 }
+
+/* Returns 1 if Transparent Huge Pages are used for all the memory, and not
+ * only for the regions requesting them with madvise(). */
+int THPIsAlways(void) {
+    char buf[1024];
+
+    if (!THPReadMode(buf,sizeof(buf))) return 0;
+    return (strstr(buf,"[always]") != NULL) ? 1 : 0;
+}
 #endif
 
 /* Report the amount of AnonHugePages in smap, in bytes. If the return
@@ -380,8 +396,9 @@ sds createLatencyReport(void) {
     }
     dictReleaseIterator(di);
 
-    /* Add non event based advices. */
-    if (THPGetAnonHugePagesSize() > 0) {
+    /* Add non event based advices. Huge pages are expected when the huge
+     * pages layout is enabled. */
+    if (!server.hugepage_layout && THPGetAnonHugePagesSize() > 0) {
         advise_disable_thp = 1;
         advices++;
     }
@@ -64,6 +64,7 @@ struct latencyStats {
 void latencyMonitorInit(void);
 void latencyAddSample(char *event, mstime_t latency);
 int THPIsEnabled(void);
+int THPIsAlways(void);
 
 /* Latency monitoring macros. */
 
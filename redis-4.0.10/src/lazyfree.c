@@ -27,7 +27,10 @@ size_t lazyfreeGetPendingObjectsCount(void) {
  * elements.
  *
  * For lists the funciton returns the number of elements in the quicklist
- * representing the list. */
+ * representing the list.
+ *
+ * For module values the effort is reported by the free_effort method of
+ * the module type, if any. */
 size_t lazyfreeGetFreeEffort(robj *obj) {
     if (obj->type == OBJ_LIST) {
         quicklist *ql = obj->ptr;
@@ -35,26 +38,86 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
     } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_HT) {
         dict *ht = obj->ptr;
         return dictSize(ht);
+    } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_ROARING) {
+        return roaringContainers(obj->ptr);
     } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_SKIPLIST){
         zset *zs = obj->ptr;
         return zs->zsl->length;
     } else if (obj->type == OBJ_HASH && obj->encoding == OBJ_ENCODING_HT) {
         dict *ht = obj->ptr;
         return dictSize(ht);
+    } else if (obj->type == OBJ_MODULE) {
+        moduleValue *mv = obj->ptr;
+        if (mv->type->free_effort) return mv->type->free_effort(mv->value);
+        return 1;
     } else {
         return 1; /* Everything else is a single allocation. */
     }
 }
 
-/* Delete a key, value, and associated expiration entry if any, from the DB.
- * If there are enough allocations to free the value object may be put into
- * a lazy free list instead of being freed synchronously. The lazy free list
- * will be reclaimed in a different bio.c thread. */
+/* If releasing an object requires more than LAZYFREE_THRESHOLD units of
+ * work (see lazyfreeGetFreeEffort()) and lazy freeing is enabled for the
+ * path releasing it, the object is reclaimed in the background. */
 #define LAZYFREE_THRESHOLD 64
-int dbAsyncDelete(redisDb *db, robj *key) {
+
+/* Return non zero if the lazyfree-lazy-* option covering the specified
+ * path is enabled. LAZYFREE_PATH_USER is used by UNLINK, FLUSHALL ASYNC and
+ * similar commands where the user explicitly asked for a lazy free. */
+static int lazyfreePathIsLazy(int path) {
+    switch(path) {
+    case LAZYFREE_PATH_USER: return 1;
+    case LAZYFREE_PATH_SERVER_DEL: return server.lazyfree_lazy_server_del;
+    case LAZYFREE_PATH_EXPIRE: return server.lazyfree_lazy_expire;
+    case LAZYFREE_PATH_EVICTION: return server.lazyfree_lazy_eviction;
+    case LAZYFREE_PATH_OVERWRITE: return server.lazyfree_lazy_server_del;
+    default: return 0;
+    }
+}
+
+/* Return non zero if the object 'val', released by the specified path,
+ * should be freed by the lazyfree thread instead of synchronously.
+ *
+ * An object is freed lazily if the lazyfree-lazy-* option covering the
+ * path is enabled and the free effort is above LAZYFREE_THRESHOLD, or, no
+ * matter what the path is, if lazyfree-auto-effort is non zero and the
+ * free effort is above it.
+ *
+ * Note that if the object is shared, to reclaim it now it is not
+ * possible. This rarely happens, however sometimes the implementation
+ * of parts of the Redis core may call incrRefCount() to protect
+ * objects, and then call dbDelete(). In this case the object is never
+ * reported as lazy freeable, and the caller will just decrement its
+ * reference count. */
+int lazyfreeShouldFreeAsync(robj *val, int path) {
+    if (val->refcount != 1) return 0;
+
+    size_t free_effort = lazyfreeGetFreeEffort(val);
+    if (lazyfreePathIsLazy(path) && free_effort > LAZYFREE_THRESHOLD)
+        return 1;
+    if (server.lazyfree_auto_effort &&
+        free_effort > (size_t)server.lazyfree_auto_effort) return 1;
+    return 0;
+}
+
+/* Queue the object 'val' in the lazy free list. The caller should make sure
+ * the object is no longer referenced by the keyspace. 'path' is only used
+ * in order to update the per path lazy free stats. */
+void lazyfreeFreeObjectAsync(robj *val, int path) {
+    atomicIncr(lazyfree_objects,1);
+    server.stat_lazyfree_objects[path]++;
+    bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
+}
+
+/* Delete a key, value, and associated expiration entry if any, from the DB.
+ * If there are enough allocations to free, and the lazy free policy for
+ * the specified path allows it (see lazyfreeShouldFreeAsync()), the value
+ * object is put into a lazy free list instead of being freed synchronously.
+ * The lazy free list will be reclaimed in a different bio.c thread. */
+int dbLazyDelete(redisDb *db, robj *key, int path) {
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
     if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
+    if (dictSize(db->hexpires) > 0) dictDelete(db->hexpires,key->ptr);
 
     /* If the value is composed of a few allocations, to free in a lazy way
      * is actually just slower... So under a certain limit we just free
@@ -62,19 +125,11 @@ int dbAsyncDelete(redisDb *db, robj *key) {
     dictEntry *de = dictUnlink(db->dict,key->ptr);
     if (de) {
         robj *val = dictGetVal(de);
-        size_t free_effort = lazyfreeGetFreeEffort(val);
 
         /* If releasing the object is too much work, do it in the background
-         * by adding the object to the lazy free list.
-         * Note that if the object is shared, to reclaim it now it is not
-         * possible. This rarely happens, however sometimes the implementation
-         * of parts of the Redis core may call incrRefCount() to protect
-         * objects, and then call dbDelete(). In this case we'll fall
-         * through and reach the dictFreeUnlinkedEntry() call, that will be
-         * equivalent to just calling decrRefCount(). */
-        if (free_effort > LAZYFREE_THRESHOLD && val->refcount == 1) {
-            atomicIncr(lazyfree_objects,1);
-            bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
+         * by adding the object to the lazy free list. */
+        if (lazyfreeShouldFreeAsync(val,path)) {
+            lazyfreeFreeObjectAsync(val,path);
             dictSetVal(db->dict,de,NULL);
         }
     }
@@ -90,6 +145,35 @@ int dbAsyncDelete(redisDb *db, robj *key) {
     }
 }
 
+/* Delete a key as requested by the user with UNLINK and similar commands:
+ * big values are always freed in the background. */
+int dbAsyncDelete(redisDb *db, robj *key) {
+    return dbLazyDelete(db,key,LAZYFREE_PATH_USER);
+}
+
+/* Release the references the keyspace dictionary 'd' holds to values that
+ * are referenced elsewhere as well, setting them to NULL in the dictionary.
+ *
+ * The lazyfree thread can't release references to values pinned by modules,
+ * since the main thread may release the pins at the same time, and reference
+ * counts are not atomic. While any value is pinned, emptyDbAsync() calls this
+ * function to release them in the main thread: this only costs a scan of the
+ * keyspace, the values themselves are still freed in the background. */
+static void lazyfreeReleaseSharedValues(dict *d) {
+    dictIterator *di = dictGetIterator(d);
+    dictEntry *de;
+
+    while ((de = dictNext(di)) != NULL) {
+        robj *val = dictGetVal(de);
+
+        if (val->refcount == 1 || val->refcount == OBJ_SHARED_REFCOUNT)
+            continue;
+        decrRefCount(val);
+        dictSetVal(d,de,NULL);
+    }
+    dictReleaseIterator(di);
+}
+
 /* Empty a Redis DB asynchronously. What the function does actually is to
  * create a new empty set of hash tables and scheduling the old ones for
  * lazy freeing. */
@@ -97,8 +181,12 @@ void emptyDbAsync(redisDb *db) {
     dict *oldht1 = db->dict, *oldht2 = db->expires;
     db->dict = dictCreate(&dbDictType,NULL);
     db->expires = dictCreate(&keyptrDictType,NULL);
+    if (moduleCountPinnedKeys()) lazyfreeReleaseSharedValues(oldht1);
     atomicIncr(lazyfree_objects,dictSize(oldht1));
     bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,oldht2);
+    /* The hash field expires index only references keys: it is small
+     * compared to the keyspace and is emptied synchronously. */
+    dictEmpty(db->hexpires,NULL);
 }
 
 /* Empty the slots-keys map of Redis CLuster by creating a new empty one
@@ -0,0 +1,1161 @@
+/* Listpack -- A lists of strings serialization format
+ *
+ * This file implements the specification you can find at:
+ *
+ *  https://github.com/antirez/listpack
+ *
+ * The listpack is a specially encoded dually linked list that is designed
+ * to be very memory efficient, like the ziplist. However, unlike the ziplist,
+ * every entry stores its own length at the end of the entry (the "backlen")
+ * instead of the length of the previous entry. This way inserting or
+ * deleting an entry never requires to update the entries that follow it,
+ * so there is no equivalent of the ziplist cascading update that can turn
+ * a single insertion into O(N^2) work.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * LISTPACK OVERALL LAYOUT
+ * =======================
+ *
+ * <tot-bytes> <num-elements> <element-1> ... <element-N> <listpack-end-byte>
+ *
+ * <tot-bytes> is an unsigned 32 bit integer holding the total amount of bytes
+ * of the listpack, header included, stored in little endian.
+ *
+ * <num-elements> is an unsigned 16 bit integer holding the number of elements.
+ * When the number of elements is 65535 or greater, the field is set to 65535
+ * and we need to scan the whole listpack in order to count them.
+ *
+ * <listpack-end-byte> is a single byte set to 255 (LP_EOF).
+ *
+ * LISTPACK ENTRIES
+ * ================
+ *
+ * Every element is encoded as:
+ *
+ * <encoding-type><element-data><element-tot-len>
+ *
+ * Elements that can be represented as integers are stored as integers,
+ * using the smallest of the following encodings:
+ *
+ * |0xxxxxxx| 7 bit unsigned integer (0-127), no additional data.
+ * |110xxxxx|yyyyyyyy| 13 bit signed integer.
+ * |11110001|... 16 bit signed integer (2 bytes follow).
+ * |11110010|... 24 bit signed integer (3 bytes follow).
+ * |11110011|... 32 bit signed integer (4 bytes follow).
+ * |11110100|... 64 bit signed integer (8 bytes follow).
+ *
+ * Other elements are stored as strings:
+ *
+ * |10xxxxxx| string up to 63 bytes, the length is in the encoding byte.
+ * |1110xxxx|yyyyyyyy| string up to 4095 bytes.
+ * |11110000|... 32 bit length (4 bytes follow), then the string.
+ *
+ * All the multi byte integers and lengths are stored in little endian.
+ *
+ * <element-tot-len> is the total length of <encoding-type> plus
+ * <element-data>, encoded in a variable number of bytes that are parsed
+ * right to left: every byte holds 7 bits of the length, and the most
+ * significant bit is set if there are more bytes on the left. This makes
+ * possible to traverse the listpack from right to left.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "listpack.h"
+#include "zmalloc.h"
+#include "util.h"
+#include "redisassert.h"
+
+#define LP_HDR_SIZE 6       /* 32 bit total len + 16 bit number of elements. */
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_BACKLEN_SIZE 5
+#define LP_ENCODING_INT 0
+#define LP_ENCODING_STRING 1
+
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_IS_7BIT_UINT(byte) (((byte)&LP_ENCODING_7BIT_UINT_MASK)==LP_ENCODING_7BIT_UINT)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_IS_6BIT_STR(byte) (((byte)&LP_ENCODING_6BIT_STR_MASK)==LP_ENCODING_6BIT_STR)
+
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_IS_13BIT_INT(byte) (((byte)&LP_ENCODING_13BIT_INT_MASK)==LP_ENCODING_13BIT_INT)
+
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_IS_12BIT_STR(byte) (((byte)&LP_ENCODING_12BIT_STR_MASK)==LP_ENCODING_12BIT_STR)
+
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_16BIT_INT_MASK 0xFF
+#define LP_ENCODING_IS_16BIT_INT(byte) (((byte)&LP_ENCODING_16BIT_INT_MASK)==LP_ENCODING_16BIT_INT)
+
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_24BIT_INT_MASK 0xFF
+#define LP_ENCODING_IS_24BIT_INT(byte) (((byte)&LP_ENCODING_24BIT_INT_MASK)==LP_ENCODING_24BIT_INT)
+
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_32BIT_INT_MASK 0xFF
+#define LP_ENCODING_IS_32BIT_INT(byte) (((byte)&LP_ENCODING_32BIT_INT_MASK)==LP_ENCODING_32BIT_INT)
+
+#define LP_ENCODING_64BIT_INT 0xF4
+#define LP_ENCODING_64BIT_INT_MASK 0xFF
+#define LP_ENCODING_IS_64BIT_INT(byte) (((byte)&LP_ENCODING_64BIT_INT_MASK)==LP_ENCODING_64BIT_INT)
+
+#define LP_ENCODING_32BIT_STR 0xF0
+#define LP_ENCODING_32BIT_STR_MASK 0xFF
+#define LP_ENCODING_IS_32BIT_STR(byte) (((byte)&LP_ENCODING_32BIT_STR_MASK)==LP_ENCODING_32BIT_STR)
+
+#define LP_EOF 0xFF
+
+#define LP_ENCODING_6BIT_STR_LEN(p) ((p)[0] & 0x3F)
+#define LP_ENCODING_12BIT_STR_LEN(p) ((((p)[0] & 0xF) << 8) | (p)[1])
+#define LP_ENCODING_32BIT_STR_LEN(p) (((uint32_t)(p)[1]<<0) | \
+                                      ((uint32_t)(p)[2]<<8) | \
+                                      ((uint32_t)(p)[3]<<16) | \
+                                      ((uint32_t)(p)[4]<<24))
+
+#define lpGetTotalBytes(p)           (((uint32_t)(p)[0]<<0) | \
+                                      ((uint32_t)(p)[1]<<8) | \
+                                      ((uint32_t)(p)[2]<<16) | \
+                                      ((uint32_t)(p)[3]<<24))
+
+#define lpGetNumElements(p)          (((uint32_t)(p)[4]<<0) | \
+                                      ((uint32_t)(p)[5]<<8))
+#define lpSetTotalBytes(p,v) do { \
+    (p)[0] = (v)&0xff; \
+    (p)[1] = ((v)>>8)&0xff; \
+    (p)[2] = ((v)>>16)&0xff; \
+    (p)[3] = ((v)>>24)&0xff; \
+} while(0)
+
+#define lpSetNumElements(p,v) do { \
+    (p)[4] = (v)&0xff; \
+    (p)[5] = ((v)>>8)&0xff; \
+} while(0)
+
+/* Create a new, empty listpack.
+ * On success the new listpack is returned, otherwise an error is returned. */
+unsigned char *lpNew(void) {
+    unsigned char *lp = zmalloc(LP_HDR_SIZE+1);
+    lpSetTotalBytes(lp,LP_HDR_SIZE+1);
+    lpSetNumElements(lp,0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+}
+
+/* Free the specified listpack. */
+void lpFree(unsigned char *lp) {
+    zfree(lp);
+}
+
+/* Encode the integer 'v' in the buffer 'intenc', setting '*enclen' to the
+ * number of bytes used. */
+static void lpEncodeInteger(int64_t v, unsigned char *intenc, uint64_t *enclen) {
+    if (v >= 0 && v <= 127) {
+        /* Single byte 0-127 integer. */
+        intenc[0] = v;
+        *enclen = 1;
+    } else if (v >= -4096 && v <= 4095) {
+        /* 13 bit integer. */
+        if (v < 0) v = ((int64_t)1<<13)+v;
+        intenc[0] = (v>>8)|LP_ENCODING_13BIT_INT;
+        intenc[1] = v&0xff;
+        *enclen = 2;
+    } else if (v >= -32768 && v <= 32767) {
+        /* 16 bit integer. */
+        if (v < 0) v = ((int64_t)1<<16)+v;
+        intenc[0] = LP_ENCODING_16BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = v>>8;
+        *enclen = 3;
+    } else if (v >= -8388608 && v <= 8388607) {
+        /* 24 bit integer. */
+        if (v < 0) v = ((int64_t)1<<24)+v;
+        intenc[0] = LP_ENCODING_24BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = v>>16;
+        *enclen = 4;
+    } else if (v >= -2147483648LL && v <= 2147483647LL) {
+        /* 32 bit integer. */
+        if (v < 0) v = ((int64_t)1<<32)+v;
+        intenc[0] = LP_ENCODING_32BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = (v>>16)&0xff;
+        intenc[4] = v>>24;
+        *enclen = 5;
+    } else {
+        /* 64 bit integer. */
+        uint64_t uv = v;
+        intenc[0] = LP_ENCODING_64BIT_INT;
+        intenc[1] = uv&0xff;
+        intenc[2] = (uv>>8)&0xff;
+        intenc[3] = (uv>>16)&0xff;
+        intenc[4] = (uv>>24)&0xff;
+        intenc[5] = (uv>>32)&0xff;
+        intenc[6] = (uv>>40)&0xff;
+        intenc[7] = (uv>>48)&0xff;
+        intenc[8] = uv>>56;
+        *enclen = 9;
+    }
+}
+
+/* Given an element 'ele' of size 'size', determine if the element can be
+ * represented inside the listpack encoded as integer, and returns
+ * LP_ENCODING_INT if so. Otherwise returns LP_ENCODING_STRING if no integer
+ * encoding is possible.
+ *
+ * If the LP_ENCODING_INT is returned, the function stores the integer encoded
+ * representation of the element in the 'intenc' buffer.
+ *
+ * Regardless of the returned encoding, 'enclen' is populated by reference to
+ * the number of bytes that the string or integer encoded element will require
+ * in order to be represented. */
+static int lpEncodeGetType(unsigned char *ele, uint32_t size, unsigned char *intenc, uint64_t *enclen) {
+    long long v;
+    if (size <= 20 && string2ll((char*)ele,size,&v)) {
+        lpEncodeInteger(v,intenc,enclen);
+        return LP_ENCODING_INT;
+    } else {
+        if (size < 64) *enclen = 1+size;
+        else if (size < 4096) *enclen = 2+size;
+        else *enclen = 5+size;
+        return LP_ENCODING_STRING;
+    }
+}
+
+/* Store a reverse-encoded variable length field, representing the length
+ * of the previous element of size 'l', in the target buffer 'buf'.
+ * The function returns the number of bytes used to encode it, from
+ * 1 to 5. If 'buf' is NULL the function just returns the number of bytes
+ * needed in order to encode the backlen. */
+static unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+    if (l <= 127) {
+        if (buf) buf[0] = l;
+        return 1;
+    } else if (l < 16383) {
+        if (buf) {
+            buf[0] = l>>7;
+            buf[1] = (l&127)|128;
+        }
+        return 2;
+    } else if (l < 2097151) {
+        if (buf) {
+            buf[0] = l>>14;
+            buf[1] = ((l>>7)&127)|128;
+            buf[2] = (l&127)|128;
+        }
+        return 3;
+    } else if (l < 268435455) {
+        if (buf) {
+            buf[0] = l>>21;
+            buf[1] = ((l>>14)&127)|128;
+            buf[2] = ((l>>7)&127)|128;
+            buf[3] = (l&127)|128;
+        }
+        return 4;
+    } else {
+        if (buf) {
+            buf[0] = l>>28;
+            buf[1] = ((l>>21)&127)|128;
+            buf[2] = ((l>>14)&127)|128;
+            buf[3] = ((l>>7)&127)|128;
+            buf[4] = (l&127)|128;
+        }
+        return 5;
+    }
+}
+
+/* Decode the backlen and returns it. If the encoding looks invalid (more than
+ * 5 bytes are used), UINT64_MAX is returned to report the problem. */
+static uint64_t lpDecodeBacklen(unsigned char *p) {
+    uint64_t val = 0;
+    uint64_t shift = 0;
+    do {
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+        if (shift > 28) return UINT64_MAX;
+    } while (1);
+    return val;
+}
+
+/* Encode the string element pointed by 's' of size 'len' in the target
+ * buffer 'buf'. The function should be called with 'buf' having always
+ * enough space for encoding the string. This is done by calling
+ * lpEncodeGetType() before calling this function. */
+static void lpEncodeString(unsigned char *buf, unsigned char *s, uint32_t len) {
+    if (len < 64) {
+        buf[0] = len | LP_ENCODING_6BIT_STR;
+        memcpy(buf+1,s,len);
+    } else if (len < 4096) {
+        buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+        buf[1] = len & 0xff;
+        memcpy(buf+2,s,len);
+    } else {
+        buf[0] = LP_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+        memcpy(buf+5,s,len);
+    }
+}
+
+/* Return the encoded length of the listpack element pointed by 'p'. This
+ * includes the encoding byte, length bytes, and the element data itself,
+ * but not the backlen. */
+static uint32_t lpCurrentEncodedSize(unsigned char *p) {
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+    if (LP_ENCODING_IS_6BIT_STR(p[0])) return 1+LP_ENCODING_6BIT_STR_LEN(p);
+    if (LP_ENCODING_IS_13BIT_INT(p[0])) return 2;
+    if (LP_ENCODING_IS_16BIT_INT(p[0])) return 3;
+    if (LP_ENCODING_IS_24BIT_INT(p[0])) return 4;
+    if (LP_ENCODING_IS_32BIT_INT(p[0])) return 5;
+    if (LP_ENCODING_IS_64BIT_INT(p[0])) return 9;
+    if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2+LP_ENCODING_12BIT_STR_LEN(p);
+    if (LP_ENCODING_IS_32BIT_STR(p[0])) return 5+LP_ENCODING_32BIT_STR_LEN(p);
+    if (p[0] == LP_EOF) return 1;
+    return 0;
+}
+
+/* Skip the current entry returning the next. It is invalid to call this
+ * function if the current element is the EOF element at the end of the
+ * listpack, however, while this function is used to implement lpNext(),
+ * it does not return NULL when the EOF element is encountered. */
+static unsigned char *lpSkip(unsigned char *p) {
+    unsigned long entrylen = lpCurrentEncodedSize(p);
+    entrylen += lpEncodeBacklen(NULL,entrylen);
+    p += entrylen;
+    return p;
+}
+
+/* If 'p' points to an element of the listpack, calling lpNext() will return
+ * the pointer to the next element (the one on the right), or NULL if 'p'
+ * already pointed to the last element of the listpack. */
+unsigned char *lpNext(unsigned char *lp, unsigned char *p) {
+    ((void) lp); /* lp is only used by the debugging assertions. */
+    p = lpSkip(p);
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* If 'p' points to an element of the listpack, calling lpPrev() will return
+ * the pointer to the previous element (the one on the left), or NULL if 'p'
+ * already pointed to the first element of the listpack. */
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p) {
+    if (p-lp == LP_HDR_SIZE) return NULL;
+    p--; /* Seek the first backlen byte of the last element. */
+    uint64_t prevlen = lpDecodeBacklen(p);
+    prevlen += lpEncodeBacklen(NULL,prevlen);
+    return p-prevlen+1; /* Seek the first byte of the previous entry. */
+}
+
+/* Return a pointer to the first element of the listpack, or NULL if the
+ * listpack has no elements. */
+unsigned char *lpFirst(unsigned char *lp) {
+    lp += LP_HDR_SIZE; /* Skip the header. */
+    if (lp[0] == LP_EOF) return NULL;
+    return lp;
+}
+
+/* Return a pointer to the last element of the listpack, or NULL if the
+ * listpack has no elements. */
+unsigned char *lpLast(unsigned char *lp) {
+    unsigned char *p = lp+lpGetTotalBytes(lp)-1; /* Seek EOF element. */
+    return lpPrev(lp,p); /* Will return NULL if EOF is the only element. */
+}
+
+/* Return the number of elements inside the listpack. This function attempts
+ * to use the cached value when within range, otherwise a full scan is
+ * needed. As a side effect of calling this function, the listpack header
+ * could be modified, because if the count is found to be already within
+ * the 'numele' header field range, the new value is set. */
+uint32_t lpLength(unsigned char *lp) {
+    uint32_t numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+
+    /* Too many elements inside the listpack. We need to scan in order
+     * to get the total number. */
+    uint32_t count = 0;
+    unsigned char *p = lpFirst(lp);
+    while(p) {
+        count++;
+        p = lpNext(lp,p);
+    }
+
+    /* If the count is again within range of the header numele field,
+     * set it. */
+    if (count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,count);
+    return count;
+}
+
+/* Decode the element pointed by 'p'. If the element is an integer, its value
+ * is stored in '*val' and 1 is returned. Otherwise the element is a string:
+ * 0 is returned, '*strp' is set to the string and '*val' to its length. */
+static int lpDecode(unsigned char *p, int64_t *val, unsigned char **strp) {
+    uint64_t uval, negstart, negmax;
+
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) {
+        negstart = UINT64_MAX; /* 7 bit ints are always positive. */
+        negmax = 0;
+        uval = p[0] & 0x7f;
+    } else if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+        *val = LP_ENCODING_6BIT_STR_LEN(p);
+        *strp = p+1;
+        return 0;
+    } else if (LP_ENCODING_IS_13BIT_INT(p[0])) {
+        uval = ((p[0]&0x1f)<<8) | p[1];
+        negstart = (uint64_t)1<<12;
+        negmax = 8191;
+    } else if (LP_ENCODING_IS_16BIT_INT(p[0])) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8;
+        negstart = (uint64_t)1<<15;
+        negmax = UINT16_MAX;
+    } else if (LP_ENCODING_IS_24BIT_INT(p[0])) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16;
+        negstart = (uint64_t)1<<23;
+        negmax = UINT32_MAX>>8;
+    } else if (LP_ENCODING_IS_32BIT_INT(p[0])) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 |
+               (uint64_t)p[4]<<24;
+        negstart = (uint64_t)1<<31;
+        negmax = UINT32_MAX;
+    } else if (LP_ENCODING_IS_64BIT_INT(p[0])) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 |
+               (uint64_t)p[4]<<24 |
+               (uint64_t)p[5]<<32 |
+               (uint64_t)p[6]<<40 |
+               (uint64_t)p[7]<<48 |
+               (uint64_t)p[8]<<56;
+        negstart = (uint64_t)1<<63;
+        negmax = UINT64_MAX;
+    } else if (LP_ENCODING_IS_12BIT_STR(p[0])) {
+        *val = LP_ENCODING_12BIT_STR_LEN(p);
+        *strp = p+2;
+        return 0;
+    } else if (LP_ENCODING_IS_32BIT_STR(p[0])) {
+        *val = LP_ENCODING_32BIT_STR_LEN(p);
+        *strp = p+5;
+        return 0;
+    } else {
+        uval = 12345678900000000ULL + p[0];
+        negstart = UINT64_MAX;
+        negmax = 0;
+    }
+
+    /* We reach this code path only for integer encodings.
+     * Convert the unsigned value to the signed one using two's complement
+     * rule. */
+    if (uval >= negstart) {
+        /* This three steps conversion should avoid undefined behaviors
+         * in the unsigned -> signed conversion. */
+        uval = negmax-uval;
+        *val = uval;
+        *val = -(*val)-1;
+    } else {
+        *val = uval;
+    }
+    return 1;
+}
+
+/* Return the listpack element pointed by 'p'.
+ *
+ * The function changes behavior depending on the passed 'intbuf' value.
+ * Specifically, if 'intbuf' is NULL:
+ *
+ * If the element is internally encoded as an integer, the function returns
+ * NULL and populates the integer value by reference in 'count'. Otherwise if
+ * the element is encoded as a string a pointer to the string (pointing inside
+ * the listpack itself) is returned, and 'count' is set to the length of the
+ * string.
+ *
+ * If instead 'intbuf' points to a buffer passed by the caller, that must be
+ * at least LP_INTBUF_SIZE bytes, the function always returns the element as
+ * it was a string (returning the pointer to the string and setting the
+ * 'count' argument to the string length by reference). However if the element
+ * is encoded as an integer, the 'intbuf' buffer is used in order to store
+ * the string representation. */
+unsigned char *lpGet(unsigned char *p, int64_t *count, unsigned char *intbuf) {
+    int64_t val;
+    unsigned char *str;
+
+    if (lpDecode(p,&val,&str)) {
+        if (intbuf) {
+            *count = ll2string((char*)intbuf,LP_INTBUF_SIZE,(long long)val);
+            return intbuf;
+        } else {
+            *count = val;
+            return NULL;
+        }
+    }
+    *count = val;
+    return str;
+}
+
+/* Like ziplistGet(): get the element pointed by 'p'. If the element is a
+ * string '*vstr' is set to the string (pointing inside the listpack) and
+ * '*vlen' to its length, otherwise '*vstr' is set to NULL and '*vll' to the
+ * integer value. Returns 0 if 'p' is NULL or points to the end of the
+ * listpack, otherwise 1. */
+unsigned int lpGetValue(unsigned char *p, unsigned char **vstr, unsigned int *vlen, long long *vll) {
+    int64_t val;
+    unsigned char *str;
+
+    if (p == NULL || p[0] == LP_EOF) return 0;
+    if (lpDecode(p,&val,&str)) {
+        if (vstr) *vstr = NULL;
+        if (vll) *vll = val;
+    } else {
+        if (vstr) *vstr = str;
+        if (vlen) *vlen = val;
+    }
+    return 1;
+}
+
+/* Insert, delete or replace the specified element 'ele' of length 'len' at
+ * the specified position 'p', with 'p' being a listpack element pointer
+ * obtained with lpFirst(), lpLast(), lpNext(), lpPrev() or lpSeek().
+ *
+ * The element is inserted before, after, or replaces the element pointed
+ * by 'p' depending on the 'where' argument, that can be LP_BEFORE, LP_AFTER
+ * or LP_REPLACE.
+ *
+ * If 'ele' is set to NULL, the function removes the element pointed by 'p'
+ * instead of inserting one.
+ *
+ * Returns NULL on out of memory or when the listpack total length would exceed
+ * the max allowed size of 2^32-1, otherwise the new pointer to the listpack
+ * holding the new element is returned (and the old pointer passed is no longer
+ * considered valid)
+ *
+ * If 'newp' is not NULL, at the end of a successful call '*newp' will be set
+ * to the address of the element just added, so that it will be possible to
+ * continue an interation with lpNext() and lpPrev().
+ *
+ * For deletion operations ('ele' set to NULL) 'newp' is set to the next
+ * element, on the right of the deleted one, or to NULL if the deleted element
+ * was the last one. */
+unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, uint32_t size, unsigned char *p, int where, unsigned char **newp) {
+    unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+    unsigned char backlen[LP_MAX_BACKLEN_SIZE];
+
+    uint64_t enclen; /* The length of the encoded element. */
+
+    /* An element pointer set to NULL means deletion, which is conceptually
+     * replacing the element with a zero-length element. So whatever we
+     * get passed as 'where', set it to LP_REPLACE. */
+    if (ele == NULL) where = LP_REPLACE;
+
+    /* If we need to insert after the current element, we just jump to the
+     * next element (that could be the EOF one) and handle the case of
+     * inserting before. So the function will actually deal with just two
+     * cases: LP_BEFORE and LP_REPLACE. */
+    if (where == LP_AFTER) {
+        p = lpSkip(p);
+        where = LP_BEFORE;
+    }
+
+    /* Store the offset of the element 'p', so that we can obtain its
+     * address again after a reallocation. */
+    unsigned long poff = p-lp;
+
+    /* Calling lpEncodeGetType() results into the encoded version of the
+     * element to be stored into 'intenc' in case it is representable as
+     * an integer: in that case, the function returns LP_ENCODING_INT.
+     * Otherwise if LP_ENCODING_STRING is returned, we'll have to call
+     * lpEncodeString() to actually write the encoded string on place later.
+     *
+     * Whatever the returned encoding is, 'enclen' is populated with the
+     * length of the encoded element. */
+    int enctype;
+    if (ele) {
+        enctype = lpEncodeGetType(ele,size,intenc,&enclen);
+    } else {
+        enctype = -1;
+        enclen = 0;
+    }
+
+    /* We need to also encode the backward-parsable length of the element
+     * and append it to the end: this allows to traverse the listpack from
+     * the end to the start. */
+    unsigned long backlen_size = ele ? lpEncodeBacklen(backlen,enclen) : 0;
+    uint64_t old_listpack_bytes = lpGetTotalBytes(lp);
+    uint32_t replaced_len  = 0;
+    if (where == LP_REPLACE) {
+        replaced_len = lpCurrentEncodedSize(p);
+        replaced_len += lpEncodeBacklen(NULL,replaced_len);
+    }
+
+    uint64_t new_listpack_bytes = old_listpack_bytes + enclen + backlen_size
+                                  - replaced_len;
+    if (new_listpack_bytes > UINT32_MAX) return NULL;
+
+    /* We now need to reallocate in order to make space or shrink the
+     * allocation (in case 'when' value is LP_REPLACE and the new element is
+     * smaller). However we do that before memmoving the memory to
+     * make room for the new element if the final allocation will get
+     * larger, or we do it after if the final allocation will get smaller. */
+
+    unsigned char *dst = lp + poff; /* May be updated after reallocation. */
+
+    /* Realloc before: we need more room. */
+    if (new_listpack_bytes > old_listpack_bytes) {
+        lp = zrealloc(lp,new_listpack_bytes);
+        dst = lp + poff;
+    }
+
+    /* Setup the listpack relocating the elements to make the exact room
+     * we need to store the new one. */
+    if (where == LP_BEFORE) {
+        memmove(dst+enclen+backlen_size,dst,old_listpack_bytes-poff);
+    } else { /* LP_REPLACE. */
+        long lendiff = (enclen+backlen_size)-replaced_len;
+        memmove(dst+replaced_len+lendiff,
+                dst+replaced_len,
+                old_listpack_bytes-poff-replaced_len);
+    }
+
+    /* Realloc after: we need to free space. */
+    if (new_listpack_bytes < old_listpack_bytes) {
+        lp = zrealloc(lp,new_listpack_bytes);
+        dst = lp + poff;
+    }
+
+    /* Store the entry. */
+    if (newp) {
+        *newp = dst;
+        /* In case of deletion, set 'newp' to NULL if the next element is
+         * the EOF element. */
+        if (!ele && dst[0] == LP_EOF) *newp = NULL;
+    }
+    if (ele) {
+        if (enctype == LP_ENCODING_INT) {
+            memcpy(dst,intenc,enclen);
+        } else {
+            lpEncodeString(dst,ele,size);
+        }
+        dst += enclen;
+        memcpy(dst,backlen,backlen_size);
+        dst += backlen_size;
+    }
+
+    /* Update header. */
+    if (where != LP_REPLACE || ele == NULL) {
+        uint32_t num_elements = lpGetNumElements(lp);
+        if (num_elements != LP_HDR_NUMELE_UNKNOWN) {
+            if (ele)
+                lpSetNumElements(lp,num_elements+1);
+            else
+                lpSetNumElements(lp,num_elements-1);
+        }
+    }
+    lpSetTotalBytes(lp,new_listpack_bytes);
+    return lp;
+}
+
+/* Append the specified element 'ele' of length 'size' at the end of the
+ * listpack. It is implemented in terms of lpInsert(), so the return value is
+ * the same as lpInsert(). */
+unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, uint32_t size) {
+    uint64_t listpack_bytes = lpGetTotalBytes(lp);
+    unsigned char *eofptr = lp + listpack_bytes - 1;
+    return lpInsert(lp,ele,size,eofptr,LP_BEFORE,NULL);
+}
+
+/* Replace the element pointed by '*p' with 'ele' of length 'size'. On
+ * return '*p' points to the new element. */
+unsigned char *lpReplace(unsigned char *lp, unsigned char **p, unsigned char *ele, uint32_t size) {
+    return lpInsert(lp,ele,size,*p,LP_REPLACE,p);
+}
+
+/* Remove the element pointed by 'p', and return the resulting listpack.
+ * If 'newp' is not NULL, the next element pointer (to the right of the
+ * deleted one) is returned by reference. If the deleted element was the
+ * last one, '*newp' is set to NULL. */
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp) {
+    return lpInsert(lp,NULL,0,p,LP_REPLACE,newp);
+}
+
+/* Return the total number of bytes the listpack is composed of. */
+uint32_t lpBytes(unsigned char *lp) {
+    return lpGetTotalBytes(lp);
+}
+
+/* Seek the specified element and returns the pointer to the seeked element.
+ * Positive indexes specify the zero-based element to seek from the head to
+ * the tail, negative indexes specify elements starting from the tail, where
+ * -1 means the last element, -2 the penultimate and so forth. If the index
+ * is out of range, NULL is returned. */
+unsigned char *lpSeek(unsigned char *lp, long index) {
+    int forward = 1; /* Seek forward by default. */
+
+    /* We want to seek from left to right or the other way around
+     * depending on the listpack length and the element position.
+     * However if the listpack length cannot be obtained in constant time,
+     * we always seek from left to right. */
+    uint32_t numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN) {
+        if (index < 0) index = (long)numele+index;
+        if (index < 0) return NULL; /* Index still < 0 means out of range. */
+        if (index >= (long)numele) return NULL; /* Out of range the other side. */
+        /* We want to scan right-to-left if the element we are looking for
+         * is past the half of the listpack. */
+        if (index > (long)numele/2) {
+            forward = 0;
+            /* Right to left scanning always expects a negative index. Convert
+             * our index to negative form. */
+            index -= numele;
+        }
+    } else {
+        /* If the listpack length is unspecified, for negative indexes we
+         * want to always scan right-to-left. */
+        if (index < 0) forward = 0;
+    }
+
+    /* Forward and backward scanning is trivially based on lpNext()/lpPrev(). */
+    if (forward) {
+        unsigned char *ele = lpFirst(lp);
+        while (index > 0 && ele) {
+            ele = lpNext(lp,ele);
+            index--;
+        }
+        return ele;
+    } else {
+        unsigned char *ele = lpLast(lp);
+        while (index < -1 && ele) {
+            ele = lpPrev(lp,ele);
+            index++;
+        }
+        return ele;
+    }
+}
+
+/* Find pointer to the entry equal to the specified entry, starting at 'p'.
+ * Skip 'skip' entries between every comparison, so that for instance when
+ * 'skip' is 1 only the fields of a field-value listpack are compared.
+ * Returns NULL when the element is not found.
+ *
+ * Like ziplistFind(), the searched string is converted to an integer at most
+ * once, and only if an integer encoded entry is found, so that integer
+ * entries are compared without decoding them to strings. */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s, uint32_t slen, unsigned int skip) {
+    int skipcnt = 0;
+    long long vll = 0;
+    int vencoding = 0; /* 0: not tried yet, 1: integer, 2: not an integer. */
+    uint32_t entrylen;
+
+    ((void) lp);
+    while (p && p[0] != LP_EOF) {
+        /* Fast path for strings shorter than 64 bytes, that is, almost all
+         * the hash fields: the length is stored in the encoding byte, and
+         * the backlen always takes a single byte. */
+        if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+            uint32_t len = LP_ENCODING_6BIT_STR_LEN(p);
+            if (skipcnt == 0) {
+                /* Check the last byte before calling memcmp(): fields of
+                 * the same length often share a prefix, like "user:1000"
+                 * and "user:1001". */
+                if (len == slen && (slen == 0 ||
+                    (p[slen] == s[slen-1] && memcmp(p+1,s,slen) == 0)))
+                    return p;
+                skipcnt = skip;
+            } else {
+                skipcnt--;
+            }
+            p += len+2;
+            continue;
+        }
+
+        if (skipcnt == 0) {
+            int64_t val;
+            unsigned char *str;
+
+            if (lpDecode(p,&val,&str)) {
+                /* Integer entry: convert the searched string once. */
+                if (vencoding == 0) {
+                    if (slen <= 20 && string2ll((char*)s,slen,&vll))
+                        vencoding = 1;
+                    else
+                        vencoding = 2;
+                }
+                if (vencoding == 1 && vll == val) return p;
+            } else {
+                if (val == slen && str[slen-1] == s[slen-1] &&
+                    memcmp(str,s,slen) == 0) return p;
+            }
+
+            /* Reset skip count */
+            skipcnt = skip;
+        } else {
+            /* Skip entry */
+            skipcnt--;
+        }
+        entrylen = lpCurrentEncodedSize(p);
+        p += entrylen+lpEncodeBacklen(NULL,entrylen);
+    }
+    return NULL;
+}
+
+/* Check that the listpack header is consistent with the size 'size' of the
+ * buffer holding it, as received from an RDB file or a DUMP payload.
+ * Returns 1 if the header looks valid, otherwise 0. */
+int lpValidateHeader(unsigned char *lp, size_t size) {
+    if (size < LP_HDR_SIZE+1) return 0;
+    if (lpGetTotalBytes(lp) != size) return 0;
+    if (lp[size-1] != LP_EOF) return 0;
+    return 1;
+}
+
+/* Print the listpack content on standard output, for debugging. */
+void lpRepr(unsigned char *lp) {
+    unsigned char *p, *vstr = NULL;
+    unsigned int vlen = 0;
+    long long vll = 0;
+    int index = 0;
+
+    printf("{total bytes %u} {num entries %u}\n",
+        lpBytes(lp), lpLength(lp));
+    p = lpFirst(lp);
+    while (p) {
+        uint32_t enclen = lpCurrentEncodedSize(p);
+        printf("{\n\taddr %p,\n\tindex %2d,\n\toffset %5ld,\n\t"
+               "entry size %5lu,\n\tbacklen size %lu,\n\t",
+            (void*)p, index, (long)(p-lp),
+            (unsigned long)enclen+lpEncodeBacklen(NULL,enclen),
+            lpEncodeBacklen(NULL,enclen));
+        lpGetValue(p,&vstr,&vlen,&vll);
+        if (vstr) {
+            printf("[str]");
+            if (vlen > 40) {
+                if (fwrite(vstr,40,1,stdout) == 0) perror("fwrite");
+                printf("...");
+            } else {
+                if (vlen && fwrite(vstr,vlen,1,stdout) == 0) perror("fwrite");
+            }
+        } else {
+            printf("[int]%lld", vll);
+        }
+        printf("\n}\n");
+        p = lpNext(lp,p);
+        index++;
+    }
+    printf("{end}\n\n");
+}
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include <time.h>
+
+#define UNUSED(x) (void)(x)
+
+static unsigned char *lpCreateFromStrings(char **ele, int count) {
+    unsigned char *lp = lpNew();
+    int j;
+
+    for (j = 0; j < count; j++)
+        lp = lpAppend(lp,(unsigned char*)ele[j],strlen(ele[j]));
+    return lp;
+}
+
+/* Assert that the element pointed by 'p' is the string 's'. */
+static int lpEntryIs(unsigned char *p, char *s) {
+    unsigned char buf[LP_INTBUF_SIZE];
+    int64_t len;
+    unsigned char *str = lpGet(p,&len,buf);
+    return (size_t)len == strlen(s) && memcmp(str,s,len) == 0;
+}
+
+int listpackTest(int argc, char *argv[]) {
+    unsigned char *lp, *p;
+    char *mixed[] = {"hello","foo","1024","-1","127","128","-4096",
+                     "32767","-8388608","2147483647","-9223372036854775808",
+                     "9223372036854775807","abc"};
+    int nmixed = sizeof(mixed)/sizeof(char*);
+    int j;
+
+    UNUSED(argc);
+    UNUSED(argv);
+
+    printf("Create and iterate a listpack with mixed encodings: ");
+    {
+        lp = lpCreateFromStrings(mixed,nmixed);
+        assert(lpLength(lp) == (uint32_t)nmixed);
+        p = lpFirst(lp);
+        for (j = 0; j < nmixed; j++) {
+            assert(p != NULL && lpEntryIs(p,mixed[j]));
+            p = lpNext(lp,p);
+        }
+        assert(p == NULL);
+        p = lpLast(lp);
+        for (j = nmixed-1; j >= 0; j--) {
+            assert(p != NULL && lpEntryIs(p,mixed[j]));
+            p = lpPrev(lp,p);
+        }
+        assert(p == NULL);
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Integer values are decoded correctly: ");
+    {
+        lp = lpCreateFromStrings(mixed,nmixed);
+        p = lpSeek(lp,10);
+        unsigned char *vstr = NULL;
+        unsigned int vlen = 0;
+        long long vll = 0;
+        assert(lpGetValue(p,&vstr,&vlen,&vll) && vstr == NULL);
+        assert(vll == LLONG_MIN);
+        p = lpSeek(lp,-2);
+        assert(lpGetValue(p,&vstr,&vlen,&vll) && vstr == NULL);
+        assert(vll == LLONG_MAX);
+        p = lpSeek(lp,6);
+        assert(lpGetValue(p,&vstr,&vlen,&vll) && vstr == NULL);
+        assert(vll == -4096);
+        p = lpSeek(lp,0);
+        assert(lpGetValue(p,&vstr,&vlen,&vll) && vstr != NULL);
+        assert(vlen == 5 && memcmp(vstr,"hello",5) == 0);
+        assert(lpSeek(lp,nmixed) == NULL);
+        assert(lpSeek(lp,-nmixed-1) == NULL);
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Insert, replace and delete in the middle: ");
+    {
+        lp = lpCreateFromStrings(mixed,3);
+        p = lpSeek(lp,1);
+        lp = lpInsert(lp,(unsigned char*)"bar",3,p,LP_AFTER,&p);
+        assert(lpEntryIs(p,"bar"));
+        assert(lpLength(lp) == 4);
+        assert(lpEntryIs(lpSeek(lp,2),"bar"));
+        assert(lpEntryIs(lpSeek(lp,3),"1024"));
+
+        lp = lpReplace(lp,&p,(unsigned char*)"12345",5);
+        assert(lpEntryIs(p,"12345"));
+        assert(lpLength(lp) == 4);
+
+        lp = lpDelete(lp,p,&p);
+        assert(lpEntryIs(p,"1024"));
+        assert(lpLength(lp) == 3);
+        lp = lpDelete(lp,p,&p);
+        assert(p == NULL);
+        assert(lpLength(lp) == 2);
+        assert(lpEntryIs(lpLast(lp),"foo"));
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Long strings and backlen encodings: ");
+    {
+        size_t lens[] = {63,64,127,128,4095,4096,16382,16383,70000};
+        int nlens = sizeof(lens)/sizeof(size_t);
+        lp = lpNew();
+        for (j = 0; j < nlens; j++) {
+            char *s = zmalloc(lens[j]);
+            memset(s,'a'+j,lens[j]);
+            lp = lpAppend(lp,(unsigned char*)s,lens[j]);
+            zfree(s);
+        }
+        p = lpLast(lp);
+        for (j = nlens-1; j >= 0; j--) {
+            int64_t len;
+            unsigned char *str = lpGet(p,&len,NULL);
+            assert((size_t)len == lens[j] && str[0] == 'a'+j);
+            p = lpPrev(lp,p);
+        }
+        assert(p == NULL);
+        assert(lpValidateHeader(lp,lpBytes(lp)));
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Find with skip: ");
+    {
+        char *pairs[] = {"a","1","100","b","c","100","d","e"};
+        lp = lpCreateFromStrings(pairs,8);
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"100",3,1);
+        assert(p == lpSeek(lp,2));
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"b",1,1);
+        assert(p == NULL); /* "b" is a value, not a field. */
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"d",1,1);
+        assert(p == lpSeek(lp,6));
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"1",1,0);
+        assert(p == lpSeek(lp,1));
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("More than 65535 elements: ");
+    {
+        lp = lpNew();
+        for (j = 0; j < 70000; j++) {
+            char buf[32];
+            int len = snprintf(buf,sizeof(buf),"%d",j);
+            lp = lpAppend(lp,(unsigned char*)buf,len);
+        }
+        assert(lpLength(lp) == 70000);
+        assert(lpEntryIs(lpSeek(lp,-1),"69999"));
+        assert(lpEntryIs(lpSeek(lp,65535),"65535"));
+        for (j = 0; j < 10000; j++) lp = lpDelete(lp,lpFirst(lp),NULL);
+        assert(lpLength(lp) == 60000);
+        assert(lpEntryIs(lpFirst(lp),"10000"));
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Stress random insert/delete against a reference array: ");
+    {
+        char *ref[512];
+        int len = 0, iter;
+        lp = lpNew();
+        srand(time(NULL));
+        for (iter = 0; iter < 20000; iter++) {
+            int pos, op = rand() % 3;
+            if (len == 0 || (op != 0 && len < 512)) {
+                char buf[128];
+                int slen;
+                if (rand() % 2)
+                    slen = snprintf(buf,sizeof(buf),"%lld",
+                        (long long)rand()-RAND_MAX/2);
+                else {
+                    slen = rand() % 100;
+                    memset(buf,'x',slen);
+                    buf[slen] = '\0';
+                }
+                pos = rand() % (len+1);
+                if (pos == len) {
+                    lp = lpAppend(lp,(unsigned char*)buf,slen);
+                } else {
+                    lp = lpInsert(lp,(unsigned char*)buf,slen,lpSeek(lp,pos),
+                                  LP_BEFORE,NULL);
+                }
+                memmove(ref+pos+1,ref+pos,sizeof(char*)*(len-pos));
+                ref[pos] = zstrdup(buf);
+                len++;
+            } else {
+                pos = rand() % len;
+                lp = lpDelete(lp,lpSeek(lp,pos),NULL);
+                zfree(ref[pos]);
+                memmove(ref+pos,ref+pos+1,sizeof(char*)*(len-pos-1));
+                len--;
+            }
+            assert(lpLength(lp) == (uint32_t)len);
+        }
+        p = lpFirst(lp);
+        for (j = 0; j < len; j++) {
+            assert(lpEntryIs(p,ref[j]));
+            zfree(ref[j]);
+            p = lpNext(lp,p);
+        }
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Insert at head of a listpack of growing entries (ziplist cascade update case): ");
+    {
+        struct timeval start, end;
+        char buf[250];
+        memset(buf,'x',sizeof(buf));
+        lp = lpNew();
+        gettimeofday(&start,NULL);
+        for (j = 0; j < 10000; j++) {
+            /* An empty listpack has no first element: insert before EOF. */
+            p = lpFirst(lp);
+            if (p == NULL) p = lp+LP_HDR_SIZE;
+            lp = lpInsert(lp,(unsigned char*)buf,250,p,LP_BEFORE,NULL);
+        }
+        gettimeofday(&end,NULL);
+        assert(lpLength(lp) == 10000);
+        lpFree(lp);
+        printf("OK (%lld usec)\n",
+            (long long)(end.tv_sec-start.tv_sec)*1000000+
+            (end.tv_usec-start.tv_usec));
+    }
+
+    printf("Benchmark lpFind on field/value pairs:\n");
+    {
+        int sizes[] = {8,32,128,512}, num = 200000, qlen[1024];
+        char buf[32], query[1024][32];
+
+        for (j = 0; j < 4; j++) {
+            struct timeval start, end;
+            long long found = 0;
+            int i;
+
+            lp = lpNew();
+            for (i = 0; i < sizes[j]; i++) {
+                int len = snprintf(buf,sizeof(buf),"field:%d",i);
+                lp = lpAppend(lp,(unsigned char*)buf,len);
+                len = snprintf(buf,sizeof(buf),"value:%d",i);
+                lp = lpAppend(lp,(unsigned char*)buf,len);
+            }
+            /* One every four lookups is a miss. */
+            for (i = 0; i < 1024; i++)
+                qlen[i] = snprintf(query[i],sizeof(query[i]),"field:%d",
+                    rand() % (sizes[j]+sizes[j]/3));
+            gettimeofday(&start,NULL);
+            for (i = 0; i < num; i++) {
+                if (lpFind(lp,lpFirst(lp),(unsigned char*)query[i&1023],
+                           qlen[i&1023],1)) found++;
+            }
+            gettimeofday(&end,NULL);
+            printf("%4d pairs: %.1f ns per lookup (%lld found)\n",
+                sizes[j],
+                ((double)(end.tv_sec-start.tv_sec)*1000000+
+                 (end.tv_usec-start.tv_usec))*1000/num, found);
+            lpFree(lp);
+        }
+    }
+
+    return 0;
+}
+#endif
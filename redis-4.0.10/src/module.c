@@ -209,9 +209,23 @@ typedef struct RedisModuleBlockedClient {
     int dbid;           /* Database number selected by the original client. */
 } RedisModuleBlockedClient;
 
+/* Structure representing a value pinned with RedisModule_PinKey(), so that
+ * module threads can read it without holding the server lock. */
+typedef struct RedisModulePinnedKey {
+    robj *value;        /* The pinned value, holding a reference. */
+    dict *paused;       /* Hash table of the value whose incremental rehashing
+                           is paused while pinned, or NULL. */
+    char buf[LONG_STR_SIZE]; /* Integer encoded strings, as text. */
+    size_t len;         /* Length of the string in 'buf'. */
+} RedisModulePinnedKey;
+
 static pthread_mutex_t moduleUnblockedClientsMutex = PTHREAD_MUTEX_INITIALIZER;
 static list *moduleUnblockedClients;
 
+/* Number of handles returned by RedisModule_PinKey() not yet released. Only
+ * accessed by the main thread, or with the server lock held. */
+static long long modulePinnedKeys = 0;
+
 /* We need a mutex that is unlocked / relocked in beforeSleep() in order to
  * allow thread safe contexts to execute commands at a safe moment. */
 static pthread_mutex_t moduleGIL = PTHREAD_MUTEX_INITIALIZER;
@@ -664,8 +678,10 @@ int RM_CreateCommand(RedisModuleCtx *ctx, const char *name, RedisModuleCmdFunc c
     cp->rediscmd->keystep = keystep;
     cp->rediscmd->microseconds = 0;
     cp->rediscmd->calls = 0;
+    commandAssignId(cp->rediscmd);
     dictAdd(server.commands,sdsdup(cmdname),cp->rediscmd);
     dictAdd(server.orig_commands,sdsdup(cmdname),cp->rediscmd);
+    buildCommandLookupTable();
     return REDISMODULE_OK;
 }
 
@@ -845,10 +861,14 @@ RedisModuleString *RM_CreateStringFromString(RedisModuleCtx *ctx, const RedisMod
  *
  * It is possible to call this function even when automatic memory management
  * is enabled. In that case the string will be released ASAP and removed
- * from the pool of string to release at the end. */
+ * from the pool of string to release at the end.
+ *
+ * 'ctx' can be NULL if the string was not obtained with automatic memory
+ * management enabled, for instance in the free privdata callback of a
+ * blocked client. */
 void RM_FreeString(RedisModuleCtx *ctx, RedisModuleString *str) {
     decrRefCount(str);
-    autoMemoryFreed(ctx,REDISMODULE_AM_STRING,str);
+    if (ctx != NULL) autoMemoryFreed(ctx,REDISMODULE_AM_STRING,str);
 }
 
 /* Every call to this function, will make the string 'str' requiring
@@ -1402,6 +1422,7 @@ void *RM_OpenKey(RedisModuleCtx *ctx, robj *keyname, int mode) {
 
     if (mode & REDISMODULE_WRITE) {
         value = lookupKeyWrite(ctx->client->db,keyname);
+        if (value) value = dbUnshareValue(ctx->client->db,keyname,value);
     } else {
         value = lookupKeyRead(ctx->client->db,keyname);
         if (value == NULL) {
@@ -1982,7 +2003,7 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
     } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
         zskiplistNode *ln = key->zcurrent;
         if (score) *score = ln->score;
-        str = createStringObject(ln->ele,sdslen(ln->ele));
+        str = createStringObject(zslNodeElement(ln),sdslen(zslNodeElement(ln)));
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2040,7 +2061,7 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
                 key->zer = 1;
                 return 0;
             } else if (key->ztype == REDISMODULE_ZSET_RANGE_LEX) {
-                if (!zslLexValueLteMax(next->ele,&key->zlrs)) {
+                if (!zslLexValueLteMax(zslNodeElement(next),&key->zlrs)) {
                     key->zer = 1;
                     return 0;
                 }
@@ -2103,7 +2124,7 @@ int RM_ZsetRangePrev(RedisModuleKey *key) {
                 key->zer = 1;
                 return 0;
             } else if (key->ztype == REDISMODULE_ZSET_RANGE_LEX) {
-                if (!zslLexValueGteMin(prev->ele,&key->zlrs)) {
+                if (!zslLexValueGteMin(zslNodeElement(prev),&key->zlrs)) {
                     key->zer = 1;
                     return 0;
                 }
@@ -2277,7 +2298,7 @@ int RM_HashGet(RedisModuleKey *key, int flags, ...) {
     va_start(ap, flags);
     while(1) {
         RedisModuleString *field, **valueptr;
-        int *existsptr;
+        int *existsptr, expired;
         /* Get the field object and the value pointer to pointer. */
         if (flags & REDISMODULE_HASH_CFIELDS) {
             char *cfield = va_arg(ap,char*);
@@ -2288,16 +2309,20 @@ int RM_HashGet(RedisModuleKey *key, int flags, ...) {
             if (field == NULL) break;
         }
 
-        /* Query the hash for existence or value object. */
+        /* Query the hash for existence or value object. Fields with an
+         * elapsed TTL not deleted yet are reported as missing. */
+        expired = key->value &&
+            hashTypeFieldIsExpired(key->value,field->ptr,
+                                   hashTypeFieldExpireNow());
         if (flags & REDISMODULE_HASH_EXISTS) {
             existsptr = va_arg(ap,int*);
-            if (key->value)
+            if (key->value && !expired)
                 *existsptr = hashTypeExists(key->value,field->ptr);
             else
                 *existsptr = 0;
         } else {
             valueptr = va_arg(ap,RedisModuleString**);
-            if (key->value) {
+            if (key->value && !expired) {
                 *valueptr = hashTypeGetValueObject(key->value,field->ptr);
                 if (*valueptr) {
                     robj *decoded = getDecodedObject(*valueptr);
@@ -2685,9 +2710,9 @@ RedisModuleCallReply *RM_Call(RedisModuleCtx *ctx, const char *cmdname, const ch
     sds proto = sdsnewlen(c->buf,c->bufpos);
     c->bufpos = 0;
     while(listLength(c->reply)) {
-        sds o = listNodeValue(listFirst(c->reply));
+        clientReplyBlock *o = listNodeValue(listFirst(c->reply));
 
-        proto = sdscatsds(proto,o);
+        proto = sdscatlen(proto,o->buf,o->used);
         listDelNode(c->reply,listFirst(c->reply));
     }
     reply = moduleCreateCallReplyFromProto(ctx,proto);
@@ -2884,6 +2909,8 @@ void moduleTypeNameByID(char *name, uint64_t moduleid) {
  *          // Optional fields
  *          .digest = myType_DigestCallBack,
  *          .mem_usage = myType_MemUsageCallBack,
+ *          .defrag = myType_DefragCallBack,
+ *          .free_effort = myType_FreeEffortCallBack,
  *      }
  *
  * * **rdb_load**: A callback function pointer that loads data from RDB files.
@@ -2891,6 +2918,14 @@ void moduleTypeNameByID(char *name, uint64_t moduleid) {
  * * **aof_rewrite**: A callback function pointer that rewrites data as commands.
  * * **digest**: A callback function pointer that is used for `DEBUG DIGEST`.
  * * **free**: A callback function pointer that can free a type value.
+ * * **defrag**: A callback function pointer called by the active defragger
+ *   with the key name and a reference to the value, see
+ *   `RedisModule_DefragAlloc()`. Only read if the version is 2 or greater.
+ * * **free_effort**: A callback function pointer returning the number of
+ *   allocations released freeing a value. Values reporting more than a few
+ *   tens of allocations are freed by the lazyfree thread, as configured by
+ *   the lazyfree-* options, so the free method must be thread safe. Only
+ *   read if the version is 3 or greater.
  *
  * The **digest* and **mem_usage** methods should currently be omitted since
  * they are not yet implemented inside the Redis modules core.
@@ -2929,6 +2964,8 @@ moduleType *RM_CreateDataType(RedisModuleCtx *ctx, const char *name, int encver,
         moduleTypeMemUsageFunc mem_usage;
         moduleTypeDigestFunc digest;
         moduleTypeFreeFunc free;
+        moduleTypeDefragFunc defrag;
+        moduleTypeFreeEffortFunc free_effort;
     } *tms = (struct typemethods*) typemethods_ptr;
 
     moduleType *mt = zcalloc(sizeof(*mt));
@@ -2940,6 +2977,8 @@ moduleType *RM_CreateDataType(RedisModuleCtx *ctx, const char *name, int encver,
     mt->mem_usage = tms->mem_usage;
     mt->digest = tms->digest;
     mt->free = tms->free;
+    if (typemethods_version >= 2) mt->defrag = tms->defrag;
+    if (typemethods_version >= 3) mt->free_effort = tms->free_effort;
     memcpy(mt->name,name,sizeof(mt->name));
     listAddNodeTail(ctx->module->types,mt);
     return mt;
@@ -3094,6 +3133,53 @@ saveerr:
     io->error = 1;
 }
 
+/* In the context of the rdb_save method of a module data type, saves the
+ * 'len' bytes at 'ptr' with a single write. Unlike the other string saving
+ * functions the blob is never compressed nor copied, so that big values
+ * laid out in contiguous memory are saved at disk bandwidth.
+ *
+ * The blob can be loaded back with RedisModule_LoadBlob(), or as a string
+ * with RedisModule_LoadStringBuffer(). */
+void RM_SaveBlob(RedisModuleIO *io, const void *ptr, size_t len) {
+    if (io->error) return;
+    /* Save opcode. */
+    ssize_t retval = rdbSaveLen(io->rio, RDB_MODULE_OPCODE_STRING);
+    if (retval == -1) goto saveerr;
+    io->bytes += retval;
+    /* Save the blob as an uncompressed string. */
+    retval = rdbSaveLen(io->rio, len);
+    if (retval == -1) goto saveerr;
+    io->bytes += retval;
+    if (len && rioWrite(io->rio, ptr, len) == 0) goto saveerr;
+    io->bytes += len;
+    return;
+
+saveerr:
+    io->error = 1;
+}
+
+/* In the context of the rdb_load method of a module data type, loads a blob
+ * saved with RedisModule_SaveBlob() directly into the 'len' bytes at 'buf',
+ * with a single read. The module should know the size of the blob in
+ * advance, for instance saving it with RedisModule_SaveUnsigned() before
+ * the blob itself: a size mismatch is handled as a loading error. */
+void RM_LoadBlob(RedisModuleIO *io, void *buf, size_t len) {
+    uint64_t stored;
+    int isencoded;
+
+    if (io->ver == 2) {
+        uint64_t opcode = rdbLoadLen(io->rio,NULL);
+        if (opcode != RDB_MODULE_OPCODE_STRING) goto loaderr;
+    }
+    if (rdbLoadLenByRef(io->rio, &isencoded, &stored) == -1) goto loaderr;
+    if (isencoded || stored != len) goto loaderr;
+    if (len && rioRead(io->rio, buf, len) == 0) goto loaderr;
+    return;
+
+loaderr:
+    moduleRDBLoadError(io);
+}
+
 /* Implements RM_LoadString() and RM_LoadStringBuffer() */
 void *moduleLoadString(RedisModuleIO *io, int plain, size_t *lenptr) {
     if (io->ver == 2) {
@@ -3266,6 +3352,60 @@ void RM_DigestEndSequence(RedisModuleDigest *md) {
     memset(md->o,0,sizeof(md->o));
 }
 
+/* --------------------------------------------------------------------------
+ * Active defrag of modules data types
+ * -------------------------------------------------------------------------- */
+
+/* The context passed to the defrag method of a module data type. */
+struct RedisModuleDefragCtx {
+    int defragged;  /* Number of allocations moved so far. */
+};
+typedef struct RedisModuleDefragCtx RedisModuleDefragCtx;
+
+/* Called by the defrag method of a module data type for every allocation
+ * of the value it owns. If the allocation was moved the old pointer is
+ * already released and the new one is returned, so the module must update
+ * its references. Otherwise NULL is returned and the pointer stays valid.
+ * Only memory obtained with RedisModule_Alloc() and friends can be passed.
+ *
+ * Example:
+ *
+ *      void myType_DefragCallBack(RedisModuleDefragCtx *ctx,
+ *                                 RedisModuleString *key, void **value)
+ *      {
+ *          struct myType *t = *value, *newt;
+ *          if ((newt = RedisModule_DefragAlloc(ctx,t)) != NULL)
+ *              *value = t = newt;
+ *          ... do the same for the allocations referenced by t ...
+ *      }
+ */
+void *RM_DefragAlloc(RedisModuleDefragCtx *ctx, void *ptr) {
+    void *newptr = activeDefragAlloc(ptr);
+    if (newptr) ctx->defragged++;
+    return newptr;
+}
+
+/* Like RedisModule_DefragAlloc() but for a string retained by the module.
+ * Strings shared with other references are never moved. */
+RedisModuleString *RM_DefragRedisModuleString(RedisModuleDefragCtx *ctx, RedisModuleString *str) {
+    return activeDefragStringOb(str,&ctx->defragged);
+}
+
+/* Defrag the moduleValue of the module object 'value' stored at 'key', then
+ * let the module defrag its own allocations if the type has a defrag
+ * method. Returns the number of allocations moved. */
+int moduleDefragValue(robj *key, robj *value) {
+    moduleValue *mv = value->ptr, *newmv;
+    struct RedisModuleDefragCtx ctx = {0};
+
+    if ((newmv = activeDefragAlloc(mv))) {
+        value->ptr = mv = newmv;
+        ctx.defragged++;
+    }
+    if (mv->type->defrag) mv->type->defrag(&ctx,key,&mv->value);
+    return ctx.defragged;
+}
+
 /* --------------------------------------------------------------------------
  * AOF API for modules data types
  * -------------------------------------------------------------------------- */
@@ -3694,6 +3834,154 @@ void moduleReleaseGIL(void) {
     pthread_mutex_unlock(&moduleGIL);
 }
 
+/* --------------------------------------------------------------------------
+ * Pinned keys
+ *
+ * Thread safe contexts serialize all the accesses to the data set behind
+ * the server lock. When a blocked command only needs to read a few keys,
+ * it can instead pin their values with RedisModule_PinKey() while holding
+ * the lock (or in the command implementation itself), and then read them
+ * from its threads without the lock, in parallel with the main thread
+ * serving other clients:
+ *
+ *     RedisModulePinnedKey *pk = RedisModule_PinKey(ctx,argv[1]);
+ *     bc = RedisModule_BlockClient(ctx,reply_cb,NULL,free_privdata_cb,0);
+ *     ... start a thread using RedisModule_PinnedHashGet(tsctx,pk,field) ...
+ *
+ * A pinned value is never modified by Redis: a write to the key while it
+ * is pinned replaces the value with a copy, and the thread keeps seeing the
+ * value as it was when it was pinned. Module type values are the exception,
+ * see RedisModule_PinnedModuleTypeGetValue().
+ * -------------------------------------------------------------------------- */
+
+/* Pin the value of the key 'keyname' and return a handle to access it
+ * from other threads, or NULL if the key does not exist. The value stays
+ * valid, even if the key is deleted or modified, until the handle is
+ * released with RedisModule_UnpinKey().
+ *
+ * Like any other call accessing the data set, this function must be called
+ * from the main thread or while holding the lock of a thread safe context. */
+RedisModulePinnedKey *RM_PinKey(RedisModuleCtx *ctx, RedisModuleString *keyname) {
+    RedisModulePinnedKey *pk;
+    robj *value = lookupKeyRead(ctx->client->db,keyname);
+
+    if (value == NULL) return NULL;
+    pk = zmalloc(sizeof(*pk));
+    pk->value = value;
+    pk->paused = NULL;
+    pk->len = 0;
+    incrRefCount(value);
+    modulePinnedKeys++;
+    if (value->type == OBJ_STRING && value->encoding == OBJ_ENCODING_INT)
+        pk->len = ll2string(pk->buf,sizeof(pk->buf),(long)value->ptr);
+    /* Lookups done by the main thread perform rehashing steps: pausing
+     * rehashing like safe iterators do makes them read only. */
+    if (value->type == OBJ_HASH && value->encoding == OBJ_ENCODING_HT) {
+        pk->paused = value->ptr;
+        pk->paused->iterators++;
+    }
+    return pk;
+}
+
+/* Release a handle returned by RedisModule_PinKey(). No thread should
+ * access the value after this call, that must be performed from the main
+ * thread, for instance in the reply or free privdata callback of the
+ * blocked client, or while holding the lock of a thread safe context. */
+void RM_UnpinKey(RedisModulePinnedKey *pk) {
+    robj *value = pk->value;
+
+    if (pk->paused) pk->paused->iterators--;
+    /* If the key was deleted or modified meanwhile, this is the last
+     * reference: free the value in background if it's big. */
+    if (lazyfreeShouldFreeAsync(value,LAZYFREE_PATH_SERVER_DEL))
+        lazyfreeFreeObjectAsync(value,LAZYFREE_PATH_SERVER_DEL);
+    else
+        decrRefCount(value);
+    modulePinnedKeys--;
+    zfree(pk);
+}
+
+/* Return the number of values currently pinned by modules. The lazyfree
+ * thread must not release references to them, see emptyDbAsync(). */
+long long moduleCountPinnedKeys(void) {
+    return modulePinnedKeys;
+}
+
+/* Return the type of the pinned value, as RedisModule_KeyType() does.
+ * This function, like all the RedisModule_Pinned*() functions, can be
+ * called from any thread without holding the server lock. */
+int RM_PinnedKeyType(RedisModulePinnedKey *pk) {
+    switch(pk->value->type) {
+    case OBJ_STRING: return REDISMODULE_KEYTYPE_STRING;
+    case OBJ_LIST: return REDISMODULE_KEYTYPE_LIST;
+    case OBJ_SET: return REDISMODULE_KEYTYPE_SET;
+    case OBJ_ZSET: return REDISMODULE_KEYTYPE_ZSET;
+    case OBJ_HASH: return REDISMODULE_KEYTYPE_HASH;
+    case OBJ_MODULE: return REDISMODULE_KEYTYPE_MODULE;
+    default: return 0;
+    }
+}
+
+/* Return the pointer and length of a pinned string value, that are valid
+ * until the handle is released, or NULL if the value is not a string. */
+const char *RM_PinnedStringPtrLen(RedisModulePinnedKey *pk, size_t *len) {
+    robj *value = pk->value;
+
+    if (value->type != OBJ_STRING) return NULL;
+    if (value->encoding == OBJ_ENCODING_INT) {
+        *len = pk->len;
+        return pk->buf;
+    }
+    *len = sdslen(value->ptr);
+    return value->ptr;
+}
+
+/* Return a new string with the value of the field 'field' of a pinned hash,
+ * or NULL if the value is not a hash or the field does not exist. When
+ * called from a thread, 'ctx' should be a thread safe context: the string
+ * is released with RedisModule_FreeString() using the same context. */
+RedisModuleString *RM_PinnedHashGet(RedisModuleCtx *ctx, RedisModulePinnedKey *pk, RedisModuleString *field) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+    size_t flen;
+    const char *fptr;
+    sds f;
+    int retval;
+
+    if (pk->value->type != OBJ_HASH) return NULL;
+    fptr = RM_StringPtrLen(field,&flen);
+    f = sdsnewlen(fptr,flen);
+    /* The pinned value is not modified, but its fields with an elapsed
+     * TTL may not be deleted yet. */
+    if (hashTypeFieldIsExpired(pk->value,f,mstime()))
+        retval = C_ERR;
+    else
+        retval = hashTypeGetValue(pk->value,f,&vstr,&vlen,&vll);
+    sdsfree(f);
+    if (retval == C_ERR) return NULL;
+    if (vstr) return RM_CreateString(ctx,(char*)vstr,vlen);
+    return RM_CreateStringFromLongLong(ctx,vll);
+}
+
+/* Return the module type of a pinned module value, or NULL if the value is
+ * not a module type value. */
+moduleType *RM_PinnedModuleTypeGetType(RedisModulePinnedKey *pk) {
+    if (pk->value->type != OBJ_MODULE) return NULL;
+    return ((moduleValue*)pk->value->ptr)->type;
+}
+
+/* Return the low level value of a pinned module type value, or NULL if the
+ * value is not a module type value.
+ *
+ * Redis can't copy module values when they are modified: the pin only
+ * guarantees that the value is not freed, and the module owning the type
+ * must synchronize its threads with the commands writing the value. */
+void *RM_PinnedModuleTypeGetValue(RedisModulePinnedKey *pk) {
+    if (pk->value->type != OBJ_MODULE) return NULL;
+    return ((moduleValue*)pk->value->ptr)->value;
+}
+
 
 /* --------------------------------------------------------------------------
  * Module Keyspace Notifications API
@@ -3916,6 +4204,7 @@ void moduleUnregisterCommands(struct RedisModule *module) {
             if (cp->module == module) {
                 dictDelete(server.commands,cmdname);
                 dictDelete(server.orig_commands,cmdname);
+                server.commands_by_id[cp->rediscmd->id] = NULL;
                 sdsfree(cmdname);
                 zfree(cp->rediscmd);
                 zfree(cp);
@@ -3923,6 +4212,7 @@ void moduleUnregisterCommands(struct RedisModule *module) {
         }
     }
     dictReleaseIterator(di);
+    buildCommandLookupTable();
 }
 
 /* Load a module and initialize it. On success C_OK is returned, otherwise
@@ -4160,6 +4450,8 @@ void moduleRegisterCoreAPI(void) {
     REGISTER_API(SaveStringBuffer);
     REGISTER_API(LoadString);
     REGISTER_API(LoadStringBuffer);
+    REGISTER_API(SaveBlob);
+    REGISTER_API(LoadBlob);
     REGISTER_API(SaveDouble);
     REGISTER_API(LoadDouble);
     REGISTER_API(SaveFloat);
@@ -4182,8 +4474,17 @@ void moduleRegisterCoreAPI(void) {
     REGISTER_API(FreeThreadSafeContext);
     REGISTER_API(ThreadSafeContextLock);
     REGISTER_API(ThreadSafeContextUnlock);
+    REGISTER_API(PinKey);
+    REGISTER_API(UnpinKey);
+    REGISTER_API(PinnedKeyType);
+    REGISTER_API(PinnedStringPtrLen);
+    REGISTER_API(PinnedHashGet);
+    REGISTER_API(PinnedModuleTypeGetType);
+    REGISTER_API(PinnedModuleTypeGetValue);
     REGISTER_API(DigestAddStringBuffer);
     REGISTER_API(DigestAddLongLong);
     REGISTER_API(DigestEndSequence);
+    REGISTER_API(DefragAlloc);
+    REGISTER_API(DefragRedisModuleString);
     REGISTER_API(SubscribeToKeyspaceEvents);
 }
@@ -176,6 +176,82 @@ int HelloKeys_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int ar
     return REDISMODULE_OK;
 }
 
+/* Private data of the command HELLO.HSUM, shared by the command, the thread
+ * and the free privdata callback. */
+typedef struct HelloHsum_Args {
+    RedisModuleBlockedClient *bc;
+    RedisModulePinnedKey *pk;
+    RedisModuleString **fields;
+    int numfields;
+} HelloHsum_Args;
+
+/* Private data freeing callback for HELLO.HSUM, called in the main thread
+ * once the client is unblocked: it is a safe place to unpin the key. */
+void HelloHsum_FreeData(void *privdata) {
+    HelloHsum_Args *args = privdata;
+    RedisModule_UnpinKey(args->pk);
+    for (int j = 0; j < args->numfields; j++)
+        RedisModule_FreeString(NULL,args->fields[j]);
+    RedisModule_Free(args->fields);
+    RedisModule_Free(args);
+}
+
+/* The thread entry point of HELLO.HSUM. The pinned hash is read without
+ * taking the server lock, while other clients may modify the key. */
+void *HelloHsum_ThreadMain(void *arg) {
+    HelloHsum_Args *args = arg;
+    RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(args->bc);
+    double sum = 0, value;
+
+    for (int j = 0; j < args->numfields; j++) {
+        RedisModuleString *v =
+            RedisModule_PinnedHashGet(ctx,args->pk,args->fields[j]);
+        if (v == NULL) continue;
+        if (RedisModule_StringToDouble(v,&value) == REDISMODULE_OK)
+            sum += value;
+        RedisModule_FreeString(ctx,v);
+    }
+    RedisModule_ReplyWithDouble(ctx,sum);
+
+    RedisModule_FreeThreadSafeContext(ctx);
+    RedisModule_UnblockClient(args->bc,args);
+    return NULL;
+}
+
+/* HELLO.HSUM <key> <field> [<field> ...] -- Return the sum of the numerical
+ * values of the specified hash fields, computed in a thread on the value
+ * the hash had when the command was called. */
+int HelloHsum_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 3) return RedisModule_WrongArity(ctx);
+
+    RedisModulePinnedKey *pk = RedisModule_PinKey(ctx,argv[1]);
+    if (pk == NULL) return RedisModule_ReplyWithDouble(ctx,0);
+    if (RedisModule_PinnedKeyType(pk) != REDISMODULE_KEYTYPE_HASH) {
+        RedisModule_UnpinKey(pk);
+        return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+
+    HelloHsum_Args *args = RedisModule_Alloc(sizeof(*args));
+    args->pk = pk;
+    args->numfields = argc-2;
+    args->fields = RedisModule_Alloc(sizeof(RedisModuleString*)*(argc-2));
+    for (int j = 2; j < argc; j++) {
+        RedisModule_RetainString(ctx,argv[j]);
+        args->fields[j-2] = argv[j];
+    }
+
+    /* The reply is accumulated by the thread using a thread safe context,
+     * the privdata is only used in order to release the resources. */
+    pthread_t tid;
+    args->bc = RedisModule_BlockClient(ctx,NULL,NULL,HelloHsum_FreeData,0);
+    if (pthread_create(&tid,NULL,HelloHsum_ThreadMain,args) != 0) {
+        RedisModule_AbortBlock(args->bc);
+        HelloHsum_FreeData(args);
+        return RedisModule_ReplyWithError(ctx,"-ERR Can't start thread");
+    }
+    return REDISMODULE_OK;
+}
+
 /* This function must be present on each Redis module. It is used in order to
  * register the commands into the Redis server. */
 int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
@@ -191,6 +267,9 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
     if (RedisModule_CreateCommand(ctx,"hello.keys",
         HelloKeys_RedisCommand,"",0,0,0) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx,"hello.hsum",
+        HelloHsum_RedisCommand,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
 
     return REDISMODULE_OK;
 }
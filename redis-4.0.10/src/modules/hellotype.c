@@ -238,6 +238,14 @@ void HelloTypeFree(void *value) {
     HelloTypeReleaseObject(value);
 }
 
+/* Freeing the value releases a node per element: long lists are freed by
+ * the lazyfree thread, which is fine since HelloTypeFree() only calls
+ * RedisModule_Free(). */
+size_t HelloTypeFreeEffort(const void *value) {
+    const struct HelloTypeObject *hto = value;
+    return hto->len;
+}
+
 void HelloTypeDigest(RedisModuleDigest *md, void *value) {
     struct HelloTypeObject *hto = value;
     struct HelloTypeNode *node = hto->head;
@@ -248,6 +256,23 @@ void HelloTypeDigest(RedisModuleDigest *md, void *value) {
     RedisModule_DigestEndSequence(md);
 }
 
+/* Called by the active defragger: move the object and every node of its
+ * list, fixing the pointers that reference the moved allocations. */
+void HelloTypeDefrag(RedisModuleDefragCtx *ctx, RedisModuleString *key, void **value) {
+    REDISMODULE_NOT_USED(key);
+    struct HelloTypeObject *hto = *value, *newhto;
+    struct HelloTypeNode **ref, *newnode;
+
+    if ((newhto = RedisModule_DefragAlloc(ctx,hto)) != NULL)
+        *value = hto = newhto;
+    ref = &hto->head;
+    while(*ref) {
+        if ((newnode = RedisModule_DefragAlloc(ctx,*ref)) != NULL)
+            *ref = newnode;
+        ref = &(*ref)->next;
+    }
+}
+
 /* This function must be present on each Redis module. It is used in order to
  * register the commands into the Redis server. */
 int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
@@ -264,7 +289,9 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
         .aof_rewrite = HelloTypeAofRewrite,
         .mem_usage = HelloTypeMemUsage,
         .free = HelloTypeFree,
-        .digest = HelloTypeDigest
+        .digest = HelloTypeDigest,
+        .defrag = HelloTypeDefrag,
+        .free_effort = HelloTypeFreeEffort
     };
 
     HelloType = RedisModule_CreateDataType(ctx,"hellotype",0,&tm);
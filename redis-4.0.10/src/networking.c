@@ -32,8 +32,13 @@
 #include <sys/uio.h>
 #include <math.h>
 #include <ctype.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-static void setProtocolError(const char *errstr, client *c, long pos);
+static void setProtocolError(const char *errstr, client *c);
+static void setupClientArgv(client *c, long argc);
+static void detachSharedQueryBuffer(client *c);
 
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
@@ -49,18 +54,68 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
     serverAssertWithInfo(NULL,o,o->type == OBJ_STRING);
     switch(o->encoding) {
     case OBJ_ENCODING_RAW: return sdsZmallocSize(o->ptr);
-    case OBJ_ENCODING_EMBSTR: return zmalloc_size(o)-sizeof(robj);
+    case OBJ_ENCODING_EMBSTR: return zslab_size(o)-sizeof(robj);
     default: return 0; /* Just integer encoding for now. */
     }
 }
 
+/* Buffer shared by the clients that have no pending partial command: data
+ * is read here and copied into a private c->querybuf only when a partial
+ * command is left after processing it, so that idle clients don't hold a
+ * query buffer at all. */
+static sds shared_querybuf = NULL;
+static int shared_querybuf_used = 0; /* Set while a client reads from it. */
+
+/* Free reply blocks ready to be reused. The pool is per thread since
+ * modules may build replies from their own threads using a thread safe
+ * context. */
+static __thread clientReplyBlock *reply_pool[PROTO_REPLY_POOL_BLOCKS];
+static __thread int reply_pool_len = 0;
+
+/* Return an empty reply block with room for at least 'size' bytes. Blocks
+ * that can hold a whole PROTO_REPLY_CHUNK_BYTES chunk are taken from the
+ * pool, while smaller ones are allocated with just the room requested (plus
+ * the allocator rounding) so that short replies overflowing the static
+ * buffer don't pin a full chunk. */
+clientReplyBlock *createReplyBlock(size_t size) {
+    clientReplyBlock *b;
+
+    if (size < PROTO_REPLY_CHUNK_BYTES-sizeof(clientReplyBlock)) {
+        b = zmalloc(sizeof(clientReplyBlock)+size);
+        b->size = zmalloc_usable(b)-sizeof(clientReplyBlock);
+    } else if (reply_pool_len) {
+        b = reply_pool[--reply_pool_len];
+    } else {
+        b = zmalloc(PROTO_REPLY_CHUNK_BYTES);
+        b->size = PROTO_REPLY_CHUNK_BYTES-sizeof(clientReplyBlock);
+    }
+    b->used = 0;
+    b->holes = 0;
+    b->pending = 0;
+    return b;
+}
+
+void freeReplyBlock(clientReplyBlock *b) {
+    if (b->size == PROTO_REPLY_CHUNK_BYTES-sizeof(clientReplyBlock) &&
+        reply_pool_len < PROTO_REPLY_POOL_BLOCKS)
+        reply_pool[reply_pool_len++] = b;
+    else
+        zfree(b);
+}
+
 /* Client.reply list dup and free methods. */
 void *dupClientReplyValue(void *o) {
-    return sdsdup(o);
+    clientReplyBlock *old = o, *b = createReplyBlock(old->used);
+    int j;
+
+    memcpy(b,old,sizeof(*old)+old->used);
+    for (j = 0; j < b->holes; j++)
+        if (b->hole[j].block) b->hole[j].block = b;
+    return b;
 }
 
 void freeClientReplyValue(void *o) {
-    sdsfree(o);
+    freeReplyBlock(o);
 }
 
 int listMatchObjects(void *a, void *b) {
@@ -95,12 +150,14 @@ client *createClient(int fd) {
     c->fd = fd;
     c->name = NULL;
     c->bufpos = 0;
-    c->querybuf = sdsempty();
+    c->querybuf = NULL;
     c->pending_querybuf = sdsempty();
     c->querybuf_peak = 0;
+    c->qb_pos = 0;
     c->reqtype = 0;
     c->argc = 0;
     c->argv = NULL;
+    memset(c->argv_cache,0,sizeof(c->argv_cache));
     c->cmd = c->lastcmd = NULL;
     c->multibulklen = 0;
     c->bulklen = -1;
@@ -221,86 +278,47 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
     return C_OK;
 }
 
-void _addReplyObjectToList(client *c, robj *o) {
-    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+/* Return the tail block of the reply list, appending a new one if the list
+ * is empty or the tail is full. 'len' is the number of bytes about to be
+ * appended: the first block of the list is sized to them when they fit in
+ * less than a chunk, the following ones are full chunks. */
+static clientReplyBlock *_replyTailBlock(client *c, size_t len) {
+    listNode *ln = listLast(c->reply);
+    clientReplyBlock *b = ln ? listNodeValue(ln) : NULL;
 
-    if (listLength(c->reply) == 0) {
-        sds s = sdsdup(o->ptr);
-        listAddNodeTail(c->reply,s);
-        c->reply_bytes += sdslen(s);
-    } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(o->ptr) <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatsds(tail,o->ptr);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(o->ptr);
-        } else {
-            sds s = sdsdup(o->ptr);
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
+    if (b == NULL || b->used == b->size) {
+        b = createReplyBlock(b == NULL ? len : PROTO_REPLY_CHUNK_BYTES);
+        listAddNodeTail(c->reply,b);
+        c->reply_bytes += b->size;
     }
-    asyncCloseClientOnOutputBufferLimitReached(c);
+    return b;
 }
 
-/* This method takes responsibility over the sds. When it is no longer
- * needed it will be free'd, otherwise it ends up in a robj. */
-void _addReplySdsToList(client *c, sds s) {
-    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-        sdsfree(s);
-        return;
-    }
+void _addReplyStringToList(client *c, const char *s, size_t len) {
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
-        listAddNodeTail(c->reply,s);
-        c->reply_bytes += sdslen(s);
-    } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(s) <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatsds(tail,s);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(s);
-            sdsfree(s);
-        } else {
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
+    /* Fill the tail block, spilling what does not fit into new blocks. */
+    while(len) {
+        clientReplyBlock *b = _replyTailBlock(c,len);
+        size_t avail = b->size - b->used;
+        size_t copy = len < avail ? len : avail;
+
+        memcpy(b->buf+b->used,s,copy);
+        b->used += copy;
+        s += copy;
+        len -= copy;
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
-void _addReplyStringToList(client *c, const char *s, size_t len) {
-    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+void _addReplyObjectToList(client *c, robj *o) {
+    _addReplyStringToList(c,o->ptr,sdslen(o->ptr));
+}
 
-    if (listLength(c->reply) == 0) {
-        sds node = sdsnewlen(s,len);
-        listAddNodeTail(c->reply,node);
-        c->reply_bytes += len;
-    } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+len <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatlen(tail,s,len);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += len;
-        } else {
-            sds node = sdsnewlen(s,len);
-            listAddNodeTail(c->reply,node);
-            c->reply_bytes += len;
-        }
-    }
-    asyncCloseClientOnOutputBufferLimitReached(c);
+/* This method takes responsibility over the sds and frees it. */
+void _addReplySdsToList(client *c, sds s) {
+    _addReplyStringToList(c,s,sdslen(s));
+    sdsfree(s);
 }
 
 /* -----------------------------------------------------------------------------
@@ -423,41 +441,62 @@ void addReplyStatusFormat(client *c, const char *fmt, ...) {
     sdsfree(s);
 }
 
-/* Adds an empty object to the reply list that will contain the multi bulk
- * length, which is not known when this function is called. */
+/* Reserves room for the multi bulk length, which is not known when this
+ * function is called, at the tail of the reply list. The returned handle is
+ * passed to setDeferredMultiBulkLength() once the length is known. */
 void *addDeferredMultiBulkLength(client *c) {
-    /* Note that we install the write event here even if the object is not
+    clientReplyBlock *b;
+    struct clientReplyHole *h;
+
+    /* Note that we install the write event here even if the length is not
      * ready to be sent, since we are sure that before returning to the
      * event loop setDeferredMultiBulkLength() will be called. */
     if (prepareClientToWrite(c) != C_OK) return NULL;
-    listAddNodeTail(c->reply,NULL); /* NULL is our placeholder. */
-    return listLast(c->reply);
+    b = _replyTailBlock(c,PROTO_REPLY_CHUNK_BYTES);
+    if (b->size - b->used < PROTO_REPLY_DEFERRED_RESERVE ||
+        b->holes == PROTO_REPLY_DEFERRED_HOLES)
+    {
+        b = createReplyBlock(PROTO_REPLY_CHUNK_BYTES);
+        listAddNodeTail(c->reply,b);
+        c->reply_bytes += b->size;
+    }
+    h = &b->hole[b->holes++];
+    h->block = b;
+    h->offset = b->used;
+    b->pending++;
+    b->used += PROTO_REPLY_DEFERRED_RESERVE;
+    return h;
 }
 
-/* Populate the length object and try gluing it to the next chunk. */
+/* Write the length in the reserved room, moving the rest of the block left
+ * to close the gap. */
 void setDeferredMultiBulkLength(client *c, void *node, long length) {
-    listNode *ln = (listNode*)node;
-    sds len, next;
+    struct clientReplyHole *h = node;
+    clientReplyBlock *b;
+    char *p;
+    size_t len, gap;
+    int j;
 
     /* Abort when *node is NULL: when the client should not accept writes
      * we return NULL in addDeferredMultiBulkLength() */
     if (node == NULL) return;
 
-    len = sdscatprintf(sdsnewlen("*",1),"%ld\r\n",length);
-    listNodeValue(ln) = len;
-    c->reply_bytes += sdslen(len);
-    if (ln->next != NULL) {
-        next = listNodeValue(ln->next);
-
-        /* Only glue when the next node is non-NULL (an sds in this case) */
-        if (next != NULL) {
-            len = sdscatsds(len,next);
-            listDelNode(c->reply,ln->next);
-            listNodeValue(ln) = len;
-            /* No need to update c->reply_bytes: we are just moving the same
-             * amount of bytes from one node to another. */
-        }
-    }
+    b = h->block;
+    p = b->buf+h->offset;
+    p[0] = '*';
+    len = 1+ll2string(p+1,PROTO_REPLY_DEFERRED_RESERVE-3,length);
+    p[len++] = '\r';
+    p[len++] = '\n';
+    gap = PROTO_REPLY_DEFERRED_RESERVE-len;
+    memmove(p+len,p+PROTO_REPLY_DEFERRED_RESERVE,
+            b->used-h->offset-PROTO_REPLY_DEFERRED_RESERVE);
+    b->used -= gap;
+    for (j = 0; j < b->holes; j++) {
+        if (b->hole[j].block && b->hole[j].offset > h->offset)
+            b->hole[j].offset -= gap;
+    }
+    h->block = NULL;
+    if (--b->pending == 0) b->holes = 0;
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
@@ -719,12 +758,39 @@ void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 
 static void freeClientArgv(client *c) {
     int j;
-    for (j = 0; j < c->argc; j++)
-        decrRefCount(c->argv[j]);
+    for (j = 0; j < c->argc; j++) {
+        robj *o = c->argv[j];
+
+        /* Keep small string objects we are the only owner of, so that
+         * createClientArgvObject() can recycle them for the argument in the
+         * same position of the next command, like the Lua client does. */
+        if (j < PROTO_ARGV_CACHE_SIZE &&
+            o->refcount == 1 &&
+            (o->encoding == OBJ_ENCODING_RAW ||
+             o->encoding == OBJ_ENCODING_EMBSTR) &&
+            sdsalloc(o->ptr) <= PROTO_ARGV_CACHE_MAX_LEN)
+        {
+            if (c->argv_cache[j]) decrRefCount(c->argv_cache[j]);
+            c->argv_cache[j] = o;
+        } else {
+            decrRefCount(o);
+        }
+    }
     c->argc = 0;
     c->cmd = NULL;
 }
 
+/* Release the objects cached by freeClientArgv(). */
+void freeClientArgvCache(client *c) {
+    int j;
+    for (j = 0; j < PROTO_ARGV_CACHE_SIZE; j++) {
+        if (c->argv_cache[j]) {
+            decrRefCount(c->argv_cache[j]);
+            c->argv_cache[j] = NULL;
+        }
+    }
+}
+
 /* Close all the slaves connections. This is useful in chained replication
  * when we resync with our own master and want to force all our slaves to
  * resync with us as well. */
@@ -781,6 +847,14 @@ void unlinkClient(client *c) {
 void freeClient(client *c) {
     listNode *ln;
 
+    /* The client running a script can be killed or disconnected while the
+     * script timed out or yielded, and the events are processed. The EVAL
+     * command is still running on behalf of it: free it later. */
+    if (c == server.lua_caller) {
+        freeClientAsync(c);
+        return;
+    }
+
     /* If it is our master that's beging disconnected we should make sure
      * to cache the state to try a partial resynchronization later.
      *
@@ -798,6 +872,13 @@ void freeClient(client *c) {
         }
     }
 
+    /* The commands of the client may be executing, see processInputBuffer():
+     * free it once they return. */
+    if (c->flags & CLIENT_PROCESSING_INPUT) {
+        freeClientAsync(c);
+        return;
+    }
+
     /* Log link disconnection with slave */
     if ((c->flags & CLIENT_SLAVE) && !(c->flags & CLIENT_MONITOR)) {
         serverLog(LL_WARNING,"Connection with slave %s lost.",
@@ -805,7 +886,12 @@ void freeClient(client *c) {
     }
 
     /* Free the query buffer */
-    sdsfree(c->querybuf);
+    if (c->querybuf == shared_querybuf) {
+        sdsclear(shared_querybuf);
+        shared_querybuf_used = 0;
+    } else {
+        sdsfree(c->querybuf);
+    }
     sdsfree(c->pending_querybuf);
     c->querybuf = NULL;
 
@@ -826,6 +912,7 @@ void freeClient(client *c) {
     /* Free data structures. */
     listRelease(c->reply);
     freeClientArgv(c);
+    freeClientArgvCache(c);
 
     /* Unlink the client: this will close the socket, remove the I/O
      * handlers, and remove references of the client from different
@@ -883,10 +970,17 @@ void freeClientAsync(client *c) {
 }
 
 void freeClientsInAsyncFreeQueue(void) {
-    while (listLength(server.clients_to_close)) {
-        listNode *ln = listFirst(server.clients_to_close);
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.clients_to_close,&li);
+    while ((ln = listNext(&li)) != NULL) {
         client *c = listNodeValue(ln);
 
+        /* The cron runs while a script yields: the clients whose commands
+         * are still executing stay in the queue, see freeClient(). */
+        if (c == server.lua_caller || c->flags & CLIENT_PROCESSING_INPUT)
+            continue;
         c->flags &= ~CLIENT_CLOSE_ASAP;
         freeClient(c);
         listDelNode(server.clients_to_close,ln);
@@ -898,7 +992,7 @@ void freeClientsInAsyncFreeQueue(void) {
 int writeToClient(int fd, client *c, int handler_installed) {
     ssize_t nwritten = 0, totwritten = 0;
     size_t objlen;
-    sds o;
+    clientReplyBlock *o;
 
     while(clientHasPendingReplies(c)) {
         if (c->bufpos > 0) {
@@ -915,23 +1009,24 @@ int writeToClient(int fd, client *c, int handler_installed) {
             }
         } else {
             o = listNodeValue(listFirst(c->reply));
-            objlen = sdslen(o);
+            objlen = o->used;
 
             if (objlen == 0) {
+                c->reply_bytes -= o->size;
                 listDelNode(c->reply,listFirst(c->reply));
                 continue;
             }
 
-            nwritten = write(fd, o + c->sentlen, objlen - c->sentlen);
+            nwritten = write(fd, o->buf + c->sentlen, objlen - c->sentlen);
             if (nwritten <= 0) break;
             c->sentlen += nwritten;
             totwritten += nwritten;
 
-            /* If we fully sent the object on head go to the next one */
+            /* If we fully sent the block on head go to the next one */
             if (c->sentlen == objlen) {
+                c->reply_bytes -= o->size;
                 listDelNode(c->reply,listFirst(c->reply));
                 c->sentlen = 0;
-                c->reply_bytes -= objlen;
                 /* If there are no longer objects in the list, we expect
                  * the count of reply bytes to be exactly zero. */
                 if (listLength(c->reply) == 0)
@@ -1073,29 +1168,29 @@ int processInlineBuffer(client *c) {
     size_t querylen;
 
     /* Search for end of line */
-    newline = strchr(c->querybuf,'\n');
+    newline = strchr(c->querybuf+c->qb_pos,'\n');
 
     /* Nothing to do without a \r\n */
     if (newline == NULL) {
-        if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+        if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
             addReplyError(c,"Protocol error: too big inline request");
-            setProtocolError("too big inline request",c,0);
+            setProtocolError("too big inline request",c);
         }
         return C_ERR;
     }
 
     /* Handle the \r\n case. */
-    if (newline && newline != c->querybuf && *(newline-1) == '\r')
+    if (newline && newline != c->querybuf+c->qb_pos && *(newline-1) == '\r')
         newline--;
 
     /* Split the input buffer up to the \r\n */
-    querylen = newline-(c->querybuf);
-    aux = sdsnewlen(c->querybuf,querylen);
+    querylen = newline-(c->querybuf+c->qb_pos);
+    aux = sdsnewlen(c->querybuf+c->qb_pos,querylen);
     argv = sdssplitargs(aux,&argc);
     sdsfree(aux);
     if (argv == NULL) {
         addReplyError(c,"Protocol error: unbalanced quotes in request");
-        setProtocolError("unbalanced quotes in inline request",c,0);
+        setProtocolError("unbalanced quotes in inline request",c);
         return C_ERR;
     }
 
@@ -1105,14 +1200,11 @@ int processInlineBuffer(client *c) {
     if (querylen == 0 && c->flags & CLIENT_SLAVE)
         c->repl_ack_time = server.unixtime;
 
-    /* Leave data after the first line of the query in the buffer */
-    sdsrange(c->querybuf,querylen+2,-1);
+    /* Move querybuffer position to the next query in the buffer. */
+    c->qb_pos += querylen+2;
 
     /* Setup argv array on client structure */
-    if (argc) {
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*argc);
-    }
+    if (argc) setupClientArgv(c,argc);
 
     /* Create redis objects for all arguments. */
     for (c->argc = 0, j = 0; j < argc; j++) {
@@ -1127,19 +1219,21 @@ int processInlineBuffer(client *c) {
     return C_OK;
 }
 
-/* Helper function. Trims query buffer to make the function that processes
- * multi bulk requests idempotent. */
+/* Helper function. Logs the protocol error and flags the client to be
+ * closed once the error is sent. */
 #define PROTO_DUMP_LEN 128
-static void setProtocolError(const char *errstr, client *c, long pos) {
+static void setProtocolError(const char *errstr, client *c) {
     if (server.verbosity <= LL_VERBOSE) {
         sds client = catClientInfoString(sdsempty(),c);
+        char *query = c->querybuf+c->qb_pos;
+        size_t querylen = sdslen(c->querybuf)-c->qb_pos;
 
         /* Sample some protocol to given an idea about what was inside. */
         char buf[256];
-        if (sdslen(c->querybuf) < PROTO_DUMP_LEN) {
-            snprintf(buf,sizeof(buf),"Query buffer during protocol error: '%s'", c->querybuf);
+        if (querylen < PROTO_DUMP_LEN) {
+            snprintf(buf,sizeof(buf),"Query buffer during protocol error: '%s'", query);
         } else {
-            snprintf(buf,sizeof(buf),"Query buffer during protocol error: '%.*s' (... more %zu bytes ...) '%.*s'", PROTO_DUMP_LEN/2, c->querybuf, sdslen(c->querybuf)-PROTO_DUMP_LEN, PROTO_DUMP_LEN/2, c->querybuf+sdslen(c->querybuf)-PROTO_DUMP_LEN/2);
+            snprintf(buf,sizeof(buf),"Query buffer during protocol error: '%.*s' (... more %zu bytes ...) '%.*s'", PROTO_DUMP_LEN/2, query, querylen-PROTO_DUMP_LEN, PROTO_DUMP_LEN/2, query+querylen-PROTO_DUMP_LEN/2);
         }
 
         /* Remove non printable chars. */
@@ -1155,7 +1249,96 @@ static void setProtocolError(const char *errstr, client *c, long pos) {
         sdsfree(client);
     }
     c->flags |= CLIENT_CLOSE_AFTER_REPLY;
-    sdsrange(c->querybuf,pos,-1);
+}
+
+/* Make sure the client argv array can hold 'argc' arguments. The array of
+ * the previous command is reused when it is large enough, but not more than
+ * twice as large. */
+static void setupClientArgv(client *c, long argc) {
+    size_t size = sizeof(robj*)*argc;
+
+    if (c->argv) {
+        size_t usable = zmalloc_usable(c->argv);
+        if (usable >= size && usable/2 <= size) return;
+        zfree(c->argv);
+    }
+    c->argv = zmalloc(size);
+}
+
+/* Create the object for the argument 'j' of the command being parsed. The
+ * object freeClientArgv() cached for the same position is used if it can
+ * hold the string without wasting more than a few bytes, since a command
+ * may keep the object, as SET does with its value. */
+static robj *createClientArgvObject(client *c, int j, const char *ptr,
+                                    size_t len)
+{
+    robj *o = j < PROTO_ARGV_CACHE_SIZE ? c->argv_cache[j] : NULL;
+
+    if (o && sdsalloc(o->ptr) >= len && sdsalloc(o->ptr)-len < 16) {
+        sds s = o->ptr;
+
+        c->argv_cache[j] = NULL;
+        memcpy(s,ptr,len);
+        s[len] = '\0';
+        sdssetlen(s,len);
+        initObjectLRUOrLFU(o);
+        return o;
+    }
+    return createStringObject(ptr,len);
+}
+
+/* Return a pointer to the first '\r' in the 'len' bytes at 'p', or NULL.
+ * Protocol headers are short, so with SSE2 the delimiter is usually found
+ * by the first 16 bytes comparison, without the cost of calling memchr(). */
+static inline char *protoFindCR(const char *p, size_t len) {
+#if defined(__SSE2__)
+    const __m128i cr = _mm_set1_epi8('\r');
+
+    while (len >= 16) {
+        int mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p),cr));
+        if (mask) return (char*)p+__builtin_ctz(mask);
+        p += 16;
+        len -= 16;
+    }
+    while (len--) {
+        if (*p == '\r') return (char*)p;
+        p++;
+    }
+    return NULL;
+#else
+    return memchr(p,'\r',len);
+#endif
+}
+
+/* Parse the length of a multi bulk or bulk header, accepting exactly what
+ * string2ll() accepts. Since lengths are short, numbers with more than 18
+ * digits are refused, so that overflows don't need to be checked: they
+ * would be refused anyway as too large. */
+static inline int protoParseLength(const char *p, size_t len,
+                                   long long *value)
+{
+    int negative = 0;
+    long long v = 0;
+
+    if (len && *p == '-') {
+        negative = 1;
+        p++;
+        len--;
+    }
+    if (len == 0 || len > 18) return 0;
+    if (*p == '0') {
+        if (len != 1 || negative) return 0;
+        *value = 0;
+        return 1;
+    }
+    while (len--) {
+        unsigned int digit = (unsigned char)*p++ - '0';
+        if (digit > 9) return 0;
+        v = v*10+digit;
+    }
+    *value = negative ? -v : v;
+    return 1;
 }
 
 /* Process the query buffer for client 'c', setting up the client argument
@@ -1171,7 +1354,6 @@ static void setProtocolError(const char *errstr, client *c, long pos) {
  * to be '*'. Otherwise for inline commands processInlineBuffer() is called. */
 int processMultibulkBuffer(client *c) {
     char *newline = NULL;
-    long pos = 0;
     int ok;
     long long ll;
 
@@ -1180,11 +1362,12 @@ int processMultibulkBuffer(client *c) {
         serverAssertWithInfo(c,NULL,c->argc == 0);
 
         /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf,'\r');
+        newline = protoFindCR(c->querybuf+c->qb_pos,
+                              sdslen(c->querybuf)-c->qb_pos);
         if (newline == NULL) {
-            if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+            if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                 addReplyError(c,"Protocol error: too big mbulk count string");
-                setProtocolError("too big mbulk count string",c,0);
+                setProtocolError("too big mbulk count string",c);
             }
             return C_ERR;
         }
@@ -1195,37 +1378,35 @@ int processMultibulkBuffer(client *c) {
 
         /* We know for sure there is a whole line since newline != NULL,
          * so go ahead and find out the multi bulk length. */
-        serverAssertWithInfo(c,NULL,c->querybuf[0] == '*');
-        ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
+        serverAssertWithInfo(c,NULL,c->querybuf[c->qb_pos] == '*');
+        ok = protoParseLength(c->querybuf+c->qb_pos+1,
+                              newline-(c->querybuf+c->qb_pos+1),&ll);
         if (!ok || ll > 1024*1024) {
             addReplyError(c,"Protocol error: invalid multibulk length");
-            setProtocolError("invalid mbulk count",c,pos);
+            setProtocolError("invalid mbulk count",c);
             return C_ERR;
         }
 
-        pos = (newline-c->querybuf)+2;
-        if (ll <= 0) {
-            sdsrange(c->querybuf,pos,-1);
-            return C_OK;
-        }
+        c->qb_pos = (newline-c->querybuf)+2;
+        if (ll <= 0) return C_OK;
 
         c->multibulklen = ll;
 
         /* Setup argv array on client structure */
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
+        setupClientArgv(c,c->multibulklen);
     }
 
     serverAssertWithInfo(c,NULL,c->multibulklen > 0);
     while(c->multibulklen) {
         /* Read bulk length if unknown */
         if (c->bulklen == -1) {
-            newline = strchr(c->querybuf+pos,'\r');
+            newline = protoFindCR(c->querybuf+c->qb_pos,
+                                  sdslen(c->querybuf)-c->qb_pos);
             if (newline == NULL) {
-                if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+                if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                     addReplyError(c,
                         "Protocol error: too big bulk count string");
-                    setProtocolError("too big bulk count string",c,0);
+                    setProtocolError("too big bulk count string",c);
                     return C_ERR;
                 }
                 break;
@@ -1235,22 +1416,23 @@ int processMultibulkBuffer(client *c) {
             if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
                 break;
 
-            if (c->querybuf[pos] != '$') {
+            if (c->querybuf[c->qb_pos] != '$') {
                 addReplyErrorFormat(c,
                     "Protocol error: expected '$', got '%c'",
-                    c->querybuf[pos]);
-                setProtocolError("expected $ but got something else",c,pos);
+                    c->querybuf[c->qb_pos]);
+                setProtocolError("expected $ but got something else",c);
                 return C_ERR;
             }
 
-            ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
+            ok = protoParseLength(c->querybuf+c->qb_pos+1,
+                                  newline-(c->querybuf+c->qb_pos+1),&ll);
             if (!ok || ll < 0 || ll > server.proto_max_bulk_len) {
                 addReplyError(c,"Protocol error: invalid bulk length");
-                setProtocolError("invalid bulk length",c,pos);
+                setProtocolError("invalid bulk length",c);
                 return C_ERR;
             }
 
-            pos += newline-(c->querybuf+pos)+2;
+            c->qb_pos = newline-c->querybuf+2;
             if (ll >= PROTO_MBULK_BIG_ARG) {
                 size_t qblen;
 
@@ -1258,26 +1440,42 @@ int processMultibulkBuffer(client *c) {
                  * try to make it likely that it will start at c->querybuf
                  * boundary so that we can optimize object creation
                  * avoiding a large copy of data. */
-                sdsrange(c->querybuf,pos,-1);
-                pos = 0;
+                if (c->querybuf == shared_querybuf) {
+                    detachSharedQueryBuffer(c);
+                    if (c->querybuf == NULL) c->querybuf = sdsempty();
+                }
+                sdsrange(c->querybuf,c->qb_pos,-1);
+                c->qb_pos = 0;
                 qblen = sdslen(c->querybuf);
                 /* Hint the sds library about the amount of bytes this string is
-                 * going to contain. */
-                if (qblen < (size_t)ll+2)
-                    c->querybuf = sdsMakeRoomFor(c->querybuf,ll+2-qblen);
+                 * going to contain. The buffer will likely become the value
+                 * of a key: move it to the huge pages arena when it would
+                 * be allocated there, see zmalloc_huge(). */
+                if (qblen < (size_t)ll+2) {
+                    if (zmalloc_huge_enabled(sdsReqSize(ll+2))) {
+                        sds qb = sdsnewlenhuge(NULL,ll+2);
+
+                        memcpy(qb,c->querybuf,qblen);
+                        sdssetlen(qb,qblen);
+                        sdsfree(c->querybuf);
+                        c->querybuf = qb;
+                    } else {
+                        c->querybuf = sdsMakeRoomFor(c->querybuf,ll+2-qblen);
+                    }
+                }
             }
             c->bulklen = ll;
         }
 
         /* Read bulk argument */
-        if (sdslen(c->querybuf)-pos < (size_t)(c->bulklen+2)) {
+        if (sdslen(c->querybuf)-c->qb_pos < (size_t)(c->bulklen+2)) {
             /* Not enough data (+2 == trailing \r\n) */
             break;
         } else {
             /* Optimization: if the buffer contains JUST our bulk element
              * instead of creating a new object by *copying* the sds we
              * just use the current sds string. */
-            if (pos == 0 &&
+            if (c->qb_pos == 0 &&
                 c->bulklen >= PROTO_MBULK_BIG_ARG &&
                 sdslen(c->querybuf) == (size_t)(c->bulklen+2))
             {
@@ -1285,22 +1483,19 @@ int processMultibulkBuffer(client *c) {
                 sdsIncrLen(c->querybuf,-2); /* remove CRLF */
                 /* Assume that if we saw a fat argument we'll see another one
                  * likely... */
-                c->querybuf = sdsnewlen(NULL,c->bulklen+2);
+                c->querybuf = sdsnewlenhuge(NULL,c->bulklen+2);
                 sdsclear(c->querybuf);
-                pos = 0;
             } else {
-                c->argv[c->argc++] =
-                    createStringObject(c->querybuf+pos,c->bulklen);
-                pos += c->bulklen+2;
+                c->argv[c->argc] = createClientArgvObject(c,c->argc,
+                    c->querybuf+c->qb_pos,c->bulklen);
+                c->argc++;
+                c->qb_pos += c->bulklen+2;
             }
             c->bulklen = -1;
             c->multibulklen--;
         }
     }
 
-    /* Trim to pos */
-    if (pos) sdsrange(c->querybuf,pos,-1);
-
     /* We're done when c->multibulk == 0 */
     if (c->multibulklen == 0) return C_OK;
 
@@ -1308,14 +1503,121 @@ int processMultibulkBuffer(client *c) {
     return C_ERR;
 }
 
+/* Return the length of the complete multi bulk request at the start of the
+ * 'len' bytes at 'p', setting '*argc' and the pointers and lengths of the
+ * arguments inside the buffer. Zero is returned if the request is not
+ * complete yet, has more than 'maxargs' arguments, or is not valid: errors
+ * are reported later by processMultibulkBuffer(). */
+static size_t peekMultibulkRequest(const char *p, size_t len, int maxargs,
+                                   int *argc, const char **argv,
+                                   size_t *argvlen)
+{
+    const char *start = p, *end = p+len, *newline;
+    long long ll;
+    int j;
+
+    if (len == 0 || *p != '*') return 0;
+    newline = protoFindCR(p,len);
+    if (newline == NULL || !protoParseLength(p+1,newline-(p+1),&ll) ||
+        ll <= 0 || ll > maxargs) return 0;
+    *argc = ll;
+    p = newline+2;
+
+    for (j = 0; j < *argc; j++) {
+        if (p >= end || *p != '$') return 0;
+        newline = protoFindCR(p,end-p);
+        if (newline == NULL || !protoParseLength(p+1,newline-(p+1),&ll) ||
+            ll < 0 || ll > server.proto_max_bulk_len) return 0;
+        p = newline+2;
+        if (p > end || (size_t)(end-p) < (size_t)ll+2) return 0;
+        argv[j] = p;
+        argvlen[j] = ll;
+        p += ll+2;
+    }
+    return p-start;
+}
+
+/* Pipelines are often made of many GET or SET commands. If the query buffer
+ * starts with one of them followed by other complete commands with the same
+ * name, return how many they are, up to PROTO_BATCH_MAX, and set '*cmd'.
+ * Otherwise zero is returned.
+ *
+ * The keys of the batch are prefetched, so that the lookups done by the
+ * commands don't stall on cache misses one after the other, and only
+ * the first command of the batch needs to go through processCommand(), see
+ * processInputBuffer(). */
+static int prefetchCommandBatch(client *c, struct redisCommand **cmd) {
+    const char *argv[3], *name = NULL;
+    size_t argvlen[3], len, namelen = 0, pos = 0;
+    int argc, wantargc = 0, count = 0;
+    uint64_t hashes[PROTO_BATCH_MAX];
+
+    while (count < PROTO_BATCH_MAX &&
+           (len = peekMultibulkRequest(c->querybuf+c->qb_pos+pos,
+                                       sdslen(c->querybuf)-c->qb_pos-pos,3,
+                                       &argc,argv,argvlen)) != 0)
+    {
+        if (count == 0) {
+            *cmd = lookupCommandByName(argv[0],argvlen[0]);
+            if (*cmd == NULL) return 0;
+            if ((*cmd)->proc == getCommand) wantargc = 2;
+            else if ((*cmd)->proc == setCommand) wantargc = 3;
+            else return 0;
+            name = argv[0];
+            namelen = argvlen[0];
+        } else if (argvlen[0] != namelen ||
+                   strncasecmp(argv[0],name,namelen))
+        {
+            break;
+        }
+        if (argc != wantargc) break;
+
+        hashes[count++] = dictGenHashFunction(argv[1],argvlen[1]);
+        pos += len;
+    }
+    if (count < 2) return 0;
+    dbPrefetchHashes(c->db,hashes,count);
+    return count;
+}
+
+/* Move the unprocessed part of the shared query buffer to a private query
+ * buffer owned by the client. */
+static void detachSharedQueryBuffer(client *c) {
+    if (c->qb_pos < sdslen(shared_querybuf))
+        c->querybuf = sdsnewlen(shared_querybuf+c->qb_pos,
+                                sdslen(shared_querybuf)-c->qb_pos);
+    else
+        c->querybuf = NULL;
+    c->qb_pos = 0;
+    sdsclear(shared_querybuf);
+    shared_querybuf_used = 0;
+}
+
+/* Return true if the client is reading from the shared query buffer, that
+ * must not be resized or freed on behalf of the client. */
+int clientQueryBufferIsShared(client *c) {
+    return c->querybuf != NULL && c->querybuf == shared_querybuf;
+}
+
 /* This function is called every time, in the client structure 'c', there is
  * more query buffer to process, because we read more data from the socket
  * or because a client was blocked and later reactivated, so there could be
  * pending query buffer, already representing a full command, to process. */
 void processInputBuffer(client *c) {
+    struct redisCommand *batchcmd = NULL;
+    int batchleft = 0, batchvalid = 0;
+    /* Scripts and modules may process events while running a command,
+     * so this function can be called for a client while the commands of
+     * another one are executing. */
+    client *prev_client = server.current_client;
+
+    /* While its commands execute the client is never freed, only closed
+     * asynchronously, so it is always there when they return. */
+    if (c->flags & CLIENT_PROCESSING_INPUT) return;
+    c->flags |= CLIENT_PROCESSING_INPUT;
     server.current_client = c;
     /* Keep processing while there is something in the input buffer */
-    while(sdslen(c->querybuf)) {
+    while(c->qb_pos < sdslen(c->querybuf)) {
         /* Return if clients are paused. */
         if (!(c->flags & CLIENT_SLAVE) && clientsArePaused()) break;
 
@@ -1331,13 +1633,24 @@ void processInputBuffer(client *c) {
 
         /* Determine request type when unknown. */
         if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
+            if (c->querybuf[c->qb_pos] == '*') {
                 c->reqtype = PROTO_REQ_MULTIBULK;
             } else {
                 c->reqtype = PROTO_REQ_INLINE;
             }
         }
 
+        /* Look for a batch of GET or SET commands at the start of every
+         * command outside of a batch. Cluster mode is excluded since every
+         * key may be redirected, and so are transactions. */
+        if (batchleft == 0 && c->reqtype == PROTO_REQ_MULTIBULK &&
+            c->multibulklen == 0 && !server.cluster_enabled &&
+            !(c->flags & CLIENT_MULTI))
+        {
+            batchleft = prefetchCommandBatch(c,&batchcmd);
+            batchvalid = 0;
+        }
+
         if (c->reqtype == PROTO_REQ_INLINE) {
             if (processInlineBuffer(c) != C_OK) break;
         } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
@@ -1350,11 +1663,27 @@ void processInputBuffer(client *c) {
         if (c->argc == 0) {
             resetClient(c);
         } else {
+            int retval;
+
+            if (batchvalid) {
+                retval = processBatchedCommand(c,batchcmd);
+            } else {
+                long long numcommands = server.stat_numcommands;
+
+                retval = processCommand(c);
+                /* If the command was executed all the checks done by
+                 * processCommand() passed: they hold for the rest of the
+                 * batch, since GET and SET can't change their outcome. */
+                if (batchleft && server.stat_numcommands != numcommands)
+                    batchvalid = 1;
+            }
+            if (batchleft && --batchleft == 0) batchvalid = 0;
+
             /* Only reset the client when the command was executed. */
-            if (processCommand(c) == C_OK) {
+            if (retval == C_OK) {
                 if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
                     /* Update the applied replication offset of our master. */
-                    c->reploff = c->read_reploff - sdslen(c->querybuf);
+                    c->reploff = c->read_reploff - sdslen(c->querybuf) + c->qb_pos;
                 }
 
                 /* Don't reset the client structure for clients blocked in a
@@ -1364,13 +1693,28 @@ void processInputBuffer(client *c) {
                 if (!(c->flags & CLIENT_BLOCKED) || c->btype != BLOCKED_MODULE)
                     resetClient(c);
             }
-            /* freeMemoryIfNeeded may flush slave output buffers. This may
-             * result into a slave, that may be the active client, to be
-             * freed. */
-            if (server.current_client == NULL) break;
         }
     }
-    server.current_client = NULL;
+
+    /* Trim to pos. A client reading from the shared buffer keeps just its
+     * partial command, if any, in a private buffer: the shared buffer is
+     * always given back before returning. */
+    if (c->querybuf == shared_querybuf) {
+        detachSharedQueryBuffer(c);
+    } else if (c->qb_pos == sdslen(c->querybuf) &&
+               c->multibulklen == 0 && !(c->flags & CLIENT_MASTER) &&
+               c->querybuf_peak < PROTO_MBULK_BIG_ARG)
+    {
+        /* The pending command was completed. Buffers that recently
+         * held big arguments are kept, as more are likely to follow. */
+        sdsfree(c->querybuf);
+        c->querybuf = NULL;
+    } else if (c->qb_pos) {
+        sdsrange(c->querybuf,c->qb_pos,-1);
+    }
+    c->qb_pos = 0;
+    c->flags &= ~CLIENT_PROCESSING_INPUT;
+    server.current_client = prev_client;
 }
 
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -1380,6 +1724,10 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(el);
     UNUSED(mask);
 
+    /* The client is executing a command that processes events: read the
+     * new data when it returns, its query buffer is still in use. */
+    if (c->flags & CLIENT_PROCESSING_INPUT) return;
+
     readlen = PROTO_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
@@ -1395,10 +1743,30 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         if (remaining < readlen) readlen = remaining;
     }
 
+    /* Clients with no partial command pending read into the shared buffer.
+     * The master always keeps its own buffer, and so does a client read
+     * while another one still owns the shared buffer, that happens when
+     * events are processed during a slow script or module command. */
+    if (c->querybuf == NULL) {
+        if (c->flags & CLIENT_MASTER || shared_querybuf_used) {
+            c->querybuf = sdsempty();
+        } else {
+            if (shared_querybuf == NULL)
+                shared_querybuf = sdsMakeRoomFor(sdsempty(),PROTO_IOBUF_LEN);
+            shared_querybuf_used = 1;
+            c->querybuf = shared_querybuf;
+        }
+    }
+
     qblen = sdslen(c->querybuf);
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
-    c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
+    if (c->querybuf != shared_querybuf)
+        c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
+    else
+        serverAssert(sdsavail(c->querybuf) >= (size_t)readlen);
     nread = read(fd, c->querybuf+qblen, readlen);
+    if (nread <= 0 && c->querybuf == shared_querybuf)
+        detachSharedQueryBuffer(c);
     if (nread == -1) {
         if (errno == EAGAIN) {
             return;
@@ -1466,7 +1834,8 @@ void getClientsMaxBuffers(unsigned long *longest_output_list,
         c = listNodeValue(ln);
 
         if (listLength(c->reply) > lol) lol = listLength(c->reply);
-        if (sdslen(c->querybuf) > bib) bib = sdslen(c->querybuf);
+        if (c->querybuf && sdslen(c->querybuf) > bib)
+            bib = sdslen(c->querybuf);
     }
     *longest_output_list = lol;
     *biggest_input_buffer = bib;
@@ -1551,8 +1920,11 @@ sds catClientInfoString(sds s, client *client) {
         (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
         (client->flags & CLIENT_MULTI) ? client->mstate.count : -1,
-        (unsigned long long) sdslen(client->querybuf),
-        (unsigned long long) sdsavail(client->querybuf),
+        (unsigned long long) (client->querybuf ?
+            sdslen(client->querybuf)-client->qb_pos : 0),
+        (unsigned long long) (client->querybuf &&
+            client->querybuf != shared_querybuf ?
+            sdsavail(client->querybuf) : 0),
         (unsigned long long) client->bufpos,
         (unsigned long long) listLength(client->reply),
         (unsigned long long) getClientOutputBufferMemoryUsage(client),
@@ -1835,9 +2207,7 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
  * the caller wishes. The main usage of this function currently is
  * enforcing the client output length limits. */
 unsigned long getClientOutputBufferMemoryUsage(client *c) {
-    unsigned long list_item_size = sizeof(listNode)+5;
-    /* The +5 above means we assume an sds16 hdr, may not be true
-     * but is not going to be a problem. */
+    unsigned long list_item_size = sizeof(listNode)+sizeof(clientReplyBlock);
 
     return c->reply_bytes + (list_item_size*listLength(c->reply));
 }
@@ -2044,3 +2414,27 @@ int processEventsWhileBlocked(void) {
     }
     return count;
 }
+
+/* Like processEventsWhileBlocked(), for a script that yields to the other
+ * clients, see luaYield(). Since the script can yield for a long time, this
+ * is more like a turn of the event loop: the AOF is written before replying,
+ * like in beforeSleep(), so that with appendfsync always the writes are not
+ * acknowledged before they are on disk, and serverCron() runs when due, for
+ * active expire, the clients timeouts, persistence and replication. */
+int processEventsWhileYielding(void) {
+    int iterations = 4; /* See processEventsWhileBlocked(). */
+    int count = 0;
+
+    server.lua_yielding = 1;
+    while (iterations--) {
+        int events = 0;
+        events += aeProcessEvents(server.el,
+                                  AE_FILE_EVENTS|AE_TIME_EVENTS|AE_DONT_WAIT);
+        flushAppendOnlyFile(0);
+        events += handleClientsWithPendingWrites();
+        if (!events) break;
+        count += events;
+    }
+    server.lua_yielding = 0;
+    return count;
+}
@@ -38,21 +38,40 @@
 
 /* ===================== Creation and parsing of objects ==================== */
 
+/* Objects are allocated from slabs: plain objects from the first one, and
+ * EMBSTR objects, that embed a string of up to
+ * OBJ_ENCODING_EMBSTR_SIZE_LIMIT bytes, from the one of their size rounded
+ * to 8 bytes. Every object is then released with zslab_free(), even if its
+ * encoding changed after creation. */
+#define OBJ_SLAB_SIZE(j) (sizeof(robj)+(j)*8)
+static zslab object_slabs[] = {
+    ZSLAB_INIT("robj",OBJ_SLAB_SIZE(0)),
+    ZSLAB_INIT("robj-embstr-24",OBJ_SLAB_SIZE(1)),
+    ZSLAB_INIT("robj-embstr-32",OBJ_SLAB_SIZE(2)),
+    ZSLAB_INIT("robj-embstr-40",OBJ_SLAB_SIZE(3)),
+    ZSLAB_INIT("robj-embstr-48",OBJ_SLAB_SIZE(4)),
+    ZSLAB_INIT("robj-embstr-56",OBJ_SLAB_SIZE(5)),
+    ZSLAB_INIT("robj-embstr-64",OBJ_SLAB_SIZE(6))
+};
+
 robj *createObject(int type, void *ptr) {
-    robj *o = zmalloc(sizeof(*o));
+    robj *o = zslab_malloc(&object_slabs[0]);
     o->type = type;
     o->encoding = OBJ_ENCODING_RAW;
     o->ptr = ptr;
     o->refcount = 1;
+    initObjectLRUOrLFU(o);
+    return o;
+}
 
-    /* Set the LRU to the current lruclock (minutes resolution), or
-     * alternatively the LFU counter. */
+/* Set the LRU to the current lruclock (minutes resolution), or
+ * alternatively the LFU counter. */
+void initObjectLRUOrLFU(robj *o) {
     if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
         o->lru = (LFUGetTimeInMinutes()<<8) | LFU_INIT_VAL;
     } else {
         o->lru = LRU_CLOCK();
     }
-    return o;
 }
 
 /* Set a special refcount in the object to make it "shared":
@@ -82,18 +101,19 @@ robj *createRawStringObject(const char *ptr, size_t len) {
  * an object where the sds string is actually an unmodifiable string
  * allocated in the same chunk as the object itself. */
 robj *createEmbeddedStringObject(const char *ptr, size_t len) {
-    robj *o = zmalloc(sizeof(robj)+sizeof(struct sdshdr8)+len+1);
-    struct sdshdr8 *sh = (void*)(o+1);
+    size_t slab = (sizeof(struct sdshdr8)+len+1+7)/8;
+    robj *o;
+    struct sdshdr8 *sh;
+
+    serverAssert(slab < sizeof(object_slabs)/sizeof(object_slabs[0]));
+    o = zslab_malloc(&object_slabs[slab]);
+    sh = (void*)(o+1);
 
     o->type = OBJ_STRING;
     o->encoding = OBJ_ENCODING_EMBSTR;
     o->ptr = sh+1;
     o->refcount = 1;
-    if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-        o->lru = (LFUGetTimeInMinutes()<<8) | LFU_INIT_VAL;
-    } else {
-        o->lru = LRU_CLOCK();
-    }
+    initObjectLRUOrLFU(o);
 
     sh->len = len;
     sh->alloc = len;
@@ -207,10 +227,17 @@ robj *createIntsetObject(void) {
     return o;
 }
 
+robj *createRoaringObject(void) {
+    roaring *r = roaringNew();
+    robj *o = createObject(OBJ_SET,r);
+    o->encoding = OBJ_ENCODING_ROARING;
+    return o;
+}
+
 robj *createHashObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_HASH, zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    unsigned char *lp = lpNew();
+    robj *o = createObject(OBJ_HASH, lp);
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -261,6 +288,9 @@ void freeSetObject(robj *o) {
     case OBJ_ENCODING_INTSET:
         zfree(o->ptr);
         break;
+    case OBJ_ENCODING_ROARING:
+        roaringFree(o->ptr);
+        break;
     default:
         serverPanic("Unknown set encoding type");
     }
@@ -286,10 +316,12 @@ void freeZsetObject(robj *o) {
 void freeHashObject(robj *o) {
     switch (o->encoding) {
     case OBJ_ENCODING_HT:
+        /* The dict privdata references the field expires, if any. */
+        if (((dict*)o->ptr)->privdata) decrRefCount(((dict*)o->ptr)->privdata);
         dictRelease((dict*) o->ptr);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         serverPanic("Unknown hash encoding type");
@@ -318,7 +350,7 @@ void decrRefCount(robj *o) {
         case OBJ_MODULE: freeModuleObject(o); break;
         default: serverPanic("Unknown object type"); break;
         }
-        zfree(o);
+        zslab_free(o);
     } else {
         if (o->refcount <= 0) serverPanic("decrRefCount against refcount <= 0");
         if (o->refcount != OBJ_SHARED_REFCOUNT) o->refcount--;
@@ -690,6 +722,8 @@ char *strEncoding(int encoding) {
     case OBJ_ENCODING_INTSET: return "intset";
     case OBJ_ENCODING_SKIPLIST: return "skiplist";
     case OBJ_ENCODING_EMBSTR: return "embstr";
+    case OBJ_ENCODING_LISTPACK: return "listpack";
+    case OBJ_ENCODING_ROARING: return "roaring";
     default: return "unknown";
     }
 }
@@ -748,6 +782,8 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
         } else if (o->encoding == OBJ_ENCODING_INTSET) {
             intset *is = o->ptr;
             asize = sizeof(*o)+sizeof(*is)+is->encoding*is->length;
+        } else if (o->encoding == OBJ_ENCODING_ROARING) {
+            asize = sizeof(*o)+roaringBytes(o->ptr);
         } else {
             serverPanic("Unknown set encoding");
         }
@@ -760,7 +796,7 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             zskiplistNode *znode = zsl->header->level[0].forward;
             asize = sizeof(*o)+sizeof(zset)+(sizeof(struct dictEntry*)*dictSlots(d));
             while(znode != NULL && samples < sample_size) {
-                elesize += sdsAllocSize(znode->ele);
+                /* The element is embedded in the skiplist node. */
                 elesize += sizeof(struct dictEntry) + zmalloc_size(znode);
                 samples++;
                 znode = znode->level[0].forward;
@@ -770,8 +806,8 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
         } else if (o->encoding == OBJ_ENCODING_HT) {
             d = o->ptr;
             di = dictGetIterator(d);
@@ -840,7 +876,7 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         while((ln = listNext(&li))) {
             client *c = listNodeValue(ln);
             mem += getClientOutputBufferMemoryUsage(c);
-            mem += sdsAllocSize(c->querybuf);
+            if (c->querybuf) mem += sdsAllocSize(c->querybuf);
             mem += sizeof(client);
         }
     }
@@ -858,7 +894,7 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
             if (c->flags & CLIENT_SLAVE)
                 continue;
             mem += getClientOutputBufferMemoryUsage(c);
-            mem += sdsAllocSize(c->querybuf);
+            if (c->querybuf) mem += sdsAllocSize(c->querybuf);
             mem += sizeof(client);
         }
     }
@@ -1098,8 +1134,11 @@ void memoryCommand(client *c) {
         addReplyLongLong(c,usage);
     } else if (!strcasecmp(c->argv[1]->ptr,"stats") && c->argc == 2) {
         struct redisMemOverhead *mh = getMemoryOverheadData();
+        size_t numslabs = 0;
+        zslab *slab;
 
-        addReplyMultiBulkLen(c,(14+mh->num_dbs)*2);
+        for (slab = zslab_list(); slab; slab = slab->next) numslabs++;
+        addReplyMultiBulkLen(c,(17+mh->num_dbs+numslabs)*2);
 
         addReplyBulkCString(c,"peak.allocated");
         addReplyLongLong(c,mh->peak_allocated);
@@ -1135,6 +1174,26 @@ void memoryCommand(client *c) {
             addReplyLongLong(c,mh->db[j].overhead_ht_expires);
         }
 
+        for (slab = zslab_list(); slab && numslabs; slab = slab->next) {
+            char slabname[64];
+            snprintf(slabname,sizeof(slabname),"slab.%s",slab->name);
+            addReplyBulkCString(c,slabname);
+            addReplyMultiBulkLen(c,8);
+
+            addReplyBulkCString(c,"objects");
+            addReplyLongLong(c,slab->used);
+
+            addReplyBulkCString(c,"pages");
+            addReplyLongLong(c,slab->npages);
+
+            addReplyBulkCString(c,"bytes.used");
+            addReplyLongLong(c,slab->used*slab->size);
+
+            addReplyBulkCString(c,"bytes.allocated");
+            addReplyLongLong(c,slab->npages*ZSLAB_PAGE_SIZE);
+            numslabs--;
+        }
+
         addReplyBulkCString(c,"overhead.total");
         addReplyLongLong(c,mh->overhead_total);
 
@@ -1156,6 +1215,15 @@ void memoryCommand(client *c) {
         addReplyBulkCString(c,"fragmentation");
         addReplyDouble(c,mh->fragmentation);
 
+        addReplyBulkCString(c,"hugepages.allocated");
+        addReplyLongLong(c,zmalloc_hugepages_allocated());
+
+        addReplyBulkCString(c,"rss.anon-hugepages");
+        addReplyLongLong(c,zmalloc_get_smap_bytes_by_field("AnonHugePages:",-1));
+
+        addReplyBulkCString(c,"rss.page-tables");
+        addReplyLongLong(c,zmalloc_get_page_tables_size());
+
         freeMemoryOverheadData(mh);
     } else if (!strcasecmp(c->argv[1]->ptr,"malloc-stats") && c->argc == 2) {
 #if defined(USE_JEMALLOC)
@@ -89,6 +89,10 @@ static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
 #define unlikely(x) (x)
 #endif
 
+/* Nodes are allocated from a slab, they are all of the same size. */
+static zslab quicklist_node_slab =
+    ZSLAB_INIT("quicklistNode",sizeof(quicklistNode));
+
 /* Create a new quicklist.
  * Free with quicklistRelease(). */
 quicklist *quicklistCreate(void) {
@@ -137,7 +141,7 @@ quicklist *quicklistNew(int fill, int compress) {
 
 REDIS_STATIC quicklistNode *quicklistCreateNode(void) {
     quicklistNode *node;
-    node = zmalloc(sizeof(*node));
+    node = zslab_malloc(&quicklist_node_slab);
     node->zl = NULL;
     node->count = 0;
     node->sz = 0;
@@ -164,7 +168,7 @@ void quicklistRelease(quicklist *quicklist) {
         zfree(current->zl);
         quicklist->count -= current->count;
 
-        zfree(current);
+        zslab_free(current);
 
         quicklist->len--;
         current = next;
@@ -598,7 +602,7 @@ REDIS_STATIC void __quicklistDelNode(quicklist *quicklist,
     quicklist->count -= node->count;
 
     zfree(node->zl);
-    zfree(node);
+    zslab_free(node);
     quicklist->len--;
 }
 
@@ -340,12 +340,13 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
     if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
     if ((c = zmalloc(clen)) == NULL) goto err;
 
-    /* Allocate our target according to the uncompressed size. */
+    /* Allocate our target according to the uncompressed size. Strings
+     * are allocated as values, see zmalloc_huge(). */
     if (plain) {
         val = zmalloc(len);
         if (lenptr) *lenptr = len;
     } else {
-        val = sdsnewlen(NULL,len);
+        val = sdsnewlenhuge(NULL,len);
     }
 
     /* Load the compressed representation and uncompress it to target. */
@@ -471,7 +472,7 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr) {
 
     if (len == RDB_LENERR) return NULL;
     if (plain || sds) {
-        void *buf = plain ? zmalloc(len) : sdsnewlen(NULL,len);
+        void *buf = plain ? zmalloc(len) : sdsnewlenhuge(NULL,len);
         if (lenptr) *lenptr = len;
         if (len && rioRead(rdb,buf,len) == 0) {
             if (plain)
@@ -482,8 +483,14 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr) {
         }
         return buf;
     } else {
-        robj *o = encode ? createStringObject(NULL,len) :
-                           createRawStringObject(NULL,len);
+        robj *o;
+
+        /* Big strings are allocated like in rdbLoadLzfStringObject(). */
+        if (len >= ZMALLOC_HUGE_MIN)
+            o = createObject(OBJ_STRING,sdsnewlenhuge(NULL,len));
+        else
+            o = encode ? createStringObject(NULL,len) :
+                         createRawStringObject(NULL,len);
         if (len && rioRead(rdb,o->ptr,len) == 0) {
             decrRefCount(o);
             return NULL;
@@ -606,6 +613,8 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
             return rdbSaveType(rdb,RDB_TYPE_SET_INTSET);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_SET);
+        else if (o->encoding == OBJ_ENCODING_ROARING)
+            return rdbSaveType(rdb,RDB_TYPE_SET_ROARING);
         else
             serverPanic("Unknown set encoding");
     case OBJ_ZSET:
@@ -616,8 +625,10 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
         else
             serverPanic("Unknown sorted set encoding");
     case OBJ_HASH:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_HASH_ZIPLIST);
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_HASH_LISTPACK);
+        else if (o->encoding == OBJ_ENCODING_HT && hashTypeHasFieldExpires(o))
+            return rdbSaveType(rdb,RDB_TYPE_HASH_TTL);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_HASH);
         else
@@ -693,6 +704,14 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
+        } else if (o->encoding == OBJ_ENCODING_ROARING) {
+            size_t l;
+            unsigned char *buf = roaringSerialize(o->ptr,&l);
+
+            n = rdbSaveRawString(rdb,buf,l);
+            zfree(buf);
+            if (n == -1) return -1;
+            nwritten += n;
         } else {
             serverPanic("Unknown set encoding");
         }
@@ -719,7 +738,7 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
             zskiplistNode *zn = zsl->tail;
             while (zn != NULL) {
                 if ((n = rdbSaveRawString(rdb,
-                    (unsigned char*)zn->ele,sdslen(zn->ele))) == -1)
+                    (unsigned char*)zslNodeElement(zn),sdslen(zslNodeElement(zn)))) == -1)
                 {
                     return -1;
                 }
@@ -734,8 +753,8 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
         }
     } else if (o->type == OBJ_HASH) {
         /* Save a hash value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
@@ -743,6 +762,7 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
         } else if (o->encoding == OBJ_ENCODING_HT) {
             dictIterator *di = dictGetIterator(o->ptr);
             dictEntry *de;
+            int ttls = hashTypeHasFieldExpires(o);
 
             if ((n = rdbSaveLen(rdb,dictSize((dict*)o->ptr))) == -1) return -1;
             nwritten += n;
@@ -757,6 +777,15 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
                 if ((n = rdbSaveRawString(rdb,(unsigned char*)value,
                         sdslen(value))) == -1) return -1;
                 nwritten += n;
+
+                /* RDB_TYPE_HASH_TTL: the expire time of the field in
+                 * milliseconds follows, or zero if it has no TTL. */
+                if (ttls) {
+                    long long expire = hashTypeGetFieldExpire(o,field);
+                    if ((n = rdbSaveLen(rdb,expire == -1 ? 0 : expire)) == -1)
+                        return -1;
+                    nwritten += n;
+                }
             }
             dictReleaseIterator(di);
         } else {
@@ -1190,8 +1219,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         /* Read Set value */
         if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
 
-        /* Use a regular set when there are too many entries. */
-        if (len > server.set_max_intset_entries) {
+        /* Use a regular set when there are too many entries, unless they
+         * may be stored in a roaring bitmap: in this case we start with a
+         * roaring bitmap and check how dense it is once loaded. */
+        if (len > server.set_max_intset_entries &&
+            server.set_roaring_min_density)
+        {
+            o = createRoaringObject();
+        } else if (len > server.set_max_intset_entries) {
             o = createSetObject();
             /* It's faster to expand the dict to the right size asap in order
              * to avoid rehashing */
@@ -1217,6 +1252,13 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     setTypeConvert(o,OBJ_ENCODING_HT);
                     dictExpand(o->ptr,len);
                 }
+            } else if (o->encoding == OBJ_ENCODING_ROARING) {
+                if (isSdsRepresentableAsLongLong(sdsele,&llval) == C_OK) {
+                    roaringAdd(o->ptr,llval);
+                } else {
+                    setTypeConvert(o,OBJ_ENCODING_HT);
+                    dictExpand(o->ptr,len);
+                }
             }
 
             /* This will also be called when the set was just converted
@@ -1227,6 +1269,11 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 sdsfree(sdsele);
             }
         }
+        if (o->encoding == OBJ_ENCODING_ROARING &&
+            !setTypeIsRoaringDense(roaringLen(o->ptr),roaringContainers(o->ptr)))
+        {
+            setTypeConvert(o,OBJ_ENCODING_HT);
+        }
     } else if (rdbtype == RDB_TYPE_ZSET_2 || rdbtype == RDB_TYPE_ZSET) {
         /* Read list/set value. */
         uint64_t zsetlen;
@@ -1256,7 +1303,8 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             if (sdslen(sdsele) > maxelelen) maxelelen = sdslen(sdsele);
 
             znode = zslInsert(zs->zsl,score,sdsele);
-            dictAdd(zs->dict,sdsele,&znode->score);
+            dictAdd(zs->dict,zslNodeElement(znode),&znode->score);
+            sdsfree(sdsele);
         }
 
         /* Convert *after* loading, since sorted sets are not stored ordered. */
@@ -1277,8 +1325,8 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         if (len > server.hash_max_ziplist_entries)
             hashTypeConvert(o, OBJ_ENCODING_HT);
 
-        /* Load every field and value into the ziplist */
-        while (o->encoding == OBJ_ENCODING_ZIPLIST && len > 0) {
+        /* Load every field and value into the listpack */
+        while (o->encoding == OBJ_ENCODING_LISTPACK && len > 0) {
             len--;
             /* Load raw strings */
             if ((field = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
@@ -1286,21 +1334,23 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             if ((value = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
                 == NULL) return NULL;
 
-            /* Add pair to ziplist */
-            o->ptr = ziplistPush(o->ptr, (unsigned char*)field,
-                    sdslen(field), ZIPLIST_TAIL);
-            o->ptr = ziplistPush(o->ptr, (unsigned char*)value,
-                    sdslen(value), ZIPLIST_TAIL);
-
-            /* Convert to hash table if size threshold is exceeded */
+            /* Convert to hash table if size threshold is exceeded, before
+             * the pair is added, so that the listpack never exceeds its
+             * max size. */
             if (sdslen(field) > server.hash_max_ziplist_value ||
                 sdslen(value) > server.hash_max_ziplist_value)
             {
-                sdsfree(field);
-                sdsfree(value);
                 hashTypeConvert(o, OBJ_ENCODING_HT);
+                ret = dictAdd((dict*)o->ptr, field, value);
+                if (ret == DICT_ERR) {
+                    rdbExitReportCorruptRDB("Duplicate keys detected");
+                }
                 break;
             }
+
+            /* Add pair to listpack */
+            o->ptr = lpAppend(o->ptr, (unsigned char*)field, sdslen(field));
+            o->ptr = lpAppend(o->ptr, (unsigned char*)value, sdslen(value));
             sdsfree(field);
             sdsfree(value);
         }
@@ -1323,6 +1373,47 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 
         /* All pairs should be read by now */
         serverAssert(len == 0);
+    } else if (rdbtype == RDB_TYPE_HASH_TTL) {
+        uint64_t len, expire;
+        sds field, value;
+
+        len = rdbLoadLen(rdb, NULL);
+        if (len == RDB_LENERR) return NULL;
+
+        /* Hashes with field TTLs are always hash table encoded. Fields
+         * already expired are loaded as well, and reclaimed later by
+         * the lazy and active expire of hash fields. */
+        o = createHashObject();
+        hashTypeConvert(o, OBJ_ENCODING_HT);
+        if (len > DICT_HT_INITIAL_SIZE) dictExpand(o->ptr,len);
+
+        while (len--) {
+            if ((field = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
+                == NULL) return NULL;
+            if ((value = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
+                == NULL) return NULL;
+            if ((expire = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
+
+            if (dictAdd((dict*)o->ptr, field, value) == DICT_ERR) {
+                rdbExitReportCorruptRDB("Duplicate keys detected");
+            }
+            if (expire) hashTypeSetFieldExpire(o,field,(long long)expire);
+        }
+    } else if (rdbtype == RDB_TYPE_SET_ROARING) {
+        size_t encoded_len;
+        unsigned char *encoded =
+            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&encoded_len);
+        roaring *r;
+
+        if (encoded == NULL) return NULL;
+        r = roaringDeserialize(encoded,encoded_len);
+        zfree(encoded);
+        if (r == NULL || roaringLen(r) == 0)
+            rdbExitReportCorruptRDB("Roaring set integrity check failed.");
+        o = createObject(OBJ_SET,r);
+        o->encoding = OBJ_ENCODING_ROARING;
+        /* 32 bit builds don't use this encoding, see setTypeIsRoaringDense(). */
+        if (sizeof(unsigned long) != 8) setTypeConvert(o,OBJ_ENCODING_HT);
     } else if (rdbtype == RDB_TYPE_LIST_QUICKLIST) {
         if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
         o = createQuicklistObject();
@@ -1339,10 +1430,12 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                rdbtype == RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == RDB_TYPE_SET_INTSET   ||
                rdbtype == RDB_TYPE_ZSET_ZIPLIST ||
-               rdbtype == RDB_TYPE_HASH_ZIPLIST)
+               rdbtype == RDB_TYPE_HASH_ZIPLIST ||
+               rdbtype == RDB_TYPE_HASH_LISTPACK)
     {
+        size_t encoded_len;
         unsigned char *encoded =
-            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
+            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&encoded_len);
         if (encoded == NULL) return NULL;
         o = createObject(OBJ_STRING,encoded); /* Obj type fixed below. */
 
@@ -1354,10 +1447,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
          * converted. */
         switch(rdbtype) {
             case RDB_TYPE_HASH_ZIPMAP:
-                /* Convert to ziplist encoded hash. This must be deprecated
+                /* Convert to listpack encoded hash. This must be deprecated
                  * when loading dumps created by Redis 2.4 gets deprecated. */
                 {
-                    unsigned char *zl = ziplistNew();
+                    unsigned char *lp = lpNew();
                     unsigned char *zi = zipmapRewind(o->ptr);
                     unsigned char *fstr, *vstr;
                     unsigned int flen, vlen;
@@ -1366,14 +1459,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     while ((zi = zipmapNext(zi, &fstr, &flen, &vstr, &vlen)) != NULL) {
                         if (flen > maxlen) maxlen = flen;
                         if (vlen > maxlen) maxlen = vlen;
-                        zl = ziplistPush(zl, fstr, flen, ZIPLIST_TAIL);
-                        zl = ziplistPush(zl, vstr, vlen, ZIPLIST_TAIL);
+                        lp = lpAppend(lp, fstr, flen);
+                        lp = lpAppend(lp, vstr, vlen);
                     }
 
                     zfree(o->ptr);
-                    o->ptr = zl;
+                    o->ptr = lp;
                     o->type = OBJ_HASH;
-                    o->encoding = OBJ_ENCODING_ZIPLIST;
+                    o->encoding = OBJ_ENCODING_LISTPACK;
 
                     if (hashTypeLength(o) > server.hash_max_ziplist_entries ||
                         maxlen > server.hash_max_ziplist_value)
@@ -1391,7 +1484,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 o->type = OBJ_SET;
                 o->encoding = OBJ_ENCODING_INTSET;
                 if (intsetLen(o->ptr) > server.set_max_intset_entries)
-                    setTypeConvert(o,OBJ_ENCODING_HT);
+                    setTypeConvert(o,setTypeIntsetTargetEncoding(o->ptr));
                 break;
             case RDB_TYPE_ZSET_ZIPLIST:
                 o->type = OBJ_ZSET;
@@ -1400,8 +1493,42 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     zsetConvert(o,OBJ_ENCODING_SKIPLIST);
                 break;
             case RDB_TYPE_HASH_ZIPLIST:
+                /* Hashes saved by older versions are ziplist encoded:
+                 * convert them to listpacks. */
+                {
+                    unsigned char *zl = o->ptr;
+                    unsigned char *lp = lpNew();
+                    unsigned char *p = ziplistIndex(zl,0);
+                    unsigned char *vstr;
+                    unsigned int vlen;
+                    long long vll;
+                    char buf[LONG_STR_SIZE];
+
+                    while (p != NULL) {
+                        if (!ziplistGet(p,&vstr,&vlen,&vll))
+                            rdbExitReportCorruptRDB("Ziplist integrity check failed.");
+                        if (vstr == NULL) {
+                            vlen = ll2string(buf,sizeof(buf),vll);
+                            vstr = (unsigned char*)buf;
+                        }
+                        lp = lpAppend(lp,vstr,vlen);
+                        p = ziplistNext(zl,p);
+                    }
+                    zfree(zl);
+                    o->ptr = lp;
+                    o->type = OBJ_HASH;
+                    o->encoding = OBJ_ENCODING_LISTPACK;
+                    if (lpLength(lp) % 2)
+                        rdbExitReportCorruptRDB("Hash ziplist with odd length.");
+                    if (hashTypeLength(o) > server.hash_max_ziplist_entries)
+                        hashTypeConvert(o, OBJ_ENCODING_HT);
+                }
+                break;
+            case RDB_TYPE_HASH_LISTPACK:
+                if (!lpValidateHeader(o->ptr,encoded_len))
+                    rdbExitReportCorruptRDB("Listpack integrity check failed.");
                 o->type = OBJ_HASH;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
+                o->encoding = OBJ_ENCODING_LISTPACK;
                 if (hashTypeLength(o) > server.hash_max_ziplist_entries)
                     hashTypeConvert(o, OBJ_ENCODING_HT);
                 break;
@@ -85,7 +85,11 @@ char *rdb_type_string[] = {
     "set-intset",
     "zset-ziplist",
     "hash-ziplist",
-    "quicklist"
+    "quicklist",
+    "",
+    "hash-listpack",
+    "hash-ttl",
+    "set-roaring"
 };
 
 /* Show a few stats collected into 'rdbstate' */
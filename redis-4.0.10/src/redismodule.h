@@ -119,7 +119,9 @@ typedef struct RedisModuleCallReply RedisModuleCallReply;
 typedef struct RedisModuleIO RedisModuleIO;
 typedef struct RedisModuleType RedisModuleType;
 typedef struct RedisModuleDigest RedisModuleDigest;
+typedef struct RedisModuleDefragCtx RedisModuleDefragCtx;
 typedef struct RedisModuleBlockedClient RedisModuleBlockedClient;
+typedef struct RedisModulePinnedKey RedisModulePinnedKey;
 
 typedef int (*RedisModuleCmdFunc) (RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 
@@ -130,8 +132,10 @@ typedef void (*RedisModuleTypeRewriteFunc)(RedisModuleIO *aof, RedisModuleString
 typedef size_t (*RedisModuleTypeMemUsageFunc)(const void *value);
 typedef void (*RedisModuleTypeDigestFunc)(RedisModuleDigest *digest, void *value);
 typedef void (*RedisModuleTypeFreeFunc)(void *value);
+typedef void (*RedisModuleTypeDefragFunc)(RedisModuleDefragCtx *ctx, RedisModuleString *key, void **value);
+typedef size_t (*RedisModuleTypeFreeEffortFunc)(const void *value);
 
-#define REDISMODULE_TYPE_METHOD_VERSION 1
+#define REDISMODULE_TYPE_METHOD_VERSION 3
 typedef struct RedisModuleTypeMethods {
     uint64_t version;
     RedisModuleTypeLoadFunc rdb_load;
@@ -140,6 +144,8 @@ typedef struct RedisModuleTypeMethods {
     RedisModuleTypeMemUsageFunc mem_usage;
     RedisModuleTypeDigestFunc digest;
     RedisModuleTypeFreeFunc free;
+    RedisModuleTypeDefragFunc defrag; /* Since version 2. */
+    RedisModuleTypeFreeEffortFunc free_effort; /* Since version 3. */
 } RedisModuleTypeMethods;
 
 #define REDISMODULE_GET_API(name) \
@@ -236,6 +242,8 @@ void REDISMODULE_API_FUNC(RedisModule_SaveString)(RedisModuleIO *io, RedisModule
 void REDISMODULE_API_FUNC(RedisModule_SaveStringBuffer)(RedisModuleIO *io, const char *str, size_t len);
 RedisModuleString *REDISMODULE_API_FUNC(RedisModule_LoadString)(RedisModuleIO *io);
 char *REDISMODULE_API_FUNC(RedisModule_LoadStringBuffer)(RedisModuleIO *io, size_t *lenptr);
+void REDISMODULE_API_FUNC(RedisModule_SaveBlob)(RedisModuleIO *io, const void *ptr, size_t len);
+void REDISMODULE_API_FUNC(RedisModule_LoadBlob)(RedisModuleIO *io, void *buf, size_t len);
 void REDISMODULE_API_FUNC(RedisModule_SaveDouble)(RedisModuleIO *io, double value);
 double REDISMODULE_API_FUNC(RedisModule_LoadDouble)(RedisModuleIO *io);
 void REDISMODULE_API_FUNC(RedisModule_SaveFloat)(RedisModuleIO *io, float value);
@@ -250,6 +258,8 @@ long long REDISMODULE_API_FUNC(RedisModule_Milliseconds)(void);
 void REDISMODULE_API_FUNC(RedisModule_DigestAddStringBuffer)(RedisModuleDigest *md, unsigned char *ele, size_t len);
 void REDISMODULE_API_FUNC(RedisModule_DigestAddLongLong)(RedisModuleDigest *md, long long ele);
 void REDISMODULE_API_FUNC(RedisModule_DigestEndSequence)(RedisModuleDigest *md);
+void *REDISMODULE_API_FUNC(RedisModule_DefragAlloc)(RedisModuleDefragCtx *ctx, void *ptr);
+RedisModuleString *REDISMODULE_API_FUNC(RedisModule_DefragRedisModuleString)(RedisModuleDefragCtx *ctx, RedisModuleString *str);
 
 /* Experimental APIs */
 #ifdef REDISMODULE_EXPERIMENTAL_API
@@ -263,6 +273,13 @@ RedisModuleCtx *REDISMODULE_API_FUNC(RedisModule_GetThreadSafeContext)(RedisModu
 void REDISMODULE_API_FUNC(RedisModule_FreeThreadSafeContext)(RedisModuleCtx *ctx);
 void REDISMODULE_API_FUNC(RedisModule_ThreadSafeContextLock)(RedisModuleCtx *ctx);
 void REDISMODULE_API_FUNC(RedisModule_ThreadSafeContextUnlock)(RedisModuleCtx *ctx);
+RedisModulePinnedKey *REDISMODULE_API_FUNC(RedisModule_PinKey)(RedisModuleCtx *ctx, RedisModuleString *keyname);
+void REDISMODULE_API_FUNC(RedisModule_UnpinKey)(RedisModulePinnedKey *pk);
+int REDISMODULE_API_FUNC(RedisModule_PinnedKeyType)(RedisModulePinnedKey *pk);
+const char *REDISMODULE_API_FUNC(RedisModule_PinnedStringPtrLen)(RedisModulePinnedKey *pk, size_t *len);
+RedisModuleString *REDISMODULE_API_FUNC(RedisModule_PinnedHashGet)(RedisModuleCtx *ctx, RedisModulePinnedKey *pk, RedisModuleString *field);
+RedisModuleType *REDISMODULE_API_FUNC(RedisModule_PinnedModuleTypeGetType)(RedisModulePinnedKey *pk);
+void *REDISMODULE_API_FUNC(RedisModule_PinnedModuleTypeGetValue)(RedisModulePinnedKey *pk);
 int REDISMODULE_API_FUNC(RedisModule_SubscribeToKeyspaceEvents)(RedisModuleCtx *ctx, int types, RedisModuleNotificationFunc cb);
 
 #endif
@@ -359,6 +376,8 @@ static int RedisModule_Init(RedisModuleCtx *ctx, const char *name, int ver, int
     REDISMODULE_GET_API(SaveStringBuffer);
     REDISMODULE_GET_API(LoadString);
     REDISMODULE_GET_API(LoadStringBuffer);
+    REDISMODULE_GET_API(SaveBlob);
+    REDISMODULE_GET_API(LoadBlob);
     REDISMODULE_GET_API(SaveDouble);
     REDISMODULE_GET_API(LoadDouble);
     REDISMODULE_GET_API(SaveFloat);
@@ -374,12 +393,21 @@ static int RedisModule_Init(RedisModuleCtx *ctx, const char *name, int ver, int
     REDISMODULE_GET_API(DigestAddStringBuffer);
     REDISMODULE_GET_API(DigestAddLongLong);
     REDISMODULE_GET_API(DigestEndSequence);
+    REDISMODULE_GET_API(DefragAlloc);
+    REDISMODULE_GET_API(DefragRedisModuleString);
 
 #ifdef REDISMODULE_EXPERIMENTAL_API
     REDISMODULE_GET_API(GetThreadSafeContext);
     REDISMODULE_GET_API(FreeThreadSafeContext);
     REDISMODULE_GET_API(ThreadSafeContextLock);
     REDISMODULE_GET_API(ThreadSafeContextUnlock);
+    REDISMODULE_GET_API(PinKey);
+    REDISMODULE_GET_API(UnpinKey);
+    REDISMODULE_GET_API(PinnedKeyType);
+    REDISMODULE_GET_API(PinnedStringPtrLen);
+    REDISMODULE_GET_API(PinnedHashGet);
+    REDISMODULE_GET_API(PinnedModuleTypeGetType);
+    REDISMODULE_GET_API(PinnedModuleTypeGetValue);
     REDISMODULE_GET_API(BlockClient);
     REDISMODULE_GET_API(UnblockClient);
     REDISMODULE_GET_API(IsBlockedReplyRequest);
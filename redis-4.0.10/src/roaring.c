@@ -0,0 +1,1236 @@
+/* Roaring bitmaps -- a compressed set of 64 bit signed integers.
+ *
+ * The integer space is split in chunks of 65536 values that share the same
+ * high 48 bits (the "key" of the chunk). Every non empty chunk is stored
+ * in a container holding the low 16 bits of its elements, either as a sorted
+ * array of uint16_t or, once the chunk holds more than ROARING_ARRAY_MAX
+ * elements, as a 65536 bits bitmap. Containers are kept sorted by key, so
+ * that iterating the structure returns the elements in ascending order.
+ *
+ * Dense sets of integers (IDs, timestamps, ...) take about 2 bytes per
+ * element in array containers and down to 1 bit per element in bitmap
+ * containers. Intersections, unions and differences are computed container
+ * by container: two bitmaps are combined 256 bits at a time.
+ *
+ * Copyright (c) 2009-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roaring.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define ROARING_OP_AND 0
+#define ROARING_OP_OR 1
+#define ROARING_OP_ANDNOT 2
+
+#define ROARING_KERNEL_SCALAR 0
+#define ROARING_KERNEL_AVX2 1
+static int roaring_kernel = -1;
+
+/* Keys are the high 48 bits of the elements: the arithmetic shift keeps
+ * negative numbers sorted before positive ones. */
+#define roaringKey(v) ((v) >> 16)
+#define roaringLow(v) ((uint16_t)((uint64_t)(v) & 0xffff))
+#define roaringValue(key,low) ((int64_t)(((uint64_t)(key) << 16) | (low)))
+
+/* Array containers store uint16_t values in the container data. Every
+ * container is allocated as either an array or a bitmap and never changes
+ * type in place, so its memory is always accessed with the same type. */
+static inline uint16_t *roaringArray(const roaringContainer *c) {
+    return (uint16_t*)c->data;
+}
+
+/* ============================ Containers ================================== */
+
+static size_t containerArrayBytes(uint32_t cap) {
+    return sizeof(roaringContainer) + ((size_t)cap*sizeof(uint16_t)+7)/8*8;
+}
+
+static size_t containerBytes(const roaringContainer *c) {
+    if (c->type == ROARING_CONTAINER_BITMAP)
+        return sizeof(roaringContainer) + ROARING_BITMAP_WORDS*sizeof(uint64_t);
+    return containerArrayBytes(c->cap);
+}
+
+static roaringContainer *containerNewArray(uint32_t cap) {
+    roaringContainer *c;
+
+    if (cap < 4) cap = 4;
+    if (cap > ROARING_ARRAY_MAX) cap = ROARING_ARRAY_MAX;
+    c = zmalloc(containerArrayBytes(cap));
+    c->card = 0;
+    c->type = ROARING_CONTAINER_ARRAY;
+    c->cap = cap;
+    return c;
+}
+
+static roaringContainer *containerNewBitmap(void) {
+    roaringContainer *c = zcalloc(sizeof(roaringContainer) +
+                                  ROARING_BITMAP_WORDS*sizeof(uint64_t));
+    c->card = 0;
+    c->type = ROARING_CONTAINER_BITMAP;
+    c->cap = 0;
+    return c;
+}
+
+static roaringContainer *containerDup(const roaringContainer *c) {
+    size_t bytes = containerBytes(c);
+    roaringContainer *dup = zmalloc(bytes);
+    memcpy(dup,c,bytes);
+    return dup;
+}
+
+/* Return 1 if 'low' is in the array 'a' of 'n' elements. In both cases 'pos'
+ * is set to the position of the first element greater or equal to 'low'. */
+static int arraySearch(const uint16_t *a, uint32_t n, uint16_t low, uint32_t *pos) {
+    uint32_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        uint32_t mid = (lo+hi) >> 1;
+        if (a[mid] < low) lo = mid+1;
+        else hi = mid;
+    }
+    *pos = lo;
+    return lo < n && a[lo] == low;
+}
+
+/* Return the first bit set at or after 'pos', or -1 if there are none. */
+static int bitmapNextSet(const uint64_t *words, uint32_t pos) {
+    uint32_t i = pos >> 6;
+    uint64_t w = words[i] & (~0ULL << (pos & 63));
+
+    while (1) {
+        if (w) return (int)(i*64 + __builtin_ctzll(w));
+        if (++i == ROARING_BITMAP_WORDS) return -1;
+        w = words[i];
+    }
+}
+
+/* Convert an array container into a bitmap container, freeing 'c'. */
+static roaringContainer *containerToBitmap(roaringContainer *c) {
+    roaringContainer *b = containerNewBitmap();
+    uint16_t *a = roaringArray(c);
+
+    for (uint32_t j = 0; j < c->card; j++)
+        b->data[a[j] >> 6] |= 1ULL << (a[j] & 63);
+    b->card = c->card;
+    zfree(c);
+    return b;
+}
+
+/* Convert a bitmap container into an array container, freeing 'c'. */
+static roaringContainer *containerToArray(roaringContainer *c) {
+    roaringContainer *a = containerNewArray(c->card);
+    uint16_t *dst = roaringArray(a);
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < ROARING_BITMAP_WORDS; i++) {
+        uint64_t w = c->data[i];
+        while (w) {
+            dst[n++] = (uint16_t)(i*64 + __builtin_ctzll(w));
+            w &= w-1;
+        }
+    }
+    a->card = n;
+    zfree(c);
+    return a;
+}
+
+/* Bitmap containers holding few elements are turned back into arrays.
+ * Return NULL (freeing the container) if it is empty. */
+static roaringContainer *containerNormalize(roaringContainer *c) {
+    if (c->card == 0) {
+        zfree(c);
+        return NULL;
+    }
+    if (c->type == ROARING_CONTAINER_BITMAP && c->card <= ROARING_ARRAY_MAX)
+        return containerToArray(c);
+    return c;
+}
+
+static int containerFind(const roaringContainer *c, uint16_t low) {
+    uint32_t pos;
+
+    if (c->type == ROARING_CONTAINER_BITMAP)
+        return (c->data[low >> 6] >> (low & 63)) & 1;
+    return arraySearch(roaringArray(c),c->card,low,&pos);
+}
+
+/* Add 'low' to the container, that may be reallocated or converted to a
+ * bitmap. Return 1 if the element was added, 0 if it was already there. */
+static int containerAdd(roaringContainer **cp, uint16_t low) {
+    roaringContainer *c = *cp;
+    uint32_t pos;
+
+    if (c->type == ROARING_CONTAINER_BITMAP) {
+        uint64_t bit = 1ULL << (low & 63);
+        if (c->data[low >> 6] & bit) return 0;
+        c->data[low >> 6] |= bit;
+        c->card++;
+        return 1;
+    }
+
+    if (arraySearch(roaringArray(c),c->card,low,&pos)) return 0;
+    if (c->card == ROARING_ARRAY_MAX) {
+        *cp = c = containerToBitmap(c);
+        c->data[low >> 6] |= 1ULL << (low & 63);
+        c->card++;
+        return 1;
+    }
+    if (c->card == c->cap) {
+        uint32_t cap = c->cap < 64 ? c->cap*2 : c->cap + c->cap/2;
+        if (cap > ROARING_ARRAY_MAX) cap = ROARING_ARRAY_MAX;
+        *cp = c = zrealloc(c,containerArrayBytes(cap));
+        c->cap = cap;
+    }
+    memmove(roaringArray(c)+pos+1,roaringArray(c)+pos,
+            (c->card-pos)*sizeof(uint16_t));
+    roaringArray(c)[pos] = low;
+    c->card++;
+    return 1;
+}
+
+/* Remove 'low' from the container. Return 1 if the element was removed.
+ * Bitmaps are converted back to arrays only when they are half the array
+ * limit, so that a container oscillating around the limit does not get
+ * converted at every operation. */
+static int containerRemove(roaringContainer **cp, uint16_t low) {
+    roaringContainer *c = *cp;
+    uint32_t pos;
+
+    if (c->type == ROARING_CONTAINER_BITMAP) {
+        uint64_t bit = 1ULL << (low & 63);
+        if (!(c->data[low >> 6] & bit)) return 0;
+        c->data[low >> 6] &= ~bit;
+        c->card--;
+        if (c->card <= ROARING_ARRAY_MAX/2) *cp = containerToArray(c);
+        return 1;
+    }
+
+    if (!arraySearch(roaringArray(c),c->card,low,&pos)) return 0;
+    memmove(roaringArray(c)+pos,roaringArray(c)+pos+1,
+            (c->card-pos-1)*sizeof(uint16_t));
+    c->card--;
+    if (c->cap > 16 && c->card < c->cap/4) {
+        uint32_t cap = c->cap/2;
+        *cp = c = zrealloc(c,containerArrayBytes(cap));
+        c->cap = cap;
+    }
+    return 1;
+}
+
+/* Return the element of rank 'rank' (0 based) of the container. */
+static uint16_t containerSelect(const roaringContainer *c, uint32_t rank) {
+    if (c->type == ROARING_CONTAINER_ARRAY) return roaringArray(c)[rank];
+    for (uint32_t i = 0; i < ROARING_BITMAP_WORDS; i++) {
+        uint64_t w = c->data[i];
+        uint32_t count = __builtin_popcountll(w);
+        if (rank < count) {
+            while (rank--) w &= w-1;
+            return (uint16_t)(i*64 + __builtin_ctzll(w));
+        }
+        rank -= count;
+    }
+    return 0; /* Not reached if 'rank' is less than the cardinality. */
+}
+
+/* ============================ Bitmap kernels ============================== */
+
+/* Combine the bitmaps 'a' and 'b' into 'dst' using the operation 'op',
+ * returning the number of bits set in the result. When 'dst' is NULL only
+ * the number of bits is computed. */
+static uint32_t bitmapOpScalar(int op, const uint64_t *a, const uint64_t *b, uint64_t *dst) {
+    uint32_t card = 0, i;
+    uint64_t w;
+
+    for (i = 0; i < ROARING_BITMAP_WORDS; i++) {
+        if (op == ROARING_OP_AND) w = a[i] & b[i];
+        else if (op == ROARING_OP_OR) w = a[i] | b[i];
+        else w = a[i] & ~b[i];
+        if (dst) dst[i] = w;
+        card += __builtin_popcountll(w);
+    }
+    return card;
+}
+
+#ifdef HAVE_X86_SIMD
+/* Count the bits set in each 64 bit lane of 'v' using a nibble lookup
+ * table: AVX2 has no vector popcount instruction. */
+__attribute__((target("avx2")))
+static inline __m256i bitmapPopcountAVX2(__m256i v) {
+    const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                            0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v,nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v,4),nibble);
+    __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup,lo),
+                                  _mm256_shuffle_epi8(lookup,hi));
+    return _mm256_sad_epu8(cnt,_mm256_setzero_si256());
+}
+
+/* Like bitmapOpScalar() but processing 256 bits at a time. */
+__attribute__((target("avx2")))
+static uint32_t bitmapOpAVX2(int op, const uint64_t *a, const uint64_t *b, uint64_t *dst) {
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t lanes[4];
+    uint32_t i;
+
+    for (i = 0; i < ROARING_BITMAP_WORDS; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b+i));
+        __m256i z;
+
+        if (op == ROARING_OP_AND) z = _mm256_and_si256(x,y);
+        else if (op == ROARING_OP_OR) z = _mm256_or_si256(x,y);
+        else z = _mm256_andnot_si256(y,x);
+        if (dst) _mm256_storeu_si256((__m256i*)(dst+i),z);
+        acc = _mm256_add_epi64(acc,bitmapPopcountAVX2(z));
+    }
+    _mm256_storeu_si256((__m256i*)lanes,acc);
+    return (uint32_t)(lanes[0]+lanes[1]+lanes[2]+lanes[3]);
+}
+#endif
+
+/* Select the best bitmap kernel supported by this CPU. */
+static void roaringSelectKernel(void) {
+    roaring_kernel = ROARING_KERNEL_SCALAR;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) roaring_kernel = ROARING_KERNEL_AVX2;
+#endif
+}
+
+static uint32_t bitmapOp(int op, const uint64_t *a, const uint64_t *b, uint64_t *dst) {
+    if (roaring_kernel == -1) roaringSelectKernel();
+#ifdef HAVE_X86_SIMD
+    if (roaring_kernel == ROARING_KERNEL_AVX2) return bitmapOpAVX2(op,a,b,dst);
+#endif
+    return bitmapOpScalar(op,a,b,dst);
+}
+
+/* ============================ Container ops =============================== */
+
+/* Intersect two arrays. When one is much smaller than the other, the
+ * elements of the small one are searched in the big one. When 'dst' is NULL
+ * the common elements are just counted. */
+static uint32_t arrayAnd(const uint16_t *a, uint32_t na, const uint16_t *b, uint32_t nb, uint16_t *dst) {
+    uint32_t i = 0, j = 0, n = 0, pos;
+
+    if (na > nb) {
+        const uint16_t *t = a; a = b; b = t;
+        uint32_t tn = na; na = nb; nb = tn;
+    }
+    if (na*32 < nb) {
+        for (i = 0; i < na; i++) {
+            if (arraySearch(b+j,nb-j,a[i],&pos)) {
+                if (dst) dst[n] = a[i];
+                n++;
+            }
+            j += pos;
+            if (j == nb) break;
+        }
+        return n;
+    }
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) i++;
+        else if (a[i] > b[j]) j++;
+        else {
+            if (dst) dst[n] = a[i];
+            n++; i++; j++;
+        }
+    }
+    return n;
+}
+
+static roaringContainer *containerAnd(const roaringContainer *a, const roaringContainer *b) {
+    roaringContainer *c;
+
+    if (a->type == ROARING_CONTAINER_BITMAP &&
+        b->type == ROARING_CONTAINER_BITMAP)
+    {
+        c = containerNewBitmap();
+        c->card = bitmapOp(ROARING_OP_AND,a->data,b->data,c->data);
+        return containerNormalize(c);
+    }
+    if (a->type == ROARING_CONTAINER_BITMAP) {
+        const roaringContainer *t = a; a = b; b = t;
+    }
+    /* Now 'a' is an array: the result can't be bigger than it. */
+    c = containerNewArray(a->card);
+    if (b->type == ROARING_CONTAINER_BITMAP) {
+        const uint16_t *src = roaringArray(a);
+        for (uint32_t j = 0; j < a->card; j++) {
+            if ((b->data[src[j] >> 6] >> (src[j] & 63)) & 1)
+                roaringArray(c)[c->card++] = src[j];
+        }
+    } else {
+        c->card = arrayAnd(roaringArray(a),a->card,roaringArray(b),b->card,
+                           roaringArray(c));
+    }
+    return containerNormalize(c);
+}
+
+/* Return the number of elements both in 'a' and 'b'. */
+static uint32_t containerAndCard(const roaringContainer *a, const roaringContainer *b) {
+    uint32_t card = 0;
+
+    if (a->type == ROARING_CONTAINER_BITMAP &&
+        b->type == ROARING_CONTAINER_BITMAP)
+        return bitmapOp(ROARING_OP_AND,a->data,b->data,NULL);
+    if (a->type == ROARING_CONTAINER_BITMAP) {
+        const roaringContainer *t = a; a = b; b = t;
+    }
+    if (b->type == ROARING_CONTAINER_BITMAP) {
+        const uint16_t *src = roaringArray(a);
+        for (uint32_t j = 0; j < a->card; j++)
+            card += (b->data[src[j] >> 6] >> (src[j] & 63)) & 1;
+        return card;
+    }
+    return arrayAnd(roaringArray(a),a->card,roaringArray(b),b->card,NULL);
+}
+
+/* Set the bits of the array elements into the bitmap 'c', updating its
+ * cardinality. */
+static void bitmapAddArray(roaringContainer *c, const roaringContainer *a) {
+    const uint16_t *src = roaringArray(a);
+
+    for (uint32_t j = 0; j < a->card; j++) {
+        uint64_t bit = 1ULL << (src[j] & 63);
+        uint64_t *w = c->data + (src[j] >> 6);
+        c->card += !(*w & bit);
+        *w |= bit;
+    }
+}
+
+static roaringContainer *containerOr(const roaringContainer *a, const roaringContainer *b) {
+    roaringContainer *c;
+
+    if (a->type == ROARING_CONTAINER_BITMAP &&
+        b->type == ROARING_CONTAINER_BITMAP)
+    {
+        c = containerNewBitmap();
+        c->card = bitmapOp(ROARING_OP_OR,a->data,b->data,c->data);
+        return c;
+    }
+    if (a->type == ROARING_CONTAINER_BITMAP) {
+        const roaringContainer *t = a; a = b; b = t;
+    }
+    if (b->type == ROARING_CONTAINER_BITMAP) {
+        c = containerDup(b);
+        bitmapAddArray(c,a);
+        return c;
+    }
+
+    /* Two arrays. */
+    if (a->card + b->card > ROARING_ARRAY_MAX) {
+        c = containerNewBitmap();
+        bitmapAddArray(c,a);
+        bitmapAddArray(c,b);
+        return containerNormalize(c);
+    } else {
+        const uint16_t *x = roaringArray(a), *y = roaringArray(b);
+        uint32_t i = 0, j = 0;
+        uint16_t *dst;
+
+        c = containerNewArray(a->card + b->card);
+        dst = roaringArray(c);
+        while (i < a->card && j < b->card) {
+            if (x[i] < y[j]) dst[c->card++] = x[i++];
+            else if (x[i] > y[j]) dst[c->card++] = y[j++];
+            else { dst[c->card++] = x[i++]; j++; }
+        }
+        while (i < a->card) dst[c->card++] = x[i++];
+        while (j < b->card) dst[c->card++] = y[j++];
+        return c;
+    }
+}
+
+static roaringContainer *containerAndNot(const roaringContainer *a, const roaringContainer *b) {
+    roaringContainer *c;
+
+    if (a->type == ROARING_CONTAINER_BITMAP) {
+        c = containerNewBitmap();
+        if (b->type == ROARING_CONTAINER_BITMAP) {
+            c->card = bitmapOp(ROARING_OP_ANDNOT,a->data,b->data,c->data);
+        } else {
+            const uint16_t *src = roaringArray(b);
+            memcpy(c->data,a->data,ROARING_BITMAP_WORDS*sizeof(uint64_t));
+            c->card = a->card;
+            for (uint32_t j = 0; j < b->card; j++) {
+                uint64_t bit = 1ULL << (src[j] & 63);
+                uint64_t *w = c->data + (src[j] >> 6);
+                c->card -= !!(*w & bit);
+                *w &= ~bit;
+            }
+        }
+        return containerNormalize(c);
+    }
+
+    /* 'a' is an array: keep the elements not in 'b'. */
+    c = containerNewArray(a->card);
+    if (b->type == ROARING_CONTAINER_BITMAP) {
+        const uint16_t *src = roaringArray(a);
+        for (uint32_t j = 0; j < a->card; j++) {
+            if (!((b->data[src[j] >> 6] >> (src[j] & 63)) & 1))
+                roaringArray(c)[c->card++] = src[j];
+        }
+    } else {
+        const uint16_t *x = roaringArray(a), *y = roaringArray(b);
+        uint32_t i = 0, j = 0;
+        while (i < a->card) {
+            while (j < b->card && y[j] < x[i]) j++;
+            if (j == b->card || y[j] != x[i])
+                roaringArray(c)[c->card++] = x[i];
+            i++;
+        }
+    }
+    return containerNormalize(c);
+}
+
+/* ============================ Roaring bitmaps ============================= */
+
+roaring *roaringNew(void) {
+    roaring *r = zmalloc(sizeof(*r));
+    r->card = 0;
+    r->len = 0;
+    r->alloc = 0;
+    r->keys = NULL;
+    r->containers = NULL;
+    r->ranks = NULL;
+    return r;
+}
+
+void roaringFree(roaring *r) {
+    for (uint32_t j = 0; j < r->len; j++) zfree(r->containers[j]);
+    zfree(r->keys);
+    zfree(r->containers);
+    zfree(r->ranks);
+    zfree(r);
+}
+
+static void roaringReserve(roaring *r, uint32_t len) {
+    if (len <= r->alloc) return;
+    r->alloc = r->alloc ? r->alloc*2 : 4;
+    if (r->alloc < len) r->alloc = len;
+    r->keys = zrealloc(r->keys,sizeof(int64_t)*r->alloc);
+    r->containers = zrealloc(r->containers,sizeof(roaringContainer*)*r->alloc);
+    r->ranks = zrealloc(r->ranks,sizeof(uint64_t)*r->alloc);
+}
+
+/* The ranks are a Fenwick tree: ranks[i-1] is the sum of the cardinalities
+ * of the containers in (i-(i&-i), i], 1 based, so that the number of
+ * elements before a container is computed, and updated, in O(log N). */
+
+/* Rebuild the ranks after containers were inserted or removed. */
+static void roaringRebuildRanks(roaring *r) {
+    uint32_t i, j;
+
+    for (i = 0; i < r->len; i++) r->ranks[i] = r->containers[i]->card;
+    for (i = 1; i <= r->len; i++) {
+        j = i + (i & -i);
+        if (j <= r->len) r->ranks[j-1] += r->ranks[i-1];
+    }
+}
+
+/* Set the rank of the last container 'idx', just appended. */
+static void roaringAppendRank(roaring *r, uint32_t idx) {
+    uint32_t i = idx+1, j;
+
+    r->ranks[idx] = r->containers[idx]->card;
+    for (j = i-1; j > i-(i & -i); j -= j & -j) r->ranks[idx] += r->ranks[j-1];
+}
+
+/* Add 'delta' to the cardinality of the container 'idx'. */
+static void roaringUpdateRank(roaring *r, uint32_t idx, int64_t delta) {
+    uint32_t i;
+
+    for (i = idx+1; i <= r->len; i += i & -i) r->ranks[i-1] += delta;
+}
+
+/* Append a container whose key is greater than all the existing ones.
+ * Empty (NULL) containers are ignored. */
+static void roaringAppend(roaring *r, int64_t key, roaringContainer *c) {
+    if (c == NULL) return;
+    roaringReserve(r,r->len+1);
+    r->keys[r->len] = key;
+    r->containers[r->len] = c;
+    r->len++;
+    r->card += c->card;
+    roaringAppendRank(r,r->len-1);
+}
+
+/* Return 1 if there is a container for 'key'. In both cases 'idx' is set to
+ * the position where the container is, or should be inserted. */
+static int roaringSearch(const roaring *r, int64_t key, uint32_t *idx) {
+    uint32_t lo = 0, hi = r->len;
+
+    /* Sets are usually filled in ascending order: check the last key
+     * before the binary search. */
+    if (r->len && key > r->keys[r->len-1]) {
+        *idx = r->len;
+        return 0;
+    }
+    while (lo < hi) {
+        uint32_t mid = (lo+hi) >> 1;
+        if (r->keys[mid] < key) lo = mid+1;
+        else hi = mid;
+    }
+    *idx = lo;
+    return lo < r->len && r->keys[lo] == key;
+}
+
+roaring *roaringDup(roaring *r) {
+    roaring *dup = roaringNew();
+
+    roaringReserve(dup,r->len);
+    for (uint32_t j = 0; j < r->len; j++)
+        roaringAppend(dup,r->keys[j],containerDup(r->containers[j]));
+    return dup;
+}
+
+/* Add 'value' to the set. Return 1 if it was added, 0 if it already was a
+ * member. */
+int roaringAdd(roaring *r, int64_t value) {
+    int64_t key = roaringKey(value);
+    uint32_t idx;
+
+    if (!roaringSearch(r,key,&idx)) {
+        roaringContainer *c = containerNewArray(4);
+        roaringArray(c)[0] = roaringLow(value);
+        c->card = 1;
+        roaringReserve(r,r->len+1);
+        memmove(r->keys+idx+1,r->keys+idx,(r->len-idx)*sizeof(int64_t));
+        memmove(r->containers+idx+1,r->containers+idx,
+                (r->len-idx)*sizeof(roaringContainer*));
+        r->keys[idx] = key;
+        r->containers[idx] = c;
+        r->len++;
+        r->card++;
+        if (idx == r->len-1) roaringAppendRank(r,idx);
+        else roaringRebuildRanks(r);
+        return 1;
+    }
+    if (!containerAdd(&r->containers[idx],roaringLow(value))) return 0;
+    r->card++;
+    roaringUpdateRank(r,idx,1);
+    return 1;
+}
+
+/* Remove 'value' from the set. Return 1 if it was removed. */
+int roaringRemove(roaring *r, int64_t value) {
+    uint32_t idx;
+
+    if (!roaringSearch(r,roaringKey(value),&idx)) return 0;
+    if (!containerRemove(&r->containers[idx],roaringLow(value))) return 0;
+    r->card--;
+    if (r->containers[idx]->card == 0) {
+        zfree(r->containers[idx]);
+        memmove(r->keys+idx,r->keys+idx+1,(r->len-idx-1)*sizeof(int64_t));
+        memmove(r->containers+idx,r->containers+idx+1,
+                (r->len-idx-1)*sizeof(roaringContainer*));
+        r->len--;
+        /* Removing the last container leaves the other ranks valid. */
+        if (idx != r->len) roaringRebuildRanks(r);
+    } else {
+        roaringUpdateRank(r,idx,-1);
+    }
+    return 1;
+}
+
+int roaringFind(roaring *r, int64_t value) {
+    uint32_t idx;
+
+    if (!roaringSearch(r,roaringKey(value),&idx)) return 0;
+    return containerFind(r->containers[idx],roaringLow(value));
+}
+
+uint64_t roaringLen(const roaring *r) {
+    return r->card;
+}
+
+/* Return the number of containers, used by the caller to estimate how dense
+ * the set is. */
+uint32_t roaringContainers(const roaring *r) {
+    return r->len;
+}
+
+/* Return the number of bytes used by the set. */
+size_t roaringBytes(const roaring *r) {
+    size_t bytes = sizeof(*r) + (size_t)r->alloc*(sizeof(int64_t)+
+                   sizeof(roaringContainer*)+sizeof(uint64_t));
+    for (uint32_t j = 0; j < r->len; j++) bytes += containerBytes(r->containers[j]);
+    return bytes;
+}
+
+/* Set 'value' to the element of rank 'rank' (0 based) in ascending order.
+ * Return 0 if 'rank' is out of range. The container is found descending the
+ * ranks tree, in O(log N). */
+int roaringSelect(roaring *r, uint64_t rank, int64_t *value) {
+    uint32_t idx = 0, step = 1;
+
+    if (rank >= r->card) return 0;
+    while (step <= r->len/2) step <<= 1;
+    for (; step; step >>= 1) {
+        if (idx+step <= r->len && r->ranks[idx+step-1] <= rank) {
+            idx += step;
+            rank -= r->ranks[idx-1];
+        }
+    }
+    *value = roaringValue(r->keys[idx],
+                          containerSelect(r->containers[idx],(uint32_t)rank));
+    return 1;
+}
+
+/* Return a random element. The set must not be empty. */
+int64_t roaringRandom(roaring *r) {
+    uint64_t rnd = ((uint64_t)rand() << 32) ^ ((uint64_t)rand() << 16) ^ rand();
+    int64_t value = 0;
+
+    roaringSelect(r,rnd % r->card,&value);
+    return value;
+}
+
+/* ============================ Iterator ==================================== */
+
+void roaringInitIterator(roaring *r, roaringIterator *it) {
+    it->r = r;
+    it->ci = 0;
+    it->pos = 0;
+}
+
+/* Position the iterator so that the next element returned is the smallest
+ * one greater or equal to 'value'. */
+void roaringSeek(roaringIterator *it, int64_t value) {
+    roaring *r = it->r;
+    uint16_t low = roaringLow(value);
+    roaringContainer *c;
+
+    it->pos = 0;
+    if (!roaringSearch(r,roaringKey(value),&it->ci)) return;
+    c = r->containers[it->ci];
+    if (c->type == ROARING_CONTAINER_BITMAP)
+        it->pos = low;
+    else
+        arraySearch(roaringArray(c),c->card,low,&it->pos);
+}
+
+/* Store the next element in 'value' and return 1, or return 0 when the
+ * iteration is over. */
+int roaringNext(roaringIterator *it, int64_t *value) {
+    roaring *r = it->r;
+
+    while (it->ci < r->len) {
+        roaringContainer *c = r->containers[it->ci];
+        if (c->type == ROARING_CONTAINER_ARRAY) {
+            if (it->pos < c->card) {
+                *value = roaringValue(r->keys[it->ci],roaringArray(c)[it->pos]);
+                it->pos++;
+                return 1;
+            }
+        } else if (it->pos < 65536) {
+            int bit = bitmapNextSet(c->data,it->pos);
+            if (bit != -1) {
+                *value = roaringValue(r->keys[it->ci],bit);
+                it->pos = bit+1;
+                return 1;
+            }
+        }
+        it->ci++;
+        it->pos = 0;
+    }
+    return 0;
+}
+
+/* ============================ Set operations ============================== */
+
+/* Return a new set with the elements both in 'a' and 'b'. */
+roaring *roaringAnd(roaring *a, roaring *b) {
+    roaring *dst = roaringNew();
+    uint32_t i = 0, j = 0;
+
+    while (i < a->len && j < b->len) {
+        if (a->keys[i] < b->keys[j]) {
+            i++;
+        } else if (a->keys[i] > b->keys[j]) {
+            j++;
+        } else {
+            roaringAppend(dst,a->keys[i],
+                containerAnd(a->containers[i],b->containers[j]));
+            i++;
+            j++;
+        }
+    }
+    return dst;
+}
+
+/* Return the number of elements both in 'a' and 'b', without creating the
+ * intersection. */
+uint64_t roaringAndCard(roaring *a, roaring *b) {
+    uint64_t card = 0;
+    uint32_t i = 0, j = 0;
+
+    while (i < a->len && j < b->len) {
+        if (a->keys[i] < b->keys[j]) {
+            i++;
+        } else if (a->keys[i] > b->keys[j]) {
+            j++;
+        } else {
+            card += containerAndCard(a->containers[i],b->containers[j]);
+            i++;
+            j++;
+        }
+    }
+    return card;
+}
+
+/* Return a new set with the elements either in 'a' or 'b'. */
+roaring *roaringOr(roaring *a, roaring *b) {
+    roaring *dst = roaringNew();
+    uint32_t i = 0, j = 0;
+
+    while (i < a->len || j < b->len) {
+        if (j == b->len || (i < a->len && a->keys[i] < b->keys[j])) {
+            roaringAppend(dst,a->keys[i],containerDup(a->containers[i]));
+            i++;
+        } else if (i == a->len || a->keys[i] > b->keys[j]) {
+            roaringAppend(dst,b->keys[j],containerDup(b->containers[j]));
+            j++;
+        } else {
+            roaringAppend(dst,a->keys[i],
+                containerOr(a->containers[i],b->containers[j]));
+            i++;
+            j++;
+        }
+    }
+    return dst;
+}
+
+/* Return a new set with the elements in 'a' that are not in 'b'. */
+roaring *roaringAndNot(roaring *a, roaring *b) {
+    roaring *dst = roaringNew();
+    uint32_t i = 0, j = 0;
+
+    while (i < a->len) {
+        while (j < b->len && b->keys[j] < a->keys[i]) j++;
+        if (j < b->len && b->keys[j] == a->keys[i]) {
+            roaringAppend(dst,a->keys[i],
+                containerAndNot(a->containers[i],b->containers[j]));
+        } else {
+            roaringAppend(dst,a->keys[i],containerDup(a->containers[i]));
+        }
+        i++;
+    }
+    return dst;
+}
+
+/* ============================ Serialization =============================== */
+
+/* The serialized format, all the integers being little endian, is:
+ *
+ * <count:uint32> followed by 'count' containers, sorted by key, each one
+ * serialized as <key:int64><card:uint32><payload>, where the payload is
+ * 'card' uint16_t values in ascending order if card <= ROARING_ARRAY_MAX,
+ * otherwise a ROARING_BITMAP_WORDS uint64_t words bitmap. */
+#define ROARING_HDR_SIZE 4
+#define ROARING_CONTAINER_HDR_SIZE 12
+
+static size_t containerPayloadSize(uint32_t card) {
+    if (card <= ROARING_ARRAY_MAX) return (size_t)card*sizeof(uint16_t);
+    return ROARING_BITMAP_WORDS*sizeof(uint64_t);
+}
+
+/* Return a zmalloc()ed buffer with the serialized set, setting 'len' to
+ * its size. */
+unsigned char *roaringSerialize(roaring *r, size_t *len) {
+    unsigned char *buf, *p;
+    size_t size = ROARING_HDR_SIZE;
+    uint32_t count = r->len;
+
+    for (uint32_t j = 0; j < r->len; j++)
+        size += ROARING_CONTAINER_HDR_SIZE +
+                containerPayloadSize(r->containers[j]->card);
+    p = buf = zmalloc(size);
+    memrev32ifbe(&count);
+    memcpy(p,&count,4); p += 4;
+
+    for (uint32_t j = 0; j < r->len; j++) {
+        roaringContainer *c = r->containers[j];
+        int64_t key = r->keys[j];
+        uint32_t card = c->card;
+
+        memrev64ifbe(&key);
+        memrev32ifbe(&card);
+        memcpy(p,&key,8); p += 8;
+        memcpy(p,&card,4); p += 4;
+        if (c->card > ROARING_ARRAY_MAX) {
+            for (uint32_t i = 0; i < ROARING_BITMAP_WORDS; i++) {
+                uint64_t w = c->data[i];
+                memrev64ifbe(&w);
+                memcpy(p,&w,8); p += 8;
+            }
+        } else if (c->type == ROARING_CONTAINER_BITMAP) {
+            /* A bitmap kept as such by the hysteresis in containerRemove(). */
+            int bit = -1;
+            while ((bit = bitmapNextSet(c->data,bit+1)) != -1) {
+                uint16_t v = bit;
+                memrev16ifbe(&v);
+                memcpy(p,&v,2); p += 2;
+                if (bit == 65535) break;
+            }
+        } else {
+            for (uint32_t i = 0; i < c->card; i++) {
+                uint16_t v = roaringArray(c)[i];
+                memrev16ifbe(&v);
+                memcpy(p,&v,2); p += 2;
+            }
+        }
+    }
+    *len = size;
+    return buf;
+}
+
+/* Create a set from the serialized representation in 'buf'. Return NULL if
+ * the buffer is not a valid serialized set: the containers must be sorted
+ * by key, non empty, and the array elements strictly ascending. */
+roaring *roaringDeserialize(const unsigned char *buf, size_t len) {
+    const unsigned char *p = buf, *end = buf+len;
+    roaring *r;
+    uint32_t count;
+    int64_t prevkey = 0;
+
+    if (len < ROARING_HDR_SIZE) return NULL;
+    memcpy(&count,p,4); p += 4;
+    memrev32ifbe(&count);
+    if (count > (len-ROARING_HDR_SIZE)/ROARING_CONTAINER_HDR_SIZE) return NULL;
+
+    r = roaringNew();
+    roaringReserve(r,count);
+    for (uint32_t j = 0; j < count; j++) {
+        roaringContainer *c;
+        int64_t key;
+        uint32_t card;
+
+        if ((size_t)(end-p) < ROARING_CONTAINER_HDR_SIZE) goto err;
+        memcpy(&key,p,8); p += 8;
+        memcpy(&card,p,4); p += 4;
+        memrev64ifbe(&key);
+        memrev32ifbe(&card);
+        if (card == 0 || card > 65536) goto err;
+        if (key < roaringKey(INT64_MIN) || key > roaringKey(INT64_MAX)) goto err;
+        if (j && key <= prevkey) goto err;
+        if ((size_t)(end-p) < containerPayloadSize(card)) goto err;
+        prevkey = key;
+
+        if (card <= ROARING_ARRAY_MAX) {
+            c = containerNewArray(card);
+            for (uint32_t i = 0; i < card; i++) {
+                uint16_t v;
+                memcpy(&v,p,2); p += 2;
+                memrev16ifbe(&v);
+                if (i && v <= roaringArray(c)[i-1]) {
+                    zfree(c);
+                    goto err;
+                }
+                roaringArray(c)[i] = v;
+            }
+        } else {
+            uint32_t bits = 0;
+            c = containerNewBitmap();
+            for (uint32_t i = 0; i < ROARING_BITMAP_WORDS; i++) {
+                memcpy(&c->data[i],p,8); p += 8;
+                memrev64ifbe(&c->data[i]);
+                bits += __builtin_popcountll(c->data[i]);
+            }
+            if (bits != card) {
+                zfree(c);
+                goto err;
+            }
+        }
+        c->card = card;
+        roaringAppend(r,key,c);
+    }
+    if (p != end) goto err;
+    return r;
+
+err:
+    roaringFree(r);
+    return NULL;
+}
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include <time.h>
+#include "intset.h"
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+#define assert(_e) ((_e)?(void)0:(_assert(#_e,__FILE__,__LINE__),exit(1)))
+static void _assert(char *estr, char *file, int line) {
+    printf("\n\n=== ASSERTION FAILED ===\n");
+    printf("==> %s:%d '%s' is not true\n",file,line,estr);
+}
+
+static void ok(void) {
+    printf("OK\n");
+}
+
+/* Random values clustered around a few keys, including negative ones, so
+ * that both array and bitmap containers are created. */
+static int64_t randomValue(int range) {
+    static const int64_t base[] = {0,-65536*3,1LL<<40,INT64_MIN,INT64_MAX-300000};
+    return base[rand()%5] + rand()%range;
+}
+
+/* Check that 'r' holds exactly the elements of the intset 'is', and that
+ * the ranks of the containers are up to date. */
+static void checkSameElements(roaring *r, intset *is) {
+    roaringIterator it;
+    int64_t v, expected;
+    uint32_t j = 0;
+
+    assert(roaringLen(r) == intsetLen(is));
+    roaringInitIterator(r,&it);
+    while (roaringNext(&it,&v)) {
+        assert(intsetGet(is,j,&expected));
+        assert(v == expected);
+        assert(roaringSelect(r,j++,&v) && v == expected);
+    }
+    assert(j == intsetLen(is));
+}
+
+static void fillRandom(roaring **r, intset **is, int count, int range) {
+    *r = roaringNew();
+    *is = intsetNew();
+    for (int j = 0; j < count; j++) {
+        int64_t v = randomValue(range);
+        uint8_t success;
+        *is = intsetAdd(*is,v,&success);
+        assert(roaringAdd(*r,v) == success);
+    }
+}
+
+/* The benchmark stores its results here so that they are not optimized
+ * away. */
+static volatile uint64_t benchmark_sink;
+
+#define UNUSED(x) (void)(x)
+int roaringTest(int argc, char **argv) {
+    roaring *r, *s, *d;
+    intset *is, *it2;
+    int j, k;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(time(NULL));
+
+    printf("Basic add/remove/find: "); {
+        r = roaringNew();
+        assert(roaringAdd(r,5) == 1);
+        assert(roaringAdd(r,5) == 0);
+        assert(roaringAdd(r,-1) == 1);
+        assert(roaringAdd(r,INT64_MIN) == 1);
+        assert(roaringAdd(r,INT64_MAX) == 1);
+        assert(roaringLen(r) == 4 && roaringContainers(r) == 4);
+        assert(roaringFind(r,-1) && roaringFind(r,INT64_MIN));
+        assert(!roaringFind(r,6) && !roaringFind(r,65536+5));
+        assert(roaringRemove(r,5) == 1);
+        assert(roaringRemove(r,5) == 0);
+        assert(roaringLen(r) == 3 && roaringContainers(r) == 3);
+        roaringFree(r);
+        ok();
+    }
+
+    printf("Array to bitmap conversion and back: "); {
+        r = roaringNew();
+        for (j = 0; j < 10000; j++) roaringAdd(r,j*2);
+        assert(r->containers[0]->type == ROARING_CONTAINER_BITMAP);
+        assert(roaringLen(r) == 10000);
+        for (j = 0; j < 10000-ROARING_ARRAY_MAX/2; j++) roaringRemove(r,j*2);
+        assert(r->containers[0]->type == ROARING_CONTAINER_ARRAY);
+        assert(roaringLen(r) == ROARING_ARRAY_MAX/2);
+        for (j = 10000-ROARING_ARRAY_MAX/2; j < 10000; j++)
+            assert(roaringFind(r,j*2) && !roaringFind(r,j*2+1));
+        roaringFree(r);
+        ok();
+    }
+
+    printf("Random adds and removes match an intset: "); {
+        for (k = 0; k < 20; k++) {
+            int range = k % 2 ? 5000 : 200000;
+            int success;
+            fillRandom(&r,&is,20000,range);
+            checkSameElements(r,is);
+            for (j = 0; j < 20000; j++) {
+                int64_t v = randomValue(range);
+                is = intsetRemove(is,v,&success);
+                assert(roaringRemove(r,v) == success);
+            }
+            checkSameElements(r,is);
+            roaringFree(r);
+            zfree(is);
+        }
+        ok();
+    }
+
+    printf("Select, seek and random: "); {
+        roaringIterator iter;
+        int64_t v, expected;
+        fillRandom(&r,&is,50000,100000);
+        for (j = 0; j < (int)intsetLen(is); j += 97) {
+            assert(roaringSelect(r,j,&v));
+            assert(intsetGet(is,j,&expected) && v == expected);
+            roaringInitIterator(r,&iter);
+            roaringSeek(&iter,expected);
+            assert(roaringNext(&iter,&v) && v == expected);
+            if (expected != INT64_MAX) {
+                roaringInitIterator(r,&iter);
+                roaringSeek(&iter,expected+1);
+                if (intsetGet(is,j+1,&expected))
+                    assert(roaringNext(&iter,&v) && v == expected);
+                else
+                    assert(!roaringNext(&iter,&v));
+            }
+        }
+        assert(!roaringSelect(r,roaringLen(r),&v));
+        for (j = 0; j < 1000; j++) assert(roaringFind(r,roaringRandom(r)));
+        roaringFree(r);
+        zfree(is);
+        ok();
+    }
+
+    printf("AND, OR, ANDNOT match an intset merge: "); {
+        for (k = 0; k < 20; k++) {
+            int range = k % 2 ? 8000 : 150000;
+            intset *expected_and = intsetNew(), *expected_or = intsetNew(),
+                   *expected_andnot = intsetNew();
+            int64_t v;
+
+            fillRandom(&r,&is,30000,range);
+            fillRandom(&s,&it2,k % 3 ? 30000 : 300,range);
+            for (j = 0; intsetGet(is,j,&v); j++) {
+                expected_or = intsetAdd(expected_or,v,NULL);
+                if (intsetFind(it2,v))
+                    expected_and = intsetAdd(expected_and,v,NULL);
+                else
+                    expected_andnot = intsetAdd(expected_andnot,v,NULL);
+            }
+            for (j = 0; intsetGet(it2,j,&v); j++)
+                expected_or = intsetAdd(expected_or,v,NULL);
+
+            d = roaringAnd(r,s); checkSameElements(d,expected_and); roaringFree(d);
+            assert(roaringAndCard(r,s) == intsetLen(expected_and));
+            assert(roaringAndCard(s,r) == intsetLen(expected_and));
+            d = roaringAnd(s,r); checkSameElements(d,expected_and); roaringFree(d);
+            d = roaringOr(r,s); checkSameElements(d,expected_or); roaringFree(d);
+            d = roaringOr(s,r); checkSameElements(d,expected_or); roaringFree(d);
+            d = roaringAndNot(r,s); checkSameElements(d,expected_andnot); roaringFree(d);
+            roaringFree(r); roaringFree(s);
+            zfree(is); zfree(it2);
+            zfree(expected_and); zfree(expected_or); zfree(expected_andnot);
+        }
+        ok();
+    }
+
+    printf("Bitmap kernels agree with the scalar loop: "); {
+        static uint64_t a[ROARING_BITMAP_WORDS], b[ROARING_BITMAP_WORDS],
+                        x[ROARING_BITMAP_WORDS], y[ROARING_BITMAP_WORDS];
+        int op;
+        for (j = 0; j < ROARING_BITMAP_WORDS; j++) {
+            a[j] = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 11) ^ rand();
+            b[j] = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 11) ^ rand();
+        }
+        roaringSelectKernel();
+        for (op = ROARING_OP_AND; op <= ROARING_OP_ANDNOT; op++) {
+            assert(bitmapOp(op,a,b,x) == bitmapOpScalar(op,a,b,y));
+            assert(memcmp(x,y,sizeof(x)) == 0);
+            assert(bitmapOp(op,a,b,NULL) == bitmapOpScalar(op,a,b,y));
+        }
+        ok();
+    }
+
+    printf("Serialization round trip and validation: "); {
+        unsigned char *buf;
+        size_t len;
+        fillRandom(&r,&is,50000,100000);
+        buf = roaringSerialize(r,&len);
+        s = roaringDeserialize(buf,len);
+        assert(s != NULL);
+        checkSameElements(s,is);
+        roaringFree(s);
+        assert(roaringDeserialize(buf,len-1) == NULL);
+        assert(roaringDeserialize(buf,3) == NULL);
+        buf[4+8] = 0; buf[4+9] = 0; /* Zero cardinality of the first container. */
+        buf[4+10] = 0; buf[4+11] = 0;
+        assert(roaringDeserialize(buf,len) == NULL);
+        zfree(buf);
+        roaringFree(r);
+        zfree(is);
+        ok();
+    }
+
+    printf("Benchmark 1M dense IDs: "); {
+        long long start;
+        roaring *odd = roaringNew();
+        r = roaringNew();
+        s = roaringNew();
+        start = usec();
+        for (j = 0; j < 1000000; j++) {
+            roaringAdd(r,j);
+            if (j % 3) roaringAdd(s,j);
+            if (j % 2) roaringAdd(odd,j*2+1);
+        }
+        printf("\n  1M adds: %lldusec, %zu bytes (intset: %zu bytes)\n",
+               usec()-start,roaringBytes(r),(size_t)(8+4*1000000));
+        start = usec();
+        for (j = 0; j < 1000000; j++) benchmark_sink += roaringFind(r,rand()%2000000);
+        printf("  1M lookups: %lldusec\n",usec()-start);
+        start = usec();
+        for (k = 0; k < 100; k++) {
+            d = roaringAnd(r,s); benchmark_sink += roaringLen(d); roaringFree(d);
+            d = roaringOr(s,odd); benchmark_sink += roaringLen(d); roaringFree(d);
+            d = roaringAndNot(r,s); benchmark_sink += roaringLen(d); roaringFree(d);
+        }
+        printf("  100 x (AND + OR + ANDNOT) of ~1M element sets: %lldusec\n",
+               usec()-start);
+        roaringFree(r); roaringFree(s); roaringFree(odd);
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2009-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ROARING_H
+#define __ROARING_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* A roaring bitmap splits the 64 bit integer space into chunks of 65536
+ * values sharing the same high 48 bits. Every non empty chunk is stored as
+ * a container of the low 16 bits: a sorted array of uint16_t while the
+ * chunk is sparse, or a 8k bitmap once it holds more than
+ * ROARING_ARRAY_MAX elements. */
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_BITMAP_WORDS 1024
+
+#define ROARING_CONTAINER_ARRAY 0
+#define ROARING_CONTAINER_BITMAP 1
+
+typedef struct roaringContainer {
+    uint32_t card;      /* Number of elements, up to 65536. */
+    uint16_t type;      /* ROARING_CONTAINER_ARRAY or _BITMAP. */
+    uint16_t cap;       /* Allocated array slots (array containers only). */
+    uint64_t data[];    /* uint16_t array or ROARING_BITMAP_WORDS words. */
+} roaringContainer;
+
+typedef struct roaring {
+    uint64_t card;                  /* Total number of elements. */
+    uint32_t len;                   /* Number of containers. */
+    uint32_t alloc;                 /* Allocated slots in keys/containers. */
+    int64_t *keys;                  /* Sorted high 48 bits (value >> 16). */
+    roaringContainer **containers;
+    uint64_t *ranks;                /* Fenwick tree of the container
+                                       cardinalities, see roaringSelect(). */
+} roaring;
+
+typedef struct roaringIterator {
+    roaring *r;
+    uint32_t ci;        /* Current container index. */
+    uint32_t pos;       /* Array index or bit number inside the container. */
+} roaringIterator;
+
+roaring *roaringNew(void);
+void roaringFree(roaring *r);
+roaring *roaringDup(roaring *r);
+int roaringAdd(roaring *r, int64_t value);
+int roaringRemove(roaring *r, int64_t value);
+int roaringFind(roaring *r, int64_t value);
+uint64_t roaringLen(const roaring *r);
+uint32_t roaringContainers(const roaring *r);
+size_t roaringBytes(const roaring *r);
+int roaringSelect(roaring *r, uint64_t rank, int64_t *value);
+int64_t roaringRandom(roaring *r);
+void roaringInitIterator(roaring *r, roaringIterator *it);
+void roaringSeek(roaringIterator *it, int64_t value);
+int roaringNext(roaringIterator *it, int64_t *value);
+roaring *roaringAnd(roaring *a, roaring *b);
+uint64_t roaringAndCard(roaring *a, roaring *b);
+roaring *roaringOr(roaring *a, roaring *b);
+roaring *roaringAndNot(roaring *a, roaring *b);
+unsigned char *roaringSerialize(roaring *r, size_t *len);
+roaring *roaringDeserialize(const unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int roaringTest(int argc, char *argv[]);
+#endif
+
+#endif // __ROARING_H
@@ -50,10 +50,26 @@ void ldbDisable(client *c);
 void ldbEnable(client *c);
 void evalGenericCommandWithDebugging(client *c, int evalsha);
 void luaLdbLineHook(lua_State *lua, lua_Debug *ar);
+void luaYield(void);
 void ldbLog(sds entry);
 void ldbLogRedisReply(char *reply);
 sds ldbCatStackValue(sds s, lua_State *lua, int idx);
 
+/* References to the Lua objects EVAL needs at every call, stored in the Lua
+ * registry so that they are found without hashing their global names again
+ * and again. They belong to the current Lua interpreter, so scriptingInit()
+ * resets them. The compiled functions are cached in a small table indexed
+ * by their SHA1. */
+#define LUA_FUNC_CACHE_SIZE 256
+struct luaRefs {
+    int err_handler;    /* The __redis__err__handler() function. */
+    int keys, argv;     /* Tables used for the KEYS and ARGV globals. */
+    struct {
+        char sha[40];   /* Lower case SHA1, or empty string if unused. */
+        int ref;
+    } func[LUA_FUNC_CACHE_SIZE];
+} luaRefs;
+
 /* Debugger shared state is stored inside this global structure. */
 #define LDB_BREAKPOINTS_MAX 64  /* Max number of breakpoints. */
 #define LDB_MAX_LEN_DEFAULT 256 /* Default len limit for replies / var dumps. */
@@ -377,6 +393,19 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
         luaPushError(lua,recursion_warning);
         return 1;
     }
+
+    /* Scripts that don't need to run atomically let the other clients run
+     * between commands once their time slice is used. */
+    if (server.lua_yield && server.lua_time_slice &&
+        mstime() - server.lua_time_start >= server.lua_time_slice)
+    {
+        luaYield();
+        if (server.lua_kill) {
+            serverLog(LL_WARNING,"Lua script killed by user with SCRIPT KILL.");
+            lua_pushstring(lua,"Script killed by user with SCRIPT KILL...");
+            return lua_error(lua);
+        }
+    }
     inuse++;
 
     /* Require at least one argument */
@@ -483,7 +512,11 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
      * command marked as non-deterministic was already called in the context
      * of this script. */
     if (cmd->flags & CMD_WRITE) {
-        if (server.lua_random_dirty && !server.lua_replicate_commands) {
+        if (server.lua_no_writes) {
+            luaPushError(lua,
+                "Write commands not allowed after redis.no_writes()");
+            goto cleanup;
+        } else if (server.lua_random_dirty && !server.lua_replicate_commands) {
             luaPushError(lua,
                 "Write commands not allowed after non deterministic commands. Call redis.replicate_commands() at the start of your script in order to switch to single commands replication mode.");
             goto cleanup;
@@ -539,8 +572,11 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
 
     /* If we are using single commands replication, we need to wrap what
      * we propagate into a MULTI/EXEC block, so that it will be atomic like
-     * a Lua script in the context of AOF and slaves. */
+     * a Lua script in the context of AOF and slaves. Scripts that may yield
+     * are not atomic: the commands of other clients can be propagated in
+     * the middle of theirs. */
     if (server.lua_replicate_commands &&
+        !server.lua_yield &&
         !server.lua_multi_emitted &&
         !(server.lua_caller->flags & CLIENT_MULTI) &&
         server.lua_write_dirty &&
@@ -575,9 +611,9 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
         reply = sdsnewlen(c->buf,c->bufpos);
         c->bufpos = 0;
         while(listLength(c->reply)) {
-            sds o = listNodeValue(listFirst(c->reply));
+            clientReplyBlock *o = listNodeValue(listFirst(c->reply));
 
-            reply = sdscatsds(reply,o);
+            reply = sdscatlen(reply,o->buf,o->used);
             listDelNode(c->reply,listFirst(c->reply));
         }
     }
@@ -718,6 +754,42 @@ int luaRedisReplicateCommandsCommand(lua_State *lua) {
     return 1;
 }
 
+/* redis.allow_yield()
+ *
+ * Declare that the script does not need to run atomically: once it ran for
+ * lua-time-slice milliseconds, the next redis.call() lets the server serve
+ * the other clients first. Like with redis.replicate_commands() the effects
+ * of the script are replicated instead of the script itself, but without a
+ * MULTI/EXEC block around them. Returns false, and the script stays atomic,
+ * if it already called a write command. */
+int luaRedisAllowYieldCommand(lua_State *lua) {
+    if (server.lua_write_dirty) {
+        lua_pushboolean(lua,0);
+    } else {
+        server.lua_yield = 1;
+        server.lua_replicate_commands = 1;
+        redisSrand48(rand());
+        lua_pushboolean(lua,1);
+    }
+    return 1;
+}
+
+/* redis.no_writes()
+ *
+ * Declare the script read only: write commands are refused from now on,
+ * and the script yields like after redis.allow_yield(), since there is
+ * nothing to keep atomic. Note that the reads that follow a yield may see
+ * the writes of other clients. Returns false if the script already called
+ * a write command. */
+int luaRedisNoWritesCommand(lua_State *lua) {
+    if (server.lua_write_dirty) {
+        lua_pushboolean(lua,0);
+        return 1;
+    }
+    server.lua_no_writes = 1;
+    return luaRedisAllowYieldCommand(lua);
+}
+
 /* redis.breakpoint()
  *
  * Allows to stop execution during a debuggign session from within
@@ -972,6 +1044,14 @@ void scriptingInit(int setup) {
     lua_pushcfunction(lua, luaRedisReplicateCommandsCommand);
     lua_settable(lua, -3);
 
+    /* redis.allow_yield and redis.no_writes */
+    lua_pushstring(lua, "allow_yield");
+    lua_pushcfunction(lua, luaRedisAllowYieldCommand);
+    lua_settable(lua, -3);
+    lua_pushstring(lua, "no_writes");
+    lua_pushcfunction(lua, luaRedisNoWritesCommand);
+    lua_settable(lua, -3);
+
     /* redis.set_repl and associated flags. */
     lua_pushstring(lua,"set_repl");
     lua_pushcfunction(lua,luaRedisSetReplCommand);
@@ -1051,6 +1131,10 @@ void scriptingInit(int setup) {
         luaL_loadbuffer(lua,errh_func,strlen(errh_func),"@err_handler_def");
         lua_pcall(lua,0,0,0);
     }
+    memset(&luaRefs,0,sizeof(luaRefs));
+    lua_getglobal(lua,"__redis__err__handler");
+    luaRefs.err_handler = luaL_ref(lua,LUA_REGISTRYINDEX);
+    luaRefs.keys = luaRefs.argv = LUA_NOREF;
 
     /* Create the (non connected) client that we use to execute Redis commands
      * inside the Lua interpreter.
@@ -1082,11 +1166,45 @@ void scriptingReset(void) {
 }
 
 /* Set an array of Redis String Objects as a Lua array (table) stored into a
- * global variable. */
-void luaSetGlobalArray(lua_State *lua, char *var, robj **elev, int elec) {
+ * global variable.
+ *
+ * The table referenced by '*ref' is reused across calls, so that short
+ * scripts called at a high rate don't allocate two new tables (and give them
+ * to the garbage collector) at every call. Everything that is not going to be
+ * overwritten is removed first, so the script always sees a clean array. */
+void luaSetGlobalArray(lua_State *lua, char *var, int *ref, robj **elev,
+                       int elec)
+{
     int j;
 
-    lua_newtable(lua);
+    if (*ref != LUA_NOREF) {
+        lua_rawgeti(lua,LUA_REGISTRYINDEX,*ref);
+        if (lua_getmetatable(lua,-1)) {
+            /* The script did something fancy with it, start again. */
+            lua_pop(lua,2);
+            luaL_unref(lua,LUA_REGISTRYINDEX,*ref);
+            *ref = LUA_NOREF;
+        }
+    }
+    if (*ref == LUA_NOREF) {
+        lua_newtable(lua);
+        lua_pushvalue(lua,-1);
+        *ref = luaL_ref(lua,LUA_REGISTRYINDEX);
+    } else {
+        lua_pushnil(lua);
+        while (lua_next(lua,-2)) {
+            lua_pop(lua,1); /* Pop the value, keep the key for lua_next(). */
+            if (lua_type(lua,-1) == LUA_TNUMBER) {
+                lua_Number idx = lua_tonumber(lua,-1);
+                if (idx >= 1 && idx <= elec && idx == (int)idx) continue;
+            }
+            /* Setting an existing field to nil is allowed while
+             * traversing the table. */
+            lua_pushvalue(lua,-1);
+            lua_pushnil(lua);
+            lua_rawset(lua,-4);
+        }
+    }
     for (j = 0; j < elec; j++) {
         lua_pushlstring(lua,(char*)elev[j]->ptr,sdslen(elev[j]->ptr));
         lua_rawseti(lua,-2,j+1);
@@ -1236,12 +1354,76 @@ void luaMaskCountHook(lua_State *lua, lua_Debug *ar) {
     }
 }
 
+/* Return the slot of the functions cache used for the specified SHA1. */
+static int luaFuncCacheSlot(char *sha) {
+    unsigned int h = 0;
+    int j;
+
+    for (j = 0; j < 8; j++) h = h*31 + (unsigned char)sha[j];
+    return h & (LUA_FUNC_CACHE_SIZE-1);
+}
+
+/* Push on the stack the compiled function of the script with the specified
+ * lower case SHA1 if it is in the functions cache, and return 1. Otherwise
+ * nothing is pushed and 0 is returned. */
+int luaGetCachedFunction(lua_State *lua, char *sha) {
+    int slot = luaFuncCacheSlot(sha);
+
+    if (memcmp(luaRefs.func[slot].sha,sha,40) != 0) return 0;
+    lua_rawgeti(lua,LUA_REGISTRYINDEX,luaRefs.func[slot].ref);
+    return 1;
+}
+
+/* Add the function on top of the stack to the functions cache, replacing
+ * the one of another script using the same slot. The stack is unchanged. */
+void luaCacheFunction(lua_State *lua, char *sha) {
+    int slot = luaFuncCacheSlot(sha);
+
+    if (luaRefs.func[slot].sha[0])
+        luaL_unref(lua,LUA_REGISTRYINDEX,luaRefs.func[slot].ref);
+    lua_pushvalue(lua,-1);
+    luaRefs.func[slot].ref = luaL_ref(lua,LUA_REGISTRYINDEX);
+    memcpy(luaRefs.func[slot].sha,sha,40);
+}
+
+/* Let the server serve the other clients for a while, on behalf of a script
+ * that allows it and used its time slice. Like after a script timeout, the
+ * caller is removed from the event loop meanwhile. The time slice of the
+ * script starts again when it resumes. Nothing is done if the script can't
+ * yield in its context: inside MULTI/EXEC, while loading, when called by
+ * our master or a module, or while debugged. */
+void luaYield(void) {
+    client *caller = server.lua_caller;
+    client *current = server.current_client;
+
+    if (caller->fd == -1 || caller->flags & (CLIENT_MULTI|CLIENT_MASTER) ||
+        server.loading || server.lua_timedout || ldb.active) return;
+
+    aeDeleteFileEvent(server.el,caller->fd,AE_READABLE);
+    processEventsWhileYielding();
+    /* The commands of the other clients set the current client: restore
+     * it, so that the pipelined commands of the caller are processed when
+     * the script returns. */
+    server.current_client = current;
+    aeCreateFileEvent(server.el,caller->fd,AE_READABLE,
+                      readQueryFromClient,caller);
+    server.lua_time_start = mstime();
+}
+
 void evalGenericCommand(client *c, int evalsha) {
     lua_State *lua = server.lua;
     char funcname[43];
     long long numkeys;
     int delhook = 0, err;
 
+    /* The other clients can run commands while a script yields, but there is
+     * just one Lua interpreter: they can't run scripts. This also covers
+     * scripts in a MULTI/EXEC block. */
+    if (server.lua_caller) {
+        addReplySds(c,sdsnew("-BUSY A script that yielded is running, scripts can't be called until it returns.\r\n"));
+        return;
+    }
+
     /* When we replicate whole scripts, we want the same PRNG sequence at
      * every call so that our PRNG is not affected by external state. */
     redisSrand48(0);
@@ -1259,6 +1441,8 @@ void evalGenericCommand(client *c, int evalsha) {
     server.lua_replicate_commands = server.lua_always_replicate_commands;
     server.lua_multi_emitted = 0;
     server.lua_repl = PROPAGATE_AOF|PROPAGATE_REPL;
+    server.lua_yield = 0;
+    server.lua_no_writes = 0;
 
     /* Get the number of arguments that are keys */
     if (getLongLongFromObjectOrReply(c,c->argv[2],&numkeys,NULL) != C_OK)
@@ -1293,35 +1477,40 @@ void evalGenericCommand(client *c, int evalsha) {
     }
 
     /* Push the pcall error handler function on the stack. */
-    lua_getglobal(lua, "__redis__err__handler");
-
-    /* Try to lookup the Lua function */
-    lua_getglobal(lua, funcname);
-    if (lua_isnil(lua,-1)) {
-        lua_pop(lua,1); /* remove the nil from the stack */
-        /* Function not defined... let's define it if we have the
-         * body of the function. If this is an EVALSHA call we can just
-         * return an error. */
-        if (evalsha) {
-            lua_pop(lua,1); /* remove the error handler from the stack. */
-            addReply(c, shared.noscripterr);
-            return;
-        }
-        if (luaCreateFunction(c,lua,c->argv[1]) == NULL) {
-            lua_pop(lua,1); /* remove the error handler from the stack. */
-            /* The error is sent to the client by luaCreateFunction()
-             * itself when it returns NULL. */
-            return;
-        }
-        /* Now the following is guaranteed to return non nil */
+    lua_rawgeti(lua,LUA_REGISTRYINDEX,luaRefs.err_handler);
+
+    /* Try to lookup the Lua function, in the cache of the compiled functions
+     * first, then as a global. */
+    if (!luaGetCachedFunction(lua,funcname+2)) {
         lua_getglobal(lua, funcname);
-        serverAssert(!lua_isnil(lua,-1));
+        if (lua_isnil(lua,-1)) {
+            lua_pop(lua,1); /* remove the nil from the stack */
+            /* Function not defined... let's define it if we have the
+             * body of the function. If this is an EVALSHA call we can just
+             * return an error. */
+            if (evalsha) {
+                lua_pop(lua,1); /* remove the error handler from the stack. */
+                addReply(c, shared.noscripterr);
+                return;
+            }
+            if (luaCreateFunction(c,lua,c->argv[1]) == NULL) {
+                lua_pop(lua,1); /* remove the error handler from the stack. */
+                /* The error is sent to the client by luaCreateFunction()
+                 * itself when it returns NULL. */
+                return;
+            }
+            /* Now the following is guaranteed to return non nil */
+            lua_getglobal(lua, funcname);
+            serverAssert(!lua_isnil(lua,-1));
+        }
+        luaCacheFunction(lua,funcname+2);
     }
 
     /* Populate the argv and keys table accordingly to the arguments that
      * EVAL received. */
-    luaSetGlobalArray(lua,"KEYS",c->argv+3,numkeys);
-    luaSetGlobalArray(lua,"ARGV",c->argv+3+numkeys,c->argc-3-numkeys);
+    luaSetGlobalArray(lua,"KEYS",&luaRefs.keys,c->argv+3,numkeys);
+    luaSetGlobalArray(lua,"ARGV",&luaRefs.argv,c->argv+3+numkeys,
+                      c->argc-3-numkeys);
 
     /* Select the right DB in the context of the Lua client */
     selectDb(server.lua_client,c->db->id);
@@ -1367,14 +1556,26 @@ void evalGenericCommand(client *c, int evalsha) {
      *
      * The call is performed every LUA_GC_CYCLE_PERIOD executed commands
      * (and for LUA_GC_CYCLE_PERIOD collection steps) because calling it
-     * for every command uses too much CPU. */
+     * for every command uses too much CPU. The size of the step follows the
+     * memory the scripts allocated since the last one, so that short scripts
+     * producing little garbage don't pay for marking all the live objects
+     * again and again. */
     #define LUA_GC_CYCLE_PERIOD 50
     {
         static long gc_count = 0;
+        static int gc_kbytes = 0; /* Lua memory used after the last step. */
 
         gc_count++;
         if (gc_count == LUA_GC_CYCLE_PERIOD) {
-            lua_gc(lua,LUA_GCSTEP,LUA_GC_CYCLE_PERIOD);
+            int kbytes = lua_gc(lua,LUA_GCCOUNT,0);
+
+            if (kbytes > gc_kbytes) {
+                int step = kbytes-gc_kbytes;
+                if (step > LUA_GC_CYCLE_PERIOD) step = LUA_GC_CYCLE_PERIOD;
+                lua_gc(lua,LUA_GCSTEP,step);
+                kbytes = lua_gc(lua,LUA_GCCOUNT,0);
+            }
+            gc_kbytes = kbytes;
             gc_count = 0;
         }
     }
@@ -1456,6 +1657,10 @@ void evalShaCommand(client *c) {
 
 void scriptCommand(client *c) {
     if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"flush")) {
+        if (server.lua_caller) {
+            addReplySds(c,sdsnew("-BUSY Can't flush the scripts while a script that yielded is running.\r\n"));
+            return;
+        }
         scriptingReset();
         addReply(c,shared.ok);
         replicationScriptCacheFlush();
@@ -1478,7 +1683,7 @@ void scriptCommand(client *c) {
     } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"kill")) {
         if (server.lua_caller == NULL) {
             addReplySds(c,sdsnew("-NOTBUSY No scripts in execution right now.\r\n"));
-        } else if (server.lua_write_dirty) {
+        } else if (server.lua_write_dirty && !server.lua_yield) {
             addReplySds(c,sdsnew("-UNKILLABLE Sorry the script already executed write commands against the dataset. You can either wait the script termination or kill the server in a hard way using the SHUTDOWN NOSAVE command.\r\n"));
         } else {
             server.lua_kill = 1;
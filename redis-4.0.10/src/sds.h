@@ -234,6 +234,9 @@ static inline void sdssetalloc(sds s, size_t newlen) {
 }
 //创建一个给定长度的sds字符串
 sds sdsnewlen(const void *init, size_t initlen);
+sds sdsnewlenhuge(const void *init, size_t initlen);
+size_t sdsReqSize(size_t initlen);
+sds sdsnewplacement(void *buf, const void *init, size_t initlen);
 //创建一个包含给定C字符的SDS
 sds sdsnew(const char *init);
 //创建一个不包含任何内容的空SDS
@@ -38,5 +38,6 @@
 
 #include "zmalloc.h"
 #define s_malloc zmalloc
+#define s_malloc_huge zmalloc_huge
 #define s_realloc zrealloc
 #define s_free zfree
@@ -455,7 +455,9 @@ void initSentinel(void) {
 
         retval = dictAdd(server.commands, sdsnew(cmd->name), cmd);
         serverAssert(retval == DICT_OK);
+        commandAssignId(cmd);
     }
+    buildCommandLookupTable();
 
     /* Initialize various data structures. */
     sentinel.current_epoch = 0;
@@ -171,6 +171,7 @@ struct redisCommand redisCommandTable[] = {
     {"srandmember",srandmemberCommand,-2,"rR",0,NULL,1,1,1,0,0},
     {"sinter",sinterCommand,-2,"rS",0,NULL,1,-1,1,0,0},
     {"sinterstore",sinterstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},
+    {"sintercard",sintercardCommand,-3,"r",0,sintercardGetKeys,0,0,0,0,0},
     {"sunion",sunionCommand,-2,"rS",0,NULL,1,-1,1,0,0},
     {"sunionstore",sunionstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},
     {"sdiff",sdiffCommand,-2,"rS",0,NULL,1,-1,1,0,0},
@@ -185,6 +186,10 @@ struct redisCommand redisCommandTable[] = {
     {"zremrangebylex",zremrangebylexCommand,4,"w",0,NULL,1,1,1,0,0},
     {"zunionstore",zunionstoreCommand,-4,"wm",0,zunionInterGetKeys,0,0,0,0,0},
     {"zinterstore",zinterstoreCommand,-4,"wm",0,zunionInterGetKeys,0,0,0,0,0},
+    {"zdiffstore",zdiffstoreCommand,-4,"wm",0,zunionInterGetKeys,0,0,0,0,0},
+    {"zunion",zunionCommand,-3,"r",0,zunionInterDiffGetKeys,0,0,0,0,0},
+    {"zinter",zinterCommand,-3,"r",0,zunionInterDiffGetKeys,0,0,0,0,0},
+    {"zdiff",zdiffCommand,-3,"r",0,zunionInterDiffGetKeys,0,0,0,0,0},
     {"zrange",zrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
     {"zrangebyscore",zrangebyscoreCommand,-4,"r",0,NULL,1,1,1,0,0},
     {"zrevrangebyscore",zrevrangebyscoreCommand,-4,"r",0,NULL,1,1,1,0,0},
@@ -213,6 +218,13 @@ struct redisCommand redisCommandTable[] = {
     {"hgetall",hgetallCommand,2,"r",0,NULL,1,1,1,0,0},
     {"hexists",hexistsCommand,3,"rF",0,NULL,1,1,1,0,0},
     {"hscan",hscanCommand,-3,"rR",0,NULL,1,1,1,0,0},
+    {"hexpire",hexpireCommand,-6,"wF",0,NULL,1,1,1,0,0},
+    {"hpexpire",hpexpireCommand,-6,"wF",0,NULL,1,1,1,0,0},
+    {"hexpireat",hexpireatCommand,-6,"wF",0,NULL,1,1,1,0,0},
+    {"hpexpireat",hpexpireatCommand,-6,"wF",0,NULL,1,1,1,0,0},
+    {"httl",httlCommand,-5,"rF",0,NULL,1,1,1,0,0},
+    {"hpttl",hpttlCommand,-5,"rF",0,NULL,1,1,1,0,0},
+    {"hpersist",hpersistCommand,-5,"wF",0,NULL,1,1,1,0,0},
     {"incrby",incrbyCommand,3,"wmF",0,NULL,1,1,1,0,0},
     {"decrby",decrbyCommand,3,"wmF",0,NULL,1,1,1,0,0},
     {"incrbyfloat",incrbyfloatCommand,3,"wmF",0,NULL,1,1,1,0,0},
@@ -706,6 +718,8 @@ void tryResizeHashTables(int dbid) {
         dictResize(server.db[dbid].dict);
     if (htNeedsResize(server.db[dbid].expires))
         dictResize(server.db[dbid].expires);
+    if (htNeedsResize(server.db[dbid].hexpires))
+        dictResize(server.db[dbid].hexpires);
 }
 
 /* Our hash table implementation performs rehashing incrementally while
@@ -808,13 +822,29 @@ int clientsCronHandleTimeout(client *c, mstime_t now_ms) {
 }
 
 /* The client query buffer is an sds.c string that can end with a lot of
- * free space not used, this function reclaims space if needed.
+ * free space not used, this function reclaims space if needed. Clients
+ * without a partial command pending only read from the buffer shared by
+ * all the clients, so their private query buffer is released.
  *
  * The function always returns 0 as it never terminates the client. */
 int clientsCronResizeQueryBuffer(client *c) {
-    size_t querybuf_size = sdsAllocSize(c->querybuf);
+    size_t querybuf_size;
     time_t idletime = server.unixtime - c->lastinteraction;
 
+    if (c->querybuf == NULL || clientQueryBufferIsShared(c)) return 0;
+
+    /* Drop the private query buffer of an inactive client with nothing
+     * pending, it will read from the shared buffer again. */
+    if (sdslen(c->querybuf) == 0 && c->multibulklen == 0 && idletime > 2 &&
+        !(c->flags & CLIENT_MASTER))
+    {
+        sdsfree(c->querybuf);
+        c->querybuf = NULL;
+        c->querybuf_peak = 0;
+        return 0;
+    }
+
+    querybuf_size = sdsAllocSize(c->querybuf);
     /* There are two conditions to resize the query buffer:
      * 1) Query buffer is > BIG_ARG and too big for latest peak.
      * 2) Client is inactive and the buffer is bigger than 1k. */
@@ -833,6 +863,13 @@ int clientsCronResizeQueryBuffer(client *c) {
     return 0;
 }
 
+/* Release the argument objects recycled by an idle client, see
+ * freeClientArgv(). The function always returns 0. */
+int clientsCronFreeArgvCache(client *c) {
+    if (server.unixtime - c->lastinteraction > 2) freeClientArgvCache(c);
+    return 0;
+}
+
 #define CLIENTS_CRON_MIN_ITERATIONS 5
 void clientsCron(void) {
     /* Make sure to process at least numclients/server.hz of clients
@@ -863,8 +900,13 @@ void clientsCron(void) {
         /* The following functions do different service checks on the client.
          * The protocol is that they return non-zero if the client was
          * terminated. */
+        /* The cron runs while a script yields: skip the clients whose
+         * commands are executing, their query buffer and arguments are in
+         * use, and they are not idle. */
+        if (c->flags & CLIENT_PROCESSING_INPUT) continue;
         if (clientsCronHandleTimeout(c,now)) continue;
         if (clientsCronResizeQueryBuffer(c)) continue;
+        if (clientsCronFreeArgvCache(c)) continue;
     }
 }
 
@@ -880,6 +922,10 @@ void databasesCron(void) {
         expireSlaveKeys();
     }
 
+    /* Evict keys ahead of the maxmemory limit. Like for expires, slaves
+     * will receive the DELs from the master. */
+    if (server.masterhost == NULL) backgroundEvictionCycle();
+
     /* Defrag keys gradually. */
     if (server.active_defrag_enabled)
         activeDefragCycle();
@@ -1235,6 +1281,10 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
      * releasing the GIL. Redis main thread will not touch anything at this
      * time. */
     if (moduleCount()) moduleReleaseGIL();
+
+    /* The active defrag adapts its effort to the time the server waits for
+     * events, measured up to afterSleep(). */
+    if (server.active_defrag_enabled) server.el_sleep_start = ustime();
 }
 
 /* This function is called immadiately after the event loop multiplexing
@@ -1243,6 +1293,10 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
 void afterSleep(struct aeEventLoop *eventLoop) {
     UNUSED(eventLoop);
     if (moduleCount()) moduleAcquireGIL();
+    if (server.el_sleep_start) {
+        server.el_sleep_usec += ustime()-server.el_sleep_start;
+        server.el_sleep_start = 0;
+    }
 }
 
 /* =========================== Server initialization ======================== */
@@ -1317,6 +1371,7 @@ void createSharedObjects(void) {
     shared.punsubscribebulk = createStringObject("$12\r\npunsubscribe\r\n",19);
     shared.del = createStringObject("DEL",3);
     shared.unlink = createStringObject("UNLINK",6);
+    shared.hdel = createStringObject("HDEL",4);
     shared.rpop = createStringObject("RPOP",4);
     shared.lpop = createStringObject("LPOP",4);
     shared.lpush = createStringObject("LPUSH",5);
@@ -1369,6 +1424,7 @@ void initServerConfig(void) {
     server.tcpkeepalive = CONFIG_DEFAULT_TCP_KEEPALIVE;
     server.active_expire_enabled = 1;
     server.active_defrag_enabled = CONFIG_DEFAULT_ACTIVE_DEFRAG;
+    server.hugepage_layout = CONFIG_DEFAULT_HUGEPAGE_LAYOUT;
     server.active_defrag_ignore_bytes = CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES;
     server.active_defrag_threshold_lower = CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER;
     server.active_defrag_threshold_upper = CONFIG_DEFAULT_DEFRAG_THRESHOLD_UPPER;
@@ -1412,12 +1468,15 @@ void initServerConfig(void) {
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
     server.active_defrag_running = 0;
+    server.el_sleep_start = 0;
+    server.el_sleep_usec = 0;
     server.notify_keyspace_events = 0;
     server.maxclients = CONFIG_DEFAULT_MAX_CLIENTS;
     server.bpop_blocked_clients = 0;
     server.maxmemory = CONFIG_DEFAULT_MAXMEMORY;
     server.maxmemory_policy = CONFIG_DEFAULT_MAXMEMORY_POLICY;
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
+    server.maxmemory_eviction_lowwater = CONFIG_DEFAULT_MAXMEMORY_EVICTION_LOWWATER;
     server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
     server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
     server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
@@ -1425,6 +1484,7 @@ void initServerConfig(void) {
     server.list_max_ziplist_size = OBJ_LIST_MAX_ZIPLIST_SIZE;
     server.list_compress_depth = OBJ_LIST_COMPRESS_DEPTH;
     server.set_max_intset_entries = OBJ_SET_MAX_INTSET_ENTRIES;
+    server.set_roaring_min_density = OBJ_SET_ROARING_MIN_DENSITY;
     server.zset_max_ziplist_entries = OBJ_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = OBJ_ZSET_MAX_ZIPLIST_VALUE;
     server.hll_sparse_max_bytes = CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES;
@@ -1445,8 +1505,10 @@ void initServerConfig(void) {
     server.lazyfree_lazy_eviction = CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION;
     server.lazyfree_lazy_expire = CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE;
     server.lazyfree_lazy_server_del = CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL;
+    server.lazyfree_auto_effort = CONFIG_DEFAULT_LAZYFREE_AUTO_EFFORT;
     server.always_show_logo = CONFIG_DEFAULT_ALWAYS_SHOW_LOGO;
     server.lua_time_limit = LUA_SCRIPT_TIME_LIMIT;
+    server.lua_time_slice = LUA_SCRIPT_TIME_SLICE;
 
     unsigned int lruclock = getLRUClock();
     atomicSet(server.lruclock,lruclock);
@@ -1515,6 +1577,8 @@ void initServerConfig(void) {
     server.execCommand = lookupCommandByCString("exec");
     server.expireCommand = lookupCommandByCString("expire");
     server.pexpireCommand = lookupCommandByCString("pexpire");
+    server.hdelCommand = lookupCommandByCString("hdel");
+    server.hpexpireatCommand = lookupCommandByCString("hpexpireat");
 
     /* Slow log */
     server.slowlog_log_slower_than = CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN;
@@ -1783,15 +1847,31 @@ void resetServerStats(void) {
     server.stat_numcommands = 0;
     server.stat_numconnections = 0;
     server.stat_expiredkeys = 0;
+    server.stat_expired_fields = 0;
+    server.stat_unshared_values = 0;
     server.stat_expired_stale_perc = 0;
     server.stat_expired_time_cap_reached_count = 0;
     server.stat_evictedkeys = 0;
+    server.stat_evicted_score = 0;
+    server.stat_evicted_scored_keys = 0;
+    server.stat_eviction_sampled_score = 0;
+    server.stat_eviction_sampled_keys = 0;
+    server.stat_eviction_stale_candidates = 0;
+    server.stat_evictedkeys_background = 0;
+    server.stat_eviction_sync_calls = 0;
+    server.stat_eviction_sync_usec = 0;
+    server.stat_eviction_lag = 0;
+    for (j = 0; j < LAZYFREE_PATH_NUM; j++)
+        server.stat_lazyfree_objects[j] = 0;
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
     server.stat_active_defrag_hits = 0;
     server.stat_active_defrag_misses = 0;
+    server.stat_active_defrag_skipped = 0;
     server.stat_active_defrag_key_hits = 0;
     server.stat_active_defrag_key_misses = 0;
+    for (j = 0; j < OBJ_TYPE_NUM; j++)
+        server.stat_active_defrag_type_hits[j] = 0;
     server.stat_fork_time = 0;
     server.stat_fork_rate = 0;
     server.stat_rejected_conn = 0;
@@ -1824,6 +1904,13 @@ void initServer(void) {
             server.syslog_facility);
     }
 
+	//大块内存使用大页
+    if (server.hugepage_layout && zmalloc_set_hugepages(1) == -1) {
+        serverLog(LL_WARNING,
+            "The huge pages layout requires Jemalloc, disabling it.");
+        server.hugepage_layout = 0;
+    }
+
 	//设置pid
     server.pid = getpid();
     server.current_client = NULL;
@@ -1882,6 +1969,7 @@ void initServer(void) {
     for (j = 0; j < server.dbnum; j++) {
         server.db[j].dict = dictCreate(&dbDictType,NULL);
         server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        server.db[j].hexpires = dictCreate(&setDictType,NULL);
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
@@ -2026,22 +2114,37 @@ void populateCommandTable(void) {
          * by rename-command statements in redis.conf. */
         retval2 = dictAdd(server.orig_commands, sdsnew(c->name), c);
         serverAssert(retval1 == DICT_OK && retval2 == DICT_OK);
+        commandAssignId(c);
     }
+    buildCommandLookupTable();
+}
+
+/* Give 'cmd' the next numeric ID. IDs are never reused: the commands of the
+ * static table get the first ones, in order, then come the commands created
+ * later by modules or by Sentinel. */
+void commandAssignId(struct redisCommand *cmd) {
+    server.commands_by_id = zrealloc(server.commands_by_id,
+        sizeof(struct redisCommand*)*(server.commands_ids+1));
+    cmd->id = server.commands_ids++;
+    server.commands_by_id[cmd->id] = cmd;
+}
+
+/* Return the command with the specified ID, or NULL if there is no such
+ * command, or if it was unregistered (module commands). */
+struct redisCommand *lookupCommandById(int id) {
+    if (id < 0 || id >= server.commands_ids) return NULL;
+    return server.commands_by_id[id];
 }
 
 void resetCommandTableStats(void) {
     struct redisCommand *c;
-    dictEntry *de;
-    dictIterator *di;
+    int j;
 
-    di = dictGetSafeIterator(server.commands);
-    while((de = dictNext(di)) != NULL) {
-        c = (struct redisCommand *) dictGetVal(de);
+    for (j = 0; j < server.commands_ids; j++) {
+        if ((c = server.commands_by_id[j]) == NULL) continue;
         c->microseconds = 0;
         c->calls = 0;
     }
-    dictReleaseIterator(di);
-
 }
 
 /* ========================== Redis OP Array API ============================ */
@@ -2083,17 +2186,173 @@ void redisOpArrayFree(redisOpArray *oa) {
 
 /* ====================== Commands lookup and execution ===================== */
 
+/* Commands are looked up by name for every command executed, so instead of
+ * the server.commands dictionary, which requires a sds name and a siphash,
+ * lookups use a perfect hash table built from its content: every name
+ * in server.commands has its own slot, so a lookup is one hash of the name
+ * and one comparison. The table is built with the "hash and displace"
+ * method: names are grouped in buckets by hash, then for every bucket,
+ * starting with the largest, a displacement is searched that sends all its
+ * names to free slots.
+ *
+ * The table must be rebuilt calling buildCommandLookupTable() every time
+ * server.commands is modified, since it references its keys. */
+typedef struct commandLookupEntry {
+    sds name;                   /* Key of server.commands, NULL if free. */
+    struct redisCommand *cmd;
+    uint64_t hash;              /* Only used while building the table. */
+    unsigned long bucketlen;    /* Only used while building the table. */
+} commandLookupEntry;
+
+static struct {
+    commandLookupEntry *table;
+    uint16_t *disp;             /* Displacement of every bucket. */
+    unsigned long mask;         /* Table size - 1. */
+    unsigned long bmask;        /* Number of buckets - 1. */
+    uint64_t seed;
+} cmdlookup;
+
+/* Case insensitive FNV-1a hash of a command name. */
+static uint64_t commandNameHash(const char *name, size_t len, uint64_t seed) {
+    uint64_t h = 14695981039346656037ULL ^ seed;
+
+    while (len--) {
+        h ^= (unsigned char)tolower((unsigned char)*name++);
+        h *= 1099511628211ULL;
+    }
+    return h ^ (h >> 32);
+}
+
+static unsigned long commandLookupSlot(uint64_t hash, unsigned long disp,
+                                       unsigned long mask)
+{
+    return ((hash >> 32) + disp*((hash >> 16) | 1)) & mask;
+}
+
+static unsigned long commandLookupBucket;  /* Used by qsort() comparator */
+
+static int commandLookupEntryCompare(const void *a, const void *b) {
+    const commandLookupEntry *ea = a, *eb = b;
+
+    /* Larger buckets first, names of the same bucket together. */
+    if (ea->bucketlen != eb->bucketlen)
+        return ea->bucketlen > eb->bucketlen ? -1 : 1;
+    if ((ea->hash & commandLookupBucket) != (eb->hash & commandLookupBucket))
+        return (ea->hash & commandLookupBucket) <
+               (eb->hash & commandLookupBucket) ? -1 : 1;
+    return 0;
+}
+
+/* Try to place the names in 'items' in a table of mask+1 slots with
+ * bmask+1 buckets using the specified seed. Return 1 on success. */
+static int commandLookupTryBuild(commandLookupEntry *items, unsigned long n,
+                                 commandLookupEntry *table, uint16_t *disp,
+                                 unsigned long mask, unsigned long bmask,
+                                 uint64_t seed)
+{
+    unsigned long *bucketlen = zcalloc(sizeof(unsigned long)*(bmask+1));
+    unsigned long j, k, i, len, slot;
+    int ok = 1;
+
+    for (j = 0; j < n; j++) {
+        items[j].hash = commandNameHash(items[j].name,sdslen(items[j].name),
+                                        seed);
+        bucketlen[items[j].hash & bmask]++;
+    }
+    for (j = 0; j < n; j++) items[j].bucketlen = bucketlen[items[j].hash & bmask];
+    zfree(bucketlen);
+    commandLookupBucket = bmask;
+    qsort(items,n,sizeof(*items),commandLookupEntryCompare);
+
+    memset(table,0,sizeof(*table)*(mask+1));
+    memset(disp,0,sizeof(*disp)*(bmask+1));
+    for (j = 0; ok && j < n; j += len) {
+        unsigned long d;
+
+        len = items[j].bucketlen;
+        for (d = 0; d <= UINT16_MAX; d++) {
+            for (k = 0; k < len; k++) {
+                slot = commandLookupSlot(items[j+k].hash,d,mask);
+                if (table[slot].name) break;
+                for (i = 0; i < k; i++)
+                    if (commandLookupSlot(items[j+i].hash,d,mask) == slot) break;
+                if (i != k) break;
+            }
+            if (k == len) break;
+        }
+        if (d > UINT16_MAX) {
+            ok = 0;
+            break;
+        }
+        disp[items[j].hash & bmask] = d;
+        for (k = 0; k < len; k++)
+            table[commandLookupSlot(items[j+k].hash,d,mask)] = items[j+k];
+    }
+    return ok;
+}
+
+/* (Re)build the perfect hash table used by lookupCommand() from the current
+ * content of server.commands. */
+void buildCommandLookupTable(void) {
+    unsigned long n = dictSize(server.commands), size = 2, buckets, j = 0;
+    commandLookupEntry *items;
+    dictIterator *di;
+    dictEntry *de;
+    uint64_t seed = 0;
+
+    zfree(cmdlookup.table);
+    zfree(cmdlookup.disp);
+    cmdlookup.table = NULL;
+    cmdlookup.disp = NULL;
+    if (n == 0) return;
+
+    items = zmalloc(sizeof(*items)*n);
+    di = dictGetIterator(server.commands);
+    while((de = dictNext(di)) != NULL) {
+        items[j].name = dictGetKey(de);
+        items[j].cmd = dictGetVal(de);
+        j++;
+    }
+    dictReleaseIterator(di);
+
+    /* Half empty table, about four names per bucket. If no seed works
+     * after a few attempts, which is very unlikely, use a larger table. */
+    while (size < n*2) size <<= 1;
+    while (1) {
+        buckets = size/8 ? size/8 : 1;
+        cmdlookup.table = zrealloc(cmdlookup.table,sizeof(*items)*size);
+        cmdlookup.disp = zrealloc(cmdlookup.disp,sizeof(uint16_t)*buckets);
+        if (commandLookupTryBuild(items,n,cmdlookup.table,cmdlookup.disp,
+                                  size-1,buckets-1,seed)) break;
+        if (++seed % 16 == 0) size <<= 1;
+    }
+    cmdlookup.mask = size-1;
+    cmdlookup.bmask = buckets-1;
+    cmdlookup.seed = seed;
+    zfree(items);
+}
+
+/* Lookup a command by name, case insensitive. The name does not need to be
+ * a sds string nor to be null terminated. */
+struct redisCommand *lookupCommandByName(const char *name, size_t len) {
+    commandLookupEntry *e;
+    uint64_t hash;
+
+    if (cmdlookup.table == NULL) return NULL;
+    hash = commandNameHash(name,len,cmdlookup.seed);
+    e = cmdlookup.table+commandLookupSlot(hash,
+        cmdlookup.disp[hash & cmdlookup.bmask],cmdlookup.mask);
+    if (e->name == NULL || sdslen(e->name) != len ||
+        strncasecmp(e->name,name,len)) return NULL;
+    return e->cmd;
+}
+
 struct redisCommand *lookupCommand(sds name) {
-    return dictFetchValue(server.commands, name);
+    return lookupCommandByName(name,sdslen(name));
 }
 
 struct redisCommand *lookupCommandByCString(char *s) {
-    struct redisCommand *cmd;
-    sds name = sdsnew(s);
-
-    cmd = dictFetchValue(server.commands, name);
-    sdsfree(name);
-    return cmd;
+    return lookupCommandByName(s,strlen(s));
 }
 
 /* Lookup the command in the current table, if not found also check in
@@ -2104,7 +2363,7 @@ struct redisCommand *lookupCommandByCString(char *s) {
  * rewriteClientCommandVector() in order to set client->cmd pointer
  * correctly even if the command was renamed. */
 struct redisCommand *lookupCommandOrOriginal(sds name) {
-    struct redisCommand *cmd = dictFetchValue(server.commands, name);
+    struct redisCommand *cmd = lookupCommand(name);
 
     if (!cmd) cmd = dictFetchValue(server.orig_commands,name);
     return cmd;
@@ -2414,8 +2673,8 @@ int processCommand(client *c) {
     if (server.maxmemory) {
         int retval = freeMemoryIfNeeded();
         /* freeMemoryIfNeeded may flush slave output buffers. This may result
-         * into a slave, that may be the active client, to be freed. */
-        if (server.current_client == NULL) return C_ERR;
+         * into a slave, that may be the active client, to be closed. */
+        if (c->flags & CLIENT_CLOSE_ASAP) return C_ERR;
 
         /* It was impossible to free enough memory, and the command the client
          * is trying to execute is denied during OOM conditions? Error. */
@@ -2531,6 +2790,34 @@ int processCommand(client *c) {
     return C_OK;
 }
 
+/* Execute a command of a batch of GET or SET commands found in the query
+ * buffer by processInputBuffer(), after processCommand() already executed
+ * one command of the batch. The conditions checked by processCommand() can't
+ * change while such commands are executed, so the command lookup and all
+ * the checks are skipped, but the maxmemory handling: like in
+ * processCommand(), memory is freed before every command, reads included,
+ * and SET is refused if this is not possible.
+ *
+ * The return value has the same meaning as in processCommand(). */
+int processBatchedCommand(client *c, struct redisCommand *cmd) {
+    c->cmd = c->lastcmd = cmd;
+
+    if (server.maxmemory) {
+        int retval = freeMemoryIfNeeded();
+        if (c->flags & CLIENT_CLOSE_ASAP) return C_ERR;
+        if ((cmd->flags & CMD_DENYOOM) && retval == C_ERR) {
+            addReply(c, shared.oomerr);
+            return C_OK;
+        }
+    }
+
+    call(c,CMD_CALL_FULL);
+    c->woff = server.master_repl_offset;
+    if (listLength(server.ready_keys))
+        handleClientsBlockedOnLists();
+    return C_OK;
+}
+
 /*================================== Shutdown =============================== */
 
 /* Close listening sockets. Also unlink the unix domain socket if
@@ -2780,7 +3067,7 @@ void commandCommand(client *c) {
         int i;
         addReplyMultiBulkLen(c, c->argc-2);
         for (i = 2; i < c->argc; i++) {
-            addReplyCommand(c, dictFetchValue(server.commands, c->argv[i]->ptr));
+            addReplyCommand(c, lookupCommand(c->argv[i]->ptr));
         }
     } else if (!strcasecmp(c->argv[1]->ptr, "count") && c->argc == 2) {
         addReplyLongLong(c, dictSize(server.commands));
@@ -3124,9 +3411,17 @@ sds genRedisInfoString(char *section) {
             "sync_partial_ok:%lld\r\n"
             "sync_partial_err:%lld\r\n"
             "expired_keys:%lld\r\n"
+            "expired_fields:%lld\r\n"
             "expired_stale_perc:%.2f\r\n"
             "expired_time_cap_reached_count:%lld\r\n"
             "evicted_keys:%lld\r\n"
+            "evicted_keys_avg_score:%.2f\r\n"
+            "eviction_sampled_avg_score:%.2f\r\n"
+            "eviction_stale_candidates:%lld\r\n"
+            "evicted_keys_background:%lld\r\n"
+            "eviction_sync_calls:%lld\r\n"
+            "eviction_sync_usec:%lld\r\n"
+            "eviction_lag_bytes:%zu\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
@@ -3136,8 +3431,16 @@ sds genRedisInfoString(char *section) {
             "slave_expires_tracked_keys:%zu\r\n"
             "active_defrag_hits:%lld\r\n"
             "active_defrag_misses:%lld\r\n"
+            "active_defrag_skipped:%lld\r\n"
             "active_defrag_key_hits:%lld\r\n"
-            "active_defrag_key_misses:%lld\r\n",
+            "active_defrag_key_misses:%lld\r\n"
+            "active_defrag_type_hits:string=%lld,list=%lld,set=%lld,zset=%lld,hash=%lld,module=%lld\r\n"
+            "lazyfree_user_objects:%lld\r\n"
+            "lazyfree_server_del_objects:%lld\r\n"
+            "lazyfree_expire_objects:%lld\r\n"
+            "lazyfree_eviction_objects:%lld\r\n"
+            "lazyfree_overwrite_objects:%lld\r\n"
+            "unshared_pinned_values:%lld\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -3150,9 +3453,20 @@ sds genRedisInfoString(char *section) {
             server.stat_sync_partial_ok,
             server.stat_sync_partial_err,
             server.stat_expiredkeys,
+            server.stat_expired_fields,
             server.stat_expired_stale_perc*100,
             server.stat_expired_time_cap_reached_count,
             server.stat_evictedkeys,
+            server.stat_evicted_scored_keys ?
+                server.stat_evicted_score/server.stat_evicted_scored_keys : 0,
+            server.stat_eviction_sampled_keys ?
+                server.stat_eviction_sampled_score/
+                server.stat_eviction_sampled_keys : 0,
+            server.stat_eviction_stale_candidates,
+            server.stat_evictedkeys_background,
+            server.stat_eviction_sync_calls,
+            server.stat_eviction_sync_usec,
+            server.stat_eviction_lag,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
@@ -3162,8 +3476,21 @@ sds genRedisInfoString(char *section) {
             getSlaveKeyWithExpireCount(),
             server.stat_active_defrag_hits,
             server.stat_active_defrag_misses,
+            server.stat_active_defrag_skipped,
             server.stat_active_defrag_key_hits,
-            server.stat_active_defrag_key_misses);
+            server.stat_active_defrag_key_misses,
+            server.stat_active_defrag_type_hits[OBJ_STRING],
+            server.stat_active_defrag_type_hits[OBJ_LIST],
+            server.stat_active_defrag_type_hits[OBJ_SET],
+            server.stat_active_defrag_type_hits[OBJ_ZSET],
+            server.stat_active_defrag_type_hits[OBJ_HASH],
+            server.stat_active_defrag_type_hits[OBJ_MODULE],
+            server.stat_lazyfree_objects[LAZYFREE_PATH_USER],
+            server.stat_lazyfree_objects[LAZYFREE_PATH_SERVER_DEL],
+            server.stat_lazyfree_objects[LAZYFREE_PATH_EXPIRE],
+            server.stat_lazyfree_objects[LAZYFREE_PATH_EVICTION],
+            server.stat_lazyfree_objects[LAZYFREE_PATH_OVERWRITE],
+            server.stat_unshared_values);
     }
 
     /* Replication */
@@ -3315,18 +3642,15 @@ sds genRedisInfoString(char *section) {
         info = sdscatprintf(info, "# Commandstats\r\n");
 
         struct redisCommand *c;
-        dictEntry *de;
-        dictIterator *di;
-        di = dictGetSafeIterator(server.commands);
-        while((de = dictNext(di)) != NULL) {
-            c = (struct redisCommand *) dictGetVal(de);
-            if (!c->calls) continue;
+        int j;
+        for (j = 0; j < server.commands_ids; j++) {
+            c = server.commands_by_id[j];
+            if (c == NULL || !c->calls) continue;
             info = sdscatprintf(info,
                 "cmdstat_%s:calls=%lld,usec=%lld,usec_per_call=%.2f\r\n",
                 c->name, c->calls, c->microseconds,
                 (c->calls == 0) ? 0 : ((float)c->microseconds/c->calls));
         }
-        dictReleaseIterator(di);
     }
 
     /* Cluster */
@@ -3397,7 +3721,13 @@ void linuxMemoryWarnings(void) {
     if (linuxOvercommitMemoryValue() == 0) {
         serverLog(LL_WARNING,"WARNING overcommit_memory is set to 0! Background save may fail under low memory condition. To fix this issue add 'vm.overcommit_memory = 1' to /etc/sysctl.conf and then reboot or run the command 'sysctl vm.overcommit_memory=1' for this to take effect.");
     }
-    if (THPIsEnabled()) {
+    if (server.hugepage_layout) {
+        if (THPIsAlways()) {
+            serverLog(LL_WARNING,"WARNING you have Transparent Huge Pages (THP) support set to 'always' in your kernel. With hugepage-layout enabled only the large allocations should use huge pages, run the command 'echo madvise > /sys/kernel/mm/transparent_hugepage/enabled' as root, and add it to your /etc/rc.local in order to retain the setting after a reboot.");
+        } else if (!THPIsEnabled()) {
+            serverLog(LL_WARNING,"WARNING hugepage-layout is enabled but Transparent Huge Pages (THP) support is disabled in your kernel, so it has no effect. To use it run the command 'echo madvise > /sys/kernel/mm/transparent_hugepage/enabled' as root.");
+        }
+    } else if (THPIsEnabled()) {
         serverLog(LL_WARNING,"WARNING you have Transparent Huge Pages (THP) support enabled in your kernel. This will create latency and memory usage issues with Redis. To fix this issue run the command 'echo never > /sys/kernel/mm/transparent_hugepage/enabled' as root, and add it to your /etc/rc.local in order to retain the setting after a reboot. Redis must be restarted after THP is disabled.");
     }
 }
@@ -3725,10 +4055,14 @@ int main(int argc, char **argv) {
     if (argc == 3 && !strcasecmp(argv[1], "test")) {
         if (!strcasecmp(argv[2], "ziplist")) {
             return ziplistTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "listpack")) {
+            return listpackTest(argc, argv);
         } else if (!strcasecmp(argv[2], "quicklist")) {
             quicklistTest(argc, argv);
         } else if (!strcasecmp(argv[2], "intset")) {
             return intsetTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "roaring")) {
+            return roaringTest(argc, argv);
         } else if (!strcasecmp(argv[2], "zipmap")) {
             return zipmapTest(argc, argv);
         } else if (!strcasecmp(argv[2], "sha1test")) {
@@ -58,7 +58,9 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "listpack.h" /* Compact list of strings, used by small hashes */
 #include "intset.h"  /* Compact integer set structure */
+#include "roaring.h" /* Compressed bitmaps of integers */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
 #include "latency.h" /* Latency monitor API */
@@ -134,6 +136,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
 #define CONFIG_DEFAULT_MAXMEMORY 0
 #define CONFIG_DEFAULT_MAXMEMORY_SAMPLES 5
+#define CONFIG_DEFAULT_MAXMEMORY_EVICTION_LOWWATER 0
 #define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
 #define CONFIG_DEFAULT_LFU_DECAY_TIME 1
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
@@ -153,8 +156,10 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL 0
+#define CONFIG_DEFAULT_LAZYFREE_AUTO_EFFORT 0
 #define CONFIG_DEFAULT_ALWAYS_SHOW_LOGO 0
 #define CONFIG_DEFAULT_ACTIVE_DEFRAG 0
+#define CONFIG_DEFAULT_HUGEPAGE_LAYOUT 0
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER 10 /* don't defrag when fragmentation is below 10% */
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_UPPER 100 /* maximum defrag force at 100% fragmentation */
 #define CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES (100<<20) /* don't defrag if frag overhead is below 100mb */
@@ -163,6 +168,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_PROTO_MAX_BULK_LEN (512ll*1024*1024) /* Bulk request max size */
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
+#define ACTIVE_EXPIRE_CYCLE_FIELDS_PER_LOOKUP 20 /* Hash fields per lookup. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
 #define ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC 25 /* CPU max % for keys collection */
 #define ACTIVE_EXPIRE_CYCLE_SLOW 0
@@ -181,6 +187,12 @@ typedef long long mstime_t; /* millisecond time type. */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_BATCH_MAX         16 /* Max GET/SET commands batched together. */
+#define PROTO_ARGV_CACHE_SIZE   16 /* Argument objects recycled per client. */
+#define PROTO_ARGV_CACHE_MAX_LEN 64 /* Max length of a recycled argument. */
+#define PROTO_REPLY_DEFERRED_HOLES 8 /* Deferred lengths pending per block. */
+#define PROTO_REPLY_DEFERRED_RESERVE 24 /* Bytes reserved for "*<len>\r\n". */
+#define PROTO_REPLY_POOL_BLOCKS 32 /* Free reply blocks kept per thread. */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
@@ -249,6 +261,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_LUA_DEBUG (1<<25)  /* Run EVAL in debug mode. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
+#define CLIENT_PROCESSING_INPUT (1<<28) /* processInputBuffer() is running the
+                                           commands of this client. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -346,6 +360,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
 #define OBJ_HASH_MAX_ZIPLIST_VALUE 64
 #define OBJ_SET_MAX_INTSET_ENTRIES 512
+#define OBJ_SET_ROARING_MIN_DENSITY 16
 #define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define OBJ_ZSET_MAX_ZIPLIST_VALUE 64
 
@@ -367,6 +382,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define MAXMEMORY_FLAG_LRU (1<<0)
 #define MAXMEMORY_FLAG_LFU (1<<1)
 #define MAXMEMORY_FLAG_ALLKEYS (1<<2)
+#define MAXMEMORY_FLAG_SIZE (1<<3) /* Score keys by frequency / size (GDSF) */
 #define MAXMEMORY_FLAG_NO_SHARED_INTEGERS \
     (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU)
 
@@ -378,11 +394,23 @@ typedef long long mstime_t; /* millisecond time type. */
 #define MAXMEMORY_ALLKEYS_LFU ((5<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_ALLKEYS_RANDOM ((6<<8)|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_NO_EVICTION (7<<8)
+#define MAXMEMORY_VOLATILE_GDSF ((8<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_SIZE)
+#define MAXMEMORY_ALLKEYS_GDSF ((9<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_SIZE|\
+                                MAXMEMORY_FLAG_ALLKEYS)
 
 #define CONFIG_DEFAULT_MAXMEMORY_POLICY MAXMEMORY_NO_EVICTION
 
+/* Code paths releasing keyspace values, see lazyfreeShouldFreeAsync(). */
+#define LAZYFREE_PATH_USER 0        /* UNLINK and other explicit requests. */
+#define LAZYFREE_PATH_SERVER_DEL 1  /* Implicit DEL, e.g. RENAME target. */
+#define LAZYFREE_PATH_EXPIRE 2      /* Lazy and active expire. */
+#define LAZYFREE_PATH_EVICTION 3    /* maxmemory eviction. */
+#define LAZYFREE_PATH_OVERWRITE 4   /* Old value replaced by dbOverwrite(). */
+#define LAZYFREE_PATH_NUM 5
+
 /* Scripting */
 #define LUA_SCRIPT_TIME_LIMIT 5000 /* milliseconds */
+#define LUA_SCRIPT_TIME_SLICE 10 /* milliseconds */
 
 /* Units */
 #define UNIT_SECONDS 0
@@ -465,6 +493,7 @@ typedef long long mstime_t; /* millisecond time type. */
  * in order to dispatch the loading to the right module, plus a 10 bits
  * encoding version. */
 #define OBJ_MODULE 5
+#define OBJ_TYPE_NUM 6  /* Number of object types, for per type stats. */
 
 /* Extract encver / signature from a module type ID. */
 #define REDISMODULE_TYPE_ENCVER_BITS 10
@@ -476,6 +505,7 @@ struct RedisModule;
 struct RedisModuleIO;
 struct RedisModuleDigest;
 struct RedisModuleCtx;
+struct RedisModuleDefragCtx;
 struct redisObject;
 
 /* Each module type implementation should export a set of methods in order
@@ -488,6 +518,8 @@ typedef void (*moduleTypeRewriteFunc)(struct RedisModuleIO *io, struct redisObje
 typedef void (*moduleTypeDigestFunc)(struct RedisModuleDigest *digest, void *value);
 typedef size_t (*moduleTypeMemUsageFunc)(const void *value);
 typedef void (*moduleTypeFreeFunc)(void *value);
+typedef void (*moduleTypeDefragFunc)(struct RedisModuleDefragCtx *ctx, struct redisObject *key, void **value);
+typedef size_t (*moduleTypeFreeEffortFunc)(const void *value);
 
 /* The module type, which is referenced in each value of a given type, defines
  * the methods and links to the module exporting the type. */
@@ -500,6 +532,8 @@ typedef struct RedisModuleType {
     moduleTypeMemUsageFunc mem_usage;
     moduleTypeDigestFunc digest;
     moduleTypeFreeFunc free;
+    moduleTypeDefragFunc defrag;
+    moduleTypeFreeEffortFunc free_effort;
     char name[10]; /* 9 bytes name + null term. Charset: A-Z a-z 0-9 _- */
 } moduleType;
 
@@ -565,7 +599,11 @@ typedef struct RedisModuleDigest {
 
 /* Objects encoding. Some kind of objects like Strings and Hashes can be
  * internally represented in multiple ways. The 'encoding' field of the object
- * is set to one of this fields for this object. */
+ * is set to one of this fields for this object.
+ *
+ * Small hashes are listpack encoded. Small sorted sets and the nodes of
+ * quicklists are still ziplists: moving them to listpacks, with their own
+ * RDB types, is left for a separate change. */
 #define OBJ_ENCODING_RAW 0     /* Raw representation */
 #define OBJ_ENCODING_INT 1     /* Encoded as integer */
 #define OBJ_ENCODING_HT 2      /* Encoded as hash table */
@@ -576,6 +614,8 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
 #define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
+#define OBJ_ENCODING_LISTPACK 10 /* Encoded as a listpack */
+#define OBJ_ENCODING_ROARING 11 /* Encoded as a roaring bitmap */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
@@ -616,6 +656,9 @@ typedef struct redisDb {
 	//键的过期时间，字典的键为键，字典的值为过期事件 UNIX 时间戳
     dict *expires;              /* Timeout of keys with a timeout set */
 
+	//带有字段过期时间的哈希键，字典的值为最近的字段过期时间（下界）
+    dict *hexpires;             /* Hashes with field TTLs, see t_hash.c */
+
 	//正处于阻塞状态的键
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
 
@@ -707,24 +750,45 @@ typedef struct readyList {
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a linked list. */
 //因为 I/O 复用的缘故，需要为每个客户端维持一个状态,多个客户端状态被服务器用链表连接起来。
+/* Blocks of the client reply list. Blocks are single PROTO_REPLY_CHUNK_BYTES
+ * allocations taken from a small per-thread pool of free blocks, so that
+ * large replies do not hit the allocator for every chunk, but the first
+ * block of a short reply that is sized to it. The multi bulk lengths that are not yet known when the reply is
+ * started are reserved inline in the block as "holes", that are filled and
+ * compacted by setDeferredMultiBulkLength(). */
+typedef struct clientReplyBlock {
+    size_t size, used;      /* Usable bytes in buf, and bytes filled. */
+    int holes;              /* Hole slots used since the block was empty. */
+    int pending;            /* Holes not yet filled. */
+    struct clientReplyHole {
+        struct clientReplyBlock *block; /* NULL once the length is set. */
+        size_t offset;                  /* Offset of the reserved bytes. */
+    } hole[PROTO_REPLY_DEFERRED_HOLES];
+    char buf[];
+} clientReplyBlock;
+
 typedef struct client {
     uint64_t id;            /* Client incremental unique ID. */
     int fd;                 /* Client socket. */
     redisDb *db;            /* Pointer to currently SELECTed DB. */
     robj *name;             /* As set by CLIENT SETNAME. */
-    sds querybuf;           /* Buffer we use to accumulate client queries. */
+    sds querybuf;           /* Buffer we use to accumulate client queries,
+                               NULL when no partial command is pending. */
     sds pending_querybuf;   /* If this is a master, this buffer represents the
                                yet not applied replication stream that we
                                are receiving from the master. */
     size_t querybuf_peak;   /* Recent (100ms or more) peak of querybuf size. */
+    size_t qb_pos;          /* The position we have read in querybuf. */
     int argc;               /* Num of arguments of current command. */
     robj **argv;            /* Arguments of current command. */
+    robj *argv_cache[PROTO_ARGV_CACHE_SIZE]; /* Argument objects recycled
+                                                for the next command. */
     struct redisCommand *cmd, *lastcmd;  /* Last command executed. */
     int reqtype;            /* Request protocol type: PROTO_REQ_* */
     int multibulklen;       /* Number of multi bulk arguments left to read. */
     long bulklen;           /* Length of bulk argument in multi bulk request. */
-    list *reply;            /* List of reply objects to send to the client. */
-    unsigned long long reply_bytes; /* Tot bytes of objects in reply list. */
+    list *reply;            /* List of clientReplyBlock to send to the client. */
+    unsigned long long reply_bytes; /* Tot size of the blocks in reply list. */
     size_t sentlen;         /* Amount of bytes already sent in the current
                                buffer or object being sent. */
     time_t ctime;           /* Client creation time. */
@@ -781,7 +845,7 @@ struct sharedObjectsStruct {
     *outofrangeerr, *noscripterr, *loadingerr, *slowscripterr, *bgsaveerr,
     *masterdownerr, *roslaveerr, *execaborterr, *noautherr, *noreplicaserr,
     *busykeyerr, *oomerr, *plus, *messagebulk, *pmessagebulk, *subscribebulk,
-    *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *del, *unlink,
+    *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *del, *unlink, *hdel,
     *rpop, *lpop, *lpush, *emptyscan,
     *select[PROTO_SHARED_SELECT_CMDS],
     *integers[OBJ_SHARED_INTEGERS],
@@ -791,9 +855,9 @@ struct sharedObjectsStruct {
 };
 
 /* ZSETs use a specialized version of Skiplists */
+/* The element of a skiplist node is embedded as an SDS string just after the
+ * levels, see zslCreateNode(): use zslNodeElement() to access it. */
 typedef struct zskiplistNode {
-	//字符串对象
-    sds ele;
 	//分值
     double score;
 	//后退指针
@@ -804,9 +868,18 @@ typedef struct zskiplistNode {
         struct zskiplistNode *forward;
 		//跨度
         unsigned int span;
+        /* Offset of the element from the start of the node, only set in
+         * level[0]. On 64 bit systems it uses the padding that follows
+         * 'span'. On 32 bit systems it makes every level 12 bytes instead
+         * of 8, about 5 bytes more per node with ZSKIPLIST_P set to 1/4:
+         * still less than the 4 bytes 'ele' pointer it replaced plus the
+         * separate allocation of the element. */
+        unsigned int eleoffset;
     } level[];
 } zskiplistNode;
 
+#define zslNodeElement(n) ((sds)((char*)(n)+(n)->level[0].eleoffset))
+
 typedef struct zskiplist {
 	//header 指向跳跃表的表头结点
 	//tail 指向跳跃表的表位节点
@@ -940,6 +1013,10 @@ struct redisServer {
 	//命令表（无 rename 配置选项的作用）
     dict *orig_commands;        /* Command table before command renaming. */
 
+	//按数字 ID 索引的命令
+    struct redisCommand **commands_by_id; /* Commands indexed by their ID. */
+    int commands_ids;           /* Number of command IDs assigned so far. */
+
 	//事件状态
     aeEventLoop *el;
 	
@@ -950,6 +1027,9 @@ struct redisServer {
 
     int activerehashing;        /* Incremental rehash in serverCron() */
     int active_defrag_running;  /* Active defragmentation running (holds current scan aggressiveness) */
+    long long el_sleep_start;   /* When the event loop started waiting. */
+    long long el_sleep_usec;    /* Time spent waiting for events, tracked
+                                   while active defrag is enabled. */
 
 	//是否设置了密码
     char *requirepass;          /* Pass for AUTH command, or NULL */
@@ -1065,7 +1145,7 @@ struct redisServer {
 	//常用命令的快捷连接
     struct redisCommand *delCommand, *multiCommand, *lpushCommand, *lpopCommand,
                         *rpopCommand, *sremCommand, *execCommand, *expireCommand,
-                        *pexpireCommand;
+                        *pexpireCommand, *hdelCommand, *hpexpireatCommand;
 
     /* Fields used only for stats */
 	//服务器启动时间
@@ -1080,6 +1160,9 @@ struct redisServer {
 	//已过期的键数量
     long long stat_expiredkeys;     /* Number of expired keys */
 
+	//已过期的哈希字段数量
+    long long stat_expired_fields;  /* Number of expired hash fields */
+
 	//可能过期的key百分比
     double stat_expired_stale_perc; /* Percentage of keys probably expired */
 
@@ -1089,6 +1172,30 @@ struct redisServer {
 	//因为回收内存而被释放的过期键的数量
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
 
+	//被淘汰的key及采样的key的淘汰分数统计, 用于衡量淘汰的质量
+    double stat_evicted_score;      /* Sum of the scores of evicted keys. */
+    long long stat_evicted_scored_keys; /* Evicted keys in the above sum. */
+    double stat_eviction_sampled_score; /* Sum of the scores of sampled keys. */
+    long long stat_eviction_sampled_keys; /* Sampled keys in the above sum. */
+    long long stat_eviction_stale_candidates; /* Pool entries discarded since
+                                                 the key was accessed. */
+
+	//后台淘汰的key数量, 以及命令执行前同步淘汰的次数和耗时
+    long long stat_evictedkeys_background; /* Keys evicted by the background
+                                              eviction cycle. */
+    long long stat_eviction_sync_calls; /* Times commands had to evict keys. */
+    long long stat_eviction_sync_usec;  /* Time spent evicting keys inline. */
+    size_t stat_eviction_lag;       /* Bytes above the low water mark after
+                                       the last background eviction cycle. */
+
+	//各释放路径交给lazyfree线程释放的对象数量
+    long long stat_lazyfree_objects[LAZYFREE_PATH_NUM]; /* Objects freed in
+                                      background, per LAZYFREE_PATH_* path. */
+
+	//被模块固定的值在写入前复制的次数
+    long long stat_unshared_values; /* Values pinned by modules copied on
+                                       write, see dbUnshareValue(). */
+
 	//成功查找键的次数
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
 
@@ -1098,8 +1205,11 @@ struct redisServer {
 	//
     long long stat_active_defrag_hits;      /* number of allocations moved */
     long long stat_active_defrag_misses;    /* number of allocations scanned but not moved */
+    long long stat_active_defrag_skipped;   /* number of allocations skipped as their size class is not fragmented */
     long long stat_active_defrag_key_hits;  /* number of keys with moved allocations */
     long long stat_active_defrag_key_misses;/* number of keys scanned and not moved */
+    long long stat_active_defrag_type_hits[OBJ_TYPE_NUM]; /* Allocations moved
+                                      while defragging keys, per value type. */
 
 	//已使用内存峰值
     size_t stat_peak_memory;        /* Max used memory record */
@@ -1169,6 +1279,7 @@ struct redisServer {
     int tcpkeepalive;               /* Set SO_KEEPALIVE if non-zero. */
     int active_expire_enabled;      /* Can be disabled for testing purposes. */
     int active_defrag_enabled;
+    int hugepage_layout;            /* Large allocations in huge pages. */
     size_t active_defrag_ignore_bytes; /* minimum amount of fragmentation waste to start active defrag */
     int active_defrag_threshold_lower; /* minimum percentage of fragmentation to start active defrag */
     int active_defrag_threshold_upper; /* maximum percentage of fragmentation at which we use maximum effort */
@@ -1357,6 +1468,8 @@ struct redisServer {
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Pricision of random sampling */
+    int maxmemory_eviction_lowwater; /* Background eviction target, as a
+                                        percentage of maxmemory. 0 = off. */
     int lfu_log_factor;             /* LFU logarithmic counter factor. */
     int lfu_decay_time;             /* LFU counter decay factor. */
     long long proto_max_bulk_len;   /* Protocol bulk length maximum size. */
@@ -1374,6 +1487,7 @@ struct redisServer {
     size_t hash_max_ziplist_entries;
     size_t hash_max_ziplist_value;
     size_t set_max_intset_entries;
+    size_t set_roaring_min_density;
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
     size_t hll_sparse_max_bytes;
@@ -1409,6 +1523,8 @@ struct redisServer {
     dict *lua_scripts;         /* A dictionary of SHA1 -> Lua scripts */
     mstime_t lua_time_limit;  /* Script timeout in milliseconds */
     mstime_t lua_time_start;  /* Start time of script, milliseconds time */
+    mstime_t lua_time_slice;  /* Run time after which a script that allows
+                                 it yields to the other clients. */
     int lua_write_dirty;  /* True if a write command was called during the
                              execution of the current script. */
     int lua_random_dirty; /* True if a random command was called during the
@@ -1419,11 +1535,18 @@ struct redisServer {
     int lua_timedout;     /* True if we reached the time limit for script
                              execution. */
     int lua_kill;         /* Kill the script if true. */
+    int lua_yield;        /* True if the script called redis.allow_yield()
+                             or redis.no_writes(). */
+    int lua_no_writes;    /* True if the script called redis.no_writes(). */
+    int lua_yielding;     /* True while the other clients are served during
+                             a yield of the script. */
     int lua_always_replicate_commands; /* Default replication type. */
     /* Lazy free */
     int lazyfree_lazy_eviction;
     int lazyfree_lazy_expire;
     int lazyfree_lazy_server_del;
+    long long lazyfree_auto_effort; /* Free in background any value whose
+                                       free effort is above this. 0 = off. */
     /* Latency monitor */
     long long latency_monitor_threshold;
     dict *latency_events;
@@ -1464,6 +1587,7 @@ struct redisCommand {
     int lastkey;  /* The last argument that's a key */
     int keystep;  /* The step between first and last key */
     long long microseconds, calls;
+    int id;       /* Numeric ID: index in server.commands_by_id. */
 };
 
 struct redisFunctionSym {
@@ -1504,6 +1628,7 @@ typedef struct {
     int encoding;
     int ii; /* intset iterator */
     dictIterator *di;
+    roaringIterator ri;
 } setTypeIterator;
 
 /* Structure to hold hash iteration abstraction. Note that iteration over
@@ -1562,6 +1687,8 @@ size_t moduleCount(void);
 void moduleAcquireGIL(void);
 void moduleReleaseGIL(void);
 void moduleNotifyKeyspaceEvent(int type, const char *event, robj *key, int dbid);
+int moduleDefragValue(robj *key, robj *value);
+long long moduleCountPinnedKeys(void);
 
 
 /* Utils */
@@ -1577,12 +1704,14 @@ void redisSetProcTitle(char *title);
 client *createClient(int fd);
 void closeTimedoutClients(void);
 void freeClient(client *c);
+void freeClientArgvCache(client *c);
 void freeClientAsync(client *c);
 void resetClient(client *c);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void *addDeferredMultiBulkLength(client *c);
 void setDeferredMultiBulkLength(client *c, void *node, long length);
 void processInputBuffer(client *c);
+int clientQueryBufferIsShared(client *c);
 void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
@@ -1605,6 +1734,7 @@ void copyClientOutputBuffer(client *dst, client *src);
 size_t sdsZmallocSize(sds s);
 size_t getStringObjectSdsUsedMemory(robj *o);
 void *dupClientReplyValue(void *o);
+void freeClientReplyValue(void *o);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
 char *getClientPeerId(client *client);
@@ -1625,6 +1755,7 @@ int listenToPort(int port, int *fds, int *count);
 void pauseClients(mstime_t duration);
 int clientsArePaused(void);
 int processEventsWhileBlocked(void);
+int processEventsWhileYielding(void);
 int handleClientsWithPendingWrites(void);
 int clientHasPendingReplies(client *c);
 void unlinkClient(client *c);
@@ -1653,6 +1784,7 @@ void listTypeInsert(listTypeEntry *entry, robj *value, int where);
 int listTypeEqual(listTypeEntry *entry, robj *o);
 void listTypeDelete(listTypeIterator *iter, listTypeEntry *entry);
 void listTypeConvert(robj *subject, int enc);
+robj *listTypeDup(robj *o);
 void unblockClientWaitingData(client *c);
 void handleClientsBlockedOnLists(void);
 void popGenericCommand(client *c, int where);
@@ -1681,6 +1813,7 @@ void freeSetObject(robj *o);
 void freeZsetObject(robj *o);
 void freeHashObject(robj *o);
 robj *createObject(int type, void *ptr);
+void initObjectLRUOrLFU(robj *o);
 robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
 robj *createEmbeddedStringObject(const char *ptr, size_t len);
@@ -1696,6 +1829,7 @@ robj *createQuicklistObject(void);
 robj *createZiplistObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
+robj *createRoaringObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
 robj *createZsetZiplistObject(void);
@@ -1713,6 +1847,7 @@ int compareStringObjects(robj *a, robj *b);
 int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
+size_t objectComputeSize(robj *o, size_t sample_size);
 #define sdsEncodedObject(objptr) (objptr->encoding == OBJ_ENCODING_RAW || objptr->encoding == OBJ_ENCODING_EMBSTR)
 
 /* Synchronous I/O with timeout */
@@ -1812,6 +1947,7 @@ void zslFree(zskiplist *zsl);
 zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele);
 unsigned char *zzlInsert(unsigned char *zl, sds ele, double score);
 int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node);
+zskiplistNode *zslUpdateScore(zskiplist *zsl, double curscore, sds ele, double newscore);
 zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range);
 zskiplistNode *zslLastInRange(zskiplist *zsl, zrangespec *range);
 double zzlGetScore(unsigned char *sptr);
@@ -1822,6 +1958,7 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range);
 unsigned int zsetLength(const robj *zobj);
 void zsetConvert(robj *zobj, int encoding);
 void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
+robj *zsetDup(robj *o);
 int zsetScore(robj *zobj, sds member, double *score);
 unsigned long zslGetRank(zskiplist *zsl, double score, sds o);
 int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore);
@@ -1843,10 +1980,14 @@ int zslLexValueLteMax(sds value, zlexrangespec *spec);
 
 /* Core functions */
 int freeMemoryIfNeeded(void);
+void backgroundEvictionCycle(void);
 int processCommand(client *c);
+int processBatchedCommand(client *c, struct redisCommand *cmd);
 void setupSignalHandlers(void);
 struct redisCommand *lookupCommand(sds name);
 struct redisCommand *lookupCommandByCString(char *s);
+struct redisCommand *lookupCommandByName(const char *name, size_t len);
+struct redisCommand *lookupCommandById(int id);
 struct redisCommand *lookupCommandOrOriginal(sds name);
 void call(client *c, int flags);
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int flags);
@@ -1868,12 +2009,16 @@ void usage(void);
 void updateDictResizePolicy(void);
 int htNeedsResize(dict *dict);
 void populateCommandTable(void);
+void commandAssignId(struct redisCommand *cmd);
+void buildCommandLookupTable(void);
 void resetCommandTableStats(void);
 void adjustOpenFilesLimit(void);
 void closeListeningSockets(int unlink_unix_socket);
 void updateCachedTime(void);
 void resetServerStats(void);
 void activeDefragCycle(void);
+void *activeDefragAlloc(void *ptr);
+robj *activeDefragStringOb(robj* ob, int *defragged);
 unsigned int getLRUClock(void);
 unsigned int LRU_CLOCK(void);
 const char *evictPolicyToString(void);
@@ -1898,13 +2043,22 @@ int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele);
 unsigned long setTypeRandomElements(robj *set, unsigned long count, robj *aux_set);
 unsigned long setTypeSize(const robj *subject);
 void setTypeConvert(robj *subject, int enc);
+int setTypeIntsetTargetEncoding(intset *is);
+int setTypeIsRoaringDense(unsigned long card, unsigned long containers);
+robj *setTypeCreateFromRoaring(roaring *r);
+robj *setTypeDup(robj *o);
 
 /* Hash data type */
 #define HASH_SET_TAKE_FIELD (1<<0)
 #define HASH_SET_TAKE_VALUE (1<<1)
+#define HASH_SET_KEEP_FIELD_TTL (1<<2)
 #define HASH_SET_COPY 0
 
 void hashTypeConvert(robj *o, int enc);
+long long hashTypeFieldExpireNow(void);
+unsigned long hashTypeCountExpiredFields(robj *o, long long now);
+int hashTypeFieldIsExpired(robj *o, sds field, long long now);
+robj *hashTypeDup(robj *o);
 void hashTypeTryConversion(robj *subject, robj **argv, int start, int end);
 void hashTypeTryObjectEncoding(robj *subject, robj **o1, robj **o2);
 int hashTypeExists(robj *o, sds key);
@@ -1913,7 +2067,7 @@ unsigned long hashTypeLength(const robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
                                 unsigned char **vstr,
                                 unsigned int *vlen,
                                 long long *vll);
@@ -1921,8 +2075,17 @@ sds hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what);
 void hashTypeCurrentObject(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll);
 sds hashTypeCurrentObjectNewSds(hashTypeIterator *hi, int what);
 robj *hashTypeLookupWriteOrCreate(client *c, robj *key);
+int hashTypeGetValue(robj *o, sds field, unsigned char **vstr, unsigned int *vlen, long long *vll);
 robj *hashTypeGetValueObject(robj *o, sds field);
 int hashTypeSet(robj *o, sds field, sds value, int flags);
+int hashTypeHasFieldExpires(const robj *o);
+long long hashTypeGetFieldExpire(robj *o, sds field);
+long long hashTypeNextFieldExpire(robj *o);
+void hashTypeSetFieldExpire(robj *o, sds field, long long when);
+int hashTypeRemoveFieldExpire(robj *o, sds field);
+void hashTypeIndexFieldExpires(redisDb *db, sds key, robj *o);
+long hashTypeExpireFields(redisDb *db, robj *key, robj *o, long long now, long max);
+int hashTypeExpireIfNeeded(redisDb *db, robj *key, robj **o);
 
 /* Pub / Sub */
 int pubsubUnsubscribeAllChannels(client *c, int notify);
@@ -1958,6 +2121,8 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags);
 robj *objectCommandLookup(client *c, robj *key);
 robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply);
+void dbPrefetchHashes(redisDb *db, const uint64_t *hashes, int count);
+void dbPrefetchKeys(redisDb *db, robj **keys, int count);
 #define LOOKUP_NONE 0
 #define LOOKUP_NOTOUCH (1<<0)
 void dbAdd(redisDb *db, robj *key, robj *val);
@@ -1968,6 +2133,7 @@ robj *dbRandomKey(redisDb *db);
 int dbSyncDelete(redisDb *db, robj *key);
 int dbDelete(redisDb *db, robj *key);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
+robj *dbUnshareValue(redisDb *db, robj *key, robj *o);
 
 #define EMPTYDB_NO_FLAGS 0      /* No flags. */
 #define EMPTYDB_ASYNC (1<<0)    /* Reclaim memory in another thread. */
@@ -1986,6 +2152,9 @@ void slotToKeyAdd(robj *key);
 void slotToKeyDel(robj *key);
 void slotToKeyFlush(void);
 int dbAsyncDelete(redisDb *db, robj *key);
+int dbLazyDelete(redisDb *db, robj *key, int path);
+int lazyfreeShouldFreeAsync(robj *val, int path);
+void lazyfreeFreeObjectAsync(robj *val, int path);
 void emptyDbAsync(redisDb *db);
 void slotToKeyFlushAsync(void);
 size_t lazyfreeGetPendingObjectsCount(void);
@@ -1994,7 +2163,9 @@ size_t lazyfreeGetPendingObjectsCount(void);
 int *getKeysFromCommand(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 void getKeysFreeResult(int *result);
 int *zunionInterGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys);
+int *zunionInterDiffGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys);
 int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+int *sintercardGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *sortGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *migrateGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *georadiusGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
@@ -2118,6 +2289,7 @@ void spopCommand(client *c);
 void srandmemberCommand(client *c);
 void sinterCommand(client *c);
 void sinterstoreCommand(client *c);
+void sintercardCommand(client *c);
 void sunionCommand(client *c);
 void sunionstoreCommand(client *c);
 void sdiffCommand(client *c);
@@ -2182,12 +2354,23 @@ void hstrlenCommand(client *c);
 void zremrangebyrankCommand(client *c);
 void zunionstoreCommand(client *c);
 void zinterstoreCommand(client *c);
+void zdiffstoreCommand(client *c);
+void zunionCommand(client *c);
+void zinterCommand(client *c);
+void zdiffCommand(client *c);
 void zscanCommand(client *c);
 void hkeysCommand(client *c);
 void hvalsCommand(client *c);
 void hgetallCommand(client *c);
 void hexistsCommand(client *c);
 void hscanCommand(client *c);
+void hexpireCommand(client *c);
+void hpexpireCommand(client *c);
+void hexpireatCommand(client *c);
+void hpexpireatCommand(client *c);
+void httlCommand(client *c);
+void hpttlCommand(client *c);
+void hpersistCommand(client *c);
 void configCommand(client *c);
 void hincrbyCommand(client *c);
 void hincrbyfloatCommand(client *c);
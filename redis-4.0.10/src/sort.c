@@ -112,6 +112,10 @@ robj *lookupKeyByPattern(redisDb *db, robj *pattern, robj *subst) {
     if (fieldobj) {
         if (o->type != OBJ_HASH) goto noobj;
 
+        /* Fields with an elapsed TTL not deleted yet are missing. */
+        if (hashTypeFieldIsExpired(o,fieldobj->ptr,hashTypeFieldExpireNow()))
+            goto noobj;
+
         /* Retrieve value from hash by the field name. The returend object
          * is a new object with refcount already incremented. */
         o = hashTypeGetValueObject(o, fieldobj->ptr);
@@ -417,7 +421,7 @@ void sortCommand(client *c) {
 
         while(rangelen--) {
             serverAssertWithInfo(c,sortval,ln != NULL);
-            sdsele = ln->ele;
+            sdsele = zslNodeElement(ln);
             vector[j].obj = createStringObject(sdsele,sdslen(sdsele));
             vector[j].u.score = 0;
             vector[j].u.cmpobj = NULL;
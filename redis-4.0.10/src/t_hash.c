@@ -35,12 +35,12 @@
  *----------------------------------------------------------------------------*/
 
 /* Check the length of a number of objects to see if we need to convert a
- * ziplist to a real hash. Note that we only check string encoded objects
+ * listpack to a real hash. Note that we only check string encoded objects
  * as their string length can be queried in constant time. */
 void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
     int i;
 
-    if (o->encoding != OBJ_ENCODING_ZIPLIST) return;
+    if (o->encoding != OBJ_ENCODING_LISTPACK) return;
 
     for (i = start; i <= end; i++) {
         if (sdsEncodedObject(argv[i]) &&
@@ -52,31 +52,31 @@ void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
     }
 }
 
-/* Get the value from a ziplist encoded hash, identified by field.
+/* Get the value from a listpack encoded hash, identified by field.
  * Returns -1 when the field cannot be found. */
-int hashTypeGetFromZiplist(robj *o, sds field,
+int hashTypeGetFromListpack(robj *o, sds field,
                            unsigned char **vstr,
                            unsigned int *vlen,
                            long long *vll)
 {
-    unsigned char *zl, *fptr = NULL, *vptr = NULL;
+    unsigned char *lp, *fptr = NULL, *vptr = NULL;
     int ret;
 
-    serverAssert(o->encoding == OBJ_ENCODING_ZIPLIST);
+    serverAssert(o->encoding == OBJ_ENCODING_LISTPACK);
 
-    zl = o->ptr;
-    fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+    lp = o->ptr;
+    fptr = lpFirst(lp);
     if (fptr != NULL) {
-        fptr = ziplistFind(fptr, (unsigned char*)field, sdslen(field), 1);
+        fptr = lpFind(lp, fptr, (unsigned char*)field, sdslen(field), 1);
         if (fptr != NULL) {
             /* Grab pointer to the value (fptr points to the field) */
-            vptr = ziplistNext(zl, fptr);
+            vptr = lpNext(lp, fptr);
             serverAssert(vptr != NULL);
         }
     }
 
     if (vptr != NULL) {
-        ret = ziplistGet(vptr, vstr, vlen, vll);
+        ret = lpGetValue(vptr, vstr, vlen, vll);
         serverAssert(ret);
         return 0;
     }
@@ -107,9 +107,9 @@ sds hashTypeGetFromHashTable(robj *o, sds field) {
  * can always check the function return by checking the return value
  * for C_OK and checking if vll (or vstr) is NULL. */
 int hashTypeGetValue(robj *o, sds field, unsigned char **vstr, unsigned int *vlen, long long *vll) {
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         *vstr = NULL;
-        if (hashTypeGetFromZiplist(o, field, vstr, vlen, vll) == 0)
+        if (hashTypeGetFromListpack(o, field, vstr, vlen, vll) == 0)
             return C_OK;
     } else if (o->encoding == OBJ_ENCODING_HT) {
         sds value;
@@ -143,12 +143,12 @@ robj *hashTypeGetValueObject(robj *o, sds field) {
  * exist. */
 size_t hashTypeGetValueLength(robj *o, sds field) {
     size_t len = 0;
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0)
+        if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0)
             len = vstr ? vlen : sdigits10(vll);
     } else if (o->encoding == OBJ_ENCODING_HT) {
         sds aux;
@@ -164,12 +164,12 @@ size_t hashTypeGetValueLength(robj *o, sds field) {
 /* Test if the specified field exists in the given hash. Returns 1 if the field
  * exists, and 0 when it doesn't. */
 int hashTypeExists(robj *o, sds field) {
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0) return 1;
+        if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0) return 1;
     } else if (o->encoding == OBJ_ENCODING_HT) {
         if (hashTypeGetFromHashTable(o, field) != NULL) return 1;
     } else {
@@ -187,6 +187,7 @@ int hashTypeExists(robj *o, sds field) {
  *
  * HASH_SET_TAKE_FIELD -- The SDS field ownership passes to the function.
  * HASH_SET_TAKE_VALUE -- The SDS value ownership passes to the function.
+ * HASH_SET_KEEP_FIELD_TTL -- Don't clear the TTL of an updated field.
  *
  * When the flags are used the caller does not need to release the passed
  * SDS string(s). It's up to the function to use the string to create a new
@@ -196,44 +197,65 @@ int hashTypeExists(robj *o, sds field) {
  * semantics of copying the values if needed.
  *
  */
+/* Set the field of a listpack encoded hash. On success C_OK is returned and
+ * '*update' is set to 1 if the field already existed. C_ERR is returned,
+ * and the hash is left unchanged, if the listpack would exceed its max size,
+ * see lpInsert(). */
+static int hashTypeSetListpack(robj *o, sds field, sds value, int *update) {
+    unsigned char *lp = o->ptr, *fptr, *vptr, *newlp;
+
+    fptr = lpFirst(lp);
+    if (fptr != NULL)
+        fptr = lpFind(lp, fptr, (unsigned char*)field, sdslen(field), 1);
+    if (fptr != NULL) {
+        /* Grab pointer to the value (fptr points to the field) */
+        vptr = lpNext(lp, fptr);
+        serverAssert(vptr != NULL);
+
+        /* Replace value */
+        newlp = lpReplace(lp, &vptr, (unsigned char*)value, sdslen(value));
+        if (newlp == NULL) return C_ERR;
+        *update = 1;
+    } else {
+        /* Push new field/value pair onto the tail of the listpack */
+        newlp = lpAppend(lp, (unsigned char*)field, sdslen(field));
+        if (newlp == NULL) return C_ERR;
+        lp = newlp;
+        newlp = lpAppend(lp, (unsigned char*)value, sdslen(value));
+        if (newlp == NULL) {
+            /* Remove the field, that was already appended. */
+            o->ptr = lpDelete(lp, lpLast(lp), NULL);
+            return C_ERR;
+        }
+    }
+    o->ptr = newlp;
+    return C_OK;
+}
+
 #define HASH_SET_TAKE_FIELD (1<<0)
 #define HASH_SET_TAKE_VALUE (1<<1)
+#define HASH_SET_KEEP_FIELD_TTL (1<<2)
 #define HASH_SET_COPY 0
 int hashTypeSet(robj *o, sds field, sds value, int flags) {
     int update = 0;
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-        unsigned char *zl, *fptr, *vptr;
-
-        zl = o->ptr;
-        fptr = ziplistIndex(zl, ZIPLIST_HEAD);
-        if (fptr != NULL) {
-            fptr = ziplistFind(fptr, (unsigned char*)field, sdslen(field), 1);
-            if (fptr != NULL) {
-                /* Grab pointer to the value (fptr points to the field) */
-                vptr = ziplistNext(zl, fptr);
-                serverAssert(vptr != NULL);
-                update = 1;
-
-                /* Delete value */
-                zl = ziplistDelete(zl, &vptr);
-
-                /* Insert new value */
-                zl = ziplistInsert(zl, vptr, (unsigned char*)value,
-                        sdslen(value));
-            }
-        }
-
-        if (!update) {
-            /* Push new field/value pair onto the tail of the ziplist */
-            zl = ziplistPush(zl, (unsigned char*)field, sdslen(field),
-                    ZIPLIST_TAIL);
-            zl = ziplistPush(zl, (unsigned char*)value, sdslen(value),
-                    ZIPLIST_TAIL);
-        }
-        o->ptr = zl;
-
-        /* Check if the ziplist needs to be converted to a hash table */
+    /* Callers check the length of the arguments with hashTypeTryConversion()
+     * in advance, but a hash table is converted back to a listpack when its
+     * last field TTL is removed, that can happen while a command sets a
+     * number of fields. */
+    if (o->encoding == OBJ_ENCODING_LISTPACK &&
+        (sdslen(field) > server.hash_max_ziplist_value ||
+         sdslen(value) > server.hash_max_ziplist_value))
+        hashTypeConvert(o, OBJ_ENCODING_HT);
+
+    /* A listpack can't be bigger than 4GB: use a hash table when the
+     * field or value would not fit. */
+    if (o->encoding == OBJ_ENCODING_LISTPACK &&
+        hashTypeSetListpack(o, field, value, &update) == C_ERR)
+        hashTypeConvert(o, OBJ_ENCODING_HT);
+
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
+        /* Check if the listpack needs to be converted to a hash table */
         if (hashTypeLength(o) > server.hash_max_ziplist_entries)
             hashTypeConvert(o, OBJ_ENCODING_HT);
     } else if (o->encoding == OBJ_ENCODING_HT) {
@@ -247,6 +269,10 @@ int hashTypeSet(robj *o, sds field, sds value, int flags) {
                 dictGetVal(de) = sdsdup(value);
             }
             update = 1;
+
+            /* Setting a new value makes the field persistent. */
+            if (!(flags & HASH_SET_KEEP_FIELD_TTL))
+                hashTypeRemoveFieldExpire(o,field);
         } else {
             sds f,v;
             if (flags & HASH_SET_TAKE_FIELD) {
@@ -279,17 +305,17 @@ int hashTypeSet(robj *o, sds field, sds value, int flags) {
 int hashTypeDelete(robj *o, sds field) {
     int deleted = 0;
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-        unsigned char *zl, *fptr;
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp, *fptr;
 
-        zl = o->ptr;
-        fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+        lp = o->ptr;
+        fptr = lpFirst(lp);
         if (fptr != NULL) {
-            fptr = ziplistFind(fptr, (unsigned char*)field, sdslen(field), 1);
+            fptr = lpFind(lp, fptr, (unsigned char*)field, sdslen(field), 1);
             if (fptr != NULL) {
-                zl = ziplistDelete(zl,&fptr); /* Delete the key. */
-                zl = ziplistDelete(zl,&fptr); /* Delete the value. */
-                o->ptr = zl;
+                lp = lpDelete(lp,fptr,&fptr); /* Delete the key. */
+                lp = lpDelete(lp,fptr,&fptr); /* Delete the value. */
+                o->ptr = lp;
                 deleted = 1;
             }
         }
@@ -299,6 +325,7 @@ int hashTypeDelete(robj *o, sds field) {
 
             /* Always check if the dictionary needs a resize after a delete. */
             if (htNeedsResize(o->ptr)) dictResize(o->ptr);
+            hashTypeRemoveFieldExpire(o,field);
         }
 
     } else {
@@ -311,8 +338,8 @@ int hashTypeDelete(robj *o, sds field) {
 unsigned long hashTypeLength(const robj *o) {
     unsigned long length = ULONG_MAX;
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-        length = ziplistLen(o->ptr) / 2;
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
+        length = lpLength(o->ptr) / 2;
     } else if (o->encoding == OBJ_ENCODING_HT) {
         length = dictSize((const dict*)o->ptr);
     } else {
@@ -326,7 +353,7 @@ hashTypeIterator *hashTypeInitIterator(robj *subject) {
     hi->subject = subject;
     hi->encoding = subject->encoding;
 
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
         hi->fptr = NULL;
         hi->vptr = NULL;
     } else if (hi->encoding == OBJ_ENCODING_HT) {
@@ -346,27 +373,27 @@ void hashTypeReleaseIterator(hashTypeIterator *hi) {
 /* Move to the next entry in the hash. Return C_OK when the next entry
  * could be found and C_ERR when the iterator reaches the end. */
 int hashTypeNext(hashTypeIterator *hi) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
-        unsigned char *zl;
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp;
         unsigned char *fptr, *vptr;
 
-        zl = hi->subject->ptr;
+        lp = hi->subject->ptr;
         fptr = hi->fptr;
         vptr = hi->vptr;
 
         if (fptr == NULL) {
             /* Initialize cursor */
             serverAssert(vptr == NULL);
-            fptr = ziplistIndex(zl, 0);
+            fptr = lpFirst(lp);
         } else {
             /* Advance cursor */
             serverAssert(vptr != NULL);
-            fptr = ziplistNext(zl, vptr);
+            fptr = lpNext(lp, vptr);
         }
         if (fptr == NULL) return C_ERR;
 
         /* Grab pointer to the value (fptr points to the field) */
-        vptr = ziplistNext(zl, fptr);
+        vptr = lpNext(lp, fptr);
         serverAssert(vptr != NULL);
 
         /* fptr, vptr now point to the first or next pair */
@@ -381,21 +408,21 @@ int hashTypeNext(hashTypeIterator *hi) {
 }
 
 /* Get the field or value at iterator cursor, for an iterator on a hash value
- * encoded as a ziplist. Prototype is similar to `hashTypeGetFromZiplist`. */
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
+ * encoded as a listpack. Prototype is similar to `hashTypeGetFromListpack`. */
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
                                 unsigned char **vstr,
                                 unsigned int *vlen,
                                 long long *vll)
 {
     int ret;
 
-    serverAssert(hi->encoding == OBJ_ENCODING_ZIPLIST);
+    serverAssert(hi->encoding == OBJ_ENCODING_LISTPACK);
 
     if (what & OBJ_HASH_KEY) {
-        ret = ziplistGet(hi->fptr, vstr, vlen, vll);
+        ret = lpGetValue(hi->fptr, vstr, vlen, vll);
         serverAssert(ret);
     } else {
-        ret = ziplistGet(hi->vptr, vstr, vlen, vll);
+        ret = lpGetValue(hi->vptr, vstr, vlen, vll);
         serverAssert(ret);
     }
 }
@@ -424,9 +451,9 @@ sds hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what) {
  * can always check the function return by checking the return value
  * type checking if vstr == NULL. */
 void hashTypeCurrentObject(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
         *vstr = NULL;
-        hashTypeCurrentFromZiplist(hi, what, vstr, vlen, vll);
+        hashTypeCurrentFromListpack(hi, what, vstr, vlen, vll);
     } else if (hi->encoding == OBJ_ENCODING_HT) {
         sds ele = hashTypeCurrentFromHashTable(hi, what);
         *vstr = (unsigned char*) ele;
@@ -458,14 +485,15 @@ robj *hashTypeLookupWriteOrCreate(client *c, robj *key) {
             addReply(c,shared.wrongtypeerr);
             return NULL;
         }
+        o = dbUnshareValue(c->db,key,o);
     }
     return o;
 }
 
-void hashTypeConvertZiplist(robj *o, int enc) {
-    serverAssert(o->encoding == OBJ_ENCODING_ZIPLIST);
+void hashTypeConvertListpack(robj *o, int enc) {
+    serverAssert(o->encoding == OBJ_ENCODING_LISTPACK);
 
-    if (enc == OBJ_ENCODING_ZIPLIST) {
+    if (enc == OBJ_ENCODING_LISTPACK) {
         /* Nothing to do... */
 
     } else if (enc == OBJ_ENCODING_HT) {
@@ -483,13 +511,13 @@ void hashTypeConvertZiplist(robj *o, int enc) {
             value = hashTypeCurrentObjectNewSds(hi,OBJ_HASH_VALUE);
             ret = dictAdd(dict, key, value);
             if (ret != DICT_OK) {
-                serverLogHexDump(LL_WARNING,"ziplist with dup elements dump",
-                    o->ptr,ziplistBlobLen(o->ptr));
-                serverPanic("Ziplist corruption detected");
+                serverLogHexDump(LL_WARNING,"listpack with dup elements dump",
+                    o->ptr,lpBytes(o->ptr));
+                serverPanic("Listpack corruption detected");
             }
         }
         hashTypeReleaseIterator(hi);
-        zfree(o->ptr);
+        lpFree(o->ptr);
         o->encoding = OBJ_ENCODING_HT;
         o->ptr = dict;
     } else {
@@ -497,16 +525,345 @@ void hashTypeConvertZiplist(robj *o, int enc) {
     }
 }
 
+/* Convert a hash table encoded hash without field TTLs back to a listpack.
+ * The caller should make sure the hash satisfies the listpack limits, see
+ * hashTypeTryConversionToListpack(): the hash is left as it is only if the
+ * listpack would exceed the max size of a listpack. */
+void hashTypeConvertHashTable(robj *o, int enc) {
+    serverAssert(o->encoding == OBJ_ENCODING_HT);
+
+    if (enc == OBJ_ENCODING_HT) {
+        /* Nothing to do... */
+
+    } else if (enc == OBJ_ENCODING_LISTPACK) {
+        dict *d = o->ptr;
+        dictIterator *di;
+        dictEntry *de;
+        unsigned char *lp = lpNew(), *newlp = lp;
+
+        serverAssert(d->privdata == NULL);
+        di = dictGetIterator(d);
+        while ((de = dictNext(di)) != NULL) {
+            sds field = dictGetKey(de), value = dictGetVal(de);
+
+            if ((newlp = lpAppend(lp,(unsigned char*)field,sdslen(field)))
+                == NULL) break;
+            lp = newlp;
+            if ((newlp = lpAppend(lp,(unsigned char*)value,sdslen(value)))
+                == NULL) break;
+            lp = newlp;
+        }
+        dictReleaseIterator(di);
+        if (newlp == NULL) {
+            lpFree(lp);
+            return;
+        }
+        dictRelease(d);
+        o->encoding = OBJ_ENCODING_LISTPACK;
+        o->ptr = lp;
+    } else {
+        serverPanic("Unknown hash encoding");
+    }
+}
+
 void hashTypeConvert(robj *o, int enc) {
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-        hashTypeConvertZiplist(o, enc);
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
+        hashTypeConvertListpack(o, enc);
     } else if (o->encoding == OBJ_ENCODING_HT) {
-        serverPanic("Not implemented");
+        hashTypeConvertHashTable(o, enc);
     } else {
         serverPanic("Unknown hash encoding");
     }
 }
 
+/* Return a copy of the hash object 'o', with the same encoding and the
+ * same field TTLs. */
+robj *hashTypeDup(robj *o) {
+    robj *hash;
+
+    serverAssert(o->type == OBJ_HASH);
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
+        size_t size = lpBytes(o->ptr);
+        unsigned char *lp = zmalloc(size);
+
+        memcpy(lp,o->ptr,size);
+        hash = createObject(OBJ_HASH,lp);
+        hash->encoding = OBJ_ENCODING_LISTPACK;
+    } else if (o->encoding == OBJ_ENCODING_HT) {
+        dict *d = o->ptr, *dup = dictCreate(&hashDictType,NULL);
+        dictIterator *di = dictGetIterator(d);
+        dictEntry *de;
+
+        dictExpand(dup,dictSize(d));
+        while ((de = dictNext(di)) != NULL)
+            dictAdd(dup,sdsdup(dictGetKey(de)),sdsdup(dictGetVal(de)));
+        dictReleaseIterator(di);
+        if (d->privdata) dup->privdata = zsetDup(d->privdata);
+        hash = createObject(OBJ_HASH,dup);
+        hash->encoding = OBJ_ENCODING_HT;
+    } else {
+        serverPanic("Unknown hash encoding");
+    }
+    return hash;
+}
+
+/*-----------------------------------------------------------------------------
+ * Hash field expires
+ *
+ * Every field of a hash can have its own TTL. The expire times are stored
+ * in a sorted set (field -> unix time in milliseconds) referenced by the
+ * privdata pointer of the dictionary of hash table encoded hashes, which is
+ * otherwise unused, so the TTLs follow the value when the key is renamed,
+ * moved, swapped or serialized. Setting the first field TTL converts a
+ * listpack encoded hash into a hash table: hashes without field TTLs are
+ * not affected at all, and the hash is converted back when its last TTL is
+ * removed, see hashTypeTryConversionToListpack().
+ *
+ * Fields are expired when the hash is accessed (see hashTypeExpireIfNeeded()
+ * called by the lookupKey*() family of functions), and in the active expire
+ * cycle, that samples the keys indexed in db->hexpires. The value of every
+ * db->hexpires entry is a lower bound of the next field expire time of the
+ * hash, so that entries of hashes that were later deleted, overwritten or
+ * had their TTLs removed are just cleaned up by the cycle.
+ *
+ * Both delete a bounded number of fields at a time, and slaves don't delete
+ * fields at all but wait for the HDELs of their master: fields with an
+ * elapsed TTL that are still there are hidden by the commands, see
+ * hashTypeFieldIsExpired().
+ *----------------------------------------------------------------------------*/
+
+/* Return the sorted set with the field expires of the hash, or NULL if no
+ * field of the hash has a TTL. */
+static robj *hashTypeFieldExpires(const robj *o) {
+    if (o->encoding != OBJ_ENCODING_HT) return NULL;
+    return ((dict*)o->ptr)->privdata;
+}
+
+/* Return 1 if at least a field of the hash has a TTL, otherwise 0. */
+int hashTypeHasFieldExpires(const robj *o) {
+    return hashTypeFieldExpires(o) != NULL;
+}
+
+/* Return the expire time of the field, or -1 if the field has no TTL
+ * (or does not exist at all). */
+long long hashTypeGetFieldExpire(robj *o, sds field) {
+    robj *zobj = hashTypeFieldExpires(o);
+    double score;
+
+    if (zobj == NULL || zsetScore(zobj,field,&score) == C_ERR) return -1;
+    return (long long)score;
+}
+
+/* Return the smallest field expire time of the hash, or -1 if no field
+ * of the hash has a TTL. */
+long long hashTypeNextFieldExpire(robj *o) {
+    robj *zobj = hashTypeFieldExpires(o);
+    zset *zs;
+
+    if (zobj == NULL) return -1;
+    zs = zobj->ptr;
+    return (long long)zs->zsl->header->level[0].forward->score;
+}
+
+/* Return the time field expire times are compared with. Like in
+ * expireIfNeeded(), scripts use the time they were started at, but not the
+ * other clients served while a script yields. */
+long long hashTypeFieldExpireNow(void) {
+    return (server.lua_caller && !server.lua_yielding) ?
+           server.lua_time_start : mstime();
+}
+
+/* Return the number of fields of the hash having an expire time older than
+ * 'now', that were not deleted yet. The count is performed using the spans
+ * of the skiplist, in O(log(N)). */
+unsigned long hashTypeCountExpiredFields(robj *o, long long now) {
+    long long when = hashTypeNextFieldExpire(o);
+    zskiplist *zsl;
+    zskiplistNode *x;
+    unsigned long count = 0;
+    int i;
+
+    if (when == -1 || when >= now) return 0;
+    zsl = ((zset*)hashTypeFieldExpires(o)->ptr)->zsl;
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward &&
+               (long long)x->level[i].forward->score < now)
+        {
+            count += x->level[i].span;
+            x = x->level[i].forward;
+        }
+    }
+    return count;
+}
+
+/* Return 1 if the field exists and has an expire time older than 'now'.
+ * Read commands report such fields as missing. */
+int hashTypeFieldIsExpired(robj *o, sds field, long long now) {
+    long long when = hashTypeNextFieldExpire(o);
+
+    if (when == -1 || when >= now) return 0;
+    when = hashTypeGetFieldExpire(o,field);
+    return when != -1 && when < now;
+}
+
+/* Like hashTypeFieldIsExpired(), for write commands: they act as if the
+ * field did not exist. Slaves apply the commands of their master to their
+ * fields as they are instead, the master sends the HDELs of expired fields
+ * before the commands writing them. */
+static int hashTypeFieldIsStale(robj *o, sds field) {
+    return server.masterhost == NULL &&
+           hashTypeFieldIsExpired(o,field,hashTypeFieldExpireNow());
+}
+
+/* Set the expire time of an existing field of the hash, converting the
+ * hash to a hash table if needed. */
+void hashTypeSetFieldExpire(robj *o, sds field, long long when) {
+    int flags = ZADD_NONE;
+    double newscore;
+    dict *d;
+
+    if (o->encoding == OBJ_ENCODING_LISTPACK)
+        hashTypeConvert(o, OBJ_ENCODING_HT);
+    d = o->ptr;
+    if (d->privdata == NULL) d->privdata = createZsetObject();
+    zsetAdd(d->privdata,(double)when,field,&flags,&newscore);
+}
+
+/* Field TTLs are only supported by the hash table encoding. Convert the
+ * hash back to a listpack once no field has a TTL anymore, if it is small
+ * enough for the hash-max-ziplist-entries and hash-max-ziplist-value
+ * limits. Hashes pinned by modules are left as they are. */
+static void hashTypeTryConversionToListpack(robj *o) {
+    dictIterator *di;
+    dictEntry *de;
+    dict *d = o->ptr;
+    int fits = 1;
+
+    if (o->refcount != 1 || d->privdata != NULL ||
+        dictSize(d) > server.hash_max_ziplist_entries) return;
+
+    di = dictGetIterator(d);
+    while ((de = dictNext(di)) != NULL) {
+        if (sdslen(dictGetKey(de)) > server.hash_max_ziplist_value ||
+            sdslen(dictGetVal(de)) > server.hash_max_ziplist_value)
+        {
+            fits = 0;
+            break;
+        }
+    }
+    dictReleaseIterator(di);
+    if (fits) hashTypeConvert(o,OBJ_ENCODING_LISTPACK);
+}
+
+/* Remove the TTL of the field. The sorted set is released as soon as no
+ * field has a TTL anymore, and the hash converted back to a listpack if
+ * possible. Return 1 if the field had a TTL, otherwise 0. */
+int hashTypeRemoveFieldExpire(robj *o, sds field) {
+    robj *zobj = hashTypeFieldExpires(o);
+
+    if (zobj == NULL || !zsetDel(zobj,field)) return 0;
+    if (zsetLength(zobj) == 0) {
+        decrRefCount(zobj);
+        ((dict*)o->ptr)->privdata = NULL;
+        hashTypeTryConversionToListpack(o);
+    }
+    return 1;
+}
+
+/* Update the db->hexpires entry of the hash 'o' stored at 'key': it is
+ * set to the next field expire time, or removed if no field has a TTL. */
+void hashTypeIndexFieldExpires(redisDb *db, sds key, robj *o) {
+    long long when = hashTypeNextFieldExpire(o);
+    dictEntry *de;
+
+    if (when == -1) {
+        if (dictSize(db->hexpires) > 0) dictDelete(db->hexpires,key);
+        return;
+    }
+    if ((de = dictFind(db->hexpires,key)) == NULL)
+        de = dictAddRaw(db->hexpires,sdsdup(key),NULL);
+    dictSetSignedIntegerVal(de,when);
+}
+
+/* Delete the fields of the hash 'o' stored at 'key' having an expire time
+ * older than 'now', up to 'max' fields (zero means no limit). The deletion
+ * is propagated to AOF and slaves as an HDEL, and the key is deleted if no
+ * field is left. Return the number of expired fields. */
+long hashTypeExpireFields(redisDb *db, robj *key, robj *o, long long now,
+                          long max)
+{
+    robj *zobj, **argv = NULL;
+    zskiplistNode *ln;
+    long expired = 0;
+    int j, argc = 2;
+
+    while ((zobj = hashTypeFieldExpires(o)) != NULL &&
+           (max == 0 || expired < max))
+    {
+        ln = ((zset*)zobj->ptr)->zsl->header->level[0].forward;
+        if ((long long)ln->score >= now) break;
+
+        if ((expired % 16) == 0)
+            argv = zrealloc(argv,sizeof(robj*)*(argc+16));
+        argv[argc++] = createStringObject(zslNodeElement(ln),sdslen(zslNodeElement(ln)));
+        /* A hash pinned by a module is expired on a private copy. */
+        if (expired == 0) o = dbUnshareValue(db,key,o);
+        hashTypeDelete(o,argv[argc-1]->ptr);
+        expired++;
+    }
+    if (expired == 0) {
+        hashTypeIndexFieldExpires(db,key->ptr,o);
+        return 0;
+    }
+
+    argv[0] = shared.hdel;
+    argv[1] = key;
+    if (server.aof_state != AOF_OFF)
+        feedAppendOnlyFile(server.hdelCommand,db->id,argv,argc);
+    replicationFeedSlaves(server.slaves,db->id,argv,argc);
+    for (j = 2; j < argc; j++) decrRefCount(argv[j]);
+    zfree(argv);
+
+    server.stat_expired_fields += expired;
+    notifyKeyspaceEvent(NOTIFY_HASH,"hexpired",key,db->id);
+    if (hashTypeLength(o) == 0) {
+        dbLazyDelete(db,key,LAZYFREE_PATH_EXPIRE);
+        notifyKeyspaceEvent(NOTIFY_GENERIC,"del",key,db->id);
+    } else {
+        hashTypeIndexFieldExpires(db,key->ptr,o);
+    }
+    return expired;
+}
+
+/* Called by the lookupKey*() family of functions before the hash '*o' stored
+ * at 'key' is accessed, in order to delete its expired fields. Like in the
+ * active expire cycle, up to ACTIVE_EXPIRE_CYCLE_FIELDS_PER_LOOKUP fields
+ * are deleted, so that the access is not delayed by a big number of fields
+ * expiring at the same time: the others are deleted by the next accesses and
+ * by the cycle, and hidden meanwhile. Like for keys, slaves don't expire
+ * fields but wait for the HDELs of their master.
+ *
+ * Return 1 if the key was deleted since all its fields expired, otherwise
+ * 0 is returned and '*o' is updated, since a pinned hash is replaced by a
+ * copy before its fields are deleted. */
+int hashTypeExpireIfNeeded(redisDb *db, robj *key, robj **o) {
+    long long when = hashTypeNextFieldExpire(*o), now;
+    dictEntry *de;
+
+    if (when == -1) return 0;
+    if (server.loading) return 0;
+
+    now = hashTypeFieldExpireNow();
+    if (now <= when) return 0;
+    if (server.masterhost != NULL) return 0;
+
+    hashTypeExpireFields(db,key,*o,now,ACTIVE_EXPIRE_CYCLE_FIELDS_PER_LOOKUP);
+    if ((de = dictFind(db->dict,key->ptr)) == NULL) return 1;
+    *o = dictGetVal(de);
+    return 0;
+}
+
 /*-----------------------------------------------------------------------------
  * Hash type commands
  *----------------------------------------------------------------------------*/
@@ -516,9 +873,17 @@ void hsetnxCommand(client *c) {
     if ((o = hashTypeLookupWriteOrCreate(c,c->argv[1])) == NULL) return;
     hashTypeTryConversion(o,c->argv,2,3);
 
-    if (hashTypeExists(o, c->argv[2]->ptr)) {
+    if (hashTypeExists(o, c->argv[2]->ptr) &&
+        !hashTypeFieldIsStale(o, c->argv[2]->ptr))
+    {
         addReply(c, shared.czero);
     } else {
+        /* The field may still exist in the slaves: replicate an HSET. */
+        if (hashTypeExists(o, c->argv[2]->ptr)) {
+            robj *aux = createStringObject("HSET",4);
+            rewriteClientCommandArgument(c,0,aux);
+            decrRefCount(aux);
+        }
         hashTypeSet(o,c->argv[2]->ptr,c->argv[3]->ptr,HASH_SET_COPY);
         addReply(c, shared.cone);
         signalModifiedKey(c->db,c->argv[1]);
@@ -539,8 +904,13 @@ void hsetCommand(client *c) {
     if ((o = hashTypeLookupWriteOrCreate(c,c->argv[1])) == NULL) return;
     hashTypeTryConversion(o,c->argv,2,c->argc-1);
 
-    for (i = 2; i < c->argc; i += 2)
-        created += !hashTypeSet(o,c->argv[i]->ptr,c->argv[i+1]->ptr,HASH_SET_COPY);
+    for (i = 2; i < c->argc; i += 2) {
+        /* Updating a field with an elapsed TTL is like creating it. */
+        int stale = hashTypeFieldIsStale(o,c->argv[i]->ptr);
+
+        if (!hashTypeSet(o,c->argv[i]->ptr,c->argv[i+1]->ptr,HASH_SET_COPY) ||
+            stale) created++;
+    }
 
     /* HMSET (deprecated) and HSET return value is different. */
     char *cmdname = c->argv[0]->ptr;
@@ -562,10 +932,13 @@ void hincrbyCommand(client *c) {
     sds new;
     unsigned char *vstr;
     unsigned int vlen;
+    int stale;
 
     if (getLongLongFromObjectOrReply(c,c->argv[3],&incr,NULL) != C_OK) return;
     if ((o = hashTypeLookupWriteOrCreate(c,c->argv[1])) == NULL) return;
-    if (hashTypeGetValue(o,c->argv[2]->ptr,&vstr,&vlen,&value) == C_OK) {
+    stale = hashTypeFieldIsStale(o,c->argv[2]->ptr);
+    if (!stale &&
+        hashTypeGetValue(o,c->argv[2]->ptr,&vstr,&vlen,&value) == C_OK) {
         if (vstr) {
             if (string2ll((char*)vstr,vlen,&value) == 0) {
                 addReplyError(c,"hash value is not an integer");
@@ -584,11 +957,23 @@ void hincrbyCommand(client *c) {
     }
     value += incr;
     new = sdsfromlonglong(value);
-    hashTypeSet(o,c->argv[2]->ptr,new,HASH_SET_TAKE_VALUE);
+    /* A field with an elapsed TTL is replaced by a persistent one. */
+    hashTypeSet(o,c->argv[2]->ptr,new,
+        HASH_SET_TAKE_VALUE|(stale ? 0 : HASH_SET_KEEP_FIELD_TTL));
     addReplyLongLong(c,value);
     signalModifiedKey(c->db,c->argv[1]);
     notifyKeyspaceEvent(NOTIFY_HASH,"hincrby",c->argv[1],c->db->id);
     server.dirty++;
+
+    /* The slaves still have the old value: replicate the new one. */
+    if (stale) {
+        robj *aux = createStringObject("HSET",4);
+        rewriteClientCommandArgument(c,0,aux);
+        decrRefCount(aux);
+        aux = createStringObjectFromLongLong(value);
+        rewriteClientCommandArgument(c,3,aux);
+        decrRefCount(aux);
+    }
 }
 
 void hincrbyfloatCommand(client *c) {
@@ -598,10 +983,13 @@ void hincrbyfloatCommand(client *c) {
     sds new;
     unsigned char *vstr;
     unsigned int vlen;
+    int stale;
 
     if (getLongDoubleFromObjectOrReply(c,c->argv[3],&incr,NULL) != C_OK) return;
     if ((o = hashTypeLookupWriteOrCreate(c,c->argv[1])) == NULL) return;
-    if (hashTypeGetValue(o,c->argv[2]->ptr,&vstr,&vlen,&ll) == C_OK) {
+    stale = hashTypeFieldIsStale(o,c->argv[2]->ptr);
+    if (!stale &&
+        hashTypeGetValue(o,c->argv[2]->ptr,&vstr,&vlen,&ll) == C_OK) {
         if (vstr) {
             if (string2ld((char*)vstr,vlen,&value) == 0) {
                 addReplyError(c,"hash value is not a float");
@@ -619,7 +1007,8 @@ void hincrbyfloatCommand(client *c) {
     char buf[MAX_LONG_DOUBLE_CHARS];
     int len = ld2string(buf,sizeof(buf),value,1);
     new = sdsnewlen(buf,len);
-    hashTypeSet(o,c->argv[2]->ptr,new,HASH_SET_TAKE_VALUE);
+    hashTypeSet(o,c->argv[2]->ptr,new,
+        HASH_SET_TAKE_VALUE|(stale ? 0 : HASH_SET_KEEP_FIELD_TTL));
     addReplyBulkCBuffer(c,buf,len);
     signalModifiedKey(c->db,c->argv[1]);
     notifyKeyspaceEvent(NOTIFY_HASH,"hincrbyfloat",c->argv[1],c->db->id);
@@ -635,22 +1024,39 @@ void hincrbyfloatCommand(client *c) {
     decrRefCount(aux);
     rewriteClientCommandArgument(c,3,newobj);
     decrRefCount(newobj);
+
+    /* HSET clears the TTL of the field, so restore it afterwards. */
+    long long expire = hashTypeGetFieldExpire(o,c->argv[2]->ptr);
+    if (expire != -1) {
+        robj *argv[6];
+        argv[0] = createStringObject("HPEXPIREAT",10);
+        argv[1] = c->argv[1];
+        argv[2] = createStringObjectFromLongLong(expire);
+        argv[3] = createStringObject("FIELDS",6);
+        argv[4] = shared.integers[1];
+        argv[5] = c->argv[2];
+        alsoPropagate(server.hpexpireatCommand,c->db->id,argv,6,
+            PROPAGATE_AOF|PROPAGATE_REPL);
+        decrRefCount(argv[0]);
+        decrRefCount(argv[2]);
+        decrRefCount(argv[3]);
+    }
 }
 
 static void addHashFieldToReply(client *c, robj *o, sds field) {
     int ret;
 
-    if (o == NULL) {
+    if (o == NULL || hashTypeFieldIsExpired(o,field,hashTypeFieldExpireNow())) {
         addReply(c, shared.nullbulk);
         return;
     }
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        ret = hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll);
+        ret = hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll);
         if (ret < 0) {
             addReply(c, shared.nullbulk);
         } else {
@@ -701,12 +1107,16 @@ void hmgetCommand(client *c) {
 
 void hdelCommand(client *c) {
     robj *o;
-    int j, deleted = 0, keyremoved = 0;
+    int j, deleted = 0, expired = 0, keyremoved = 0;
 
     if ((o = lookupKeyWriteOrReply(c,c->argv[1],shared.czero)) == NULL ||
         checkType(c,o,OBJ_HASH)) return;
+    o = dbUnshareValue(c->db,c->argv[1],o);
 
     for (j = 2; j < c->argc; j++) {
+        /* Fields with an elapsed TTL are deleted and replicated, but not
+         * reported, since they were already hidden. */
+        if (hashTypeFieldIsStale(o,c->argv[j]->ptr)) expired++;
         if (hashTypeDelete(o,c->argv[j]->ptr)) {
             deleted++;
             if (hashTypeLength(o) == 0) {
@@ -724,7 +1134,7 @@ void hdelCommand(client *c) {
                                 c->db->id);
         server.dirty += deleted;
     }
-    addReplyLongLong(c,deleted);
+    addReplyLongLong(c,deleted-expired);
 }
 
 void hlenCommand(client *c) {
@@ -733,7 +1143,8 @@ void hlenCommand(client *c) {
     if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
         checkType(c,o,OBJ_HASH)) return;
 
-    addReplyLongLong(c,hashTypeLength(o));
+    addReplyLongLong(c,hashTypeLength(o)-
+        hashTypeCountExpiredFields(o,hashTypeFieldExpireNow()));
 }
 
 void hstrlenCommand(client *c) {
@@ -741,16 +1152,20 @@ void hstrlenCommand(client *c) {
 
     if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
         checkType(c,o,OBJ_HASH)) return;
+    if (hashTypeFieldIsExpired(o,c->argv[2]->ptr,hashTypeFieldExpireNow())) {
+        addReply(c,shared.czero);
+        return;
+    }
     addReplyLongLong(c,hashTypeGetValueLength(o,c->argv[2]->ptr));
 }
 
 static void addHashIteratorCursorToReply(client *c, hashTypeIterator *hi, int what) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr)
             addReplyBulkCBuffer(c, vstr, vlen);
         else
@@ -768,6 +1183,8 @@ void genericHgetallCommand(client *c, int flags) {
     hashTypeIterator *hi;
     int multiplier = 0;
     int length, count = 0;
+    long long now = hashTypeFieldExpireNow();
+    unsigned long expired;
 
     if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.emptymultibulk)) == NULL
         || checkType(c,o,OBJ_HASH)) return;
@@ -775,11 +1192,16 @@ void genericHgetallCommand(client *c, int flags) {
     if (flags & OBJ_HASH_KEY) multiplier++;
     if (flags & OBJ_HASH_VALUE) multiplier++;
 
-    length = hashTypeLength(o) * multiplier;
+    expired = hashTypeCountExpiredFields(o,now);
+    length = (hashTypeLength(o)-expired) * multiplier;
     addReplyMultiBulkLen(c, length);
 
     hi = hashTypeInitIterator(o);
     while (hashTypeNext(hi) != C_ERR) {
+        /* Only hashes with field TTLs, that are hash tables, have expired
+         * fields. */
+        if (expired && hashTypeFieldIsExpired(o,
+            hashTypeCurrentFromHashTable(hi,OBJ_HASH_KEY),now)) continue;
         if (flags & OBJ_HASH_KEY) {
             addHashIteratorCursorToReply(c, hi, OBJ_HASH_KEY);
             count++;
@@ -811,7 +1233,9 @@ void hexistsCommand(client *c) {
     if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
         checkType(c,o,OBJ_HASH)) return;
 
-    addReply(c, hashTypeExists(o,c->argv[2]->ptr) ? shared.cone : shared.czero);
+    addReply(c, hashTypeExists(o,c->argv[2]->ptr) &&
+        !hashTypeFieldIsExpired(o,c->argv[2]->ptr,hashTypeFieldExpireNow()) ?
+        shared.cone : shared.czero);
 }
 
 void hscanCommand(client *c) {
@@ -823,3 +1247,265 @@ void hscanCommand(client *c) {
         checkType(c,o,OBJ_HASH)) return;
     scanGenericCommand(c,o,cursor);
 }
+
+/*-----------------------------------------------------------------------------
+ * Hash field expire commands
+ *----------------------------------------------------------------------------*/
+
+/* Parse the "FIELDS numfields field [field ...]" arguments starting at
+ * c->argv[pos]: the number of fields must match the number of the remaining
+ * arguments. Returns C_OK on success, otherwise C_ERR is returned and an
+ * error is sent to the client. */
+static int getHashFieldsArgOrReply(client *c, int pos, long long *numfields) {
+    if (pos+1 >= c->argc || strcasecmp(c->argv[pos]->ptr,"fields")) {
+        addReply(c,shared.syntaxerr);
+        return C_ERR;
+    }
+    if (getLongLongFromObjectOrReply(c,c->argv[pos+1],numfields,NULL) != C_OK)
+        return C_ERR;
+    if (*numfields <= 0 || *numfields != c->argc-pos-2) {
+        addReplyError(c,"numfields should be greater than 0 and match "
+                        "the number of fields");
+        return C_ERR;
+    }
+    return C_OK;
+}
+
+#define HEXPIRE_NX (1<<0)   /* Set only if the field has no TTL. */
+#define HEXPIRE_XX (1<<1)   /* Set only if the field has a TTL. */
+#define HEXPIRE_GT (1<<2)   /* Set only if greater than the current TTL. */
+#define HEXPIRE_LT (1<<3)   /* Set only if less than the current TTL. */
+
+/* This is the generic command implementation for HEXPIRE, HPEXPIRE,
+ * HEXPIREAT and HPEXPIREAT:
+ *
+ * HEXPIRE key time [NX|XX|GT|LT] FIELDS numfields field [field ...]
+ *
+ * 'basetime' and 'unit' have the same meaning as in expireGenericCommand().
+ * For every field the reply is -2 if the field does not exist, 0 if the
+ * condition was not met, 1 if the TTL was set, and 2 if the field was
+ * deleted since the expire time is in the past.
+ *
+ * The command is propagated as an HPEXPIREAT with the absolute expire time
+ * of the fields actually changed, and as an HDEL for the deleted fields. */
+void hexpireGenericCommand(client *c, long long basetime, int unit) {
+    robj *o, *key = c->argv[1], **updated, **deleted;
+    long long when, numfields, now = mstime();
+    int j, pos = 3, flags = 0, numupdated = 0, numdeleted = 0;
+
+    if (getLongLongFromObjectOrReply(c,c->argv[2],&when,NULL) != C_OK)
+        return;
+
+    /* Parse the optional condition. */
+    if (c->argc > pos && strcasecmp(c->argv[pos]->ptr,"fields")) {
+        char *opt = c->argv[pos]->ptr;
+
+        if (!strcasecmp(opt,"nx")) flags = HEXPIRE_NX;
+        else if (!strcasecmp(opt,"xx")) flags = HEXPIRE_XX;
+        else if (!strcasecmp(opt,"gt")) flags = HEXPIRE_GT;
+        else if (!strcasecmp(opt,"lt")) flags = HEXPIRE_LT;
+        else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+        pos++;
+    }
+    if (getHashFieldsArgOrReply(c,pos,&numfields) != C_OK) return;
+
+    if (when < 0 || (unit == UNIT_SECONDS && when > LLONG_MAX/1000)) {
+        addReplyError(c,"invalid expire time");
+        return;
+    }
+    if (unit == UNIT_SECONDS) when *= 1000;
+    if (when > LLONG_MAX-basetime) {
+        addReplyError(c,"invalid expire time");
+        return;
+    }
+    when += basetime;
+
+    o = lookupKeyWrite(c->db,key);
+    if (o != NULL && checkType(c,o,OBJ_HASH)) return;
+    if (o != NULL) o = dbUnshareValue(c->db,key,o);
+
+    addReplyMultiBulkLen(c,numfields);
+    if (o == NULL) {
+        for (j = 0; j < numfields; j++) addReplyLongLong(c,-2);
+        return;
+    }
+
+    updated = zmalloc(sizeof(robj*)*(numfields+5));
+    deleted = zmalloc(sizeof(robj*)*(numfields+2));
+    for (j = pos+2; j < c->argc; j++) {
+        sds field = c->argv[j]->ptr;
+        long long current;
+
+        if (!hashTypeExists(o,field) || hashTypeFieldIsStale(o,field)) {
+            addReplyLongLong(c,-2);
+            continue;
+        }
+
+        /* A field without TTL is considered to have an infinite TTL
+         * by the GT and LT conditions. */
+        current = hashTypeGetFieldExpire(o,field);
+        if (((flags & HEXPIRE_NX) && current != -1) ||
+            ((flags & HEXPIRE_XX) && current == -1) ||
+            ((flags & HEXPIRE_GT) && (current == -1 || when <= current)) ||
+            ((flags & HEXPIRE_LT) && current != -1 && when >= current))
+        {
+            addReplyLongLong(c,0);
+            continue;
+        }
+
+        /* Like EXPIRE, an expire time in the past deletes the field, but
+         * not when loading the AOF or in the context of a slave. */
+        if (when <= now && !server.loading && !server.masterhost) {
+            hashTypeDelete(o,field);
+            deleted[2+numdeleted++] = c->argv[j];
+            addReplyLongLong(c,2);
+        } else {
+            hashTypeSetFieldExpire(o,field,when);
+            updated[5+numupdated++] = c->argv[j];
+            addReplyLongLong(c,1);
+        }
+    }
+
+    if (numdeleted) {
+        deleted[0] = shared.hdel;
+        deleted[1] = key;
+        alsoPropagate(server.hdelCommand,c->db->id,deleted,numdeleted+2,
+            PROPAGATE_AOF|PROPAGATE_REPL);
+        notifyKeyspaceEvent(NOTIFY_HASH,"hdel",key,c->db->id);
+    }
+    if (numupdated)
+        notifyKeyspaceEvent(NOTIFY_HASH,"hexpire",key,c->db->id);
+    if (hashTypeLength(o) == 0) {
+        dbDelete(c->db,key);
+        notifyKeyspaceEvent(NOTIFY_GENERIC,"del",key,c->db->id);
+    } else {
+        hashTypeIndexFieldExpires(c->db,key->ptr,o);
+    }
+    if (numupdated || numdeleted) {
+        signalModifiedKey(c->db,key);
+        server.dirty += numupdated+numdeleted;
+    }
+
+    if (numupdated) {
+        /* Propagate as HPEXPIREAT key when FIELDS numupdated field ... */
+        updated[0] = createStringObject("HPEXPIREAT",10);
+        updated[1] = key;
+        updated[2] = createStringObjectFromLongLong(when);
+        updated[3] = createStringObject("FIELDS",6);
+        updated[4] = createStringObjectFromLongLong(numupdated);
+        incrRefCount(key);
+        for (j = 5; j < numupdated+5; j++) incrRefCount(updated[j]);
+        replaceClientCommandVector(c,numupdated+5,updated);
+    } else {
+        zfree(updated);
+        preventCommandPropagation(c);
+    }
+    zfree(deleted);
+}
+
+/* HEXPIRE key seconds [NX|XX|GT|LT] FIELDS numfields field [field ...] */
+void hexpireCommand(client *c) {
+    hexpireGenericCommand(c,mstime(),UNIT_SECONDS);
+}
+
+/* HPEXPIRE key milliseconds [NX|XX|GT|LT] FIELDS numfields field ... */
+void hpexpireCommand(client *c) {
+    hexpireGenericCommand(c,mstime(),UNIT_MILLISECONDS);
+}
+
+/* HEXPIREAT key unix-time-seconds [NX|XX|GT|LT] FIELDS numfields ... */
+void hexpireatCommand(client *c) {
+    hexpireGenericCommand(c,0,UNIT_SECONDS);
+}
+
+/* HPEXPIREAT key unix-time-ms [NX|XX|GT|LT] FIELDS numfields ... */
+void hpexpireatCommand(client *c) {
+    hexpireGenericCommand(c,0,UNIT_MILLISECONDS);
+}
+
+/* Implements HTTL and HPTTL: for every field the reply is -2 if the field
+ * does not exist, -1 if it has no TTL, otherwise the remaining time to live
+ * in seconds or milliseconds. */
+void httlGenericCommand(client *c, int output_ms) {
+    robj *o;
+    long long numfields;
+    int j;
+
+    if (getHashFieldsArgOrReply(c,2,&numfields) != C_OK) return;
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o != NULL && checkType(c,o,OBJ_HASH)) return;
+
+    addReplyMultiBulkLen(c,numfields);
+    for (j = 4; j < c->argc; j++) {
+        sds field = c->argv[j]->ptr;
+        long long expire, ttl;
+
+        if (o == NULL || !hashTypeExists(o,field)) {
+            addReplyLongLong(c,-2);
+            continue;
+        }
+        if ((expire = hashTypeGetFieldExpire(o,field)) == -1) {
+            addReplyLongLong(c,-1);
+            continue;
+        }
+        /* Slaves keep expired fields until the master deletes them, but
+         * report them as already gone. */
+        ttl = expire-mstime();
+        if (ttl < 0) {
+            addReplyLongLong(c,-2);
+            continue;
+        }
+        addReplyLongLong(c,output_ms ? ttl : ((ttl+500)/1000));
+    }
+}
+
+/* HTTL key FIELDS numfields field [field ...] */
+void httlCommand(client *c) {
+    httlGenericCommand(c,0);
+}
+
+/* HPTTL key FIELDS numfields field [field ...] */
+void hpttlCommand(client *c) {
+    httlGenericCommand(c,1);
+}
+
+/* HPERSIST key FIELDS numfields field [field ...]
+ *
+ * Remove the TTL of the fields. For every field the reply is -2 if the
+ * field does not exist, -1 if it has no TTL, and 1 if the TTL was removed. */
+void hpersistCommand(client *c) {
+    robj *o;
+    long long numfields;
+    int j, removed = 0;
+
+    if (getHashFieldsArgOrReply(c,2,&numfields) != C_OK) return;
+    o = lookupKeyWrite(c->db,c->argv[1]);
+    if (o != NULL && checkType(c,o,OBJ_HASH)) return;
+    if (o != NULL) o = dbUnshareValue(c->db,c->argv[1],o);
+
+    addReplyMultiBulkLen(c,numfields);
+    for (j = 4; j < c->argc; j++) {
+        sds field = c->argv[j]->ptr;
+
+        if (o == NULL || !hashTypeExists(o,field) ||
+            hashTypeFieldIsStale(o,field))
+        {
+            addReplyLongLong(c,-2);
+        } else if (hashTypeRemoveFieldExpire(o,field)) {
+            addReplyLongLong(c,1);
+            removed++;
+        } else {
+            addReplyLongLong(c,-1);
+        }
+    }
+
+    if (removed) {
+        hashTypeIndexFieldExpires(c->db,c->argv[1]->ptr,o);
+        signalModifiedKey(c->db,c->argv[1]);
+        notifyKeyspaceEvent(NOTIFY_HASH,"hpersist",c->argv[1],c->db->id);
+        server.dirty += removed;
+    }
+}
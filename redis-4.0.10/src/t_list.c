@@ -190,6 +190,20 @@ void listTypeConvert(robj *subject, int enc) {
     }
 }
 
+/* Return a copy of the list object 'o', with the same encoding. */
+robj *listTypeDup(robj *o) {
+    robj *lobj;
+
+    serverAssert(o->type == OBJ_LIST);
+    if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+        lobj = createObject(OBJ_LIST,quicklistDup(o->ptr));
+        lobj->encoding = OBJ_ENCODING_QUICKLIST;
+    } else {
+        serverPanic("Unknown list encoding");
+    }
+    return lobj;
+}
+
 /*-----------------------------------------------------------------------------
  * List Commands
  *----------------------------------------------------------------------------*/
@@ -202,6 +216,7 @@ void pushGenericCommand(client *c, int where) {
         addReply(c,shared.wrongtypeerr);
         return;
     }
+    if (lobj) lobj = dbUnshareValue(c->db,c->argv[1],lobj);
 
     for (j = 2; j < c->argc; j++) {
         if (!lobj) {
@@ -237,6 +252,7 @@ void pushxGenericCommand(client *c, int where) {
 
     if ((subject = lookupKeyWriteOrReply(c,c->argv[1],shared.czero)) == NULL ||
         checkType(c,subject,OBJ_LIST)) return;
+    subject = dbUnshareValue(c->db,c->argv[1],subject);
 
     for (j = 2; j < c->argc; j++) {
         listTypePush(subject,c->argv[j],where);
@@ -279,6 +295,7 @@ void linsertCommand(client *c) {
 
     if ((subject = lookupKeyWriteOrReply(c,c->argv[1],shared.czero)) == NULL ||
         checkType(c,subject,OBJ_LIST)) return;
+    subject = dbUnshareValue(c->db,c->argv[1],subject);
 
     /* Seek pivot from head to tail */
     iter = listTypeInitIterator(subject,0,LIST_TAIL);
@@ -341,6 +358,7 @@ void lindexCommand(client *c) {
 void lsetCommand(client *c) {
     robj *o = lookupKeyWriteOrReply(c,c->argv[1],shared.nokeyerr);
     if (o == NULL || checkType(c,o,OBJ_LIST)) return;
+    o = dbUnshareValue(c->db,c->argv[1],o);
     long index;
     robj *value = c->argv[3];
 
@@ -367,6 +385,7 @@ void lsetCommand(client *c) {
 void popGenericCommand(client *c, int where) {
     robj *o = lookupKeyWriteOrReply(c,c->argv[1],shared.nullbulk);
     if (o == NULL || checkType(c,o,OBJ_LIST)) return;
+    o = dbUnshareValue(c->db,c->argv[1],o);
 
     robj *value = listTypePop(o,where);
     if (value == NULL) {
@@ -450,6 +469,7 @@ void ltrimCommand(client *c) {
 
     if ((o = lookupKeyWriteOrReply(c,c->argv[1],shared.ok)) == NULL ||
         checkType(c,o,OBJ_LIST)) return;
+    o = dbUnshareValue(c->db,c->argv[1],o);
     llen = listTypeLength(o);
 
     /* convert negative indexes */
@@ -498,6 +518,7 @@ void lremCommand(client *c) {
 
     subject = lookupKeyWriteOrReply(c,c->argv[1],shared.czero);
     if (subject == NULL || checkType(c,subject,OBJ_LIST)) return;
+    subject = dbUnshareValue(c->db,c->argv[1],subject);
 
     listTypeIterator *li;
     if (toremove < 0) {
@@ -576,6 +597,8 @@ void rpoplpushCommand(client *c) {
         robj *touchedkey = c->argv[1];
 
         if (dobj && checkType(c,dobj,OBJ_LIST)) return;
+        sobj = dbUnshareValue(c->db,c->argv[1],sobj);
+        if (dobj) dobj = dbUnshareValue(c->db,c->argv[2],dobj);
         value = listTypePop(sobj,LIST_TAIL);
         /* We saved touched key, and protect it, since rpoplpushHandlePush
          * may change the client command argument vector (it does not
@@ -759,6 +782,7 @@ int serveClientBlockedOnList(client *receiver, robj *key, robj *dstkey, redisDb
         if (!(dstobj &&
              checkType(receiver,dstobj,OBJ_LIST)))
         {
+            if (dstobj) dstobj = dbUnshareValue(receiver->db,dstkey,dstobj);
             /* Propagate the RPOP operation. */
             argv[0] = shared.rpop;
             argv[1] = key;
@@ -820,6 +844,8 @@ void handleClientsBlockedOnLists(void) {
             if (o != NULL && o->type == OBJ_LIST) {
                 dictEntry *de;
 
+                o = dbUnshareValue(rl->db,rl->key,o);
+
                 /* We serve clients in the same order they blocked for
                  * this key, from the first blocked to the last. */
                 de = dictFind(rl->db->blocking_keys,rl->key);
@@ -895,7 +921,10 @@ void blockingPopGenericCommand(client *c, int where) {
                 if (listTypeLength(o) != 0) {
                     /* Non empty list, this is like a non normal [LR]POP. */
                     char *event = (where == LIST_HEAD) ? "lpop" : "rpop";
-                    robj *value = listTypePop(o,where);
+                    robj *value;
+
+                    o = dbUnshareValue(c->db,c->argv[j],o);
+                    value = listTypePop(o,where);
                     serverAssert(value != NULL);
 
                     addReplyMultiBulkLen(c,2);
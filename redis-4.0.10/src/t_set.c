@@ -45,6 +45,25 @@ robj *setTypeCreate(sds value) {
     return createSetObject();
 }
 
+/* Return the encoding an intset that grew past set-max-intset-entries
+ * should be converted to: a roaring bitmap if its elements are dense
+ * enough, otherwise a hash table. */
+int setTypeIntsetTargetEncoding(intset *is) {
+    unsigned long containers = 0;
+    int64_t intele, key = 0;
+    uint32_t j;
+
+    if (server.set_roaring_min_density == 0) return OBJ_ENCODING_HT;
+    for (j = 0; intsetGet(is,j,&intele); j++) {
+        if (j == 0 || (intele >> 16) != key) {
+            key = intele >> 16;
+            containers++;
+        }
+    }
+    return setTypeIsRoaringDense(intsetLen(is),containers) ?
+           OBJ_ENCODING_ROARING : OBJ_ENCODING_HT;
+}
+
 /* Add the specified value into a set.
  *
  * If the value was already member of the set, nothing is done and 0 is
@@ -64,10 +83,10 @@ int setTypeAdd(robj *subject, sds value) {
             uint8_t success = 0;
             subject->ptr = intsetAdd(subject->ptr,llval,&success);
             if (success) {
-                /* Convert to regular set when the intset contains
-                 * too many entries. */
+                /* Convert to a roaring bitmap or to a regular set when the
+                 * intset contains too many entries. */
                 if (intsetLen(subject->ptr) > server.set_max_intset_entries)
-                    setTypeConvert(subject,OBJ_ENCODING_HT);
+                    setTypeConvert(subject,setTypeIntsetTargetEncoding(subject->ptr));
                 return 1;
             }
         } else {
@@ -79,6 +98,14 @@ int setTypeAdd(robj *subject, sds value) {
             serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
             return 1;
         }
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
+            return roaringAdd(subject->ptr,llval);
+        } else {
+            setTypeConvert(subject,OBJ_ENCODING_HT);
+            serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
+            return 1;
+        }
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -98,6 +125,9 @@ int setTypeRemove(robj *setobj, sds value) {
             setobj->ptr = intsetRemove(setobj->ptr,llval,&success);
             if (success) return 1;
         }
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK)
+            return roaringRemove(setobj->ptr,llval);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -112,6 +142,9 @@ int setTypeIsMember(robj *subject, sds value) {
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
             return intsetFind((intset*)subject->ptr,llval);
         }
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK)
+            return roaringFind(subject->ptr,llval);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -126,6 +159,8 @@ setTypeIterator *setTypeInitIterator(robj *subject) {
         si->di = dictGetIterator(subject->ptr);
     } else if (si->encoding == OBJ_ENCODING_INTSET) {
         si->ii = 0;
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {
+        roaringInitIterator(subject->ptr,&si->ri);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -144,7 +179,8 @@ void setTypeReleaseIterator(setTypeIterator *si) {
  * Since set elements can be internally be stored as SDS strings or
  * simple arrays of integers, setTypeNext returns the encoding of the
  * set object you are iterating, and will populate the appropriate pointer
- * (sdsele) or (llele) accordingly.
+ * (sdsele) or (llele) accordingly: llele is used by both the intset and
+ * the roaring encodings.
  *
  * Note that both the sdsele and llele pointers should be passed and cannot
  * be NULL since the function will try to defensively populate the non
@@ -161,6 +197,9 @@ int setTypeNext(setTypeIterator *si, sds *sdsele, int64_t *llele) {
         if (!intsetGet(si->subject->ptr,si->ii++,llele))
             return -1;
         *sdsele = NULL; /* Not needed. Defensive. */
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {
+        if (!roaringNext(&si->ri,llele)) return -1;
+        *sdsele = NULL; /* Not needed. Defensive. */
     } else {
         serverPanic("Wrong set encoding in setTypeNext");
     }
@@ -183,6 +222,7 @@ sds setTypeNextObject(setTypeIterator *si) {
     switch(encoding) {
         case -1:    return NULL;
         case OBJ_ENCODING_INTSET:
+        case OBJ_ENCODING_ROARING:
             return sdsfromlonglong(intele);
         case OBJ_ENCODING_HT:
             return sdsdup(sdsele);
@@ -194,8 +234,8 @@ sds setTypeNextObject(setTypeIterator *si) {
 
 /* Return random element from a non empty set.
  * The returned element can be a int64_t value if the set is encoded
- * as an "intset" blob of integers, or an SDS string if the set
- * is a regular set.
+ * as an "intset" blob of integers or as a roaring bitmap, or an SDS string
+ * if the set is a regular set.
  *
  * The caller provides both pointers to be populated with the right
  * object. The return value of the function is the object->encoding
@@ -213,6 +253,9 @@ int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele) {
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
         *llele = intsetRandom(setobj->ptr);
         *sdsele = NULL; /* Not needed. Defensive. */
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        *llele = roaringRandom(setobj->ptr);
+        *sdsele = NULL; /* Not needed. Defensive. */
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -224,6 +267,8 @@ unsigned long setTypeSize(const robj *subject) {
         return dictSize((const dict*)subject->ptr);
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
         return intsetLen((const intset*)subject->ptr);
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        return roaringLen((const roaring*)subject->ptr);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -235,7 +280,7 @@ unsigned long setTypeSize(const robj *subject) {
 void setTypeConvert(robj *setobj, int enc) {
     setTypeIterator *si;
     serverAssertWithInfo(NULL,setobj,setobj->type == OBJ_SET &&
-                             setobj->encoding == OBJ_ENCODING_INTSET);
+                             setobj->encoding != OBJ_ENCODING_HT);
 
     if (enc == OBJ_ENCODING_HT) {
         int64_t intele;
@@ -243,7 +288,7 @@ void setTypeConvert(robj *setobj, int enc) {
         sds element;
 
         /* Presize the dict to avoid rehashing */
-        dictExpand(d,intsetLen(setobj->ptr));
+        dictExpand(d,setTypeSize(setobj));
 
         /* To add the elements we extract integers and create redis objects */
         si = setTypeInitIterator(setobj);
@@ -253,14 +298,103 @@ void setTypeConvert(robj *setobj, int enc) {
         }
         setTypeReleaseIterator(si);
 
+        if (setobj->encoding == OBJ_ENCODING_ROARING)
+            roaringFree(setobj->ptr);
+        else
+            zfree(setobj->ptr);
         setobj->encoding = OBJ_ENCODING_HT;
-        zfree(setobj->ptr);
         setobj->ptr = d;
+    } else if (enc == OBJ_ENCODING_ROARING &&
+               setobj->encoding == OBJ_ENCODING_INTSET)
+    {
+        roaring *r = roaringNew();
+        int64_t intele;
+        uint32_t j;
+
+        /* The intset is sorted, so the containers are appended in order. */
+        for (j = 0; intsetGet(setobj->ptr,j,&intele); j++)
+            roaringAdd(r,intele);
+        zfree(setobj->ptr);
+        setobj->encoding = OBJ_ENCODING_ROARING;
+        setobj->ptr = r;
     } else {
         serverPanic("Unsupported set conversion");
     }
 }
 
+/* Return a copy of the set object 'o', with the same encoding. */
+robj *setTypeDup(robj *o) {
+    robj *set;
+
+    serverAssert(o->type == OBJ_SET);
+    if (o->encoding == OBJ_ENCODING_INTSET) {
+        size_t size = intsetBlobLen(o->ptr);
+        intset *is = zmalloc(size);
+
+        memcpy(is,o->ptr,size);
+        set = createObject(OBJ_SET,is);
+        set->encoding = OBJ_ENCODING_INTSET;
+    } else if (o->encoding == OBJ_ENCODING_ROARING) {
+        set = createObject(OBJ_SET,roaringDup(o->ptr));
+        set->encoding = OBJ_ENCODING_ROARING;
+    } else if (o->encoding == OBJ_ENCODING_HT) {
+        dictIterator *di = dictGetIterator(o->ptr);
+        dictEntry *de;
+
+        set = createSetObject();
+        dictExpand(set->ptr,dictSize((dict*)o->ptr));
+        while ((de = dictNext(di)) != NULL)
+            dictAdd(set->ptr,sdsdup(dictGetKey(de)),NULL);
+        dictReleaseIterator(di);
+    } else {
+        serverPanic("Unknown set encoding");
+    }
+    return set;
+}
+
+/* Return true if a set of 'card' integers spread over 'containers' ranges
+ * of 65536 values is dense enough to be encoded as a roaring bitmap.
+ *
+ * SSCAN returns the next element of a roaring bitmap as cursor, that does
+ * not fit the cursor of 32 bit builds: they never use this encoding. */
+int setTypeIsRoaringDense(unsigned long card, unsigned long containers) {
+    return sizeof(unsigned long) == 8 &&
+           server.set_roaring_min_density &&
+           card >= containers*server.set_roaring_min_density;
+}
+
+/* Create a set object holding the elements of the roaring bitmap 'r', that
+ * is owned by the returned object. The encoding is the one the set would
+ * have if the elements were added one after the other with SADD. */
+robj *setTypeCreateFromRoaring(roaring *r) {
+    robj *o = createObject(OBJ_SET,r);
+    o->encoding = OBJ_ENCODING_ROARING;
+
+    if (roaringLen(r) <= server.set_max_intset_entries) {
+        roaringIterator ri;
+        intset *is = intsetNew();
+        int64_t intele;
+
+        roaringInitIterator(r,&ri);
+        while (roaringNext(&ri,&intele)) is = intsetAdd(is,intele,NULL);
+        roaringFree(r);
+        o->encoding = OBJ_ENCODING_INTSET;
+        o->ptr = is;
+    } else if (!setTypeIsRoaringDense(roaringLen(r),roaringContainers(r))) {
+        setTypeConvert(o,OBJ_ENCODING_HT);
+    }
+    return o;
+}
+
+/* Remove the integer 'llele' from a set encoded as an intset or as a
+ * roaring bitmap. */
+static void setTypeRemoveInteger(robj *setobj, int64_t llele) {
+    if (setobj->encoding == OBJ_ENCODING_INTSET)
+        setobj->ptr = intsetRemove(setobj->ptr,llele,NULL);
+    else
+        roaringRemove(setobj->ptr,llele);
+}
+
 void saddCommand(client *c) {
     robj *set;
     int j, added = 0;
@@ -274,6 +408,7 @@ void saddCommand(client *c) {
             addReply(c,shared.wrongtypeerr);
             return;
         }
+        set = dbUnshareValue(c->db,c->argv[1],set);
     }
 
     for (j = 2; j < c->argc; j++) {
@@ -293,6 +428,7 @@ void sremCommand(client *c) {
 
     if ((set = lookupKeyWriteOrReply(c,c->argv[1],shared.czero)) == NULL ||
         checkType(c,set,OBJ_SET)) return;
+    set = dbUnshareValue(c->db,c->argv[1],set);
 
     for (j = 2; j < c->argc; j++) {
         if (setTypeRemove(set,c->argv[j]->ptr)) {
@@ -339,6 +475,9 @@ void smoveCommand(client *c) {
         return;
     }
 
+    srcset = dbUnshareValue(c->db,c->argv[1],srcset);
+    if (dstset) dstset = dbUnshareValue(c->db,c->argv[2],dstset);
+
     /* If the element cannot be removed from the src set, return 0. */
     if (!setTypeRemove(srcset,ele->ptr)) {
         addReply(c,shared.czero);
@@ -417,6 +556,7 @@ void spopWithCountCommand(client *c) {
      * indeed a set. Otherwise, return nil */
     if ((set = lookupKeyReadOrReply(c,c->argv[1],shared.emptymultibulk))
         == NULL || checkType(c,set,OBJ_SET)) return;
+    set = dbUnshareValue(c->db,c->argv[1],set);
 
     /* If count is zero, serve an empty multibulk ASAP to avoid special
      * cases later. */
@@ -475,10 +615,10 @@ void spopWithCountCommand(client *c) {
         while(count--) {
             /* Emit and remove. */
             encoding = setTypeRandomElement(set,&sdsele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 addReplyBulkLongLong(c,llele);
                 objele = createStringObjectFromLongLong(llele);
-                set->ptr = intsetRemove(set->ptr,llele,NULL);
+                setTypeRemoveInteger(set,llele);
             } else {
                 addReplyBulkCBuffer(c,sdsele,sdslen(sdsele));
                 objele = createStringObject(sdsele,sdslen(sdsele));
@@ -505,7 +645,7 @@ void spopWithCountCommand(client *c) {
         /* Create a new set with just the remaining elements. */
         while(remaining--) {
             encoding = setTypeRandomElement(set,&sdsele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 sdsele = sdsfromlonglong(llele);
             } else {
                 sdsele = sdsdup(sdsele);
@@ -524,7 +664,7 @@ void spopWithCountCommand(client *c) {
         setTypeIterator *si;
         si = setTypeInitIterator(set);
         while((encoding = setTypeNext(si,&sdsele,&llele)) != -1) {
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 addReplyBulkLongLong(c,llele);
                 objele = createStringObjectFromLongLong(llele);
             } else {
@@ -570,14 +710,15 @@ void spopCommand(client *c) {
      * indeed a set */
     if ((set = lookupKeyWriteOrReply(c,c->argv[1],shared.nullbulk)) == NULL ||
         checkType(c,set,OBJ_SET)) return;
+    set = dbUnshareValue(c->db,c->argv[1],set);
 
     /* Get a random element from the set */
     encoding = setTypeRandomElement(set,&sdsele,&llele);
 
     /* Remove the element from the set */
-    if (encoding == OBJ_ENCODING_INTSET) {
+    if (encoding != OBJ_ENCODING_HT) {
         ele = createStringObjectFromLongLong(llele);
-        set->ptr = intsetRemove(set->ptr,llele,NULL);
+        setTypeRemoveInteger(set,llele);
     } else {
         ele = createStringObject(sdsele,sdslen(sdsele));
         setTypeRemove(set,ele->ptr);
@@ -652,7 +793,7 @@ void srandmemberWithCountCommand(client *c) {
         addReplyMultiBulkLen(c,count);
         while(count--) {
             encoding = setTypeRandomElement(set,&ele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 addReplyBulkLongLong(c,llele);
             } else {
                 addReplyBulkCBuffer(c,ele,sdslen(ele));
@@ -689,7 +830,7 @@ void srandmemberWithCountCommand(client *c) {
         while((encoding = setTypeNext(si,&ele,&llele)) != -1) {
             int retval = DICT_ERR;
 
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 retval = dictAdd(d,createStringObjectFromLongLong(llele),NULL);
             } else {
                 retval = dictAdd(d,createStringObject(ele,sdslen(ele)),NULL);
@@ -719,7 +860,7 @@ void srandmemberWithCountCommand(client *c) {
 
         while(added < count) {
             encoding = setTypeRandomElement(set,&ele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 objele = createStringObjectFromLongLong(llele);
             } else {
                 objele = createStringObject(ele,sdslen(ele));
@@ -766,7 +907,7 @@ void srandmemberCommand(client *c) {
         checkType(c,set,OBJ_SET)) return;
 
     encoding = setTypeRandomElement(set,&ele,&llele);
-    if (encoding == OBJ_ENCODING_INTSET) {
+    if (encoding != OBJ_ENCODING_HT) {
         addReplyBulkLongLong(c,llele);
     } else {
         addReplyBulkCBuffer(c,ele,sdslen(ele));
@@ -791,16 +932,273 @@ int qsortCompareSetsByRevCardinality(const void *s1, const void *s2) {
     return 0;
 }
 
+/* Return the elements of an intset or roaring encoded set as a roaring
+ * bitmap. Roaring sets are returned as they are, setting 'owned' to 0,
+ * otherwise a new bitmap the caller should free is created. */
+static roaring *setTypeGetRoaring(robj *setobj, int *owned) {
+    roaring *r;
+    int64_t intele;
+    uint32_t j;
+
+    if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        *owned = 0;
+        return setobj->ptr;
+    }
+    r = roaringNew();
+    for (j = 0; intsetGet(setobj->ptr,j,&intele); j++) roaringAdd(r,intele);
+    *owned = 1;
+    return r;
+}
+
+/* Return true if the fast path of setTypeRoaringOp() can be used, that is
+ * if all the sets are sets of integers and at least one of them is a
+ * roaring bitmap. NULL entries in 'sets' are missing keys. */
+static int setTypeRoaringOpUsable(robj **sets, int setnum) {
+    int j, roaring_sets = 0;
+
+    for (j = 0; j < setnum; j++) {
+        if (sets[j] == NULL) continue;
+        if (sets[j]->encoding == OBJ_ENCODING_HT) return 0;
+        if (sets[j]->encoding == OBJ_ENCODING_ROARING) roaring_sets++;
+    }
+    return roaring_sets != 0;
+}
+
+/* Compute the intersection, union or difference of the sets when they are
+ * all sets of integers and at least one of them is a roaring bitmap: in
+ * this case the operation is performed container by container instead of
+ * looking up every element. NULL entries in 'sets' are missing keys.
+ *
+ * Return NULL if the fast path can't be used, otherwise a new roaring
+ * bitmap with the result. */
+static roaring *setTypeRoaringOp(robj **sets, int setnum, int op) {
+    roaring *acc = NULL, *r, *res;
+    int j, owned, acc_owned = 0;
+
+    if (!setTypeRoaringOpUsable(sets,setnum)) return NULL;
+    if (op == SET_OP_DIFF && sets[0] == NULL) return roaringNew();
+
+    for (j = 0; j < setnum; j++) {
+        if (sets[j] == NULL) continue;
+        r = setTypeGetRoaring(sets[j],&owned);
+        if (acc == NULL) {
+            acc = r;
+            acc_owned = owned;
+            continue;
+        }
+        if (op == SET_OP_INTER) res = roaringAnd(acc,r);
+        else if (op == SET_OP_UNION) res = roaringOr(acc,r);
+        else res = roaringAndNot(acc,r);
+        if (acc_owned) roaringFree(acc);
+        if (owned) roaringFree(r);
+        acc = res;
+        acc_owned = 1;
+        if (op != SET_OP_UNION && roaringLen(acc) == 0) break;
+    }
+    return acc_owned ? acc : roaringDup(acc);
+}
+
+/* Like setTypeRoaringOp() with SET_OP_INTER, but only the cardinality of
+ * the intersection is computed: the last set is intersected with the
+ * others without creating the final bitmap. Return 0 if the fast path
+ * can't be used, otherwise the cardinality is stored at 'card'. */
+static int setTypeRoaringInterCard(robj **sets, int setnum, unsigned long *card) {
+    roaring *acc, *r;
+    int owned, acc_owned;
+
+    if (!setTypeRoaringOpUsable(sets,setnum)) return 0;
+    if (setnum == 1) {
+        *card = setTypeSize(sets[0]);
+        return 1;
+    }
+    if (setnum == 2) {
+        acc = setTypeGetRoaring(sets[0],&acc_owned);
+    } else if ((acc = setTypeRoaringOp(sets,setnum-1,SET_OP_INTER)) != NULL) {
+        acc_owned = 1;
+    } else {
+        /* Only the last set is a roaring bitmap. */
+        return 0;
+    }
+    r = setTypeGetRoaring(sets[setnum-1],&owned);
+    *card = roaringAndCard(acc,r);
+    if (acc_owned) roaringFree(acc);
+    if (owned) roaringFree(r);
+    return 1;
+}
+
+/* Store 'dstset', the result of a set operation, at 'dstkey' replying with
+ * its cardinality and firing the 'event' keyspace notification. When the
+ * result is empty the destination key is deleted instead. */
+static void setTypeStoreResult(client *c, robj *dstset, robj *dstkey,
+                               char *event)
+{
+    int deleted = dbDelete(c->db,dstkey);
+
+    if (setTypeSize(dstset) > 0) {
+        dbAdd(c->db,dstkey,dstset);
+        addReplyLongLong(c,setTypeSize(dstset));
+        notifyKeyspaceEvent(NOTIFY_SET,event,dstkey,c->db->id);
+    } else {
+        decrRefCount(dstset);
+        addReply(c,shared.czero);
+        if (deleted)
+            notifyKeyspaceEvent(NOTIFY_GENERIC,"del",
+                dstkey,c->db->id);
+    }
+    signalModifiedKey(c->db,dstkey);
+    server.dirty++;
+}
+
+/* Reply with the result of setTypeRoaringOp(), or store it at 'dstkey'
+ * firing the 'event' keyspace notification. The bitmap is consumed. */
+static void setTypeRoaringOpReply(client *c, roaring *r, robj *dstkey, char *event) {
+    if (!dstkey) {
+        roaringIterator ri;
+        int64_t intele;
+
+        addReplyMultiBulkLen(c,roaringLen(r));
+        roaringInitIterator(r,&ri);
+        while (roaringNext(&ri,&intele)) addReplyBulkLongLong(c,intele);
+        roaringFree(r);
+    } else {
+        setTypeStoreResult(c,setTypeCreateFromRoaring(r),dstkey,event);
+    }
+}
+
+/* Compute the union or the difference of sets that are all intsets, NULL
+ * entries in 'sets' being missing keys. The sorted arrays are merged, so no
+ * element is hashed or converted to a string. The result intset is allocated
+ * once, with room for the biggest possible result and the encoding needed by
+ * its range of values, the elements are appended in order, and the unused
+ * room is released at the end.
+ *
+ * Return NULL if some set is not an intset, otherwise the resulting intset. */
+static intset *setTypeIntsetOp(robj **sets, int setnum, int op) {
+    intset *dst;
+    uint32_t *pos, maxlen = 0;
+    int64_t intele, min = 0, max = 0, cur;
+    int j, found;
+    uint32_t k;
+
+    for (j = 0; j < setnum; j++) {
+        if (sets[j] && sets[j]->encoding != OBJ_ENCODING_INTSET) return NULL;
+    }
+
+    /* The elements of the union are in the range of all the sets, the ones
+     * of the difference in the range of the first set. */
+    for (j = 0; j < (op == SET_OP_DIFF ? 1 : setnum); j++) {
+        uint32_t len;
+
+        if (!sets[j] || (len = intsetLen(sets[j]->ptr)) == 0) continue;
+        intsetGet(sets[j]->ptr,0,&intele);
+        if (maxlen == 0 || intele < min) min = intele;
+        intsetGet(sets[j]->ptr,len-1,&intele);
+        if (maxlen == 0 || intele > max) max = intele;
+        maxlen += len;
+    }
+
+    dst = intsetNewPresized(maxlen,min,max);
+    pos = zcalloc(sizeof(uint32_t)*setnum);
+    if (op == SET_OP_UNION) {
+        /* Every round adds the smallest element at the current position of
+         * the sets, moving forward all the sets positioned at it. */
+        while(1) {
+            found = 0;
+            for (j = 0; j < setnum; j++) {
+                if (sets[j] && intsetGet(sets[j]->ptr,pos[j],&intele) &&
+                    (!found || intele < min))
+                {
+                    min = intele;
+                    found = 1;
+                }
+            }
+            if (!found) break;
+            intsetAppend(dst,min);
+            for (j = 0; j < setnum; j++) {
+                if (sets[j] && intsetGet(sets[j]->ptr,pos[j],&intele) &&
+                    intele == min) pos[j]++;
+            }
+        }
+    } else if (op == SET_OP_DIFF && sets[0]) {
+        /* The elements of the first set are probed in ascending order, so
+         * the position in the other sets only moves forward. */
+        for (k = 0; intsetGet(sets[0]->ptr,k,&intele); k++) {
+            for (j = 1; j < setnum; j++) {
+                if (!sets[j]) continue; /* no key is an empty set. */
+                if (sets[j] == sets[0]) break; /* same set! */
+                pos[j] = intsetSeek(sets[j]->ptr,pos[j],intele);
+                if (intsetGet(sets[j]->ptr,pos[j],&cur) && cur == intele)
+                    break;
+            }
+            if (j == setnum) intsetAppend(dst,intele);
+        }
+    }
+    zfree(pos);
+    return intsetTrim(dst);
+}
+
+/* Like setTypeIsMember() but for an element returned by setTypeNext(): the
+ * element is the string 'sdsele' if 'encoding' is OBJ_ENCODING_HT,
+ * otherwise the integer 'llele'. Integers are only converted to strings
+ * when looked up in a hash table. */
+static int setTypeIsMemberElement(robj *setobj, int encoding, sds sdsele,
+                                  int64_t llele)
+{
+    int ismember;
+
+    if (encoding == OBJ_ENCODING_HT) return setTypeIsMember(setobj,sdsele);
+    if (setobj->encoding == OBJ_ENCODING_INTSET)
+        return intsetFind(setobj->ptr,llele);
+    if (setobj->encoding == OBJ_ENCODING_ROARING)
+        return roaringFind(setobj->ptr,llele);
+    sdsele = sdsfromlonglong(llele);
+    ismember = setTypeIsMember(setobj,sdsele);
+    sdsfree(sdsele);
+    return ismember;
+}
+
+/* Add to 'setobj' an element returned by setTypeNext(), see
+ * setTypeIsMemberElement(). */
+static int setTypeAddElement(robj *setobj, int encoding, sds sdsele,
+                             int64_t llele)
+{
+    int added;
+
+    if (encoding == OBJ_ENCODING_HT) return setTypeAdd(setobj,sdsele);
+    sdsele = sdsfromlonglong(llele);
+    added = setTypeAdd(setobj,sdsele);
+    sdsfree(sdsele);
+    return added;
+}
+
+/* Reply with an element returned by setTypeNext(), see
+ * setTypeIsMemberElement(). */
+static void addReplySetElement(client *c, int encoding, sds sdsele,
+                               int64_t llele)
+{
+    if (encoding == OBJ_ENCODING_HT)
+        addReplyBulkCBuffer(c,sdsele,sdslen(sdsele));
+    else
+        addReplyBulkLongLong(c,llele);
+}
+
+/* Implements SINTER, SINTERSTORE and SMEMBERS, and SINTERCARD when
+ * 'cardinality_only' is true: in this case only the number of elements of
+ * the intersection is returned, stopping as soon as 'limit' elements are
+ * found if 'limit' is not zero. */
 void sinterGenericCommand(client *c, robj **setkeys,
-                          unsigned long setnum, robj *dstkey) {
+                          unsigned long setnum, robj *dstkey,
+                          int cardinality_only, unsigned long limit) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);
+    uint32_t *pos;
     setTypeIterator *si;
     robj *dstset = NULL;
+    roaring *result;
     sds elesds;
-    int64_t intobj;
+    int64_t intobj, cur;
     void *replylen = NULL;
     unsigned long j, cardinality = 0;
-    int encoding;
+    int encoding, exhausted = 0;
 
     for (j = 0; j < setnum; j++) {
         robj *setobj = dstkey ?
@@ -814,6 +1212,8 @@ void sinterGenericCommand(client *c, robj **setkeys,
                     server.dirty++;
                 }
                 addReply(c,shared.czero);
+            } else if (cardinality_only) {
+                addReply(c,shared.czero);
             } else {
                 addReply(c,shared.emptymultibulk);
             }
@@ -829,42 +1229,67 @@ void sinterGenericCommand(client *c, robj **setkeys,
      * algorithm's performance */
     qsort(sets,setnum,sizeof(robj*),qsortCompareSetsByCardinality);
 
+    if (cardinality_only) {
+        if (setTypeRoaringInterCard(sets,setnum,&cardinality)) {
+            if (limit && cardinality > limit) cardinality = limit;
+            addReplyLongLong(c,cardinality);
+            zfree(sets);
+            return;
+        }
+    } else if ((result = setTypeRoaringOp(sets,setnum,SET_OP_INTER)) != NULL) {
+        setTypeRoaringOpReply(c,result,dstkey,"sinterstore");
+        zfree(sets);
+        return;
+    }
+
     /* The first thing we should output is the total number of elements...
      * since this is a multi-bulk write, but at this stage we don't know
      * the intersection set size, so we use a trick, append an empty object
      * to the output list and save the pointer to later modify it with the
      * right length */
-    if (!dstkey) {
-        replylen = addDeferredMultiBulkLength(c);
-    } else {
+    if (dstkey) {
         /* If we have a target key where to store the resulting set
          * create this key with an empty set inside */
         dstset = createIntsetObject();
+    } else if (!cardinality_only) {
+        replylen = addDeferredMultiBulkLength(c);
     }
 
     /* Iterate all the elements of the first (smallest) set, and test
      * the element against all the other sets, if at least one set does
-     * not include the element it is discarded */
+     * not include the element it is discarded.
+     *
+     * When the first set is not a hash table its elements are returned in
+     * ascending order, so the other intsets are merged with it: 'pos' is
+     * the position reached in each of them, that only moves forward. */
+    pos = zcalloc(sizeof(uint32_t)*setnum);
     si = setTypeInitIterator(sets[0]);
-    while((encoding = setTypeNext(si,&elesds,&intobj)) != -1) {
+    while(!exhausted && (encoding = setTypeNext(si,&elesds,&intobj)) != -1) {
         for (j = 1; j < setnum; j++) {
             if (sets[j] == sets[0]) continue;
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 /* intset with intset is simple... and fast */
-                if (sets[j]->encoding == OBJ_ENCODING_INTSET &&
-                    !intsetFind((intset*)sets[j]->ptr,intobj))
+                if (sets[j]->encoding == OBJ_ENCODING_INTSET) {
+                    pos[j] = intsetSeek(sets[j]->ptr,pos[j],intobj);
+                    if (!intsetGet(sets[j]->ptr,pos[j],&cur)) {
+                        /* All the elements left are bigger than the
+                         * ones of this set. */
+                        exhausted = 1;
+                        break;
+                    }
+                    if (cur != intobj) break;
+                } else if (sets[j]->encoding == OBJ_ENCODING_ROARING &&
+                           !roaringFind(sets[j]->ptr,intobj))
                 {
                     break;
                 /* in order to compare an integer with an object we
                  * have to use the generic function, creating an object
                  * for this */
-                } else if (sets[j]->encoding == OBJ_ENCODING_HT) {
-                    elesds = sdsfromlonglong(intobj);
-                    if (!setTypeIsMember(sets[j],elesds)) {
-                        sdsfree(elesds);
-                        break;
-                    }
-                    sdsfree(elesds);
+                } else if (sets[j]->encoding == OBJ_ENCODING_HT &&
+                           !setTypeIsMemberElement(sets[j],encoding,NULL,
+                                                   intobj))
+                {
+                    break;
                 }
             } else if (encoding == OBJ_ENCODING_HT) {
                 if (!setTypeIsMember(sets[j],elesds)) {
@@ -875,43 +1300,25 @@ void sinterGenericCommand(client *c, robj **setkeys,
 
         /* Only take action when all sets contain the member */
         if (j == setnum) {
-            if (!dstkey) {
-                if (encoding == OBJ_ENCODING_HT)
-                    addReplyBulkCBuffer(c,elesds,sdslen(elesds));
-                else
-                    addReplyBulkLongLong(c,intobj);
-                cardinality++;
-            } else {
-                if (encoding == OBJ_ENCODING_INTSET) {
-                    elesds = sdsfromlonglong(intobj);
-                    setTypeAdd(dstset,elesds);
-                    sdsfree(elesds);
-                } else {
-                    setTypeAdd(dstset,elesds);
-                }
+            cardinality++;
+            if (dstkey) {
+                setTypeAddElement(dstset,encoding,elesds,intobj);
+            } else if (!cardinality_only) {
+                addReplySetElement(c,encoding,elesds,intobj);
+            } else if (limit && cardinality == limit) {
+                break;
             }
         }
     }
     setTypeReleaseIterator(si);
+    zfree(pos);
 
     if (dstkey) {
         /* Store the resulting set into the target, if the intersection
          * is not an empty set. */
-        int deleted = dbDelete(c->db,dstkey);
-        if (setTypeSize(dstset) > 0) {
-            dbAdd(c->db,dstkey,dstset);
-            addReplyLongLong(c,setTypeSize(dstset));
-            notifyKeyspaceEvent(NOTIFY_SET,"sinterstore",
-                dstkey,c->db->id);
-        } else {
-            decrRefCount(dstset);
-            addReply(c,shared.czero);
-            if (deleted)
-                notifyKeyspaceEvent(NOTIFY_GENERIC,"del",
-                    dstkey,c->db->id);
-        }
-        signalModifiedKey(c->db,dstkey);
-        server.dirty++;
+        setTypeStoreResult(c,dstset,dstkey,"sinterstore");
+    } else if (cardinality_only) {
+        addReplyLongLong(c,cardinality);
     } else {
         setDeferredMultiBulkLength(c,replylen,cardinality);
     }
@@ -919,25 +1326,87 @@ void sinterGenericCommand(client *c, robj **setkeys,
 }
 
 void sinterCommand(client *c) {
-    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL);
+    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL,0,0);
 }
 
 void sinterstoreCommand(client *c) {
-    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1]);
+    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1],0,0);
+}
+
+/* SINTERCARD numkeys key [key ...] [LIMIT limit] */
+void sintercardCommand(client *c) {
+    long numkeys, limit = 0;
+    int j;
+
+    if (getLongFromObjectOrReply(c,c->argv[1],&numkeys,NULL) != C_OK)
+        return;
+    if (numkeys < 1) {
+        addReplyError(c,"numkeys should be greater than 0");
+        return;
+    }
+    if (numkeys > c->argc-2) {
+        addReplyError(c,"Number of keys can't be greater than number of args");
+        return;
+    }
+
+    for (j = 2+numkeys; j < c->argc; j++) {
+        char *opt = c->argv[j]->ptr;
+        int moreargs = (c->argc-1) - j;
+
+        if (!strcasecmp(opt,"limit") && moreargs) {
+            j++;
+            if (getLongFromObjectOrReply(c,c->argv[j],&limit,NULL) != C_OK)
+                return;
+            if (limit < 0) {
+                addReplyError(c,"LIMIT can't be negative");
+                return;
+            }
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+    sinterGenericCommand(c,c->argv+2,numkeys,NULL,1,limit);
 }
 
 #define SET_OP_UNION 0
 #define SET_OP_DIFF 1
 #define SET_OP_INTER 2
 
+/* Read only SUNION can stream the union to the client instead of building
+ * it in a temporary set: an element is emitted only if it is not a member
+ * of the sets before its own. This costs a lookup in each of those sets for
+ * every element, while building the union costs a copy and an insertion,
+ * so the sets are sorted by decreasing size (the lookups are done for the
+ * elements of the smaller sets) and the union is streamed only if this
+ * requires less than SET_UNION_STREAM_LOOKUPS lookups per element. */
+#define SET_UNION_STREAM_LOOKUPS 3
+static int setTypeUnionCanStream(robj **sets, int setnum) {
+    unsigned long long lookups = 0, elements = 0;
+    int j;
+
+    /* Missing keys are sorted at the end. */
+    qsort(sets,setnum,sizeof(robj*),qsortCompareSetsByRevCardinality);
+    for (j = 0; j < setnum && sets[j]; j++) {
+        lookups += (unsigned long long)setTypeSize(sets[j])*j;
+        elements += setTypeSize(sets[j]);
+    }
+    return lookups <= elements*SET_UNION_STREAM_LOOKUPS;
+}
+
 void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
                               robj *dstkey, int op) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);
     setTypeIterator *si;
     robj *dstset = NULL;
+    roaring *result;
+    intset *is;
     sds ele;
-    int j, cardinality = 0;
-    int diff_algo = 1;
+    int64_t intele;
+    void *replylen = NULL;
+    int j, k, encoding;
+    int diff_algo = 1, stream = 0;
+    unsigned long cardinality = 0;
 
     for (j = 0; j < setnum; j++) {
         robj *setobj = dstkey ?
@@ -954,6 +1423,40 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
         sets[j] = setobj;
     }
 
+    /* The union or difference of a single set is the set itself: without a
+     * destination key (SUNION and SDIFF of one key, SPOP and SRANDMEMBER
+     * with a count not smaller than the set) reply with its elements, with
+     * no copy of the set. */
+    if (!dstkey && setnum == 1) {
+        if (sets[0] == NULL) {
+            addReply(c,shared.emptymultibulk);
+        } else {
+            addReplyMultiBulkLen(c,setTypeSize(sets[0]));
+            si = setTypeInitIterator(sets[0]);
+            while((encoding = setTypeNext(si,&ele,&intele)) != -1)
+                addReplySetElement(c,encoding,ele,intele);
+            setTypeReleaseIterator(si);
+        }
+        zfree(sets);
+        return;
+    }
+
+    if ((result = setTypeRoaringOp(sets,setnum,op)) != NULL) {
+        setTypeRoaringOpReply(c,result,dstkey,
+            op == SET_OP_UNION ? "sunionstore" : "sdiffstore");
+        zfree(sets);
+        return;
+    }
+
+    if ((is = setTypeIntsetOp(sets,setnum,op)) != NULL) {
+        /* Sets of integers are merged without any lookup. */
+        dstset = createObject(OBJ_SET,is);
+        dstset->encoding = OBJ_ENCODING_INTSET;
+        if (dstkey && intsetLen(is) > server.set_max_intset_entries)
+            setTypeConvert(dstset,setTypeIntsetTargetEncoding(is));
+        goto reply;
+    }
+
     /* Select what DIFF algorithm to use.
      *
      * Algorithm 1 is O(N*M) where N is the size of the element first set
@@ -987,21 +1490,49 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
         }
     }
 
-    /* We need a temp set object to store our union. If the dstkey
-     * is not NULL (that is, we are inside an SUNIONSTORE operation) then
-     * this set object will be the resulting object to set into the target key*/
-    dstset = createIntsetObject();
+    /* Without a destination key the union and the DIFF algorithm 1 never
+     * need to look at the elements already emitted, so they are streamed
+     * to the client as they are found. Otherwise we need a temp set object
+     * to store the result: if the dstkey is not NULL (that is, we are inside
+     * an SUNIONSTORE or SDIFFSTORE operation) then this set object will be
+     * the resulting object to set into the target key. */
+    if (!dstkey) {
+        if (op == SET_OP_UNION)
+            stream = setTypeUnionCanStream(sets,setnum);
+        else
+            stream = diff_algo == 1;
+    }
+    if (stream)
+        replylen = addDeferredMultiBulkLength(c);
+    else
+        dstset = createIntsetObject();
 
     if (op == SET_OP_UNION) {
         /* Union is trivial, just add every element of every set to the
-         * temporary set. */
+         * temporary set, or stream the elements not already emitted for
+         * one of the previous sets. */
         for (j = 0; j < setnum; j++) {
             if (!sets[j]) continue; /* non existing keys are like empty sets */
+            if (stream) {
+                for (k = 0; k < j; k++) if (sets[k] == sets[j]) break;
+                if (k != j) continue; /* same set! */
+            }
 
             si = setTypeInitIterator(sets[j]);
-            while((ele = setTypeNextObject(si)) != NULL) {
-                if (setTypeAdd(dstset,ele)) cardinality++;
-                sdsfree(ele);
+            while((encoding = setTypeNext(si,&ele,&intele)) != -1) {
+                if (!stream) {
+                    setTypeAddElement(dstset,encoding,ele,intele);
+                    continue;
+                }
+                for (k = 0; k < j; k++) {
+                    if (sets[k] &&
+                        setTypeIsMemberElement(sets[k],encoding,ele,intele))
+                        break;
+                }
+                if (k == j) {
+                    addReplySetElement(c,encoding,ele,intele);
+                    cardinality++;
+                }
             }
             setTypeReleaseIterator(si);
         }
@@ -1015,18 +1546,21 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
          * This way we perform at max N*M operations, where N is the size of
          * the first set, and M the number of sets. */
         si = setTypeInitIterator(sets[0]);
-        while((ele = setTypeNextObject(si)) != NULL) {
+        while((encoding = setTypeNext(si,&ele,&intele)) != -1) {
             for (j = 1; j < setnum; j++) {
                 if (!sets[j]) continue; /* no key is an empty set. */
                 if (sets[j] == sets[0]) break; /* same set! */
-                if (setTypeIsMember(sets[j],ele)) break;
+                if (setTypeIsMemberElement(sets[j],encoding,ele,intele)) break;
             }
             if (j == setnum) {
                 /* There is no other set with this element. Add it. */
-                setTypeAdd(dstset,ele);
-                cardinality++;
+                if (stream) {
+                    addReplySetElement(c,encoding,ele,intele);
+                    cardinality++;
+                } else {
+                    setTypeAddElement(dstset,encoding,ele,intele);
+                }
             }
-            sdsfree(ele);
         }
         setTypeReleaseIterator(si);
     } else if (op == SET_OP_DIFF && sets[0] && diff_algo == 2) {
@@ -1043,9 +1577,9 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
             si = setTypeInitIterator(sets[j]);
             while((ele = setTypeNextObject(si)) != NULL) {
                 if (j == 0) {
-                    if (setTypeAdd(dstset,ele)) cardinality++;
+                    setTypeAdd(dstset,ele);
                 } else {
-                    if (setTypeRemove(dstset,ele)) cardinality--;
+                    setTypeRemove(dstset,ele);
                 }
                 sdsfree(ele);
             }
@@ -1053,39 +1587,26 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
 
             /* Exit if result set is empty as any additional removal
              * of elements will have no effect. */
-            if (cardinality == 0) break;
+            if (setTypeSize(dstset) == 0) break;
         }
     }
 
-    /* Output the content of the resulting set, if not in STORE mode */
-    if (!dstkey) {
-        addReplyMultiBulkLen(c,cardinality);
+reply:
+    if (stream) {
+        setDeferredMultiBulkLength(c,replylen,cardinality);
+    } else if (!dstkey) {
+        /* Output the content of the resulting set, if not in STORE mode */
+        addReplyMultiBulkLen(c,setTypeSize(dstset));
         si = setTypeInitIterator(dstset);
-        while((ele = setTypeNextObject(si)) != NULL) {
-            addReplyBulkCBuffer(c,ele,sdslen(ele));
-            sdsfree(ele);
-        }
+        while((encoding = setTypeNext(si,&ele,&intele)) != -1)
+            addReplySetElement(c,encoding,ele,intele);
         setTypeReleaseIterator(si);
         decrRefCount(dstset);
     } else {
         /* If we have a target key where to store the resulting set
          * create this key with the result set inside */
-        int deleted = dbDelete(c->db,dstkey);
-        if (setTypeSize(dstset) > 0) {
-            dbAdd(c->db,dstkey,dstset);
-            addReplyLongLong(c,setTypeSize(dstset));
-            notifyKeyspaceEvent(NOTIFY_SET,
-                op == SET_OP_UNION ? "sunionstore" : "sdiffstore",
-                dstkey,c->db->id);
-        } else {
-            decrRefCount(dstset);
-            addReply(c,shared.czero);
-            if (deleted)
-                notifyKeyspaceEvent(NOTIFY_GENERIC,"del",
-                    dstkey,c->db->id);
-        }
-        signalModifiedKey(c->db,dstkey);
-        server.dirty++;
+        setTypeStoreResult(c,dstset,dstkey,
+            op == SET_OP_UNION ? "sunionstore" : "sdiffstore");
     }
     zfree(sets);
 }
@@ -67,13 +67,25 @@ int zslLexValueGteMin(sds value, zlexrangespec *spec);
 int zslLexValueLteMax(sds value, zlexrangespec *spec);
 
 /* Create a skiplist node with the specified number of levels.
- * The SDS string 'ele' is referenced by the node after the call. */
+ * A copy of the SDS string 'ele' is embedded in the same allocation, just
+ * after the levels, so the node needs no pointer to the element and
+ * comparing elements while walking the skiplist does not access another
+ * allocation. The caller retains the ownership of 'ele'. The header node is
+ * created with a NULL 'ele'. */
 //创建并返回一个新的跳跃表节点
 zskiplistNode *zslCreateNode(int level, double score, sds ele) {
-    zskiplistNode *zn =
-        zmalloc(sizeof(*zn)+level*sizeof(struct zskiplistLevel));
+    size_t levelsize = level*sizeof(struct zskiplistLevel);
+    size_t elesize = ele ? sdsReqSize(sdslen(ele)) : 0;
+    zskiplistNode *zn = zmalloc(sizeof(*zn)+levelsize+elesize);
+    sds embedded;
+
     zn->score = score;
-    zn->ele = ele;
+    zn->level[0].eleoffset = 0;
+    if (ele) {
+        embedded = sdsnewplacement((char*)zn->level+levelsize,
+                                   ele,sdslen(ele));
+        zn->level[0].eleoffset = embedded-(char*)zn;
+    }
     return zn;
 }
 
@@ -97,12 +109,10 @@ zskiplist *zslCreate(void) {
     return zsl;
 }
 
-/* Free the specified skiplist node. The referenced SDS string representation
- * of the element is freed too, unless node->ele is set to NULL before calling
- * this function. */
+/* Free the specified skiplist node, together with the embedded SDS string
+ * representation of the element. */
 //释放指定的跳表节点
 void zslFreeNode(zskiplistNode *node) {
-    sdsfree(node->ele);
     zfree(node);
 }
 
@@ -132,14 +142,16 @@ int zslRandomLevel(void) {
     return (level<ZSKIPLIST_MAXLEVEL) ? level : ZSKIPLIST_MAXLEVEL;
 }
 
-/* Insert a new node in the skiplist. Assumes the element does not already
- * exist (up to the caller to enforce that). The skiplist takes ownership
- * of the passed SDS string 'ele'. */
-//插入一个新节点到跳表中
-zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele) {
+/* Link the node 'node', with the specified number of levels, in the
+ * skiplist at the position of its score and element. */
+static zskiplistNode *zslInsertNode(zskiplist *zsl, zskiplistNode *node,
+                                    int level)
+{
     zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
     unsigned int rank[ZSKIPLIST_MAXLEVEL];
-    int i, level;
+    double score = node->score;
+    sds ele = zslNodeElement(node);
+    int i;
 
     serverAssert(!isnan(score));
     x = zsl->header;//头节点
@@ -152,7 +164,7 @@ zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele) {
                 (x->level[i].forward->score < score ||
 				 //对比成员字符
                     (x->level[i].forward->score == score &&
-                    sdscmp(x->level[i].forward->ele,ele) < 0)))
+                    sdscmp(zslNodeElement(x->level[i].forward),ele) < 0)))
         {
 			//记录跨域了多少个节点
             rank[i] += x->level[i].span;
@@ -165,7 +177,6 @@ zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele) {
      * scores, reinserting the same element should never happen since the
      * caller of zslInsert() should test in the hash table if the element is
      * already inside or not. */
-    level = zslRandomLevel();//生成新节点的层级
 	//zslInsert() 的调用者会确保同分值且同成员的元素不会出现，故这个里面不需要进一步检查
     if (level > zsl->level) {
         for (i = zsl->level; i < level; i++) {
@@ -176,8 +187,7 @@ zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele) {
 		//更新表中节点最大层数
         zsl->level = level;
     }
-	//创建一个新节点
-    x = zslCreateNode(level,score,ele);
+    x = node;
 	//将前面记录的指针指向新节点，并做相应的设置
     for (i = 0; i < level; i++) {
 		//设置新节点的forward指针
@@ -210,6 +220,16 @@ zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele) {
     return x;
 }
 
+/* Insert a new node in the skiplist. Assumes the element does not already
+ * exist (up to the caller to enforce that). The node stores a copy of the
+ * passed SDS string 'ele', that is still owned by the caller. */
+//插入一个新节点到跳表中
+zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele) {
+    int level = zslRandomLevel();//生成新节点的层级
+
+    return zslInsertNode(zsl,zslCreateNode(level,score,ele),level);
+}
+
 /* Internal function used by zslDelete, zslDeleteByScore and zslDeleteByRank */
 void zslDeleteNode(zskiplist *zsl, zskiplistNode *x, zskiplistNode **update) {
     int i;
@@ -238,7 +258,7 @@ void zslDeleteNode(zskiplist *zsl, zskiplistNode *x, zskiplistNode **update) {
  * If 'node' is NULL the deleted node is freed by zslFreeNode(), otherwise
  * it is not freed (but just unlinked) and *node is set to the node pointer,
  * so that it is possible for the caller to reuse the node (including the
- * referenced SDS string at node->ele). */
+ * embedded SDS string of the element). */
 int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node) {
     zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
     int i;
@@ -248,7 +268,7 @@ int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node) {
         while (x->level[i].forward &&
                 (x->level[i].forward->score < score ||
                     (x->level[i].forward->score == score &&
-                     sdscmp(x->level[i].forward->ele,ele) < 0)))
+                     sdscmp(zslNodeElement(x->level[i].forward),ele) < 0)))
         {
             x = x->level[i].forward;
         }
@@ -257,7 +277,7 @@ int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node) {
     /* We may have multiple elements with the same score, what we need
      * is to find the element with both the right score and object. */
     x = x->level[0].forward;
-    if (x && score == x->score && sdscmp(x->ele,ele) == 0) {
+    if (x && score == x->score && sdscmp(zslNodeElement(x),ele) == 0) {
         zslDeleteNode(zsl, x, update);
         if (!node)
             zslFreeNode(x);
@@ -268,6 +288,48 @@ int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node) {
     return 0; /* not found */
 }
 
+/* Update the score of an element inside the skiplist, that must exist with
+ * the score 'curscore'. The node is never reallocated: it is updated in place
+ * if the new score keeps it in the same position, otherwise it is unlinked
+ * and linked again at the new position, so the element and the score pointers
+ * stored in the dictionary of the sorted set remain valid. */
+zskiplistNode *zslUpdateScore(zskiplist *zsl, double curscore, sds ele,
+                              double newscore)
+{
+    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+    int i, level;
+
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward &&
+                (x->level[i].forward->score < curscore ||
+                    (x->level[i].forward->score == curscore &&
+                     sdscmp(zslNodeElement(x->level[i].forward),ele) < 0)))
+        {
+            x = x->level[i].forward;
+        }
+        update[i] = x;
+    }
+    x = x->level[0].forward;
+    serverAssert(x && curscore == x->score && sdscmp(zslNodeElement(x),ele) == 0);
+
+    /* If the node stays between the same neighbours just set the score. */
+    if ((x->backward == NULL || x->backward->score < newscore) &&
+        (x->level[0].forward == NULL ||
+         x->level[0].forward->score > newscore))
+    {
+        x->score = newscore;
+        return x;
+    }
+
+    /* The levels of the node are the ones where it is linked from update[]. */
+    for (level = 0; level < zsl->level; level++)
+        if (update[level]->level[level].forward != x) break;
+    zslDeleteNode(zsl,x,update);
+    x->score = newscore;
+    return zslInsertNode(zsl,x,level);
+}
+
 int zslValueGteMin(double value, zrangespec *spec) {
     return spec->minex ? (value > spec->min) : (value >= spec->min);
 }
@@ -371,8 +433,8 @@ unsigned long zslDeleteRangeByScore(zskiplist *zsl, zrangespec *range, dict *dic
     {
         zskiplistNode *next = x->level[0].forward;
         zslDeleteNode(zsl,x,update);
-        dictDelete(dict,x->ele);
-        zslFreeNode(x); /* Here is where x->ele is actually released. */
+        dictDelete(dict,zslNodeElement(x));
+        zslFreeNode(x); /* Here is where the element is actually released. */
         removed++;
         x = next;
     }
@@ -388,7 +450,7 @@ unsigned long zslDeleteRangeByLex(zskiplist *zsl, zlexrangespec *range, dict *di
     x = zsl->header;
     for (i = zsl->level-1; i >= 0; i--) {
         while (x->level[i].forward &&
-            !zslLexValueGteMin(x->level[i].forward->ele,range))
+            !zslLexValueGteMin(zslNodeElement(x->level[i].forward),range))
                 x = x->level[i].forward;
         update[i] = x;
     }
@@ -397,11 +459,11 @@ unsigned long zslDeleteRangeByLex(zskiplist *zsl, zlexrangespec *range, dict *di
     x = x->level[0].forward;
 
     /* Delete nodes while in range. */
-    while (x && zslLexValueLteMax(x->ele,range)) {
+    while (x && zslLexValueLteMax(zslNodeElement(x),range)) {
         zskiplistNode *next = x->level[0].forward;
         zslDeleteNode(zsl,x,update);
-        dictDelete(dict,x->ele);
-        zslFreeNode(x); /* Here is where x->ele is actually released. */
+        dictDelete(dict,zslNodeElement(x));
+        zslFreeNode(x); /* Here is where the element is actually released. */
         removed++;
         x = next;
     }
@@ -429,7 +491,7 @@ unsigned long zslDeleteRangeByRank(zskiplist *zsl, unsigned int start, unsigned
     while (x && traversed <= end) {
         zskiplistNode *next = x->level[0].forward;
         zslDeleteNode(zsl,x,update);
-        dictDelete(dict,x->ele);
+        dictDelete(dict,zslNodeElement(x));
         zslFreeNode(x);
         removed++;
         traversed++;
@@ -452,13 +514,13 @@ unsigned long zslGetRank(zskiplist *zsl, double score, sds ele) {
         while (x->level[i].forward &&
             (x->level[i].forward->score < score ||
                 (x->level[i].forward->score == score &&
-                sdscmp(x->level[i].forward->ele,ele) <= 0))) {
+                sdscmp(zslNodeElement(x->level[i].forward),ele) <= 0))) {
             rank += x->level[i].span;
             x = x->level[i].forward;
         }
 
-        /* x might be equal to zsl->header, so test if obj is non-NULL */
-        if (x->ele && sdscmp(x->ele,ele) == 0) {
+        /* x might be equal to zsl->header, that has no element. */
+        if (x != zsl->header && sdscmp(zslNodeElement(x),ele) == 0) {
             return rank;
         }
     }
@@ -626,10 +688,10 @@ int zslIsInLexRange(zskiplist *zsl, zlexrangespec *range) {
             (range->minex || range->maxex)))
         return 0;
     x = zsl->tail;
-    if (x == NULL || !zslLexValueGteMin(x->ele,range))
+    if (x == NULL || !zslLexValueGteMin(zslNodeElement(x),range))
         return 0;
     x = zsl->header->level[0].forward;
-    if (x == NULL || !zslLexValueLteMax(x->ele,range))
+    if (x == NULL || !zslLexValueLteMax(zslNodeElement(x),range))
         return 0;
     return 1;
 }
@@ -647,7 +709,7 @@ zskiplistNode *zslFirstInLexRange(zskiplist *zsl, zlexrangespec *range) {
     for (i = zsl->level-1; i >= 0; i--) {
         /* Go forward while *OUT* of range. */
         while (x->level[i].forward &&
-            !zslLexValueGteMin(x->level[i].forward->ele,range))
+            !zslLexValueGteMin(zslNodeElement(x->level[i].forward),range))
                 x = x->level[i].forward;
     }
 
@@ -656,7 +718,7 @@ zskiplistNode *zslFirstInLexRange(zskiplist *zsl, zlexrangespec *range) {
     serverAssert(x != NULL);
 
     /* Check if score <= max. */
-    if (!zslLexValueLteMax(x->ele,range)) return NULL;
+    if (!zslLexValueLteMax(zslNodeElement(x),range)) return NULL;
     return x;
 }
 
@@ -673,7 +735,7 @@ zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range) {
     for (i = zsl->level-1; i >= 0; i--) {
         /* Go forward while *IN* range. */
         while (x->level[i].forward &&
-            zslLexValueLteMax(x->level[i].forward->ele,range))
+            zslLexValueLteMax(zslNodeElement(x->level[i].forward),range))
                 x = x->level[i].forward;
     }
 
@@ -681,7 +743,7 @@ zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range) {
     serverAssert(x != NULL);
 
     /* Check if score >= min. */
-    if (!zslLexValueGteMin(x->ele,range)) return NULL;
+    if (!zslLexValueGteMin(zslNodeElement(x),range)) return NULL;
     return x;
 }
 
@@ -1162,18 +1224,24 @@ void zsetConvert(robj *zobj, int encoding) {
         sptr = ziplistNext(zl,eptr);
         serverAssertWithInfo(NULL,zobj,sptr != NULL);
 
+        /* The nodes copy the element, so a single scratch string is
+         * enough for the whole conversion. */
+        ele = sdsempty();
         while (eptr != NULL) {
             score = zzlGetScore(sptr);
             serverAssertWithInfo(NULL,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
-            if (vstr == NULL)
-                ele = sdsfromlonglong(vlong);
-            else
-                ele = sdsnewlen((char*)vstr,vlen);
+            if (vstr == NULL) {
+                char buf[LONG_STR_SIZE];
+                ele = sdscpylen(ele,buf,ll2string(buf,sizeof(buf),vlong));
+            } else {
+                ele = sdscpylen(ele,(char*)vstr,vlen);
+            }
 
             node = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->dict,ele,&node->score) == DICT_OK);
+            serverAssert(dictAdd(zs->dict,zslNodeElement(node),&node->score) == DICT_OK);
             zzlNext(zl,&eptr,&sptr);
         }
+        sdsfree(ele);
 
         zfree(zobj->ptr);
         zobj->ptr = zs;
@@ -1193,7 +1261,7 @@ void zsetConvert(robj *zobj, int encoding) {
         zfree(zs->zsl);
 
         while (node) {
-            zl = zzlInsertAt(zl,NULL,node->ele,node->score);
+            zl = zzlInsertAt(zl,NULL,zslNodeElement(node),node->score);
             next = node->level[0].forward;
             zslFreeNode(node);
             node = next;
@@ -1207,6 +1275,37 @@ void zsetConvert(robj *zobj, int encoding) {
     }
 }
 
+/* Return a copy of the sorted set object 'o', with the same encoding. */
+robj *zsetDup(robj *o) {
+    robj *zobj;
+
+    serverAssert(o->type == OBJ_ZSET);
+    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+        size_t size = ziplistBlobLen(o->ptr);
+        unsigned char *zl = zmalloc(size);
+
+        memcpy(zl,o->ptr,size);
+        zobj = createObject(OBJ_ZSET,zl);
+        zobj->encoding = OBJ_ENCODING_ZIPLIST;
+    } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+        zset *zs = o->ptr, *dup;
+        zskiplistNode *ln, *node;
+
+        zobj = createZsetObject();
+        dup = zobj->ptr;
+        dictExpand(dup->dict,dictSize(zs->dict));
+        /* Insert from the greatest element, so that every insertion stops
+         * at the head of the new skiplist. */
+        for (ln = zs->zsl->tail; ln != NULL; ln = ln->backward) {
+            node = zslInsert(dup->zsl,ln->score,zslNodeElement(ln));
+            dictAdd(dup->dict,zslNodeElement(node),&node->score);
+        }
+    } else {
+        serverPanic("Unknown sorted set encoding");
+    }
+    return zobj;
+}
+
 /* Convert the sorted set object into a ziplist if it is not already a ziplist
  * and if the number of elements and the maximum element size is within the
  * expected ranges. */
@@ -1363,26 +1462,17 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
                 if (newscore) *newscore = score;
             }
 
-            /* Remove and re-insert when score changes. */
+            /* Update the skiplist when the score changes. */
             if (score != curscore) {
-                zskiplistNode *node;
-                serverAssert(zslDelete(zs->zsl,curscore,ele,&node));
-                znode = zslInsert(zs->zsl,score,node->ele);
-                /* We reused the node->ele SDS string, free the node now
-                 * since zslInsert created a new one. */
-                node->ele = NULL;
-                zslFreeNode(node);
-                /* Note that we did not removed the original element from
-                 * the hash table representing the sorted set, so we just
-                 * update the score. */
-                dictGetVal(de) = &znode->score; /* Update score ptr. */
+                /* The node is reused, so the element and the score pointer
+                 * in the hash table are still valid. */
+                zslUpdateScore(zs->zsl,curscore,ele,score);
                 *flags |= ZADD_UPDATED;
             }
             return 1;
         } else if (!xx) {
-            ele = sdsdup(ele);
             znode = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+            serverAssert(dictAdd(zs->dict,zslNodeElement(znode),&znode->score) == DICT_OK);
             *flags |= ZADD_ADDED;
             if (newscore) *newscore = score;
             return 1;
@@ -1590,6 +1680,7 @@ void zaddGenericCommand(client *c, int flags) {
             addReply(c,shared.wrongtypeerr);
             goto cleanup;
         }
+        zobj = dbUnshareValue(c->db,key,zobj);
     }
 
     for (j = 0; j < elements; j++) {
@@ -1644,6 +1735,7 @@ void zremCommand(client *c) {
 
     if ((zobj = lookupKeyWriteOrReply(c,key,shared.czero)) == NULL ||
         checkType(c,zobj,OBJ_ZSET)) return;
+    zobj = dbUnshareValue(c->db,key,zobj);
 
     for (j = 2; j < c->argc; j++) {
         if (zsetDel(zobj,c->argv[j]->ptr)) deleted++;
@@ -1697,6 +1789,7 @@ void zremrangeGenericCommand(client *c, int rangetype) {
     /* Step 2: Lookup & range sanity checks if needed. */
     if ((zobj = lookupKeyWriteOrReply(c,key,shared.czero)) == NULL ||
         checkType(c,zobj,OBJ_ZSET)) goto cleanup;
+    zobj = dbUnshareValue(c->db,key,zobj);
 
     if (rangetype == ZRANGE_RANK) {
         /* Sanitize indexes. */
@@ -1785,6 +1878,7 @@ typedef struct {
     int type; /* Set, sorted set */
     int encoding;
     double weight;
+    int reverse; /* Iterate sorted sets from the highest score. */
 
     union {
         /* Set iterators. */
@@ -1798,6 +1892,7 @@ typedef struct {
                 dictIterator *di;
                 dictEntry *de;
             } ht;
+            roaringIterator ri;
         } set;
 
         /* Sorted set iterators. */
@@ -1850,8 +1945,12 @@ void zuiInitIterator(zsetopsrc *op) {
             it->is.ii = 0;
         } else if (op->encoding == OBJ_ENCODING_HT) {
             it->ht.dict = op->subject->ptr;
-            it->ht.di = dictGetIterator(op->subject->ptr);
+            /* A safe iterator, since ZUNION and ZINTER with a LIMIT look
+             * up elements in all the inputs while iterating them. */
+            it->ht.di = dictGetSafeIterator(op->subject->ptr);
             it->ht.de = dictNext(it->ht.di);
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            roaringInitIterator(op->subject->ptr,&it->ri);
         } else {
             serverPanic("Unknown set encoding");
         }
@@ -1859,14 +1958,15 @@ void zuiInitIterator(zsetopsrc *op) {
         iterzset *it = &op->iter.zset;
         if (op->encoding == OBJ_ENCODING_ZIPLIST) {
             it->zl.zl = op->subject->ptr;
-            it->zl.eptr = ziplistIndex(it->zl.zl,0);
+            it->zl.eptr = ziplistIndex(it->zl.zl,op->reverse ? -2 : 0);
             if (it->zl.eptr != NULL) {
                 it->zl.sptr = ziplistNext(it->zl.zl,it->zl.eptr);
                 serverAssert(it->zl.sptr != NULL);
             }
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             it->sl.zs = op->subject->ptr;
-            it->sl.node = it->sl.zs->zsl->header->level[0].forward;
+            it->sl.node = op->reverse ? it->sl.zs->zsl->tail :
+                          it->sl.zs->zsl->header->level[0].forward;
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1885,6 +1985,8 @@ void zuiClearIterator(zsetopsrc *op) {
             UNUSED(it); /* skip */
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dictReleaseIterator(it->ht.di);
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            UNUSED(it); /* skip */
         } else {
             serverPanic("Unknown set encoding");
         }
@@ -1912,6 +2014,8 @@ int zuiLength(zsetopsrc *op) {
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = op->subject->ptr;
             return dictSize(ht);
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            return roaringLen(op->subject->ptr);
         } else {
             serverPanic("Unknown set encoding");
         }
@@ -1953,6 +2057,13 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->is.ii++;
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            int64_t ell;
+
+            if (!roaringNext(&it->ri,&ell))
+                return 0;
+            val->ell = ell;
+            val->score = 1.0;
         } else if (op->encoding == OBJ_ENCODING_HT) {
             if (it->ht.de == NULL)
                 return 0;
@@ -1974,15 +2085,19 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
             val->score = zzlGetScore(it->zl.sptr);
 
             /* Move to next element. */
-            zzlNext(it->zl.zl,&it->zl.eptr,&it->zl.sptr);
+            if (op->reverse)
+                zzlPrev(it->zl.zl,&it->zl.eptr,&it->zl.sptr);
+            else
+                zzlNext(it->zl.zl,&it->zl.eptr,&it->zl.sptr);
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             if (it->sl.node == NULL)
                 return 0;
-            val->ele = it->sl.node->ele;
+            val->ele = zslNodeElement(it->sl.node);
             val->score = it->sl.node->score;
 
             /* Move to next element. */
-            it->sl.node = it->sl.node->level[0].forward;
+            it->sl.node = op->reverse ? it->sl.node->backward :
+                                        it->sl.node->level[0].forward;
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -2069,6 +2184,15 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             } else {
                 return 0;
             }
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            if (zuiLongLongFromValue(val) &&
+                roaringFind(op->subject->ptr,val->ell))
+            {
+                *score = 1.0;
+                return 1;
+            } else {
+                return 0;
+            }
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = op->subject->ptr;
             zuiSdsFromValue(val);
@@ -2134,51 +2258,327 @@ inline static void zunionInterAggregate(double *target, double val, int aggregat
     }
 }
 
-uint64_t dictSdsHash(const void *key);
-int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
+/* ZUNION, ZINTER and ZDIFF reply with their result ordered like ZRANGE, or
+ * like ZREVRANGE with the REV option, without creating a sorted set: the
+ * elements are collected in a zsetopresult and sorted only to emit the
+ * reply. With a LIMIT only the first 'limit' elements in reply order are
+ * kept, in a binary heap having the last of them at the root.
+ *
+ * Elements are either owned by their entry, or borrowed from the inputs or
+ * from the union accumulator, that outlive the result. */
+typedef struct {
+    sds ele;
+    double score;
+    int owned;
+} zsetopentry;
+
+typedef struct {
+    zsetopentry *entries;
+    unsigned long len, alloc;
+    unsigned long limit;    /* Max number of entries, 0 means no limit. */
+    int reverse;            /* Order like ZREVRANGE instead of ZRANGE. */
+} zsetopresult;
+
+/* Return a negative value if 'a' comes before 'b' in the reply, a positive
+ * one if it comes after. */
+static int zuiEntryCompare(const zsetopentry *a, const zsetopentry *b,
+                           int reverse)
+{
+    int cmp;
+
+    if (a->score < b->score) cmp = -1;
+    else if (a->score > b->score) cmp = 1;
+    else cmp = sdscmp(a->ele,b->ele);
+    return reverse ? -cmp : cmp;
+}
+
+static int zuiEntryCompareAsc(const void *a, const void *b) {
+    return zuiEntryCompare(a,b,0);
+}
+
+static int zuiEntryCompareDesc(const void *a, const void *b) {
+    return zuiEntryCompare(a,b,1);
+}
+
+static void zuiResultInit(zsetopresult *res, unsigned long limit, int reverse) {
+    res->entries = NULL;
+    res->len = res->alloc = 0;
+    res->limit = limit;
+    res->reverse = reverse;
+}
+
+/* Return true if the result holds 'limit' entries already: new elements
+ * are only added if they come before the last of them. */
+static int zuiResultFull(zsetopresult *res) {
+    return res->limit && res->len == res->limit;
+}
+
+/* Add 'ele' with the specified score to the result, unless the result is
+ * full and the element comes after all the ones already kept. Return 1 if
+ * the element was added: in this case the result takes the ownership of
+ * 'ele' if 'owned' is true. */
+static int zuiResultAdd(zsetopresult *res, sds ele, double score, int owned) {
+    zsetopentry e = {ele, score, owned}, *h = res->entries;
+    unsigned long j, child;
+
+    if (zuiResultFull(res)) {
+        if (zuiEntryCompare(&e,&h[0],res->reverse) >= 0) return 0;
+
+        /* Replace the root, that is the last entry, and sift it down. */
+        if (h[0].owned) sdsfree(h[0].ele);
+        j = 0;
+        while ((child = j*2+1) < res->len) {
+            if (child+1 < res->len &&
+                zuiEntryCompare(&h[child+1],&h[child],res->reverse) > 0)
+                child++;
+            if (zuiEntryCompare(&h[child],&e,res->reverse) <= 0) break;
+            h[j] = h[child];
+            j = child;
+        }
+        h[j] = e;
+        return 1;
+    }
+
+    if (res->len == res->alloc) {
+        res->alloc = res->alloc ? res->alloc*2 : 16;
+        if (res->limit && res->alloc > res->limit) res->alloc = res->limit;
+        res->entries = h = zrealloc(h,sizeof(zsetopentry)*res->alloc);
+    }
+    j = res->len++;
+    if (res->limit) {
+        /* Sift up: every entry comes before its parent. */
+        while (j > 0 && zuiEntryCompare(&h[(j-1)/2],&e,res->reverse) < 0) {
+            h[j] = h[(j-1)/2];
+            j = (j-1)/2;
+        }
+    }
+    h[j] = e;
+    return 1;
+}
+
+/* Add the element stored in 'val' to the result, see zuiResultAdd(). */
+static void zuiResultAddValue(zsetopresult *res, zsetopval *val, double score) {
+    sds ele = zuiSdsFromValue(val);
+
+    if (val->flags & OPVAL_DIRTY_SDS) {
+        /* The string was created for this value: move it to the result. */
+        if (zuiResultAdd(res,ele,score,1)) {
+            val->flags &= ~OPVAL_DIRTY_SDS;
+            val->ele = NULL;
+        }
+    } else {
+        zuiResultAdd(res,ele,score,0);
+    }
+}
+
+/* Reply with the result entries in order, then release the result. */
+static void zuiResultReply(client *c, zsetopresult *res, int withscores) {
+    unsigned long j;
 
-dictType setAccumulatorDictType = {
-    dictSdsHash,               /* hash function */
-    NULL,                      /* key dup */
-    NULL,                      /* val dup */
-    dictSdsKeyCompare,         /* key compare */
-    NULL,                      /* key destructor */
-    NULL                       /* val destructor */
-};
+    if (res->len)
+        qsort(res->entries,res->len,sizeof(zsetopentry),
+              res->reverse ? zuiEntryCompareDesc : zuiEntryCompareAsc);
+    addReplyMultiBulkLen(c,withscores ? res->len*2 : res->len);
+    for (j = 0; j < res->len; j++) {
+        zsetopentry *e = res->entries+j;
+
+        addReplyBulkCBuffer(c,e->ele,sdslen(e->ele));
+        if (withscores) addReplyDouble(c,e->score);
+        if (e->owned) sdsfree(e->ele);
+    }
+    zfree(res->entries);
+}
 
-void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
+/* Return true if the weighted scores of the input are all finite. */
+static int zuiWeightedScoresAreFinite(zsetopsrc *op) {
+    double first, last;
+
+    if (!isfinite(op->weight)) return 0;
+    if (op->type != OBJ_ZSET || zuiLength(op) == 0) return 1;
+    if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        unsigned char *zl = op->subject->ptr;
+        first = zzlGetScore(ziplistIndex(zl,1));
+        last = zzlGetScore(ziplistIndex(zl,-1));
+    } else {
+        zskiplist *zsl = ((zset*)op->subject->ptr)->zsl;
+        first = zsl->header->level[0].forward->score;
+        last = zsl->tail->score;
+    }
+    return isfinite(first*op->weight) && isfinite(last*op->weight);
+}
+
+/* ZUNION and ZINTER with a LIMIT much smaller than the inputs use the
+ * threshold algorithm: the inputs are walked in parallel in reply order,
+ * and the score of every new element is aggregated looking it up in all
+ * the inputs. An element not seen yet comes after the last element seen
+ * in each of the inputs containing it, so its score can't be better than
+ * the aggregate of those last scores: as soon as the result is full of
+ * elements better than this bound the rest of the inputs is skipped, and
+ * no accumulator with all the elements of the union is ever created.
+ *
+ * With REV the walk and the bound use negated scores, so that the inputs are
+ * always walked in ascending order, turning MIN into MAX and vice versa.
+ * The scores in the result are always computed like the other code paths.
+ *
+ * Return 0 if the algorithm can't be used, leaving the result untouched. */
+#define ZSET_TOPK_MIN_RATIO 8
+static int zuiTopK(zsetopsrc *src, long setnum, int op, int aggregate,
+                   zsetopresult *res)
+{
+    double *weight, *last, score = 0, value, bound, worst, negsum;
+    int *done, progress, present, stop = 0, hasneg, walkagg = aggregate;
+    long i, j, maxlen = 0;
+    zsetopval zval;
+    dict *seen;
+    sds ele;
+
+    if (res->limit == 0) return 0;
+    for (i = 0; i < setnum; i++) {
+        /* Infinite scores may sum up to NaN, that is turned into zero:
+         * the aggregate would no longer grow with the scores. */
+        if (!zuiWeightedScoresAreFinite(&src[i])) return 0;
+        if (zuiLength(&src[i]) > maxlen) maxlen = zuiLength(&src[i]);
+    }
+    if (res->limit > (unsigned long)maxlen/ZSET_TOPK_MIN_RATIO) return 0;
+
+    if (res->reverse && aggregate != REDIS_AGGR_SUM)
+        walkagg = aggregate == REDIS_AGGR_MIN ? REDIS_AGGR_MAX :
+                                                REDIS_AGGR_MIN;
+    weight = zmalloc(sizeof(double)*setnum);
+    last = zmalloc(sizeof(double)*setnum);
+    done = zmalloc(sizeof(int)*setnum);
+    for (i = 0; i < setnum; i++) {
+        weight[i] = res->reverse ? -src[i].weight : src[i].weight;
+        src[i].reverse = weight[i] < 0;
+        done[i] = zuiLength(&src[i]) == 0;
+        if (done[i] && op == SET_OP_INTER) stop = 1;
+        zuiInitIterator(&src[i]);
+    }
+
+    seen = dictCreate(&setDictType,NULL);
+    memset(&zval,0,sizeof(zval));
+    while (!stop) {
+        progress = 0;
+        for (i = 0; i < setnum; i++) {
+            if (done[i]) continue;
+            if (!zuiNext(&src[i],&zval)) {
+                done[i] = 1;
+                continue;
+            }
+            progress = 1;
+            last[i] = zval.score*weight[i];
+            ele = zuiSdsFromValue(&zval);
+            if (dictFind(seen,ele) != NULL) continue;
+            dictAdd(seen,sdsdup(ele),NULL);
+
+            /* Aggregate the scores in input order, like the other code
+             * paths, so that the result doesn't depend on the LIMIT. */
+            present = 0;
+            for (j = 0; j < setnum; j++) {
+                if (src[j].subject == src[i].subject) {
+                    value = zval.score;
+                } else if (!zuiFind(&src[j],&zval,&value)) {
+                    if (op == SET_OP_INTER) break;
+                    continue;
+                }
+                value *= src[j].weight;
+                if (present++ == 0)
+                    score = value;
+                else
+                    zunionInterAggregate(&score,value,aggregate);
+            }
+            if (j != setnum) continue; /* Not in every input of ZINTER. */
+            zuiResultAddValue(res,&zval,score);
+        }
+        if (!progress) break;
+        if (!zuiResultFull(res)) continue;
+
+        /* Compute the bound for the elements not seen yet. */
+        if (op == SET_OP_INTER) {
+            for (i = 0; i < setnum; i++) {
+                if (done[i]) break; /* Nothing left in the intersection. */
+                if (i == 0)
+                    bound = last[0];
+                else
+                    zunionInterAggregate(&bound,last[i],walkagg);
+            }
+            if (i != setnum) break;
+        } else {
+            /* An element of the union is in any subset of the inputs not
+             * completely walked: with SUM the lowest score is the one of
+             * the element in all the inputs with negative scores. */
+            present = hasneg = 0;
+            negsum = 0;
+            for (i = 0; i < setnum; i++) {
+                if (done[i]) continue;
+                if (present++ == 0 || last[i] < bound) bound = last[i];
+                if (last[i] < 0) {
+                    negsum += last[i];
+                    hasneg = 1;
+                }
+            }
+            if (present == 0) break;
+            if (walkagg == REDIS_AGGR_SUM && hasneg) bound = negsum;
+        }
+        worst = res->reverse ? -res->entries[0].score : res->entries[0].score;
+        if (worst < bound) break;
+    }
+    if (zval.flags & OPVAL_DIRTY_SDS) sdsfree(zval.ele);
+
+    for (i = 0; i < setnum; i++) {
+        zuiClearIterator(&src[i]);
+        src[i].reverse = 0;
+    }
+    dictRelease(seen);
+    zfree(weight);
+    zfree(last);
+    zfree(done);
+    return 1;
+}
+
+/* Implements ZUNIONSTORE, ZINTERSTORE and ZDIFFSTORE when 'dstkey' is not
+ * NULL, otherwise ZUNION, ZINTER and ZDIFF. The number of input keys is at
+ * 'numkeysIndex', followed by the keys and the options. */
+void zunionInterDiffGenericCommand(client *c, robj *dstkey, int numkeysIndex,
+                                   int op)
+{
     int i, j;
-    long setnum;
+    long setnum, limit = 0;
     int aggregate = REDIS_AGGR_SUM;
+    int withscores = 0, reverse = 0;
     zsetopsrc *src;
     zsetopval zval;
+    zsetopresult res;
     sds tmp;
     unsigned int maxelelen = 0;
-    robj *dstobj;
-    zset *dstzset;
+    robj *dstobj = NULL;
+    zset *dstzset = NULL;
     zskiplistNode *znode;
+    dict *accumulator = NULL;
     int touched = 0;
 
     /* expect setnum input keys to be given */
-    if ((getLongFromObjectOrReply(c, c->argv[2], &setnum, NULL) != C_OK))
+    if ((getLongFromObjectOrReply(c, c->argv[numkeysIndex], &setnum, NULL) != C_OK))
         return;
 
     if (setnum < 1) {
-        addReplyError(c,
-            "at least 1 input key is needed for ZUNIONSTORE/ZINTERSTORE");
+        addReplyErrorFormat(c,
+            "at least 1 input key is needed for %s", c->cmd->name);
         return;
     }
 
     /* test if the expected number of keys would overflow */
-    if (setnum > c->argc-3) {
+    if (setnum > c->argc-(numkeysIndex+1)) {
         addReply(c,shared.syntaxerr);
         return;
     }
 
     /* read keys to be used for input */
     src = zcalloc(sizeof(zsetopsrc) * setnum);
-    for (i = 0, j = 3; i < setnum; i++, j++) {
-        robj *obj = lookupKeyWrite(c->db,c->argv[j]);
+    for (i = 0, j = numkeysIndex+1; i < setnum; i++, j++) {
+        robj *obj = dstkey ?
+            lookupKeyWrite(c->db,c->argv[j]) :
+            lookupKeyRead(c->db,c->argv[j]);
         if (obj != NULL) {
             if (obj->type != OBJ_ZSET && obj->type != OBJ_SET) {
                 zfree(src);
@@ -2202,7 +2602,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
         int remaining = c->argc - j;
 
         while (remaining) {
-            if (remaining >= (setnum + 1) &&
+            if (op != SET_OP_DIFF && remaining >= (setnum + 1) &&
                 !strcasecmp(c->argv[j]->ptr,"weights"))
             {
                 j++; remaining--;
@@ -2214,7 +2614,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                         return;
                     }
                 }
-            } else if (remaining >= 2 &&
+            } else if (op != SET_OP_DIFF && remaining >= 2 &&
                        !strcasecmp(c->argv[j]->ptr,"aggregate"))
             {
                 j++; remaining--;
@@ -2230,6 +2630,30 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                     return;
                 }
                 j++; remaining--;
+            } else if (!dstkey &&
+                       !strcasecmp(c->argv[j]->ptr,"withscores"))
+            {
+                j++; remaining--;
+                withscores = 1;
+            } else if (!dstkey && !strcasecmp(c->argv[j]->ptr,"rev")) {
+                j++; remaining--;
+                reverse = 1;
+            } else if (!dstkey && remaining >= 2 &&
+                       !strcasecmp(c->argv[j]->ptr,"limit"))
+            {
+                j++; remaining--;
+                if (getLongFromObjectOrReply(c,c->argv[j],&limit,NULL)
+                    != C_OK)
+                {
+                    zfree(src);
+                    return;
+                }
+                if (limit < 0) {
+                    zfree(src);
+                    addReplyError(c,"LIMIT can't be negative");
+                    return;
+                }
+                j++; remaining--;
             } else {
                 zfree(src);
                 addReply(c,shared.syntaxerr);
@@ -2239,14 +2663,53 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
     }
 
     /* sort sets from the smallest to largest, this will improve our
-     * algorithm's performance */
-    qsort(src,setnum,sizeof(zsetopsrc),zuiCompareByCardinality);
+     * algorithm's performance. The first input of ZDIFF is the one the
+     * other inputs are subtracted from, so it must stay in place. */
+    if (op != SET_OP_DIFF)
+        qsort(src,setnum,sizeof(zsetopsrc),zuiCompareByCardinality);
 
-    dstobj = createZsetObject();
-    dstzset = dstobj->ptr;
     memset(&zval, 0, sizeof(zval));
 
-    if (op == SET_OP_INTER) {
+    if (op == SET_OP_DIFF && !dstkey && src[0].type == OBJ_ZSET) {
+        /* The first input is walked in reply order, so the elements not in
+         * the other inputs are streamed to the client as they are found. */
+        void *replylen = addDeferredMultiBulkLength(c);
+        long added = 0;
+        double value;
+
+        src[0].reverse = reverse;
+        zuiInitIterator(&src[0]);
+        while ((!limit || added < limit) && zuiNext(&src[0],&zval)) {
+            for (j = 1; j < setnum; j++) {
+                if (src[j].subject == src[0].subject ||
+                    zuiFind(&src[j],&zval,&value)) break;
+            }
+            if (j == setnum) {
+                zuiBufferFromValue(&zval);
+                addReplyBulkCBuffer(c,zval.estr,zval.elen);
+                if (withscores) addReplyDouble(c,zval.score);
+                added++;
+            }
+        }
+        zuiClearIterator(&src[0]);
+        if (zval.flags & OPVAL_DIRTY_SDS) sdsfree(zval.ele);
+        setDeferredMultiBulkLength(c,replylen,withscores ? added*2 : added);
+        zfree(src);
+        return;
+    }
+
+    if (dstkey) {
+        dstobj = createZsetObject();
+        dstzset = dstobj->ptr;
+    } else {
+        zuiResultInit(&res,limit,reverse);
+    }
+
+    if (!dstkey && op != SET_OP_DIFF &&
+        zuiTopK(src,setnum,op,aggregate,&res))
+    {
+        /* The result is already computed. */
+    } else if (op == SET_OP_INTER) {
         /* Skip everything if the smallest input is empty. */
         if (zuiLength(&src[0]) > 0) {
             /* Precondition: as src[0] is non-empty and the inputs are ordered
@@ -2273,21 +2736,26 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 }
 
                 /* Only continue when present in every input. */
-                if (j == setnum) {
-                    tmp = zuiNewSdsFromValue(&zval);
+                if (j == setnum && !dstkey) {
+                    zuiResultAddValue(&res,&zval,score);
+                } else if (j == setnum) {
+                    tmp = zuiSdsFromValue(&zval);
                     znode = zslInsert(dstzset->zsl,score,tmp);
-                    dictAdd(dstzset->dict,tmp,&znode->score);
+                    dictAdd(dstzset->dict,zslNodeElement(znode),&znode->score);
                     if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
                 }
             }
             zuiClearIterator(&src[0]);
         }
     } else if (op == SET_OP_UNION) {
-        dict *accumulator = dictCreate(&setAccumulatorDictType,NULL);
         dictIterator *di;
         dictEntry *de, *existing;
         double score;
 
+        /* The elements are freed with the accumulator. Without a
+         * destination key this happens after the reply is emitted, since
+         * the result references them. */
+        accumulator = dictCreate(&setDictType,NULL);
         if (setnum) {
             /* Our union is at least as large as the largest set.
              * Resize the dictionary ASAP to avoid useless rehashing. */
@@ -2330,26 +2798,63 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
             zuiClearIterator(&src[i]);
         }
 
-        /* Step 2: convert the dictionary into the final sorted set. */
+        /* Step 2: convert the dictionary into the final sorted set, or
+         * collect the elements to reply with. */
         di = dictGetIterator(accumulator);
 
         /* We now are aware of the final size of the resulting sorted set,
          * let's resize the dictionary embedded inside the sorted set to the
          * right size, in order to save rehashing time. */
-        dictExpand(dstzset->dict,dictSize(accumulator));
+        if (dstkey) dictExpand(dstzset->dict,dictSize(accumulator));
 
         while((de = dictNext(di)) != NULL) {
             sds ele = dictGetKey(de);
             score = dictGetDoubleVal(de);
+            if (!dstkey) {
+                zuiResultAdd(&res,ele,score,0);
+                continue;
+            }
             znode = zslInsert(dstzset->zsl,score,ele);
-            dictAdd(dstzset->dict,ele,&znode->score);
+            dictAdd(dstzset->dict,zslNodeElement(znode),&znode->score);
         }
         dictReleaseIterator(di);
-        dictRelease(accumulator);
+        if (dstkey) dictRelease(accumulator);
+    } else if (op == SET_OP_DIFF) {
+        if (zuiLength(&src[0]) > 0) {
+            zuiInitIterator(&src[0]);
+            while (zuiNext(&src[0],&zval)) {
+                double value;
+
+                for (j = 1; j < setnum; j++) {
+                    /* It is not safe to access the zset we are
+                     * iterating, so explicitly check for equal object. */
+                    if (src[j].subject == src[0].subject ||
+                        zuiFind(&src[j],&zval,&value)) break;
+                }
+
+                /* Only continue when missing from all the other inputs. */
+                if (j == setnum && !dstkey) {
+                    zuiResultAddValue(&res,&zval,zval.score);
+                } else if (j == setnum) {
+                    tmp = zuiSdsFromValue(&zval);
+                    znode = zslInsert(dstzset->zsl,zval.score,tmp);
+                    dictAdd(dstzset->dict,zslNodeElement(znode),&znode->score);
+                    if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
+                }
+            }
+            zuiClearIterator(&src[0]);
+        }
     } else {
         serverPanic("Unknown operator");
     }
 
+    if (!dstkey) {
+        zuiResultReply(c,&res,withscores);
+        if (accumulator) dictRelease(accumulator);
+        zfree(src);
+        return;
+    }
+
     if (dbDelete(c->db,dstkey))
         touched = 1;
     if (dstzset->zsl->length) {
@@ -2358,7 +2863,8 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
         addReplyLongLong(c,zsetLength(dstobj));
         signalModifiedKey(c->db,dstkey);
         notifyKeyspaceEvent(NOTIFY_ZSET,
-            (op == SET_OP_UNION) ? "zunionstore" : "zinterstore",
+            (op == SET_OP_UNION) ? "zunionstore" :
+            (op == SET_OP_INTER) ? "zinterstore" : "zdiffstore",
             dstkey,c->db->id);
         server.dirty++;
     } else {
@@ -2374,11 +2880,27 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
 }
 
 void zunionstoreCommand(client *c) {
-    zunionInterGenericCommand(c,c->argv[1], SET_OP_UNION);
+    zunionInterDiffGenericCommand(c,c->argv[1],2,SET_OP_UNION);
 }
 
 void zinterstoreCommand(client *c) {
-    zunionInterGenericCommand(c,c->argv[1], SET_OP_INTER);
+    zunionInterDiffGenericCommand(c,c->argv[1],2,SET_OP_INTER);
+}
+
+void zdiffstoreCommand(client *c) {
+    zunionInterDiffGenericCommand(c,c->argv[1],2,SET_OP_DIFF);
+}
+
+void zunionCommand(client *c) {
+    zunionInterDiffGenericCommand(c,NULL,1,SET_OP_UNION);
+}
+
+void zinterCommand(client *c) {
+    zunionInterDiffGenericCommand(c,NULL,1,SET_OP_INTER);
+}
+
+void zdiffCommand(client *c) {
+    zunionInterDiffGenericCommand(c,NULL,1,SET_OP_DIFF);
 }
 
 void zrangeGenericCommand(client *c, int reverse) {
@@ -2472,7 +2994,7 @@ void zrangeGenericCommand(client *c, int reverse) {
 
         while(rangelen--) {
             serverAssertWithInfo(c,zobj,ln != NULL);
-            ele = ln->ele;
+            ele = zslNodeElement(ln);
             addReplyBulkCBuffer(c,ele,sdslen(ele));
             if (withscores)
                 addReplyDouble(c,ln->score);
@@ -2659,7 +3181,7 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
             }
 
             rangelen++;
-            addReplyBulkCBuffer(c,ln->ele,sdslen(ln->ele));
+            addReplyBulkCBuffer(c,zslNodeElement(ln),sdslen(zslNodeElement(ln)));
 
             if (withscores) {
                 addReplyDouble(c,ln->score);
@@ -2749,7 +3271,7 @@ void zcountCommand(client *c) {
 
         /* Use rank of first element, if any, to determine preliminary count */
         if (zn != NULL) {
-            rank = zslGetRank(zsl, zn->score, zn->ele);
+            rank = zslGetRank(zsl, zn->score, zslNodeElement(zn));
             count = (zsl->length - (rank - 1));
 
             /* Find last element in range */
@@ -2757,7 +3279,7 @@ void zcountCommand(client *c) {
 
             /* Use rank of last element, if any, to determine the actual count */
             if (zn != NULL) {
-                rank = zslGetRank(zsl, zn->score, zn->ele);
+                rank = zslGetRank(zsl, zn->score, zslNodeElement(zn));
                 count -= (zsl->length - rank);
             }
         }
@@ -2827,7 +3349,7 @@ void zlexcountCommand(client *c) {
 
         /* Use rank of first element, if any, to determine preliminary count */
         if (zn != NULL) {
-            rank = zslGetRank(zsl, zn->score, zn->ele);
+            rank = zslGetRank(zsl, zn->score, zslNodeElement(zn));
             count = (zsl->length - (rank - 1));
 
             /* Find last element in range */
@@ -2835,7 +3357,7 @@ void zlexcountCommand(client *c) {
 
             /* Use rank of last element, if any, to determine the actual count */
             if (zn != NULL) {
-                rank = zslGetRank(zsl, zn->score, zn->ele);
+                rank = zslGetRank(zsl, zn->score, zslNodeElement(zn));
                 count -= (zsl->length - rank);
             }
         }
@@ -3001,13 +3523,13 @@ void genericZrangebylexCommand(client *c, int reverse) {
         while (ln && limit--) {
             /* Abort when the node is no longer in range. */
             if (reverse) {
-                if (!zslLexValueGteMin(ln->ele,&range)) break;
+                if (!zslLexValueGteMin(zslNodeElement(ln),&range)) break;
             } else {
-                if (!zslLexValueLteMax(ln->ele,&range)) break;
+                if (!zslLexValueLteMax(zslNodeElement(ln),&range)) break;
             }
 
             rangelen++;
-            addReplyBulkCBuffer(c,ln->ele,sdslen(ln->ele));
+            addReplyBulkCBuffer(c,zslNodeElement(ln),sdslen(zslNodeElement(ln)));
 
             /* Move to next node */
             if (reverse) {
@@ -1121,7 +1121,13 @@ unsigned char *ziplistFind(unsigned char *p, unsigned char *vstr, unsigned int v
         if (skipcnt == 0) {
             /* Compare current entry with specified entry */
             if (ZIP_IS_STR(encoding)) {
-                if (len == vlen && memcmp(q, vstr, vlen) == 0) {
+                /* Check the last byte before calling memcmp(): fields of
+                 * the same length often share a prefix, like "user:1000"
+                 * and "user:1001". */
+                if (len == vlen && (vlen == 0 ||
+                    (q[vlen-1] == vstr[vlen-1] &&
+                     memcmp(q, vstr, vlen) == 0)))
+                {
                     return p;
                 }
             } else {
@@ -1927,6 +1933,36 @@ int ziplistTest(int argc, char **argv) {
         stress(ZIPLIST_TAIL,100000,16384,256);
     }
 
+    printf("Benchmark ziplistFind on field/value pairs:\n");
+    {
+        int sizes[] = {8,32,128,512}, i, j, num = 200000, qlen[1024];
+        char buf[32], query[1024][32];
+
+        for (i = 0; i < 4; i++) {
+            long long start, found = 0;
+            zl = ziplistNew();
+            for (j = 0; j < sizes[i]; j++) {
+                int len = snprintf(buf,sizeof(buf),"field:%d",j);
+                zl = ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+                len = snprintf(buf,sizeof(buf),"value:%d",j);
+                zl = ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+            }
+            /* One every four lookups is a miss. */
+            for (j = 0; j < 1024; j++)
+                qlen[j] = snprintf(query[j],sizeof(query[j]),"field:%d",
+                    rand() % (sizes[i]+sizes[i]/3));
+            start = usec();
+            for (j = 0; j < num; j++) {
+                p = ziplistIndex(zl,ZIPLIST_HEAD);
+                if (ziplistFind(p,(unsigned char*)query[j&1023],
+                                qlen[j&1023],1)) found++;
+            }
+            printf("%4d pairs: %.1f ns per lookup (%lld found)\n",
+                sizes[i],(double)(usec()-start)*1000/num,found);
+            zfree(zl);
+        }
+    }
+
     return 0;
 }
 #endif
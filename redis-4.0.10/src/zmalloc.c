@@ -28,6 +28,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "fmacros.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -40,6 +41,7 @@ void zlibc_free(void *ptr) {
 }
 
 #include <string.h>
+#include <stdint.h>
 #include <pthread.h>
 #include "config.h"
 #include "zmalloc.h"
@@ -61,15 +63,30 @@ void zlibc_free(void *ptr) {
 #define calloc(count,size) tc_calloc(count,size)
 #define realloc(ptr,size) tc_realloc(ptr,size)
 #define free(ptr) tc_free(ptr)
+#define posix_memalign(ptr,align,size) tc_posix_memalign(ptr,align,size)
 #elif defined(USE_JEMALLOC)
 #define malloc(size) je_malloc(size)
 #define calloc(count,size) je_calloc(count,size)
 #define realloc(ptr,size) je_realloc(ptr,size)
 #define free(ptr) je_free(ptr)
+#define posix_memalign(ptr,align,size) je_posix_memalign(ptr,align,size)
 #define mallocx(size,flags) je_mallocx(size,flags)
 #define dallocx(ptr,flags) je_dallocx(ptr,flags)
 #endif
 
+/* Allocations served by the huge pages arena, see zmalloc_set_hugepages(). */
+#if defined(USE_JEMALLOC)
+#include <sys/mman.h>
+static unsigned zmalloc_huge_arena = 0;     /* Arena index, 0 if not created. */
+static int zmalloc_huge_on = 0;
+#define use_huge(size) (zmalloc_huge_on && (size) >= ZMALLOC_HUGE_MIN)
+#define huge_malloc(size) je_mallocx(size, \
+    MALLOCX_ARENA(zmalloc_huge_arena)|MALLOCX_TCACHE_NONE)
+#else
+#define use_huge(size) ((void)(size),0)
+#define huge_malloc(size) NULL
+#endif
+
 #define update_zmalloc_stat_alloc(__n) do { \
     size_t _n = (__n); \
     if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
@@ -181,6 +198,12 @@ size_t zmalloc_size(void *ptr) {
     if (size&(sizeof(long)-1)) size += sizeof(long)-(size&(sizeof(long)-1));
     return size+PREFIX_SIZE;
 }
+
+/* Return the number of bytes the caller can use in the allocation, that is
+ * just the requested size since the real one is unknown. */
+size_t zmalloc_usable(void *ptr) {
+    return *((size_t*)((char*)ptr-PREFIX_SIZE));
+}
 #endif
 
 void zfree(void *ptr) {
@@ -219,6 +242,334 @@ void zmalloc_set_oom_handler(void (*oom_handler)(size_t)) {
     zmalloc_oom_handler = oom_handler;
 }
 
+/* ------------------------- Huge pages layout -----------------------------
+ * Large values, like big strings, are long lived and rarely written. The
+ * code allocating them uses zmalloc_huge(): with the huge pages layout
+ * enabled, allocations of at least ZMALLOC_HUGE_MIN bytes are served by a
+ * dedicated jemalloc arena whose chunks (2MB, aligned to their size) are
+ * madvise()d with MADV_HUGEPAGE. With the kernel transparent huge pages set
+ * to "madvise" only this memory is backed by huge pages, saving TLB misses
+ * on large datasets, while the rest of the memory stays in normal pages and
+ * doesn't make the copy on write after fork() copy 2MB for every write.
+ *
+ * The size alone is not enough to choose: dict tables are large too, but
+ * every insertion and deletion of a key writes them, and rehashing rewrites
+ * them completely, so they are allocated with zmalloc() like the rest.
+ * ------------------------------------------------------------------------- */
+
+/* Like zmalloc(), for allocations that are long lived and rarely written.
+ * The memory is released with zfree() and can be resized with zrealloc(),
+ * that may move it out of the huge pages arena. */
+void *zmalloc_huge(size_t size) {
+    void *ptr;
+
+    if (!use_huge(size)) return zmalloc(size);
+    ptr = huge_malloc(size);
+    if (!ptr) zmalloc_oom_handler(size);
+    update_zmalloc_stat_alloc(zmalloc_size(ptr));
+    return ptr;
+}
+
+/* Return 1 if zmalloc_huge(size) would allocate from the huge pages arena,
+ * so that callers can skip work that is only worth it in that case. */
+int zmalloc_huge_enabled(size_t size) {
+    return use_huge(size);
+}
+
+#if defined(USE_JEMALLOC)
+static chunk_alloc_t *zmalloc_default_chunk_alloc;
+
+static void *zmallocHugeChunkAlloc(void *new_addr, size_t size,
+    size_t alignment, bool *zero, bool *commit, unsigned arena_ind)
+{
+    void *chunk = zmalloc_default_chunk_alloc(new_addr,size,alignment,
+                                              zero,commit,arena_ind);
+#ifdef MADV_HUGEPAGE
+    if (chunk) madvise(chunk,size,MADV_HUGEPAGE);
+#endif
+    return chunk;
+}
+
+/* Enable or disable the huge pages layout for the next allocations. The
+ * arena is created the first time the layout is enabled. Returns 0 on
+ * success, -1 if the allocator doesn't support it. */
+int zmalloc_set_hugepages(int enable) {
+    if (enable && !zmalloc_huge_arena) {
+        unsigned arena;
+        size_t sz = sizeof(arena), hsz = sizeof(chunk_hooks_t);
+        chunk_hooks_t hooks;
+        char name[64];
+
+        if (je_mallctl("arenas.extend",&arena,&sz,NULL,0)) return -1;
+        snprintf(name,sizeof(name),"arena.%u.chunk_hooks",arena);
+        if (je_mallctl(name,&hooks,&hsz,NULL,0)) return -1;
+        zmalloc_default_chunk_alloc = hooks.alloc;
+        hooks.alloc = zmallocHugeChunkAlloc;
+        if (je_mallctl(name,NULL,NULL,&hooks,hsz)) return -1;
+        zmalloc_huge_arena = arena;
+    }
+    zmalloc_huge_on = enable;
+    return 0;
+}
+
+/* Bytes allocated from the huge pages arena. */
+size_t zmalloc_hugepages_allocated(void) {
+    const char *classes[] = {"small","large","huge"};
+    size_t allocated = 0, bytes, sz = sizeof(bytes), epoch = 1;
+    char name[64];
+    int j;
+
+    if (!zmalloc_huge_arena) return 0;
+    /* Update the statistics cached by mallctl. */
+    je_mallctl("epoch",&epoch,&sz,&epoch,sz);
+    for (j = 0; j < 3; j++) {
+        snprintf(name,sizeof(name),"stats.arenas.%u.%s.allocated",
+            zmalloc_huge_arena,classes[j]);
+        if (je_mallctl(name,&bytes,&sz,NULL,0) == 0) allocated += bytes;
+    }
+    return allocated;
+}
+#else
+int zmalloc_set_hugepages(int enable) {
+    return enable ? -1 : 0;
+}
+
+size_t zmalloc_hugepages_allocated(void) {
+    return 0;
+}
+#endif
+
+/* ----------------------------- Slab allocator -----------------------------
+ * Small fixed size structures allocated in large numbers (dict entries,
+ * objects, list nodes) are served by slabs: pages of ZSLAB_PAGE_SIZE bytes,
+ * aligned to their size, split into slots of the slab object size. The page
+ * header is found by masking the object address, so objects have no
+ * allocator overhead and no size class rounding, and zslab_free() doesn't
+ * need to know the slab the object belongs to.
+ *
+ * The pages with free slots are kept in ZSLAB_BUCKETS lists by usage, and
+ * objects are allocated from a page of the fullest bucket, so that the
+ * sparse pages are likely to get emptied and returned to the allocator.
+ * With jemalloc the active defragger also moves the objects of the sparse
+ * pages to the fullest ones, see zslab_defrag(). Other allocators don't
+ * support active defrag, so the pages are only reclaimed as they empty.
+ *
+ * Slabs are declared statically with ZSLAB_INIT() by the code using them,
+ * and join the list of all the slabs, used for stats, on first use.
+ * ------------------------------------------------------------------------- */
+
+struct zslabPage {
+    zslab *slab;
+    zslabPage *prev, *next;     /* Links in the bucket while not full. */
+    void *free;                 /* List of the released slots. */
+    unsigned int used;          /* Slots allocated. */
+    unsigned int fresh;         /* Slots never allocated start here. */
+    unsigned int slots;         /* Total slots in the page. */
+    unsigned int bucket;        /* Bucket of slab->pages the page is in. */
+};
+
+#define ZSLAB_HDR_SIZE ((sizeof(zslabPage)+15) & ~(size_t)15)
+#define ZSLAB_PAGE(ptr) \
+    ((zslabPage*)((uintptr_t)(ptr) & ~(uintptr_t)(ZSLAB_PAGE_SIZE-1)))
+#define ZSLAB_FULL(p) ((p)->free == NULL && (p)->fresh == (p)->slots)
+
+static zslab *zslabs = NULL;
+static pthread_mutex_t zslabs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The slab locks must not be held by other threads (lazy free) when the
+ * process forks, or the child could deadlock allocating. */
+static void zslabAtForkPrepare(void) {
+    zslab *s;
+
+    pthread_mutex_lock(&zslabs_mutex);
+    for (s = zslabs; s; s = s->next) pthread_mutex_lock(&s->lock);
+}
+
+static void zslabAtForkRelease(void) {
+    zslab *s;
+
+    for (s = zslabs; s; s = s->next) pthread_mutex_unlock(&s->lock);
+    pthread_mutex_unlock(&zslabs_mutex);
+}
+
+static void zslabRegister(zslab *s) {
+    pthread_mutex_lock(&zslabs_mutex);
+    if (!s->registered) {
+        if (zslabs == NULL)
+            pthread_atfork(zslabAtForkPrepare,zslabAtForkRelease,
+                           zslabAtForkRelease);
+        s->next = zslabs;
+        zslabs = s;
+        s->registered = 1;
+    }
+    pthread_mutex_unlock(&zslabs_mutex);
+}
+
+static void zslabLink(zslab *s, zslabPage *p) {
+    p->bucket = (size_t)p->used*ZSLAB_BUCKETS/p->slots;
+    p->prev = NULL;
+    p->next = s->pages[p->bucket];
+    if (p->next) p->next->prev = p;
+    s->pages[p->bucket] = p;
+}
+
+static void zslabUnlink(zslab *s, zslabPage *p) {
+    if (p->prev) p->prev->next = p->next;
+    else s->pages[p->bucket] = p->next;
+    if (p->next) p->next->prev = p->prev;
+}
+
+/* Move the page 'p', that was not full, to the bucket matching its usage
+ * after a slot was taken or released. */
+static void zslabUpdate(zslab *s, zslabPage *p) {
+    if ((size_t)p->used*ZSLAB_BUCKETS/p->slots == p->bucket) return;
+    zslabUnlink(s,p);
+    zslabLink(s,p);
+}
+
+/* Return a page of the fullest bucket, or NULL if all the pages are full. */
+static zslabPage *zslabFullest(zslab *s) {
+    int j;
+
+    for (j = ZSLAB_BUCKETS-1; j >= 0; j--)
+        if (s->pages[j]) return s->pages[j];
+    return NULL;
+}
+
+static zslabPage *zslabNewPage(zslab *s) {
+    zslabPage *p;
+
+    if (s->spare) {
+        p = s->spare;
+        s->spare = NULL;
+    } else {
+        void *mem;
+
+        if (posix_memalign(&mem,ZSLAB_PAGE_SIZE,ZSLAB_PAGE_SIZE) != 0)
+            zmalloc_oom_handler(ZSLAB_PAGE_SIZE);
+        update_zmalloc_stat_alloc(ZSLAB_PAGE_SIZE);
+        p = mem;
+        p->slab = s;
+        p->slots = (ZSLAB_PAGE_SIZE-ZSLAB_HDR_SIZE)/s->size;
+        s->npages++;
+    }
+    p->free = NULL;
+    p->used = 0;
+    p->fresh = 0;
+    zslabLink(s,p);
+    return p;
+}
+
+/* Take a slot from the page 'p', that must have free slots. */
+static void *zslabTake(zslab *s, zslabPage *p) {
+    void *ptr;
+
+    if (p->free) {
+        ptr = p->free;
+        p->free = *(void**)ptr;
+    } else {
+        ptr = (char*)p+ZSLAB_HDR_SIZE+(size_t)p->fresh++*s->size;
+    }
+    p->used++;
+    s->used++;
+    if (ZSLAB_FULL(p)) zslabUnlink(s,p);
+    else zslabUpdate(s,p);
+    return ptr;
+}
+
+static void zslabRelease(zslab *s, zslabPage *p, void *ptr) {
+    int wasfull = ZSLAB_FULL(p);
+
+    *(void**)ptr = p->free;
+    p->free = ptr;
+    p->used--;
+    s->used--;
+    if (p->used == 0) {
+        /* Keep a single empty page around, return the others. */
+        if (!wasfull) zslabUnlink(s,p);
+        if (s->spare == NULL) {
+            s->spare = p;
+        } else {
+            s->npages--;
+            update_zmalloc_stat_free(ZSLAB_PAGE_SIZE);
+            free(p);
+        }
+    } else if (wasfull) {
+        zslabLink(s,p);
+    } else {
+        zslabUpdate(s,p);
+    }
+}
+
+void *zslab_malloc(zslab *s) {
+    zslabPage *p;
+    void *ptr;
+
+    if (!s->registered) zslabRegister(s);
+    pthread_mutex_lock(&s->lock);
+    if ((p = zslabFullest(s)) == NULL) p = zslabNewPage(s);
+    ptr = zslabTake(s,p);
+    pthread_mutex_unlock(&s->lock);
+    return ptr;
+}
+
+void zslab_free(void *ptr) {
+    zslabPage *p;
+    zslab *s;
+
+    if (ptr == NULL) return;
+    p = ZSLAB_PAGE(ptr);
+    s = p->slab;
+    pthread_mutex_lock(&s->lock);
+    zslabRelease(s,p,ptr);
+    pthread_mutex_unlock(&s->lock);
+}
+
+size_t zslab_size(void *ptr) {
+    return ZSLAB_PAGE(ptr)->slab->size;
+}
+
+/* Move the object to a page of the fullest bucket of its slab if its page
+ * is used less than the average of the slab, so that sparse pages get
+ * emptied and returned. Nothing is moved if the 'defrag' flag of the slab
+ * is clear. Returns the new address, or NULL if the object was not moved,
+ * in which case the old pointer is still valid. */
+void *zslab_defrag(void *ptr) {
+    zslabPage *p = ZSLAB_PAGE(ptr), *dst;
+    zslab *s = p->slab;
+    void *newptr = NULL;
+
+    if (!s->defrag) return NULL;
+    pthread_mutex_lock(&s->lock);
+    dst = zslabFullest(s);
+    if (dst == p) dst = p->next;
+    if (!ZSLAB_FULL(p) && dst && dst->used >= p->used &&
+        (size_t)p->used*(s->npages-(s->spare != NULL)) < s->used)
+    {
+        newptr = zslabTake(s,dst);
+        memcpy(newptr,ptr,s->size);
+        zslabRelease(s,p,ptr);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return newptr;
+}
+
+/* Return the first slab in the list of the slabs in use, the others follow
+ * in the 'next' field. */
+zslab *zslab_list(void) {
+    return zslabs;
+}
+
+/* Bytes in slab pages not used by objects: free slots and page headers. */
+size_t zslab_unused_memory(void) {
+    size_t unused = 0;
+    zslab *s;
+
+    for (s = zslabs; s; s = s->next)
+        unused += s->npages*ZSLAB_PAGE_SIZE - s->used*s->size;
+    return unused;
+}
+
 /* Get the RSS information in an OS-specific way.
  *
  * WARNING: the function zmalloc_get_rss() is not designed to be fast
@@ -352,6 +703,31 @@ size_t zmalloc_get_private_dirty(long pid) {
     return zmalloc_get_smap_bytes_by_field("Private_Dirty:",pid);
 }
 
+/* Size of the page tables of the process, in bytes. It grows with the
+ * memory mapped in normal pages, so together with the anonymous huge pages
+ * it tells how well the TLB covers the dataset. */
+#if defined(HAVE_PROC_STAT)
+size_t zmalloc_get_page_tables_size(void) {
+    char line[256];
+    size_t bytes = 0;
+    FILE *fp = fopen("/proc/self/status","r");
+
+    if (!fp) return 0;
+    while(fgets(line,sizeof(line),fp) != NULL) {
+        if (strncmp(line,"VmPTE:",6) == 0) {
+            bytes = strtol(line+6,NULL,10) * 1024;
+            break;
+        }
+    }
+    fclose(fp);
+    return bytes;
+}
+#else
+size_t zmalloc_get_page_tables_size(void) {
+    return 0;
+}
+#endif
+
 /* Returns the size of physical memory (RAM) in bytes.
  * It looks ugly, but this is the cleanest way to achive cross platform results.
  * Cleaned up from:
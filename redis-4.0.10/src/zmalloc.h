@@ -35,6 +35,9 @@
 #define __xstr(s) __str(s)
 #define __str(s) #s
 
+#include <stddef.h>
+#include <pthread.h>
+
 //使用tcmalloc作为内存分配器,tcmalloc是google推出的内存分配器
 #if defined(USE_TCMALLOC)
 #define ZMALLOC_LIB ("tcmalloc-" __xstr(TC_VERSION_MAJOR) "." __xstr(TC_VERSION_MINOR))
@@ -94,8 +97,51 @@ void zfree_no_tcache(void *ptr);
 void *zmalloc_no_tcache(size_t size);
 #endif
 
+/* Huge pages layout, see zmalloc.c. */
+#define ZMALLOC_HUGE_MIN (64*1024)
+void *zmalloc_huge(size_t size);
+int zmalloc_huge_enabled(size_t size);
+int zmalloc_set_hugepages(int enable);
+size_t zmalloc_hugepages_allocated(void);
+size_t zmalloc_get_page_tables_size(void);
+
+/* Slab allocator for fixed size objects, see zmalloc.c. */
+#define ZSLAB_PAGE_SIZE 4096
+#define ZSLAB_BUCKETS 8
+
+typedef struct zslabPage zslabPage;
+
+typedef struct zslab {
+    const char *name;       /* Name reported in MEMORY STATS. */
+    size_t size;            /* Size of every object. */
+    zslabPage *pages[ZSLAB_BUCKETS]; /* Pages with free slots by usage, the
+                               fullest ones in the last bucket. */
+    zslabPage *spare;       /* Empty page kept to avoid page churn. */
+    size_t used;            /* Objects allocated. */
+    size_t npages;          /* Pages allocated, including the spare one. */
+    int registered;         /* Already in the list of all the slabs. */
+    int defrag;             /* Objects may be moved by zslab_defrag(). The
+                               defragger clears it for slabs with little
+                               unused space. */
+    struct zslab *next;     /* Next slab in the list of all the slabs. */
+    pthread_mutex_t lock;   /* Objects may be freed by other threads. */
+} zslab;
+
+#define ZSLAB_INIT(name,size) \
+    {name,size,{NULL},NULL,0,0,0,1,NULL,PTHREAD_MUTEX_INITIALIZER}
+
+void *zslab_malloc(zslab *s);
+void zslab_free(void *ptr);
+size_t zslab_size(void *ptr);
+void *zslab_defrag(void *ptr);
+zslab *zslab_list(void);
+size_t zslab_unused_memory(void);
+
 #ifndef HAVE_MALLOC_SIZE
 size_t zmalloc_size(void *ptr);
+size_t zmalloc_usable(void *ptr);
+#else
+#define zmalloc_usable(p) zmalloc_size(p)
 #endif
 
 #endif /* __ZMALLOC_H */
@@ -21,6 +21,21 @@ start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rd
 "0","zset","zset","a","1","b","2","c","3","aa","10","bb","20","cc","30","aaa","100","bbb","200","ccc","300","aaaa","1000","cccc","123456789","bbbb","5000000000",
 "0","zset_zipped","zset","a","1","b","2","c","3",
 }
+
+  test "RDB load ziplist hash: converts to listpack" {
+    r select 0
+    assert_encoding listpack hash_zipped
+    assert_equal {a 1 b 2 c 3} [r hgetall hash_zipped]
+  }
+
+  test "RDB save and reload of listpack encoded hash" {
+    r del lphash
+    r hset lphash f1 v1 f2 12345 f3 -9000000000
+    assert_encoding listpack lphash
+    r debug reload
+    assert_encoding listpack lphash
+    assert_equal {f1 v1 f2 12345 f3 -9000000000} [r hgetall lphash]
+  }
 }
 
 set server_path [tmpdir "server.rdb-startup-test"]
@@ -0,0 +1,197 @@
+/* Test module for RedisModule_SaveBlob() / RedisModule_LoadBlob() and for
+ * the free_effort method of module types.
+ *
+ * BLOBTYPE.SET <key> <data> <effort> -- Set the key to a blob holding <data>,
+ *                                       reporting <effort> as free effort.
+ *                                       Freeing the blob takes <effort>
+ *                                       microseconds, like a value with as
+ *                                       many allocations would.
+ * BLOBTYPE.GET <key>                 -- Return the data of the blob.
+ * BLOBTYPE.BADLEN <key>              -- Save a wrong length before the blob
+ *                                       in the next RDB files, so that
+ *                                       loading them fails.
+ */
+
+#include "redismodule.h"
+#include <string.h>
+#include <unistd.h>
+
+static RedisModuleType *BlobType;
+
+typedef struct BlobObject {
+    size_t len;
+    size_t effort;
+    int badlen;
+    char *data;
+} BlobObject;
+
+static BlobObject *createBlobObject(const char *data, size_t len, size_t effort) {
+    BlobObject *o = RedisModule_Alloc(sizeof(*o));
+    o->len = len;
+    o->effort = effort;
+    o->badlen = 0;
+    o->data = RedisModule_Alloc(len ? len : 1);
+    memcpy(o->data,data,len);
+    return o;
+}
+
+static void releaseBlobObject(BlobObject *o) {
+    RedisModule_Free(o->data);
+    RedisModule_Free(o);
+}
+
+/* Open the key for writing, replying with an error if it holds a value of
+ * another type. */
+static RedisModuleKey *openBlobKey(RedisModuleCtx *ctx, RedisModuleString *keyname, int mode) {
+    RedisModuleKey *key = RedisModule_OpenKey(ctx,keyname,mode);
+    int type = RedisModule_KeyType(key);
+
+    if (type != REDISMODULE_KEYTYPE_EMPTY &&
+        RedisModule_ModuleTypeGetType(key) != BlobType)
+    {
+        RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+        return NULL;
+    }
+    return key;
+}
+
+int BlobTypeSet_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModuleKey *key;
+    long long effort;
+    const char *data;
+    size_t len;
+
+    RedisModule_AutoMemory(ctx);
+    if (argc != 4) return RedisModule_WrongArity(ctx);
+    if (RedisModule_StringToLongLong(argv[3],&effort) != REDISMODULE_OK ||
+        effort < 0)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid effort");
+    if ((key = openBlobKey(ctx,argv[1],REDISMODULE_WRITE)) == NULL)
+        return REDISMODULE_OK;
+    data = RedisModule_StringPtrLen(argv[2],&len);
+    RedisModule_ModuleTypeSetValue(key,BlobType,
+        createBlobObject(data,len,effort));
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx,"OK");
+}
+
+int BlobTypeGet_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModuleKey *key;
+    BlobObject *o;
+
+    RedisModule_AutoMemory(ctx);
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    if ((key = openBlobKey(ctx,argv[1],REDISMODULE_READ)) == NULL)
+        return REDISMODULE_OK;
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY)
+        return RedisModule_ReplyWithNull(ctx);
+    o = RedisModule_ModuleTypeGetValue(key);
+    return RedisModule_ReplyWithStringBuffer(ctx,o->data,o->len);
+}
+
+int BlobTypeBadLen_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModuleKey *key;
+    BlobObject *o;
+
+    RedisModule_AutoMemory(ctx);
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    if ((key = openBlobKey(ctx,argv[1],REDISMODULE_WRITE)) == NULL)
+        return REDISMODULE_OK;
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY)
+        return RedisModule_ReplyWithError(ctx,"ERR no such key");
+    o = RedisModule_ModuleTypeGetValue(key);
+    o->badlen = 1;
+    return RedisModule_ReplyWithSimpleString(ctx,"OK");
+}
+
+/* ========================== "blobtype" type methods ======================= */
+
+void *BlobTypeRdbLoad(RedisModuleIO *rdb, int encver) {
+    BlobObject *o;
+
+    if (encver != 0) return NULL;
+    o = RedisModule_Alloc(sizeof(*o));
+    o->len = RedisModule_LoadUnsigned(rdb);
+    o->effort = RedisModule_LoadUnsigned(rdb);
+    o->badlen = 0;
+    o->data = RedisModule_Alloc(o->len ? o->len : 1);
+    RedisModule_LoadBlob(rdb,o->data,o->len);
+    return o;
+}
+
+void BlobTypeRdbSave(RedisModuleIO *rdb, void *value) {
+    BlobObject *o = value;
+
+    RedisModule_SaveUnsigned(rdb,o->len+o->badlen);
+    RedisModule_SaveUnsigned(rdb,o->effort);
+    RedisModule_SaveBlob(rdb,o->data,o->len);
+}
+
+void BlobTypeAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+    BlobObject *o = value;
+
+    RedisModule_EmitAOF(aof,"BLOBTYPE.SET","sbl",key,o->data,o->len,
+        (long long)o->effort);
+}
+
+size_t BlobTypeMemUsage(const void *value) {
+    const BlobObject *o = value;
+
+    return sizeof(*o)+o->len;
+}
+
+void BlobTypeDigest(RedisModuleDigest *md, void *value) {
+    BlobObject *o = value;
+
+    RedisModule_DigestAddStringBuffer(md,(unsigned char*)o->data,o->len);
+    RedisModule_DigestEndSequence(md);
+}
+
+void BlobTypeFree(void *value) {
+    BlobObject *o = value;
+
+    if (o->effort) usleep(o->effort);
+    releaseBlobObject(o);
+}
+
+size_t BlobTypeFreeEffort(const void *value) {
+    const BlobObject *o = value;
+
+    return o->effort;
+}
+
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+    REDISMODULE_NOT_USED(argc);
+
+    if (RedisModule_Init(ctx,"blobtype",1,REDISMODULE_APIVER_1)
+        == REDISMODULE_ERR) return REDISMODULE_ERR;
+
+    RedisModuleTypeMethods tm = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = BlobTypeRdbLoad,
+        .rdb_save = BlobTypeRdbSave,
+        .aof_rewrite = BlobTypeAofRewrite,
+        .mem_usage = BlobTypeMemUsage,
+        .free = BlobTypeFree,
+        .digest = BlobTypeDigest,
+        .free_effort = BlobTypeFreeEffort
+    };
+
+    BlobType = RedisModule_CreateDataType(ctx,"blob-type",0,&tm);
+    if (BlobType == NULL) return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"blobtype.set",
+        BlobTypeSet_RedisCommand,"write deny-oom",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"blobtype.get",
+        BlobTypeGet_RedisCommand,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"blobtype.badlen",
+        BlobTypeBadLen_RedisCommand,"write",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    return REDISMODULE_OK;
+}
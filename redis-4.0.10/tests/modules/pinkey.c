@@ -0,0 +1,88 @@
+/* Test module for RedisModule_PinKey() and the related API.
+ *
+ * PINKEY.PIN <key>            -- Pin the value of the key and return the id
+ *                                of the handle, or nil if the key is missing.
+ * PINKEY.HGET <id> <field>    -- Return a field of a pinned hash.
+ * PINKEY.UNPIN <id>           -- Release the handle.
+ */
+
+#define REDISMODULE_EXPERIMENTAL_API
+#include "redismodule.h"
+#include <string.h>
+
+#define PINKEY_MAX 16
+
+static RedisModulePinnedKey *pinned[PINKEY_MAX];
+
+/* Parse the handle id at argv[1], replying with an error if it is not the
+ * id of a pinned key. */
+static RedisModulePinnedKey **lookupHandle(RedisModuleCtx *ctx, RedisModuleString **argv) {
+    long long id;
+
+    if (RedisModule_StringToLongLong(argv[1],&id) != REDISMODULE_OK ||
+        id < 0 || id >= PINKEY_MAX || pinned[id] == NULL)
+    {
+        RedisModule_ReplyWithError(ctx,"ERR no such pinned key");
+        return NULL;
+    }
+    return &pinned[id];
+}
+
+int PinKey_Pin(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    int id;
+
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    for (id = 0; id < PINKEY_MAX && pinned[id]; id++);
+    if (id == PINKEY_MAX)
+        return RedisModule_ReplyWithError(ctx,"ERR too many pinned keys");
+    pinned[id] = RedisModule_PinKey(ctx,argv[1]);
+    if (pinned[id] == NULL) return RedisModule_ReplyWithNull(ctx);
+    return RedisModule_ReplyWithLongLong(ctx,id);
+}
+
+int PinKey_HGet(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModulePinnedKey **pk;
+    RedisModuleString *value;
+
+    if (argc != 3) return RedisModule_WrongArity(ctx);
+    if ((pk = lookupHandle(ctx,argv)) == NULL) return REDISMODULE_OK;
+    if (RedisModule_PinnedKeyType(*pk) != REDISMODULE_KEYTYPE_HASH)
+        return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+    value = RedisModule_PinnedHashGet(ctx,*pk,argv[2]);
+    if (value == NULL) return RedisModule_ReplyWithNull(ctx);
+    RedisModule_ReplyWithString(ctx,value);
+    RedisModule_FreeString(ctx,value);
+    return REDISMODULE_OK;
+}
+
+int PinKey_Unpin(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModulePinnedKey **pk;
+
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    if ((pk = lookupHandle(ctx,argv)) == NULL) return REDISMODULE_OK;
+    RedisModule_UnpinKey(*pk);
+    *pk = NULL;
+    return RedisModule_ReplyWithSimpleString(ctx,"OK");
+}
+
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+    REDISMODULE_NOT_USED(argc);
+
+    if (RedisModule_Init(ctx,"pinkey",1,REDISMODULE_APIVER_1)
+        == REDISMODULE_ERR) return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"pinkey.pin",
+        PinKey_Pin,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"pinkey.hget",
+        PinKey_HGet,"readonly",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"pinkey.unpin",
+        PinKey_Unpin,"readonly",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    return REDISMODULE_OK;
+}
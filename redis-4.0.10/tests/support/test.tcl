@@ -28,6 +28,12 @@ proc assert_equal {expected value {detail ""}} {
     }
 }
 
+proc assert_range {value min max} {
+    if {!($value <= $max && $value >= $min)} {
+        error "assertion:Expected '$value' to be between '$min' and '$max'"
+    }
+}
+
 proc assert_error {pattern code} {
     if {[catch {uplevel 1 $code} error]} {
         assert_match $pattern $error
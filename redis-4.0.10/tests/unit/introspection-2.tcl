@@ -21,3 +21,70 @@ start_server {tags {"introspection"}} {
         r touch key0 key1 key2 key3
     } 2
 }
+
+start_server {tags {"introspection"}} {
+    test {Every command can be looked up by name in any case} {
+        set names {}
+        foreach cmd [r command] {lappend names [lindex $cmd 0]}
+        assert {[llength $names] > 150}
+        foreach name $names {
+            assert_equal $name [lindex [r command info [string toupper $name]] 0 0]
+            assert_equal $name [lindex [r command info [string totitle $name]] 0 0]
+        }
+        list [r command info get- ge getx {}] [catch {r gett foo} e] $e
+    } {{{} {} {} {}} 1 {ERR unknown command 'gett'}}
+}
+
+start_server {tags {"introspection"} overrides {rename-command {set myset}}} {
+    test {Renamed commands are looked up by their new name} {
+        assert_error {*unknown command*} {r set foo bar}
+        r config resetstat
+        r MySet foo bar
+        list [r get foo] [lindex [r command info myset] 0 0] \
+             [string match {*cmdstat_set:calls=1,*} [r info commandstats]]
+    } {bar set 1}
+}
+
+start_server {tags {"introspection"}} {
+    test {MEMORY STATS reports the slab allocators usage} {
+        r flushall
+        r debug populate 1000
+        r rpush mylist a b c
+        set stats [r memory stats]
+        set entries [dict get $stats slab.dictEntry]
+        assert {[dict get $entries objects] >= 1001}
+        assert {[dict get $entries bytes.allocated] >=
+                [dict get $entries bytes.used]}
+        assert {[dict get $stats slab.quicklistNode objects] >= 1}
+        assert {[dict get $stats slab.robj objects] >= 1}
+
+        r flushall
+        set after [dict get [r memory stats] slab.dictEntry objects]
+        assert {$after < [dict get $entries objects]}
+    }
+
+    test {Big values go to the huge pages arena} {
+        if {[string match {*jemalloc*} [s mem_allocator]]} {
+            r config set hugepage-layout yes
+            r flushall
+            set base [dict get [r memory stats] hugepages.allocated]
+            # Big values use the arena, the main dict table does not.
+            r debug populate 100000
+            set huge [dict get [r memory stats] hugepages.allocated]
+            assert {$huge - $base < 65536}
+            r set bigval [string repeat x 200000]
+            set huge [dict get [r memory stats] hugepages.allocated]
+            assert {$huge - $base >= 200000}
+            r debug reload
+            set huge [dict get [r memory stats] hugepages.allocated]
+            assert {$huge - $base >= 200000}
+            r config set hugepage-layout no
+            r flushall
+            assert {[dict get [r memory stats] hugepages.allocated] < $huge}
+        } else {
+            assert_error {*requires*Jemalloc*} {r config set hugepage-layout yes}
+            assert_equal {hugepage-layout no} [r config get hugepage-layout]
+        }
+        assert {[dict get [r memory stats] rss.page-tables] >= 0}
+    }
+}
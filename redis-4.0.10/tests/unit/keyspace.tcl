@@ -13,6 +13,28 @@ start_server {tags {"keyspace"}} {
         list [r del foo1 foo2 foo3 foo4] [r mget foo1 foo2 foo3]
     } {3 {{} {} {}}}
 
+    test {MGET, EXISTS and DEL with many keys} {
+        r flushdb
+        set keys {}
+        set expected {}
+        for {set j 0} {$j < 50} {incr j} {
+            lappend keys key:$j
+            if {$j % 3} {
+                r set key:$j $j
+                lappend expected $j
+            } else {
+                lappend expected {}
+            }
+        }
+        r set key:1 1 px 1
+        lset expected 1 {}
+        after 10
+        assert_equal $expected [r mget {*}$keys]
+        assert_equal 32 [r exists {*}$keys]
+        assert_equal 32 [r del {*}$keys]
+        r dbsize
+    } {0}
+
     test {KEYS with pattern} {
         foreach key {key_x key_y key_z foo_a foo_b foo_c} {
             r set $key hello
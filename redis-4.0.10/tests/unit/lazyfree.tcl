@@ -1,4 +1,10 @@
-start_server {tags {"lazyfree"}} {
+# The big sets of integers used here must be hash tables, not roaring bitmaps.
+start_server {
+    tags {"lazyfree"}
+    overrides {
+        "set-roaring-min-density" 0
+    }
+} {
     test "UNLINK can reclaim memory in background" {
         set orig_mem [s used_memory]
         set args {}
@@ -36,4 +42,29 @@ start_server {tags {"lazyfree"}} {
             fail "Memory is not reclaimed by FLUSHDB ASYNC"
         }
     }
+
+    test "lazyfree-auto-effort frees big overwritten values in background" {
+        r config set lazyfree-auto-effort 1000
+        r config resetstat
+        set args {}
+        for {set i 0} {$i < 10000} {incr i} {
+            lappend args $i
+        }
+        r sadd myset {*}$args
+        r sadd otherset a b c
+        # Small values are still freed synchronously.
+        r set otherset foo
+        assert_equal 0 [s lazyfree_overwrite_objects]
+        r set myset foo
+        assert_equal 1 [s lazyfree_overwrite_objects]
+        r del myset
+        r sadd myset {*}$args
+        r sadd dst a b c
+        r rename myset dst
+        assert_equal 0 [s lazyfree_server_del_objects]
+        r sadd myset {*}$args
+        r rename dst myset
+        assert_equal 1 [s lazyfree_server_del_objects]
+        r config set lazyfree-auto-effort 0
+    }
 }
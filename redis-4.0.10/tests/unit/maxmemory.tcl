@@ -24,7 +24,7 @@ start_server {tags {"maxmemory"}} {
     }
 
     foreach policy {
-        allkeys-random allkeys-lru allkeys-lfu volatile-lru volatile-lfu volatile-random volatile-ttl
+        allkeys-random allkeys-lru allkeys-lfu allkeys-gdsf volatile-lru volatile-lfu volatile-gdsf volatile-random volatile-ttl
     } {
         test "maxmemory - is the memory limit honoured? (policy $policy)" {
             # make sure to start with a blank instance
@@ -98,7 +98,7 @@ start_server {tags {"maxmemory"}} {
     }
 
     foreach policy {
-        volatile-lru volatile-lfu volatile-random volatile-ttl
+        volatile-lru volatile-lfu volatile-gdsf volatile-random volatile-ttl
     } {
         test "maxmemory - policy $policy should only remove volatile keys." {
             # make sure to start with a blank instance
@@ -141,4 +141,86 @@ start_server {tags {"maxmemory"}} {
             }
         }
     }
+
+    test "maxmemory - eviction stats with keys in multiple DBs" {
+        r flushall
+        r config resetstat
+        r select 10
+        for {set j 0} {$j < 100} {incr j} {
+            r set "hot:$j" x
+            for {set i 0} {$i < 50} {incr i} {r get "hot:$j"}
+        }
+        r select 9
+        set used [s used_memory]
+        set limit [expr {$used+100*1024}]
+        r config set maxmemory $limit
+        r config set maxmemory-policy allkeys-lfu
+        for {set j 0} {$j < 5000} {incr j} {
+            r set [randomKey] x
+        }
+        assert {[s used_memory] < ($limit+4096)}
+        assert {[s evicted_keys] > 0}
+        # Evicted keys are the best candidates among the sampled ones, so
+        # their average score can't be lower than the sampled keys one.
+        assert {[s evicted_keys_avg_score] >= [s eviction_sampled_avg_score]}
+        assert {[s eviction_sampled_avg_score] > 0}
+        r config set maxmemory 0
+        r flushall
+    }
+
+    test "maxmemory - background eviction keeps memory below the low water mark" {
+        r flushall
+        r config resetstat
+        set used [s used_memory]
+        set limit [expr {$used+400*1024}]
+        set lowwater [expr {int(100.0*($used+200*1024)/$limit)}]
+        r config set maxmemory $limit
+        r config set maxmemory-policy allkeys-lru
+        r config set maxmemory-eviction-lowwater $lowwater
+        for {set j 0} {$j < 5000} {incr j} {
+            r set [randomKey] x
+        }
+        wait_for_condition 50 100 {
+            [s evicted_keys_background] > 0 &&
+            [s eviction_lag_bytes] == 0
+        } else {
+            fail "Background eviction did not reach the low water mark"
+        }
+        assert {[s used_memory] < $limit}
+        r config set maxmemory-eviction-lowwater 0
+        r config set maxmemory 0
+        r flushall
+    }
+
+    test "maxmemory - allkeys-gdsf evicts big keys before small keys" {
+        r flushall
+        set big [string repeat x 20000]
+        for {set j 0} {$j < 50} {incr j} {
+            r set "big:$j" $big
+        }
+        for {set j 0} {$j < 500} {incr j} {
+            r set "small:$j" x
+        }
+        set used [s used_memory]
+        r config set maxmemory [expr {$used-300000}]
+        r config set maxmemory-policy allkeys-gdsf
+        r config set maxmemory-samples 10
+        r set foo bar
+        set big_evicted 0
+        set small_evicted 0
+        for {set j 0} {$j < 50} {incr j} {
+            if {![r exists "big:$j"]} {incr big_evicted}
+        }
+        for {set j 0} {$j < 500} {incr j} {
+            if {![r exists "small:$j"]} {incr small_evicted}
+        }
+        # Big keys are less than 10% of the keys: with a size unaware
+        # policy they would be about 10% of the evicted keys as well.
+        set evicted [expr {$big_evicted+$small_evicted}]
+        assert {$big_evicted > 0}
+        assert {$big_evicted*550 > 2*50*$evicted}
+        r config set maxmemory-samples 5
+        r config set maxmemory 0
+        r flushall
+    }
 }
@@ -83,3 +83,97 @@ if 0 {
         }
     }
 }
+
+start_server {tags {"defrag"}} {
+    if {[string match {*jemalloc*} [s mem_allocator]]} {
+        test "Active defrag moves the allocations of aggregate types" {
+            r config set activedefrag no
+            r config set active-defrag-threshold-lower 5
+            r config set active-defrag-ignore-bytes 1mb
+            # Interleave the small values of every type with string fillers,
+            # then delete the fillers to leave the pages half empty.
+            r eval {
+                for j=0,30000 do
+                    redis.call('set','filler:'..j,string.rep('x',60))
+                    redis.call('rpush','list:'..j,'a','b','c')
+                    redis.call('hset','hash:'..j,'field','value')
+                    redis.call('zadd','zset:'..j,j,'member')
+                    redis.call('sadd','set:'..j,j,j+1)
+                end
+                for j=0,30000 do
+                    redis.call('del','filler:'..j)
+                end
+            } 0
+            r config resetstat
+            r config set activedefrag yes
+            wait_for_condition 100 100 {
+                [string match {*list=[1-9]*,set=[1-9]*,zset=[1-9]*,hash=[1-9]*} [s active_defrag_type_hits]]
+            } else {
+                fail "Defrag didn't move the allocations of every type: [s active_defrag_type_hits]"
+            }
+            r config set activedefrag no
+            assert_equal {a b c} [r lrange list:100 0 -1]
+            assert_equal value [r hget hash:100 field]
+            assert_equal 100 [r zscore zset:100 member]
+            assert_equal {100 101} [lsort [r smembers set:100]]
+        }
+
+        # The example module is built by 'make -C src/modules'.
+        set hellotype [file normalize src/modules/hellotype.so]
+        if {[file exists $hellotype]} {
+            test "Active defrag moves the values of module types" {
+                r config set activedefrag no
+                r flushall
+                r module load $hellotype
+                r eval {
+                    for j=0,50000 do
+                        for k=0,2 do
+                            redis.call('hellotype.insert','filler:'..j,j+k)
+                            redis.call('hellotype.insert','key:'..j,j+k)
+                        end
+                    end
+                    for j=0,50000 do
+                        redis.call('del','filler:'..j)
+                    end
+                } 0
+                r config resetstat
+                r config set activedefrag yes
+                wait_for_condition 100 100 {
+                    [string match {*module=[1-9]*} [s active_defrag_type_hits]]
+                } else {
+                    fail "Defrag didn't move the module values: [s active_defrag_type_hits]"
+                }
+                r config set activedefrag no
+                assert_equal {100 101 102} [r hellotype.range key:100 0 10]
+                assert_equal {50000 50001 50002} [r hellotype.range key:50000 0 10]
+            }
+        }
+
+        test "Active defrag skips the size classes that are not fragmented" {
+            r config set activedefrag no
+            r flushall
+            # Values of 300 bytes are never deleted, so their size class
+            # stays full while the one of the 100 bytes values is sparse.
+            r debug populate 100000 stable 300
+            r eval {
+                for j=0,100000 do
+                    redis.call('set','f:'..j,string.rep('x',100))
+                    redis.call('set','g:'..j,string.rep('y',100))
+                end
+                for j=0,100000 do
+                    redis.call('del','f:'..j)
+                end
+            } 0
+            r config resetstat
+            r config set activedefrag yes
+            wait_for_condition 100 100 {
+                [s active_defrag_hits] > 0 && [s active_defrag_skipped] > 0
+            } else {
+                fail "Defrag didn't skip the full size classes"
+            }
+            r config set activedefrag no
+            assert_equal [string repeat y 100] [r get g:100]
+            assert_equal 300 [r strlen stable:100]
+        }
+    }
+}
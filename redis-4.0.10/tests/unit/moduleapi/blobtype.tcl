@@ -0,0 +1,66 @@
+set testmodule [file normalize tests/modules/blobtype.so]
+
+start_server {tags {"modules"}} {
+    r module load $testmodule
+
+    test {Blobs saved with SaveBlob() survive DEBUG RELOAD} {
+        r del empty small big
+        r blobtype.set empty {} 0
+        r blobtype.set small "hello\x00world" 0
+        set big [string repeat "0123456789abcdef" 100000]
+        r blobtype.set big $big 0
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal {} [r blobtype.get empty]
+        assert_equal "hello\x00world" [r blobtype.get small]
+        assert_equal $big [r blobtype.get big]
+    }
+
+    test {Blobs survive an AOF rewrite} {
+        set digest [r debug digest]
+        r config set appendonly yes
+        wait_for_condition 50 100 {
+            [s aof_rewrite_in_progress] == 0 &&
+            [s aof_rewrite_scheduled] == 0
+        } else {
+            fail "AOF rewrite not terminated"
+        }
+        r debug loadaof
+        r config set appendonly no
+        assert_equal $digest [r debug digest]
+    }
+
+    test {UNLINK frees values with a big free effort in background} {
+        r config resetstat
+        r blobtype.set few x 10
+        r unlink few
+        assert_equal 0 [s lazyfree_user_objects]
+        # Freeing the value takes half a second.
+        r blobtype.set many x 500000
+        r unlink many
+        assert_equal 1 [s lazyfree_user_objects]
+        assert_equal 1 [s lazyfree_pending_objects]
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0
+        } else {
+            fail "Lazy free of the value not completed"
+        }
+    }
+}
+
+start_server {tags {"modules"}} {
+    r module load $testmodule
+
+    test {LoadBlob() fails if the length is not the saved one} {
+        r blobtype.set key somedata 0
+        r blobtype.badlen key
+        catch {r debug reload}
+        wait_for_condition 50 100 {
+            [string match {*Read performed by module 'blobtype' about type 'blob-type'*} \
+                [exec tail -1 < [srv 0 stdout]]]
+        } else {
+            fail "Loading a blob with a wrong length did not fail"
+        }
+    }
+}
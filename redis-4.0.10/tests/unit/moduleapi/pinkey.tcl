@@ -0,0 +1,116 @@
+set testmodule [file normalize tests/modules/pinkey.so]
+
+start_server {tags {"modules"}} {
+    r module load $testmodule
+
+    test {Writes to a pinned hash modify a copy} {
+        r config resetstat
+        r del h
+        r hset h a 1 b 2
+        set id [r pinkey.pin h]
+        r hset h a 10
+        r hdel h b
+        assert_equal {1 2} [list [r pinkey.hget $id a] [r pinkey.hget $id b]]
+        assert_equal {a 10} [r hgetall h]
+        # Only the first write copies the value.
+        assert_equal 1 [s unshared_pinned_values]
+        r pinkey.unpin $id
+    } {OK}
+
+    test {Only the commands modifying a pinned value copy it} {
+        r config resetstat
+        r del h h2 s
+        r hset h a 1
+        r sadd s a b c
+        set id [r pinkey.pin h]
+        set id2 [r pinkey.pin s]
+        r expire h 1000
+        r persist h
+        r rename h h2
+        r move h2 10
+        r select 10
+        r rename h2 h
+        r move h 9
+        r select 9
+        r exists h
+        assert_equal 0 [s unshared_pinned_values]
+        r spop s 2
+        assert_equal 1 [s unshared_pinned_values]
+        assert_equal 1 [r pinkey.hget $id a]
+        r pinkey.unpin $id
+        r pinkey.unpin $id2
+    } {OK}
+
+    test {Pinned values are copied with their encoding} {
+        r config set set-max-intset-entries 512
+        r del l is rs hs zl zs hl hh
+        r rpush l a b c
+        r sadd is 1 2 3
+        for {set i 0} {$i < 1000} {incr i} {r sadd rs $i}
+        r sadd hs a b c
+        r zadd zl 1 a 2 b
+        r zadd zs 1 [string repeat x 100] 2 b
+        r hset hl a 1
+        r hset hh a 1 b 2
+        r hexpire hh 1000 FIELDS 1 a
+        foreach {key enc add del} {
+            l quicklist {rpush l d} {rpop l}
+            is intset {sadd is 4} {srem is 4}
+            rs roaring {sadd rs 5000} {srem rs 5000}
+            hs hashtable {sadd hs d} {srem hs d}
+            zl ziplist {zadd zl 3 c} {zrem zl c}
+            zs skiplist {zadd zs 3 c} {zrem zs c}
+            hl listpack {hset hl b 2} {hdel hl b}
+            hh hashtable {hset hh c 3} {hdel hh c}
+        } {
+            assert_encoding $enc $key
+            set digest [r debug digest]
+            set id [r pinkey.pin $key]
+            r {*}$add
+            r {*}$del
+            assert_encoding $enc $key
+            assert_equal $digest [r debug digest]
+            r pinkey.unpin $id
+        }
+        # The field TTLs are copied as well.
+        set ttl [lindex [r httl hh FIELDS 1 a] 0]
+        assert {$ttl > 900 && $ttl <= 1000}
+    }
+
+    test {Pinned values survive DEL and FLUSHALL ASYNC} {
+        r flushall
+        for {set j 0} {$j < 3} {incr j} {
+            r del h
+            for {set i 0} {$i < 1000} {incr i} {r hset h f$i $i}
+            set id [r pinkey.pin h]
+            if {$j == 0} {
+                r del h
+            } elseif {$j == 1} {
+                r flushall async
+            } else {
+                # The hash is copied on write, the pinned one is flushed.
+                r hset h f0 new
+                r flushall async
+            }
+            assert_equal 999 [r pinkey.hget $id f999]
+            assert_equal 0 [r dbsize]
+            r pinkey.unpin $id
+        }
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0
+        } else {
+            fail "Lazy free of the flushed values not completed"
+        }
+        r ping
+    } {PONG}
+
+    test {FLUSHALL ASYNC of values pinned by another key} {
+        r flushall
+        r hset h a 1
+        set id [r pinkey.pin h]
+        r rename h h2
+        r flushall async
+        assert_equal 1 [r pinkey.hget $id a]
+        r pinkey.unpin $id
+    } {OK}
+}
@@ -100,6 +100,181 @@ start_server {tags {"protocol"}} {
     unset c
 }
 
+start_server {tags {"protocol"}} {
+    proc write_pipeline {client cmds} {
+        foreach cmd $cmds {
+            set proto "*[llength $cmd]\r\n"
+            foreach arg $cmd {
+                append proto "\$[string length $arg]\r\n$arg\r\n"
+            }
+            $client write $proto
+        }
+        $client flush
+    }
+
+    proc read_replies {client count} {
+        set replies {}
+        for {set j 0} {$j < $count} {incr j} {
+            lappend replies [catch {$client read} reply] $reply
+        }
+        return $replies
+    }
+
+    test "Pipelined GET and SET batches" {
+        r flushall
+        r config resetstat
+        set cmds {}
+        for {set j 0} {$j < 40} {incr j} {
+            lappend cmds [list [expr {$j%2 ? "SET" : "set"}] key:$j val:$j]
+        }
+        lappend cmds {set key:0 new ex 100}
+        for {set j 0} {$j < 40} {incr j} {
+            lappend cmds [list [expr {$j%3 ? "GET" : "get"}] key:$j]
+        }
+        lappend cmds {get} {get key:1} {ping} {get key:2}
+        write_pipeline r $cmds
+        set replies [read_replies r [llength $cmds]]
+
+        set expected {}
+        for {set j 0} {$j < 40} {incr j} {lappend expected 0 OK}
+        lappend expected 0 OK 0 new
+        for {set j 1} {$j < 40} {incr j} {lappend expected 0 val:$j}
+        assert_equal $expected [lrange $replies 0 end-8]
+        assert_match {1 *wrong number of arguments*} [lrange $replies end-7 end-6]
+        assert_equal {0 val:1 0 PONG 0 val:2} [lrange $replies end-5 end]
+        assert_match {*cmdstat_set:calls=41,*} [r info commandstats]
+        assert_match {*cmdstat_get:calls=42,*} [r info commandstats]
+    }
+
+    test "Pipelined commands with arguments of different sizes" {
+        r flushall
+        set cmds {}
+        set expected {}
+        foreach len {1 5 20 12 40 44 45 3 64 70 30 2} {
+            set key [string repeat k $len]
+            set val [string repeat v [expr {$len*2}]]
+            lappend cmds [list set $key $val] [list append $key x] \
+                         [list get $key] [list hset h$len f $val]
+            lappend expected 0 OK 0 [expr {$len*2+1}] 0 ${val}x 0 1
+        }
+        write_pipeline r $cmds
+        assert_equal $expected [read_replies r [llength $cmds]]
+        assert_equal [string repeat v 80] [r hget h40 f]
+        assert_equal [string repeat v 2] [r hget h1 f]
+    }
+
+    test "Pipelined replies with deferred lengths and large elements" {
+        r flushall
+        for {set j 0} {$j < 100} {incr j} {
+            r zadd z $j m$j
+        }
+        r rpush biglist [string repeat a 20000] [string repeat b 40000] c
+        set cmds {}
+        set expected {}
+        # More deferred lengths than a single block can track at once.
+        lappend cmds [list lrange biglist 2 2]
+        lappend expected 0 c
+        for {set j 0} {$j < 20} {incr j} {
+            lappend cmds [list zrangebyscore z $j [expr {$j+1}]]
+            lappend expected 0 [list m$j m[expr {$j+1}]]
+        }
+        for {set j 0} {$j < 30} {incr j} {
+            lappend cmds [list zrangebyscore z 0 [expr {$j*3}]]
+            set res {}
+            for {set i 0} {$i <= $j*3} {incr i} {lappend res m$i}
+            lappend expected 0 $res
+            lappend cmds [list lrange biglist 0 -1]
+            lappend expected 0 [r lrange biglist 0 -1]
+        }
+        write_pipeline r $cmds
+        assert_equal $expected [read_replies r [llength $cmds]]
+    }
+
+    test "Partial commands keep a query buffer only while pending" {
+        set rd [redis_deferring_client]
+        $rd client setname partial
+        $rd read
+        set info [lsearch -inline [split [r client list] "\n"] *name=partial*]
+        assert_match {*qbuf=0 qbuf-free=0 *} $info
+
+        $rd write "*3\r\n\$3\r\nSET\r\n\$3\r\nkey\r\n\$5\r\nva"
+        $rd flush
+        wait_for_condition 50 100 {
+            [string match {*name=partial*qbuf=2 qbuf-free=* *} [r client list]]
+        } else {
+            fail "Partial command not kept in the query buffer"
+        }
+        $rd write "lue\r\n*1\r\n\$4\r\nPI"
+        $rd flush
+        assert_equal OK [$rd read]
+        $rd write "NG\r\n"
+        $rd flush
+        assert_equal PONG [$rd read]
+        assert_equal value [r get key]
+        set info [lsearch -inline [split [r client list] "\n"] *name=partial*]
+        assert_match {*qbuf=0 qbuf-free=0 *} $info
+        $rd close
+    }
+
+    test "Pipelined batches are rejected like single commands" {
+        set rd [redis_deferring_client]
+        r config set requirepass foobar
+        r auth foobar
+        write_pipeline $rd {{get a} {get b} {get c} {auth foobar} {get a}}
+        set replies [read_replies $rd 5]
+        r config set requirepass ""
+        assert_match {1 {NOAUTH*}} [lrange $replies 0 1]
+        assert_match {1 {NOAUTH*}} [lrange $replies 4 5]
+        assert_equal {0 OK 0 {}} [lrange $replies 6 end]
+
+        r config set maxmemory 1
+        r config set maxmemory-policy noeviction
+        write_pipeline $rd {{set a 1} {set b 2} {set c 3} {get a}}
+        set replies [read_replies $rd 4]
+        r config set maxmemory 0
+        $rd close
+        assert_match {1 {OOM*}} [lrange $replies 0 1]
+        assert_match {1 {OOM*}} [lrange $replies 4 5]
+        assert_equal {0 {}} [lrange $replies 6 end]
+    }
+
+    test "Pipelined commands while a slow script processes events" {
+        # Every script times out, so the events of the other clients are
+        # processed while the pipeline is still being parsed.
+        r config set lua-time-limit 10
+        set script {
+            local t = redis.call('time')
+            local start = t[1]*1000000+t[2]
+            repeat
+                t = redis.call('time')
+            until t[1]*1000000+t[2]-start > 15000
+            return string.len(ARGV[1])
+        }
+        set rd [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+        set cmds {}
+        for {set j 0} {$j < 40} {incr j} {
+            lappend cmds [list eval $script 0 [string repeat x 2000]]
+        }
+        foreach round {1 2} {
+            write_pipeline $rd $cmds
+            # Read by the server while it runs the scripts of the pipeline.
+            for {set j 0} {$j < 10} {incr j} {
+                $rd2 ping
+                catch {$rd2 read}
+            }
+            write_pipeline $rd {{ping}}
+            set replies [read_replies $rd [expr {[llength $cmds]+1}]]
+            assert_equal [lrepeat [llength $cmds] 0 2000] [lrange $replies 0 end-2]
+            assert_equal {0 PONG} [lrange $replies end-1 end]
+        }
+        r config set lua-time-limit 5000
+        $rd close
+        $rd2 close
+        assert_equal PONG [r ping]
+    }
+}
+
 start_server {tags {"regression"}} {
     test "Regression for a crash with blocking ops and pipelining" {
         set rd [redis_deferring_client]
@@ -38,6 +38,21 @@ start_server {tags {"scripting"}} {
         r eval {return {KEYS[1],KEYS[2],ARGV[1],ARGV[2]}} 2 a b c d
     } {a b c d}
 
+    test {EVAL - KEYS and ARGV don't keep what the previous script set} {
+        r eval {KEYS[4] = 'x'; KEYS.foo = 'bar'; ARGV[3] = 'y'} 2 a b c
+        set count {
+            local n = 0
+            for k,v in pairs(KEYS) do n = n+1 end
+            for k,v in pairs(ARGV) do n = n+1 end
+            return {n,#KEYS,#ARGV,KEYS[1],ARGV[1]}
+        }
+        assert_equal {2 1 1 k v} [r eval $count 1 k v]
+        r eval {setmetatable(KEYS,{__index = function() return 'x' end})} 0
+        assert_equal {0 0 0} [r eval $count 0]
+        r eval {KEYS = {1,2,3}} 0
+        r eval $count 1 k v
+    } {2 1 1 k v}
+
     test {EVAL - is Lua able to call Redis API?} {
         r set mykey myval
         r eval {return redis.call('get',KEYS[1])} 1 mykey
@@ -526,6 +541,164 @@ start_server {tags {"scripting"}} {
     }
 }
 
+start_server {tags {"scripting"}} {
+    # Write to 'counter' until 'stop' is set by another client.
+    set loop {
+        redis.allow_yield()
+        local i = 0
+        while not redis.call('get','stop') and i < 10000000 do
+            i = i + 1
+            redis.call('set','counter',i)
+        end
+        return i
+    }
+    # Spin for 300 milliseconds calling TIME.
+    set spin {
+        if ARGV[1] == 'yield' then redis.allow_yield() end
+        local t = redis.call('time')
+        local start = t[1]*1000000+t[2]
+        repeat t = redis.call('time') until t[1]*1000000+t[2]-start > 300000
+        return 1
+    }
+
+    test {Scripts that allow it yield to the other clients} {
+        r del stop counter
+        set rd [redis_deferring_client]
+        $rd eval $loop 0
+        after 100
+        assert_equal PONG [r ping]
+        assert {[r get counter] > 0}
+        r set stop 1
+        set n [$rd read]
+        assert {$n > 0 && $n < 10000000}
+        assert_equal $n [r get counter]
+    }
+
+    test {Scripts don't yield unless they allow it} {
+        foreach mode {atomic yield} {
+            $rd eval $spin 0 $mode
+            after 50
+            set start [clock milliseconds]
+            r ping
+            set elapsed($mode) [expr {[clock milliseconds]-$start}]
+            assert_equal 1 [$rd read]
+        }
+        assert {$elapsed(atomic) >= 150}
+        assert {$elapsed(yield) < 150}
+    }
+
+    test {Pipelined scripts that yield are all executed} {
+        r config resetstat
+        set proto {}
+        foreach j {1 2 3} {
+            set args [list eval $spin 0 yield]
+            append proto "*[llength $args]\r\n"
+            foreach arg $args {
+                append proto "\$[string length $arg]\r\n$arg\r\n"
+            }
+        }
+        $rd write $proto
+        $rd flush
+        # Commands of other clients run while each of the scripts yields.
+        for {set j 0} {$j < 10} {incr j} {
+            assert_equal PONG [r ping]
+            after 50
+        }
+        wait_for_condition 50 100 {
+            [string match {*cmdstat_eval:calls=3,*} [r info commandstats]]
+        } else {
+            fail "Pipelined scripts not executed without further input"
+        }
+        foreach j {1 2 3} {assert_equal 1 [$rd read]}
+    }
+
+    test {Scripts and SCRIPT FLUSH are refused while a script yielded} {
+        r del stop
+        $rd eval $loop 0
+        after 100
+        catch {r eval {return 1} 0} e
+        assert_match {BUSY*} $e
+        r multi
+        r eval {return 1} 0
+        catch {r exec} e
+        assert_match {*BUSY*} $e
+        catch {r script flush} e
+        assert_match {BUSY*} $e
+        r set stop 1
+        assert {[$rd read] > 0}
+        r eval {return 1} 0
+    } {1}
+
+    test {Yielding scripts that wrote can be killed by SCRIPT KILL} {
+        r del stop
+        $rd eval $loop 0
+        after 100
+        r script kill
+        catch {$rd read} e
+        assert_match {*killed by user*} $e
+        assert_equal PONG [r ping]
+        $rd ping
+        assert_equal PONG [$rd read]
+    }
+
+    test {Scripts calling redis.no_writes() can't write} {
+        catch {r eval {redis.no_writes(); redis.call('set','x','1')} 0} e
+        assert_match {*not allowed after redis.no_writes()*} $e
+        r eval {redis.call('set','x','1'); return redis.no_writes()} 0
+    } {}
+
+    test {Keys are actively expired while a script yields} {
+        r del stop
+        $rd eval $loop 0
+        after 100
+        set expired [s expired_keys]
+        r set volatile 1 px 50
+        wait_for_condition 50 100 {
+            [s expired_keys] > $expired
+        } else {
+            fail "Active expire not performed while the script yields"
+        }
+        r set stop 1
+        assert {[$rd read] > 0}
+    }
+
+    test {Writes during a yield are in the AOF before the reply} {
+        r config set appendonly yes
+        wait_for_condition 50 100 {
+            [s aof_rewrite_in_progress] == 0 &&
+            [s aof_rewrite_scheduled] == 0
+        } else {
+            fail "AOF rewrite not terminated"
+        }
+        r config set appendfsync always
+        r del stop
+        $rd eval $loop 0
+        after 100
+        r set aofkey aofvalue
+        set aof [file join [lindex [r config get dir] 1] appendonly.aof]
+        set fp [open $aof r]
+        set content [read $fp]
+        close $fp
+        r set stop 1
+        assert {[$rd read] > 0}
+        r config set appendonly no
+        r config set appendfsync everysec
+        string match {*aofvalue*} $content
+    } {1}
+
+    test {No yield with lua-time-slice set to 0} {
+        r config set lua-time-slice 0
+        $rd eval $spin 0 yield
+        after 50
+        set start [clock milliseconds]
+        r ping
+        r config set lua-time-slice 10
+        assert_equal 1 [$rd read]
+        $rd close
+        expr {[clock milliseconds]-$start >= 150}
+    } {1}
+}
+
 foreach cmdrepl {0 1} {
     start_server {tags {"scripting repl"}} {
         start_server {} {
@@ -730,6 +903,34 @@ start_server {tags {"scripting repl"}} {
                 fail "Time key does not match between master and slave"
             }
         }
+
+        test "Scripts that yielded are replicated as single commands" {
+            r del stop list
+            set rd [redis_deferring_client]
+            $rd eval {
+                redis.allow_yield()
+                local i = 0
+                while not redis.call('get','stop') do
+                    i = i + 1
+                    redis.call('rpush','list',i)
+                end
+                return i
+            } 0
+            after 100
+            r rpush list other
+            r set stop 1
+            assert {[$rd read] > 0}
+            $rd close
+            set list [r lrange list 0 -1]
+            assert {[lsearch $list other] > 0}
+            wait_for_condition 50 100 {
+                [r -1 lrange list 0 -1] eq $list
+            } else {
+                fail "Master-Slave desync after a script that yielded"
+            }
+            r debug loadaof
+            assert_equal $list [r lrange list 0 -1]
+        }
     }
 }
 
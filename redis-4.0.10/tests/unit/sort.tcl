@@ -39,8 +39,8 @@ start_server {
         1000 lpush quicklist "Old Linked list"
         10000 lpush quicklist "Old Big Linked list"
         16 sadd intset "Intset"
-        1000 sadd hashtable "Hash table"
-        10000 sadd hashtable "Big Hash table"
+        1000 sadd roaring "Roaring bitmap"
+        10000 sadd roaring "Big Roaring bitmap"
     } {
         set result [create_random_dataset $num $cmd]
         assert_encoding $enc tosort
@@ -0,0 +1,366 @@
+start_server {tags {"hash" "expire"}} {
+    test {HEXPIRE - set and read field TTLs} {
+        r del myhash
+        r hset myhash f1 v1 f2 v2 f3 v3
+        assert_equal {1 1 -2} [r hexpire myhash 100 FIELDS 3 f1 f2 nofield]
+        set ttl [r httl myhash FIELDS 3 f1 f3 nofield]
+        assert_range [lindex $ttl 0] 90 100
+        assert_equal {-1 -2} [lrange $ttl 1 2]
+        assert_range [lindex [r hpttl myhash FIELDS 1 f2] 0] 90000 100000
+    }
+
+    test {HEXPIRE - missing key and wrong type} {
+        r del nokey
+        assert_equal {-2 -2} [r hexpire nokey 100 FIELDS 2 a b]
+        assert_equal {-2} [r httl nokey FIELDS 1 a]
+        r set str foo
+        assert_error {*WRONGTYPE*} {r hexpire str 100 FIELDS 1 a}
+        assert_error {*WRONGTYPE*} {r httl str FIELDS 1 a}
+    }
+
+    test {HEXPIRE - syntax errors} {
+        r del myhash
+        r hset myhash f1 v1
+        assert_error {*syntax*} {r hexpire myhash 100 FOO 1 f1}
+        assert_error {*syntax*} {r hexpire myhash 100 NX FOO 1 f1}
+        assert_error {*numfields*} {r hexpire myhash 100 FIELDS 2 f1}
+        assert_error {*numfields*} {r hexpire myhash 100 FIELDS 0 f1}
+        assert_error {*not an integer*} {r hexpire myhash 100 FIELDS x f1}
+        assert_error {*invalid expire*} {r hexpire myhash -1 FIELDS 1 f1}
+    }
+
+    test {HEXPIRE - NX/XX/GT/LT conditions} {
+        r del myhash
+        r hset myhash f1 v1 f2 v2 f3 v3
+        assert_equal {0 0} [r hexpire myhash 100 XX FIELDS 2 f1 f2]
+        assert_equal {0} [r hexpire myhash 100 GT FIELDS 1 f1]
+        assert_equal {1} [r hexpire myhash 100 NX FIELDS 1 f1]
+        assert_equal {0 1} [r hexpire myhash 200 NX FIELDS 2 f1 f2]
+        assert_equal {0 1} [r hexpire myhash 150 GT FIELDS 2 f2 f1]
+        assert_equal {0 1} [r hexpire myhash 170 LT FIELDS 2 f1 f2]
+        assert_equal {1} [r hexpire myhash 50 LT FIELDS 1 f3]
+        assert_equal {1} [r hexpire myhash 300 XX FIELDS 1 f2]
+        assert_range [lindex [r httl myhash FIELDS 1 f1] 0] 140 150
+        assert_range [lindex [r httl myhash FIELDS 1 f2] 0] 290 300
+        assert_range [lindex [r httl myhash FIELDS 1 f3] 0] 40 50
+    }
+
+    test {HEXPIRE - small hashes are listpack encoded until a TTL is set} {
+        r del myhash
+        r hset myhash f1 v1 f2 v2
+        assert_encoding listpack myhash
+        r hexpire myhash 100 FIELDS 1 nofield
+        assert_encoding listpack myhash
+        r hexpire myhash 100 FIELDS 1 f1
+        assert_encoding hashtable myhash
+    }
+
+    test {Hashes are converted back to listpack when the last TTL is removed} {
+        r del myhash
+        r hset myhash f1 v1 f2 v2 f3 v3
+        r hexpire myhash 100 FIELDS 3 f1 f2 f3
+        r hpersist myhash FIELDS 1 f1
+        r hdel myhash f2
+        assert_encoding hashtable myhash
+        r hset myhash f3 new
+        assert_encoding listpack myhash
+        assert_equal {f1 f3 new v1} [lsort [r hgetall myhash]]
+
+        # Clearing the last TTL while setting a big value.
+        r hpexpire myhash 100 FIELDS 1 f1
+        r hset myhash f1 v1 f4 [string repeat x 100]
+        assert_encoding hashtable myhash
+        assert_equal 100 [r hstrlen myhash f4]
+
+        # Hashes too big for a listpack are kept as they are.
+        r hpexpire myhash 1 FIELDS 1 f3
+        after 10
+        r hget myhash f3
+        assert_encoding hashtable myhash
+        r hdel myhash f4
+        r hset myhash f5 v5
+        r hpexpire myhash 1 FIELDS 1 f5
+        after 10
+        r hget myhash f1
+        assert_encoding listpack myhash
+        assert_equal {f1 v1} [r hgetall myhash]
+    }
+
+    test {HEXPIRE - a time in the past deletes the field} {
+        r del myhash
+        r hset myhash f1 v1 f2 v2
+        assert_equal {2} [r hexpireat myhash 1 FIELDS 1 f1]
+        assert_equal {f2 v2} [r hgetall myhash]
+        assert_equal {2} [r hpexpire myhash 0 FIELDS 1 f2]
+        r exists myhash
+    } {0}
+
+    test {HPERSIST - remove field TTLs} {
+        r del myhash
+        r hset myhash f1 v1 f2 v2
+        r hexpire myhash 100 FIELDS 1 f1
+        assert_equal {1 -1 -2} [r hpersist myhash FIELDS 3 f1 f2 nofield]
+        assert_equal {-1 -1} [r httl myhash FIELDS 2 f1 f2]
+        assert_equal {-2} [r hpersist nokey FIELDS 1 f1]
+    }
+
+    test {HSET clears the field TTL, HINCRBY keeps it} {
+        r del myhash
+        r hset myhash f1 v1 f2 10 f3 1.5
+        r hexpire myhash 100 FIELDS 3 f1 f2 f3
+        r hset myhash f1 v2
+        r hincrby myhash f2 1
+        r hincrbyfloat myhash f3 1
+        assert_equal {-1} [r httl myhash FIELDS 1 f1]
+        assert_range [lindex [r httl myhash FIELDS 1 f2] 0] 90 100
+        assert_range [lindex [r httl myhash FIELDS 1 f3] 0] 90 100
+    }
+
+    test {HDEL removes the field TTL} {
+        r del myhash
+        r hset myhash f1 v1 f2 v2
+        r hexpire myhash 100 FIELDS 1 f1
+        r hdel myhash f1
+        r hset myhash f1 v1
+        r httl myhash FIELDS 1 f1
+    } {-1}
+
+    test {Fields are expired lazily on access} {
+        r debug set-active-expire 0
+        r del myhash
+        r hset myhash f1 v1 f2 v2 f3 v3
+        set expired [s expired_fields]
+        r hpexpire myhash 10 FIELDS 2 f1 f2
+        after 20
+        assert_equal {f3 v3} [r hgetall myhash]
+        assert_equal [expr {$expired+2}] [s expired_fields]
+        r hpexpire myhash 10 FIELDS 1 f3
+        after 20
+        r debug set-active-expire 1
+        r exists myhash
+    } {0}
+
+    test {Lookups delete a bounded number of fields and hide the others} {
+        r flushall
+        r debug set-active-expire 0
+        set fields {}
+        for {set j 0} {$j < 100} {incr j} {lappend fields f$j}
+        foreach f $fields {r hset myhash $f 1}
+        r hset myhash keep 1
+        set expired [s expired_fields]
+        r hpexpire myhash 10 FIELDS 100 {*}$fields
+        after 20
+        assert_equal {} [r hget myhash f99]
+        assert_equal [expr {$expired+20}] [s expired_fields]
+        assert_equal {1 {keep 1}} [list [r hlen myhash] [r hgetall myhash]]
+        assert_equal {{}} [r hmget myhash f98]
+        assert_equal {0 0} [list [r hexists myhash f97] [r hstrlen myhash f97]]
+        assert_equal {keep 1} [lindex [r hscan myhash 0 COUNT 1000] 1]
+        r rpush mylist hash
+        assert_equal {{} 1} [r sort mylist BY nosort GET my*->f96 GET my*->keep]
+        r del mylist
+        r hdel myhash keep
+        # Only fields with an elapsed TTL are left.
+        r config resetstat
+        assert_equal {0 0} [list [r exists myhash] [r hlen myhash]]
+        # EXISTS does not count as a keyspace miss.
+        assert_equal 1 [s keyspace_misses]
+        r debug set-active-expire 1
+        wait_for_condition 50 100 {
+            [r dbsize] == 0
+        } else {
+            fail "Hidden fields were not actively expired"
+        }
+    }
+
+    test {Write commands treat fields with an elapsed TTL as missing} {
+        r flushall
+        r debug set-active-expire 0
+        set fields {}
+        for {set j 0} {$j < 100} {incr j} {lappend fields f$j}
+        foreach f $fields {r hset myhash $f 1}
+        r hset myhash a 1 b 1 c 1 d 1 e 1 keep 1
+        r hpexpire myhash 10 FIELDS 100 {*}$fields
+        # Every lookup deletes 20 fields: these expire after the others, so
+        # they are still there when the commands access them.
+        r hpexpire myhash 20 FIELDS 5 a b c d e
+        after 30
+        set repl [attach_to_replication_stream]
+        assert_equal 1 [r hsetnx myhash a 2]
+        assert_equal 5 [r hincrby myhash b 5]
+        assert_equal 1 [r hset myhash c 3]
+        assert_equal 0 [r hdel myhash d]
+        assert_equal {-2} [r hpersist myhash FIELDS 1 e]
+        assert_equal {2 5 3 {} {} 1} [r hmget myhash a b c d e keep]
+        assert_equal {-1 -1 -1} [r httl myhash FIELDS 3 a b c]
+        r debug set-active-expire 1
+        assert_replication_stream $repl {
+            {select *}
+            {hdel myhash *}
+            {hset myhash a 2}
+            {hdel myhash *}
+            {hset myhash b 5}
+            {hdel myhash *}
+            {hset myhash c 3}
+            {hdel myhash *}
+            {hdel myhash d}
+            {hdel myhash *}
+            {hdel myhash e}
+        }
+        close_replication_stream $repl
+    }
+
+    test {Fields are expired actively} {
+        r flushall
+        r config resetstat
+        r debug set-active-expire 1
+        for {set j 0} {$j < 50} {incr j} {
+            r hset myhash$j a 1 b 2
+            r hpexpire myhash$j 50 FIELDS 1 a
+        }
+        r hset persistent a 1 b 2
+        r hpexpire persistent 100000 FIELDS 1 a
+        wait_for_condition 50 100 {
+            [r dbsize] == 51 && [s expired_fields] >= 50
+        } else {
+            fail "Fields were not actively expired"
+        }
+        assert_equal {b 2} [r hgetall myhash0]
+        r hlen persistent
+    } {2}
+
+    test {Active expire deletes hashes once all their fields expired} {
+        r flushall
+        for {set j 0} {$j < 50} {incr j} {
+            r hset myhash$j a 1
+            r hpexpire myhash$j 50 FIELDS 1 a
+        }
+        wait_for_condition 50 100 {
+            [r dbsize] == 0
+        } else {
+            fail "Hashes were not actively expired"
+        }
+    }
+
+    test {Field TTLs follow RENAME, MOVE and SWAPDB} {
+        r flushall
+        r hset myhash f1 v1 f2 v2
+        r hexpire myhash 100 FIELDS 1 f1
+        r rename myhash newhash
+        assert_range [lindex [r httl newhash FIELDS 1 f1] 0] 90 100
+        r move newhash 10
+        r select 10
+        assert_range [lindex [r httl newhash FIELDS 1 f1] 0] 90 100
+        r swapdb 10 11
+        r select 11
+        assert_range [lindex [r httl newhash FIELDS 1 f1] 0] 90 100
+        r flushall
+        r select 9
+    } {OK}
+
+    test {Field TTLs survive DEBUG RELOAD, DUMP/RESTORE and AOF rewrite} {
+        r flushall
+        r hset myhash f1 v1 f2 v2 f3 v3
+        r hexpire myhash 100 FIELDS 1 f1
+        r hpexpireat myhash 99999999999999 FIELDS 1 f2
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_range [lindex [r httl myhash FIELDS 1 f1] 0] 90 100
+        assert {[lindex [r hpttl myhash FIELDS 1 f2] 0] > 1000000}
+        assert_equal {-1} [r httl myhash FIELDS 1 f3]
+        set dump [r dump myhash]
+        r del myhash
+        r restore myhash 0 $dump
+        assert_equal $digest [r debug digest]
+        r config set appendonly yes
+        waitForBgrewriteaof r
+        r debug loadaof
+        r config set appendonly no
+        assert_equal $digest [r debug digest]
+        assert_range [lindex [r httl myhash FIELDS 1 f1] 0] 90 100
+    }
+
+    test {Field TTLs are part of DEBUG DIGEST} {
+        r flushall
+        r hset myhash f1 v1
+        set digest [r debug digest]
+        r hexpire myhash 100 FIELDS 1 f1
+        assert {$digest ne [r debug digest]}
+        r hpersist myhash FIELDS 1 f1
+        assert_equal $digest [r debug digest]
+    }
+
+    test {HEXPIRE is propagated as HPEXPIREAT and HDEL} {
+        r flushall
+        r hset myhash f1 v1 f2 v2 f3 3
+        set repl [attach_to_replication_stream]
+        r hexpire myhash 100 FIELDS 3 f1 f2 nofield
+        r hexpire myhash 100 NX FIELDS 1 f1
+        r hexpireat myhash 1 FIELDS 1 f2
+        r hpersist myhash FIELDS 1 f1
+        r hexpire myhash 100 FIELDS 1 f3
+        r hincrbyfloat myhash f3 1
+        r debug set-active-expire 0
+        r hpexpire myhash 10 FIELDS 1 f3
+        after 20
+        r hgetall myhash
+        r debug set-active-expire 1
+        assert_replication_stream $repl {
+            {select *}
+            {hpexpireat myhash * FIELDS 2 f1 f2}
+            {hdel myhash f2}
+            {hpersist myhash FIELDS 1 f1}
+            {hpexpireat myhash * FIELDS 1 f3}
+            {hset myhash f3 4}
+            {hpexpireat myhash * FIELDS 1 f3}
+            {hpexpireat myhash * FIELDS 1 f3}
+            {hdel myhash f3}
+        }
+        close_replication_stream $repl
+    }
+}
+
+start_server {tags {"hash" "expire" "repl"}} {
+    start_server {} {
+        test {Slaves hide fields with an elapsed TTL} {
+            r -1 slaveof [srv 0 host] [srv 0 port]
+            wait_for_condition 50 100 {
+                [string match {*master_link_status:up*} [r -1 info replication]]
+            } else {
+                fail "Can't turn the instance into a slave"
+            }
+            r debug set-active-expire 0
+            r hset myhash f1 v1 f2 v2
+            r hpexpire myhash 50 FIELDS 1 f1
+            r hset other f1 v1
+            r hpexpire other 50 FIELDS 1 f1
+            r rpush mylist hash
+            wait_for_condition 50 100 {
+                [r -1 exists other] == 1
+            } else {
+                fail "The slave did not receive the hashes"
+            }
+            after 100
+            assert_equal {} [r -1 hget myhash f1]
+            assert_equal {f2 v2} [r -1 hgetall myhash]
+            assert_equal {1 0} [list [r -1 hlen myhash] [r -1 hexists myhash f1]]
+            assert_equal {-2} [r -1 httl myhash FIELDS 1 f1]
+            assert_equal 0 [r -1 exists other]
+            # SORT is a write command because of STORE.
+            r -1 config set slave-read-only no
+            assert_equal {{} v2} [r -1 sort mylist BY nosort GET my*->f1 GET my*->f2]
+            r -1 config set slave-read-only yes
+            # The fields are still there until the master deletes them.
+            assert_equal 3 [r -1 dbsize]
+            r hget myhash f1
+            r hget other f1
+            wait_for_condition 50 100 {
+                [r -1 dbsize] == 2
+            } else {
+                fail "The slave did not receive the HDELs of the master"
+            }
+            r debug set-active-expire 1
+        }
+    }
+}
@@ -56,6 +56,14 @@ start_server {
         for {set i 0} {$i < 512} {incr i} { r sadd myset $i }
         assert_encoding intset myset
         assert_equal 1 [r sadd myset 512]
+        assert_encoding roaring myset
+    }
+
+    test "SADD overflows the intset with sparse integers" {
+        r del myset
+        for {set i 0} {$i < 512} {incr i} { r sadd myset [expr {$i*100000}] }
+        assert_encoding intset myset
+        assert_equal 1 [r sadd myset 512]
         assert_encoding hashtable myset
     }
 
@@ -72,12 +80,12 @@ start_server {
         for {set i 0} {$i < 1280} {incr i} { r sadd mylargeintset $i }
         for {set i 0} {$i <  256} {incr i} { r sadd myhashset [format "i%03d" $i] }
         assert_encoding intset myintset
-        assert_encoding hashtable mylargeintset
+        assert_encoding roaring mylargeintset
         assert_encoding hashtable myhashset
 
         r debug reload
         assert_encoding intset myintset
-        assert_encoding hashtable mylargeintset
+        assert_encoding roaring mylargeintset
         assert_encoding hashtable myhashset
     }
 
@@ -163,6 +171,20 @@ start_server {
             assert_equal [list 195 196 197 198 199 $large] [lsort [r smembers setres]]
         }
 
+        test "SINTERCARD with two and three sets - $type" {
+            assert_equal 6 [r sintercard 2 set1 set2]
+            assert_equal 3 [r sintercard 3 set1 set2 set3]
+            assert_equal 201 [r sintercard 1 set1]
+            assert_equal 0 [r sintercard 2 set1 nokey]
+        }
+
+        test "SINTERCARD with LIMIT - $type" {
+            assert_equal 4 [r sintercard 2 set1 set2 LIMIT 4]
+            assert_equal 6 [r sintercard 2 set1 set2 limit 0]
+            assert_equal 6 [r sintercard 2 set1 set2 limit 100]
+            assert_equal 1 [r sintercard 3 set1 set2 set3 limit 1]
+        }
+
         test "SUNION with two sets - $type" {
             set expected [lsort -uniq "[r smembers set1] [r smembers set2]"]
             assert_equal $expected [lsort [r sunion set1 set2]]
@@ -273,6 +295,73 @@ start_server {
         lsort [r sinter set1 set2]
     } {1 2 3}
 
+    test "SINTERCARD against non-set should throw error" {
+        r set key1 x
+        assert_error "WRONGTYPE*" {r sintercard 2 key1 noset}
+    }
+
+    test "SINTERCARD syntax errors" {
+        assert_error "*greater than 0*" {r sintercard 0 set1}
+        assert_error "*not an integer*" {r sintercard a set1}
+        assert_error "*can't be greater*" {r sintercard 3 set1 set2}
+        assert_error "*can't be negative*" {r sintercard 1 set1 limit -1}
+        assert_error "*syntax*" {r sintercard 1 set1 limit}
+        assert_error "*syntax*" {r sintercard 1 set1 foo 1}
+    }
+
+    test "COMMAND GETKEYS SINTERCARD" {
+        r command getkeys sintercard 2 key1 key2 limit 1
+    } {key1 key2}
+
+    test "SINTER, SINTERCARD, SUNION and SDIFF fuzzing with mixed encodings" {
+        for {set j 0} {$j < 100} {incr j} {
+            set args {}
+            set num_sets [expr {[randomInt 10]+1}]
+            for {set i 0} {$i < $num_sets} {incr i} {
+                r del set_$i
+                lappend args set_$i
+                # Sets of integers are intsets unless a string is added.
+                set elements {}
+                for {set k [randomInt 100]} {$k > 0} {incr k -1} {
+                    lappend elements [randomInt 150]
+                }
+                if {[randomInt 2]} {lappend elements [randomValue]}
+                if {[llength $elements]} {r sadd set_$i {*}$elements}
+            }
+            # Compute the expected results from the sets content.
+            set union [r smembers set_0]
+            set inter $union
+            set diff $union
+            for {set i 1} {$i < $num_sets} {incr i} {
+                set members [r smembers set_$i]
+                lappend union {*}$members
+                set keep {}
+                foreach e $inter {
+                    if {[lsearch -exact $members $e] != -1} {lappend keep $e}
+                }
+                set inter $keep
+                set keep {}
+                foreach e $diff {
+                    if {[lsearch -exact $members $e] == -1} {lappend keep $e}
+                }
+                set diff $keep
+            }
+            set union [lsort -unique $union]
+            set inter [lsort $inter]
+            set diff [lsort $diff]
+            assert_equal $union [lsort [r sunion {*}$args]]
+            assert_equal $inter [lsort [r sinter {*}$args]]
+            assert_equal $diff [lsort [r sdiff {*}$args]]
+            assert_equal [llength $inter] [r sintercard $num_sets {*}$args]
+            assert_equal [expr {min([llength $inter],2)}] \
+                         [r sintercard $num_sets {*}$args limit 2]
+            assert_equal [llength $union] [r sunionstore res {*}$args]
+            assert_equal $union [lsort [r smembers res]]
+            assert_equal [llength $diff] [r sdiffstore res {*}$args]
+            assert_equal $diff [lsort [r smembers res]]
+        }
+    }
+
     test "SINTERSTORE against non existing keys should delete dstkey" {
         r set setres xxx
         assert_equal 0 [r sinterstore setres foo111 bar222]
@@ -563,6 +652,196 @@ start_server {
         lsort [r smembers set]
     } {a b c}
 
+    proc create_roaring_set {key min max step} {
+        r del $key
+        set args {}
+        for {set i $min} {$i < $max} {incr i $step} { lappend args $i }
+        r sadd $key {*}$args
+    }
+
+    # Create a hashtable encoded copy of the set 'src', used to check the
+    # results of the roaring code paths against the generic ones.
+    proc create_hashtable_copy {dst src} {
+        r del $dst
+        r sunionstore $dst $src
+        r sadd $dst foo
+        r srem $dst foo
+        assert_encoding hashtable $dst
+    }
+
+    test "Roaring sets - basics" {
+        create_roaring_set myset 0 10000 1
+        r sadd myset -1 -70000 9223372036854775807 -9223372036854775808
+        assert_encoding roaring myset
+        assert_equal 10004 [r scard myset]
+        assert_equal 1 [r sismember myset 9223372036854775807]
+        assert_equal 1 [r sismember myset -9223372036854775808]
+        assert_equal 1 [r sismember myset 5000]
+        assert_equal 0 [r sismember myset 10000]
+        assert_equal 0 [r sismember myset foo]
+        assert_equal 0 [r sadd myset 42]
+        assert_equal 2 [r srem myset 42 -70000 foo 20000]
+        assert_equal 0 [r sismember myset 42]
+        assert_equal 10002 [r scard myset]
+        assert_equal 1 [r sismember myset [r srandmember myset]]
+        assert_equal 50 [llength [lsort -unique [r srandmember myset 50]]]
+        set popped [r spop myset 100]
+        assert_equal 100 [llength [lsort -unique $popped]]
+        assert_equal 9902 [r scard myset]
+        assert_equal 0 [r sismember myset [lindex $popped 0]]
+        assert_encoding roaring myset
+    }
+
+    test "Roaring sets - SPOP with count over many containers" {
+        # About 20 elements in each of 1000 containers.
+        create_roaring_set myset 0 [expr {1000*65536}] 3277
+        assert_encoding roaring myset
+        set members [lsort -integer [r smembers myset]]
+        set card [r scard myset]
+        set popped {}
+        for {set j 0} {$j < 10} {incr j} {
+            lappend popped {*}[r spop myset 1500]
+        }
+        assert_equal 15000 [llength [lsort -unique $popped]]
+        assert_equal [expr {$card-15000}] [r scard myset]
+        assert_equal $members [lsort -integer [concat $popped [r smembers myset]]]
+    }
+
+    test "Roaring sets - adding a non-integer converts to hashtable" {
+        create_roaring_set myset 0 1000 1
+        assert_encoding roaring myset
+        assert_equal 1 [r sadd myset a]
+        assert_encoding hashtable myset
+        assert_equal 1001 [r scard myset]
+        assert_equal 1 [r sismember myset 999]
+    }
+
+    test "Roaring sets - set-roaring-min-density" {
+        r config set set-roaring-min-density 0
+        create_roaring_set myset 0 1000 1
+        assert_encoding hashtable myset
+        r config set set-roaring-min-density 100
+        create_roaring_set myset 0 1000000 1000
+        assert_encoding hashtable myset
+        r config set set-roaring-min-density 16
+        create_roaring_set myset 0 1000000 1000
+        assert_encoding roaring myset
+    }
+
+    test "Roaring sets - SINTER, SUNION, SDIFF match the generic implementation" {
+        # Dense containers become bitmaps, sparser ones stay arrays.
+        create_roaring_set set1 -10000 30000 1
+        create_roaring_set set2 0 60000 3
+        create_roaring_set set3 -5000 150000 7
+        create_set set4 {5 10 15 -5000 29997 400000}
+        foreach key {set1 set2 set3} {
+            assert_encoding roaring $key
+            create_hashtable_copy h$key $key
+        }
+        create_set hset4 {5 10 15 -5000 29997 400000 foo}
+        foreach {roaring generic} {
+            {set1 set2} {hset1 hset2}
+            {set2 set1 set3} {hset2 hset1 hset3}
+            {set1 set4} {hset1 hset4}
+            {set3 set2 nokey} {hset3 hset2 nokey}
+        } {
+            foreach cmd {sinter sunion sdiff} {
+                # hset4 needs an extra "foo" element to be a hashtable.
+                set expected [lsort [r $cmd {*}$generic]]
+                set expected [lsearch -all -inline -not $expected foo]
+                assert_equal $expected [lsort [r $cmd {*}$roaring]]
+            }
+        }
+    }
+
+    test "Roaring sets - SINTERCARD" {
+        create_roaring_set set1 0 100000 1
+        create_roaring_set set2 50000 200000 3
+        create_roaring_set set3 0 200000 7
+        r sadd small 1 60000 60003 60004 1000000
+        assert_equal [r scard set1] [r sintercard 1 set1]
+        foreach keys {
+            {set1 set2} {set2 set1 set3} {set1 small} {small set2 set3}
+        } {
+            set card [llength [r sinter {*}$keys]]
+            assert_equal $card [r sintercard [llength $keys] {*}$keys]
+            assert_equal [expr {min($card,10)}] \
+                         [r sintercard [llength $keys] {*}$keys limit 10]
+        }
+        assert_equal 0 [r sintercard 2 set1 nokey]
+    }
+
+    test "Roaring sets - STORE variants pick the result encoding" {
+        create_roaring_set set1 0 10000 1
+        create_roaring_set set2 5000 15000 1
+        assert_equal 5000 [r sinterstore res set1 set2]
+        assert_encoding roaring res
+        assert_equal 15000 [r sunionstore res set1 set2]
+        assert_encoding roaring res
+        assert_equal 5000 [r sdiffstore res set1 set2]
+        assert_encoding roaring res
+        assert_equal {0 1 2} [lrange [lsort -integer [r smembers res]] 0 2]
+        r sadd small 1 2 3 200000
+        assert_equal 3 [r sinterstore res set1 small]
+        assert_encoding intset res
+        assert_equal 0 [r sinterstore res set1 nokey]
+        assert_equal 0 [r exists res]
+        assert_equal 0 [r sdiffstore res set1 set1]
+        assert_equal 0 [r exists res]
+    }
+
+    test "Roaring sets - SSCAN returns every element" {
+        create_roaring_set myset -70000 70000 3
+        r sadd myset 9223372036854775807 -9223372036854775808
+        assert_encoding roaring myset
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r sscan myset $cur count 500]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        assert_equal [lsort [r smembers myset]] [lsort $keys]
+        assert_equal [r scard myset] [llength $keys]
+        set res [r sscan myset 0 count 10000000 match *99]
+        assert_equal 0 [lindex $res 0]
+        assert_equal [lsort [lsearch -all -inline [r smembers myset] *99]] \
+                     [lsort [lindex $res 1]]
+    }
+
+    test "Roaring sets - DEBUG RELOAD, DUMP/RESTORE and AOF rewrite" {
+        r flushall
+        create_roaring_set myset -10000 10000 1
+        r sadd myset -9223372036854775808 9223372036854775807
+        create_roaring_set myset2 0 200000 20
+        set digest [r debug digest]
+        r debug reload
+        assert_encoding roaring myset
+        assert_encoding roaring myset2
+        assert_equal $digest [r debug digest]
+        set dump [r dump myset]
+        r del myset
+        r restore myset 0 $dump
+        assert_encoding roaring myset
+        assert_equal $digest [r debug digest]
+        r config set appendonly yes
+        waitForBgrewriteaof r
+        r debug loadaof
+        r config set appendonly no
+        assert_encoding roaring myset
+        assert_equal $digest [r debug digest]
+    }
+
+    test "Roaring sets - ZUNIONSTORE and ZINTERSTORE with roaring sources" {
+        create_roaring_set myset 0 1000 1
+        r zadd myzset 2 5 3 2000 4 foo
+        assert_equal 1002 [r zunionstore res 2 myset myzset]
+        assert_equal 3 [r zscore res 5]
+        assert_equal 1 [r zinterstore res 2 myset myzset]
+        assert_equal {5 3} [r zrange res 0 -1 withscores]
+    }
+
     tags {slow} {
         test {intsets implementation stress testing} {
             for {set j 0} {$j < 20} {incr j} {
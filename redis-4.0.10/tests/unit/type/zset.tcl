@@ -613,6 +613,62 @@ start_server {tags {"zset"}} {
             assert_equal {b 2 c 3} [r zrange zsetc 0 -1 withscores]
         }
 
+        test "ZUNION, ZINTER and ZDIFF basics - $encoding" {
+            r del zseta zsetb
+            r zadd zseta 1 a 2 b 3 c
+            r zadd zsetb 1 b 2 c 3 d
+            assert_equal {a b d c} [r zunion 2 zseta zsetb]
+            assert_equal {a 1 b 3 d 3 c 5} [r zunion 2 zseta zsetb withscores]
+            assert_equal {a 2 b 7 d 9 c 12} \
+                [r zunion 2 zseta zsetb weights 2 3 withscores]
+            assert_equal {b 3 c 5} [r zinter 2 zseta zsetb withscores]
+            assert_equal {b 1 c 2} \
+                [r zinter 2 zseta zsetb aggregate min withscores]
+            assert_equal {a 1} [r zdiff 2 zseta zsetb withscores]
+            assert_equal {} [r zinter 2 zseta nokey]
+            assert_equal {a b c} [r zdiff 2 zseta nokey]
+            assert_equal {} [r zdiff 2 nokey zseta]
+            assert_equal {} [r zdiff 2 zseta zseta]
+        }
+
+        test "ZUNION, ZINTER and ZDIFF with LIMIT and REV - $encoding" {
+            assert_equal {a b} [r zunion 2 zseta zsetb limit 2]
+            assert_equal {c 5 d 3} [r zunion 2 zseta zsetb rev limit 2 withscores]
+            assert_equal {a b d c} [r zunion 2 zseta zsetb limit 0]
+            assert_equal {c b} [r zinter 2 zseta zsetb rev]
+            assert_equal {b} [r zinter 2 zseta zsetb limit 1]
+            assert_equal {a b} [r zdiff 2 zseta nokey limit 2]
+            assert_equal {c 3 b 2} [r zdiff 2 zseta nokey rev limit 2 withscores]
+        }
+
+        test "ZUNION and ZDIFF with a regular set - $encoding" {
+            r del seta
+            r sadd seta a b c
+            assert_equal {a 2 b 5 c 8 d 9} \
+                [r zunion 2 seta zsetb weights 2 3 withscores]
+            assert_equal {c b a} [r zdiff 2 seta nokey rev]
+            assert_equal {a 1} [r zdiff 2 seta zsetb withscores]
+        }
+
+        test "ZDIFFSTORE basics - $encoding" {
+            assert_equal 1 [r zdiffstore zsetc 2 zseta zsetb]
+            assert_equal {a 1} [r zrange zsetc 0 -1 withscores]
+            assert_encoding $encoding zsetc
+            assert_equal 0 [r zdiffstore zsetc 2 zseta zseta]
+            assert_equal 0 [r exists zsetc]
+        }
+
+        test "ZUNION, ZINTER and ZDIFF errors - $encoding" {
+            r set str foo
+            assert_error "*WRONGTYPE*" {r zunion 2 zseta str}
+            assert_error "*syntax*" {r zdiff 2 zseta zsetb weights 1 2}
+            assert_error "*syntax*" {r zdiff 2 zseta zsetb aggregate min}
+            assert_error "*syntax*" {r zunionstore zsetc 2 zseta zsetb withscores}
+            assert_error "*syntax*" {r zinter 3 zseta zsetb}
+            assert_error "*at least 1*" {r zinter 0 zseta}
+            assert_error "*negative*" {r zunion 1 zseta limit -1}
+        }
+
         foreach cmd {ZUNIONSTORE ZINTERSTORE} {
             test "$cmd with +inf/-inf scores - $encoding" {
                 r del zsetinf1 zsetinf2
@@ -696,6 +752,45 @@ start_server {tags {"zset"}} {
         }
     }
 
+    test "ZUNION and ZINTER with LIMIT and REV match the STORE variants" {
+        # Small limits on big inputs walk the inputs in score order, that
+        # must return the same elements and scores of the full aggregation.
+        r config set zset-max-ziplist-entries 128
+        r config set zset-max-ziplist-value 64
+        for {set j 0} {$j < 50} {incr j} {
+            r del z1 z2 z3 s1
+            for {set i 0} {$i < 300} {incr i} {
+                r zadd z1 [randomInt 100] e[randomInt 500]
+                r zadd z2 [expr {[randomInt 200]-100}] e[randomInt 500]
+            }
+            for {set i 0} {$i < 50} {incr i} {
+                r zadd z3 [expr {rand()}] e[randomInt 500]
+                r sadd s1 e[randomInt 500]
+            }
+            set keys [lrange {z1 z2 z3 s1} 0 [randomInt 4]]
+            set numkeys [llength $keys]
+            set opts {}
+            foreach k $keys {lappend opts [lindex {1 2 -1 0.5 0} [randomInt 5]]}
+            set opts [list weights {*}$opts aggregate \
+                [lindex {sum min max} [randomInt 3]]]
+            set limit [expr {[randomInt 30]+1}]
+            foreach cmd {zunion zinter} {
+                r ${cmd}store dst $numkeys {*}$keys {*}$opts
+                assert_equal [r zrange dst 0 -1 withscores] \
+                    [r $cmd $numkeys {*}$keys {*}$opts withscores]
+                assert_equal [r zrange dst 0 [expr {$limit-1}] withscores] \
+                    [r $cmd $numkeys {*}$keys {*}$opts limit $limit withscores]
+                assert_equal [r zrevrange dst 0 [expr {$limit-1}] withscores] \
+                    [r $cmd $numkeys {*}$keys {*}$opts rev limit $limit withscores]
+            }
+            r zdiffstore dst $numkeys {*}$keys
+            assert_equal [r zrange dst 0 -1 withscores] \
+                [r zdiff $numkeys {*}$keys withscores]
+            assert_equal [r zrevrange dst 0 [expr {$limit-1}]] \
+                [r zdiff $numkeys {*}$keys rev limit $limit]
+        }
+    }
+
     test "ZSET commands don't accept the empty strings as valid score" {
         assert_error "*not*float*" {r zadd myzset "" abc}
     }
@@ -1025,6 +1120,36 @@ start_server {tags {"zset"}} {
             }
             assert_equal {} $err
         }
+
+        test "ZSETs score updates keep ranks and scores consistent - $encoding" {
+            # Small increments usually leave the element in place, big
+            # ones move it to another position.
+            r del myzset
+            for {set j 0} {$j < $elements} {incr j} {
+                r zadd myzset [expr {$j*10}] $j
+            }
+            for {set k 0} {$k < 1000} {incr k} {
+                set ele [randomInt $elements]
+                if {rand() < .5} {
+                    r zincrby myzset [expr {rand()}] $ele
+                } else {
+                    r zadd myzset [randomInt [expr {$elements*10}]] $ele
+                }
+            }
+            assert_encoding $encoding myzset
+            set rank 0
+            set err {}
+            foreach {ele score} [r zrange myzset 0 -1 withscores] {
+                if {[r zrank myzset $ele] != $rank ||
+                    [r zscore myzset $ele] != $score} {
+                    set err "$ele at rank $rank has a wrong rank or score"
+                    break
+                }
+                incr rank
+            }
+            assert_equal {} $err
+            assert_equal [r zrange myzset 0 -1] [lreverse [r zrevrange myzset 0 -1]]
+        }
     }
 
     tags {"slow"} {
@@ -0,0 +1,202 @@
+/* Simulation of the eviction pool used by Redis in order to approximate
+ * LRU when there are multiple DBs of very different sizes.
+ *
+ * Two strategies are compared:
+ *
+ * "per-db": the Redis 4.0 algorithm, sampling maxmemory-samples keys from
+ *           every non empty DB for each populate round, with a 16 entries
+ *           pool whose entries are never checked again.
+ *
+ * "proportional": the current algorithm, splitting a budget of samples
+ *           among DBs proportionally to their size, with a 64 entries pool
+ *           where entries whose key was accessed after being sampled are
+ *           discarded instead of evicted.
+ *
+ * For every strategy the program reports the average idle time of the
+ * evicted keys compared to the average idle time of the whole population
+ * (the higher the ratio, the better), and the number of keys sampled for
+ * every eviction (a proxy of the CPU used).
+ *
+ * Compile with: cc -O2 evpool-simulation.c -o evpool-simulation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DBNUM 16
+#define SAMPLES 5
+#define MAXPOOL 64
+
+long dbsize[DBNUM] = {1000000, 200000, 50000, 10000, 5000, 1000, 500, 100,
+                      100, 50, 50, 20, 20, 10, 10, 10};
+
+struct key {
+    uint64_t atime;     /* Last access time. */
+    uint64_t gen;       /* Incremented every time the slot gets a new key. */
+};
+
+struct poolentry {
+    int used;
+    int db;
+    long idx;
+    uint64_t gen;
+    uint64_t idle;
+};
+
+struct key *keys[DBNUM];
+struct poolentry pool[MAXPOOL];
+int poolsize;
+long total_keys;
+uint64_t now, atime_sum, samples_taken;
+
+void reset(void) {
+    int j;
+    long i;
+
+    now = 0;
+    atime_sum = 0;
+    samples_taken = 0;
+    total_keys = 0;
+    memset(pool,0,sizeof(pool));
+    for (j = 0; j < DBNUM; j++) {
+        if (keys[j] == NULL) keys[j] = malloc(sizeof(struct key)*dbsize[j]);
+        for (i = 0; i < dbsize[j]; i++) {
+            keys[j][i].atime = 0;
+            keys[j][i].gen = 0;
+        }
+        total_keys += dbsize[j];
+    }
+}
+
+void touch(int db, long idx) {
+    atime_sum -= keys[db][idx].atime;
+    keys[db][idx].atime = now;
+    atime_sum += now;
+}
+
+/* Access a key with a power-law distribution over the global keyspace, so
+ * that a few keys are very hot. Keys of the small DBs are the hottest, as
+ * it happens when small DBs are used for metadata or sessions. */
+void access_random_key(void) {
+    long idx = 1;
+    int db;
+
+    while((rand() % 21) != 0 && idx < total_keys) idx *= 2;
+    if (idx > total_keys) idx = total_keys;
+    idx = rand() % idx;
+    for (db = DBNUM-1; db >= 0; db--) {
+        if (idx < dbsize[db]) break;
+        idx -= dbsize[db];
+    }
+    touch(db,idx);
+}
+
+void pool_insert(int db, long idx) {
+    uint64_t idle = now - keys[db][idx].atime;
+    int k = 0;
+
+    samples_taken++;
+    while (k < poolsize && pool[k].used && pool[k].idle < idle) k++;
+    if (k == 0 && pool[poolsize-1].used) return;
+    if (k < poolsize && !pool[k].used) {
+        /* Empty slot. */
+    } else if (!pool[poolsize-1].used) {
+        memmove(pool+k+1,pool+k,sizeof(pool[0])*(poolsize-k-1));
+    } else {
+        k--;
+        memmove(pool,pool+1,sizeof(pool[0])*k);
+    }
+    pool[k].used = 1;
+    pool[k].db = db;
+    pool[k].idx = idx;
+    pool[k].gen = keys[db][idx].gen;
+    pool[k].idle = idle;
+}
+
+void populate(int proportional) {
+    int db, j, count;
+
+    for (db = 0; db < DBNUM; db++) {
+        if (proportional) {
+            int budget = SAMPLES*DBNUM;
+            if (budget > MAXPOOL) budget = MAXPOOL;
+            double share = (double)budget*dbsize[db]/total_keys;
+            count = (int)share;
+            if ((double)rand()/RAND_MAX < share-count) count++;
+        } else {
+            count = SAMPLES;
+        }
+        if (count > dbsize[db]) count = dbsize[db];
+        for (j = 0; j < count; j++) pool_insert(db,rand() % dbsize[db]);
+    }
+}
+
+/* Evict a key, returning its idle time. The evicted key is replaced by a
+ * new key in the same DB so that DB sizes are constant. */
+uint64_t evict(int proportional) {
+    int k;
+
+    while(1) {
+        populate(proportional);
+        for (k = poolsize-1; k >= 0; k--) {
+            struct poolentry *pe = pool+k;
+            struct key *key;
+
+            if (!pe->used) continue;
+            pe->used = 0;
+            key = &keys[pe->db][pe->idx];
+            if (key->gen != pe->gen) continue; /* Ghost. */
+            if (proportional && now - key->atime < pe->idle) continue;
+
+            uint64_t idle = now - key->atime;
+            key->gen++;
+            touch(pe->db,pe->idx);
+            return idle;
+        }
+    }
+}
+
+void run(const char *name, int proportional, long ticks) {
+    double evicted_idle = 0, population_idle = 0;
+    long j;
+
+    srand(1234);
+    reset();
+    poolsize = proportional ? MAXPOOL : 16;
+
+    /* Warmup: every key gets a random access time, then keys are accessed
+     * with the power-law distribution without evicting. */
+    for (j = 0; j < DBNUM; j++) {
+        long i;
+        for (i = 0; i < dbsize[j]; i++) {
+            keys[j][i].atime = rand() % total_keys;
+            atime_sum += keys[j][i].atime;
+        }
+    }
+    now = total_keys;
+    for (j = 0; j < ticks; j++) {
+        now++;
+        access_random_key();
+    }
+
+    for (j = 0; j < ticks; j++) {
+        now++;
+        access_random_key();
+        population_idle += (double)now - (double)atime_sum/total_keys;
+        evicted_idle += evict(proportional);
+    }
+    printf("%-14s avg evicted idle: %12.1f  avg population idle: %12.1f  "
+           "ratio: %.3f  samples/eviction: %.2f\n",
+        name, evicted_idle/ticks, population_idle/ticks,
+        evicted_idle/population_idle, (double)samples_taken/ticks);
+}
+
+int main(int argc, char **argv) {
+    long ticks = argc > 1 ? atol(argv[1]) : 2000000;
+
+    run("per-db",0,ticks);
+    run("proportional",1,ticks);
+    return 0;
+}
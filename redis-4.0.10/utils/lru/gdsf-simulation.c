@@ -0,0 +1,202 @@
+/* Trace driven simulation comparing the hit rate of the LRU, LFU and GDSF
+ * (GreedyDual-Size-Frequency) maxmemory policies on a cache storing values
+ * of very different sizes.
+ *
+ * Like Redis, the simulated cache evicts the best candidate among a few
+ * randomly sampled keys, and uses the same logarithmic frequency counter
+ * of the LFU policies. GDSF scores keys by size divided by frequency.
+ *
+ * The trace is read from a file containing one "<key> <size>" pair per
+ * line, where <key> is a non negative integer. When no file is given a
+ * synthetic trace is generated: Zipf distributed accesses over 100k keys,
+ * 90% of which are small (16-1024 bytes) while the others are big (10KB to
+ * 1MB).
+ *
+ * For every policy the object hit rate (hits / accesses) and the byte hit
+ * rate (bytes served from cache / bytes accessed) are reported.
+ *
+ * Compile with: cc -O2 gdsf-simulation.c -o gdsf-simulation -lm
+ * Usage: ./gdsf-simulation [cache-size-bytes] [trace-file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define SAMPLES 5
+#define LFU_INIT_VAL 5
+#define LFU_LOG_FACTOR 10
+#define SYNTH_KEYS 100000
+#define SYNTH_ACCESSES 5000000
+
+enum { POLICY_LRU, POLICY_LFU, POLICY_GDSF };
+const char *policy_name[] = {"lru", "lfu", "gdsf"};
+
+struct access {
+    long key;
+    long size;
+};
+
+struct access *trace;
+long trace_len, maxkey;
+
+/* Per key cache state. */
+long *cpos;         /* Position in the 'cached' array, -1 if not cached. */
+long *csize;        /* Size of the cached value. */
+uint64_t *catime;   /* Last access time. */
+uint8_t *ccounter;  /* Logarithmic frequency counter. */
+long *cached;       /* Cached keys, for random sampling. */
+long numcached;
+
+uint8_t log_incr(uint8_t counter) {
+    if (counter == 255) return counter;
+    double r = (double)rand()/RAND_MAX;
+    double baseval = counter-LFU_INIT_VAL;
+    if (baseval < 0) baseval = 0;
+    if (r < 1.0/(baseval*LFU_LOG_FACTOR+1)) counter++;
+    return counter;
+}
+
+/* Higher score means better candidate for eviction. */
+double score(int policy, long key, uint64_t now) {
+    switch(policy) {
+    case POLICY_LRU: return now - catime[key];
+    case POLICY_LFU: return 255 - ccounter[key];
+    default: return (double)csize[key]/(ccounter[key]+1);
+    }
+}
+
+void evict_one(int policy, uint64_t now, long *used) {
+    long best = -1, j;
+    double bestscore = -1;
+
+    for (j = 0; j < SAMPLES; j++) {
+        long key = cached[rand() % numcached];
+        double s = score(policy,key,now);
+        if (s > bestscore) {
+            bestscore = s;
+            best = key;
+        }
+    }
+    *used -= csize[best];
+    numcached--;
+    cached[cpos[best]] = cached[numcached];
+    cpos[cached[numcached]] = cpos[best];
+    cpos[best] = -1;
+}
+
+void simulate(int policy, long cachesize) {
+    long used = 0, j;
+    uint64_t hits = 0, bytes = 0, hitbytes = 0;
+
+    srand(1234);
+    numcached = 0;
+    for (j = 0; j <= maxkey; j++) cpos[j] = -1;
+
+    for (j = 0; j < trace_len; j++) {
+        long key = trace[j].key, size = trace[j].size;
+
+        bytes += size;
+        if (cpos[key] != -1 && csize[key] == size) {
+            hits++;
+            hitbytes += size;
+            catime[key] = j;
+            ccounter[key] = log_incr(ccounter[key]);
+            continue;
+        }
+
+        /* Miss: store the value, evicting keys if needed. */
+        if (size > cachesize) continue;
+        if (cpos[key] != -1) {
+            used -= csize[key];
+        } else {
+            cpos[key] = numcached;
+            cached[numcached++] = key;
+        }
+        csize[key] = size;
+        catime[key] = j;
+        ccounter[key] = LFU_INIT_VAL;
+        used += size;
+        while (used > cachesize) evict_one(policy,j,&used);
+    }
+    printf("%-5s object hit rate: %6.2f%%  byte hit rate: %6.2f%%\n",
+        policy_name[policy], (double)hits*100/trace_len,
+        (double)hitbytes*100/bytes);
+}
+
+void load_trace(const char *filename) {
+    FILE *fp = fopen(filename,"r");
+    long alloc = 1024, key, size;
+
+    if (!fp) {
+        perror("Opening trace file");
+        exit(1);
+    }
+    trace = malloc(sizeof(*trace)*alloc);
+    while (fscanf(fp,"%ld %ld",&key,&size) == 2) {
+        if (key < 0 || size <= 0) continue;
+        if (trace_len == alloc) {
+            alloc *= 2;
+            trace = realloc(trace,sizeof(*trace)*alloc);
+        }
+        trace[trace_len].key = key;
+        trace[trace_len].size = size;
+        trace_len++;
+        if (key > maxkey) maxkey = key;
+    }
+    fclose(fp);
+}
+
+void synthetic_trace(void) {
+    double *cdf = malloc(sizeof(double)*SYNTH_KEYS), sum = 0;
+    long *size = malloc(sizeof(long)*SYNTH_KEYS), j;
+
+    srand(4321);
+    for (j = 0; j < SYNTH_KEYS; j++) {
+        sum += 1.0/pow(j+1,0.9);
+        cdf[j] = sum;
+        if (rand() % 10)
+            size[j] = 16 + rand() % 1009;
+        else
+            size[j] = 10240 + rand() % (1024*1024-10240);
+    }
+
+    trace_len = SYNTH_ACCESSES;
+    maxkey = SYNTH_KEYS-1;
+    trace = malloc(sizeof(*trace)*trace_len);
+    for (j = 0; j < trace_len; j++) {
+        double r = (double)rand()/RAND_MAX*sum;
+        long lo = 0, hi = SYNTH_KEYS-1;
+        while (lo < hi) {
+            long mid = (lo+hi)/2;
+            if (cdf[mid] < r) lo = mid+1; else hi = mid;
+        }
+        /* Scatter popular keys, so that popularity is not correlated
+         * with the key ID. */
+        long key = (lo*7919) % SYNTH_KEYS;
+        trace[j].key = key;
+        trace[j].size = size[lo];
+    }
+    free(cdf);
+    free(size);
+}
+
+int main(int argc, char **argv) {
+    long cachesize = argc > 1 ? atol(argv[1]) : 256*1024*1024;
+    int policy;
+
+    if (argc > 2) load_trace(argv[2]); else synthetic_trace();
+    cpos = malloc(sizeof(long)*(maxkey+1));
+    csize = malloc(sizeof(long)*(maxkey+1));
+    catime = malloc(sizeof(uint64_t)*(maxkey+1));
+    ccounter = malloc(sizeof(uint8_t)*(maxkey+1));
+    cached = malloc(sizeof(long)*(maxkey+1));
+
+    printf("%ld accesses, %ld keys, cache size %ld bytes\n",
+        trace_len, maxkey+1, cachesize);
+    for (policy = POLICY_LRU; policy <= POLICY_GDSF; policy++)
+        simulate(policy,cachesize);
+    return 0;
+}